@@ -34,7 +34,8 @@ CREATE TABLE IF NOT EXISTS public.changesets (
     source text,
     validated boolean,
     quality integer,
-    bbox public.geometry(MultiPolygon,4326)
+    bbox public.geometry(MultiPolygon,4326),
+    regions text[]
 );
 ALTER TABLE ONLY public.changesets
     ADD CONSTRAINT changesets_pkey PRIMARY KEY (id);
@@ -54,11 +55,16 @@ CREATE TABLE IF NOT EXISTS public.validation (
     source text,
     version bigint,
     timestamp timestamp with time zone,
-    location public.geometry(Geometry,4326)
+    location public.geometry(Geometry,4326),
+    regions text[]
 );
 ALTER TABLE ONLY public.validation
     ADD CONSTRAINT validation_pkey PRIMARY KEY (osm_id, status, source);
 
+-- The regions were added later, this updates an existing database
+ALTER TABLE public.changesets ADD COLUMN IF NOT EXISTS regions text[];
+ALTER TABLE public.validation ADD COLUMN IF NOT EXISTS regions text[];
+
 CREATE TABLE IF NOT EXISTS public.ways_poly (
     osm_id int8,
     changeset int8,
@@ -109,6 +115,15 @@ CREATE TABLE IF NOT EXISTS public.relations (
 ALTER TABLE ONLY public.relations
     ADD CONSTRAINT relations_pkey PRIMARY KEY (osm_id);
 
+-- The last replication file committed for each frequency. Underpass
+-- also creates this when it starts, for databases set up before it.
+CREATE TABLE IF NOT EXISTS public.replication_state (
+    frequency text PRIMARY KEY,
+    sequence int8 NOT NULL,
+    timestamp timestamp with time zone,
+    updated_at timestamp with time zone
+);
+
 CREATE UNIQUE INDEX nodes_id_idx ON public.nodes (osm_id DESC);
 CREATE UNIQUE INDEX ways_poly_id_idx ON public.ways_poly (osm_id DESC);
 CREATE UNIQUE INDEX ways_line_id_idx ON public.ways_line(osm_id DESC);
@@ -123,5 +138,6 @@ CREATE INDEX ways_poly_timestamp_idx ON public.ways_poly(timestamp DESC);
 CREATE INDEX ways_line_timestamp_idx ON public.ways_line(timestamp DESC);
 
 CREATE INDEX idx_changesets_hashtags ON public.changesets USING gin(hashtags);
+CREATE INDEX idx_changesets_regions ON public.changesets USING gin(regions);
 CREATE INDEX idx_osm_id_status ON public.validation (osm_id)
 
@@ -31,12 +31,12 @@
 #include <boost/timer/timer.hpp>
 #include <boost/asio.hpp>
 #include <boost/thread/thread.hpp>
-#include <boost/asio/thread_pool.hpp>
 #include <mutex>
 #include <boost/thread/pthread/shared_mutex.hpp>
 #include <string.h>
 
 #include "utils/log.hh"
+#include "utils/executor.hh"
 
 using namespace queryvalidate;
 using namespace queryraw;
@@ -106,6 +106,7 @@ Bootstrap::start(const underpassconfig::UnderpassConfig &config) {
     processWays();
     processNodes();
     processRelations();
+    executor::Executor::getDefault().dumpMetrics();
 
 }
 
@@ -141,7 +142,7 @@ Bootstrap::processWays() {
             }
 
             auto tasks = std::make_shared<std::vector<BootstrapTask>>(concurrentTasks);
-            boost::asio::thread_pool pool(concurrentTasks);
+            executor::TaskGroup group("bootstrap", executor::low);
             for (int taskIndex = 0; taskIndex < concurrentTasks; taskIndex++) {
                 auto taskWays = std::make_shared<std::vector<OsmWay>>();
                 WayTask wayTask {
@@ -151,10 +152,10 @@ Bootstrap::processWays() {
                 };
                 std::cout << "\r" << "Processing " << *table_it << ": " << count << "/" << total << " (" << percentage << "%)";
 
-                boost::asio::post(pool, boost::bind(&Bootstrap::threadBootstrapWayTask, this, wayTask));
+                group.post(boost::bind(&Bootstrap::threadBootstrapWayTask, this, wayTask));
             }
 
-            pool.join();
+            group.wait();
 
             auto queries = allTasksQueries(tasks);
 
@@ -199,7 +200,7 @@ Bootstrap::processNodes() {
         nodes = queryraw->getNodesFromDB(lastid, concurrency * page_size);
 
         auto tasks = std::make_shared<std::vector<BootstrapTask>>(concurrentTasks);
-        boost::asio::thread_pool pool(concurrentTasks);
+        executor::TaskGroup group("bootstrap", executor::low);
         for (int taskIndex = 0; taskIndex < concurrentTasks; taskIndex++) {
             auto taskNodes = std::make_shared<std::vector<OsmNode>>();
             NodeTask nodeTask {
@@ -208,10 +209,10 @@ Bootstrap::processNodes() {
                 std::ref(nodes),
             };
             std::cout << "\r" << "Processing nodes: " << count << "/" << total << " (" << percentage << "%)";
-            boost::asio::post(pool, boost::bind(&Bootstrap::threadBootstrapNodeTask, this, nodeTask));
+            group.post(boost::bind(&Bootstrap::threadBootstrapNodeTask, this, nodeTask));
         }
 
-        pool.join();
+        group.wait();
 
         auto queries = allTasksQueries(tasks);
         for (auto it = queries.underpass.begin(); it != queries.underpass.end(); ++it) {
@@ -253,7 +254,7 @@ Bootstrap::processRelations() {
         relations = queryraw->getRelationsFromDB(lastid, concurrency * page_size);
 
         auto tasks = std::make_shared<std::vector<BootstrapTask>>(concurrentTasks);
-        boost::asio::thread_pool pool(concurrentTasks);
+        executor::TaskGroup group("bootstrap", executor::low);
         for (int taskIndex = 0; taskIndex < concurrentTasks; taskIndex++) {
             auto taskRelations = std::make_shared<std::vector<OsmRelation>>();
             RelationTask relationTask {
@@ -262,10 +263,10 @@ Bootstrap::processRelations() {
                 std::ref(relations),
             };
             std::cout << "\r" << "Processing relations: " << count << "/" << total << " (" << percentage << "%)";
-            boost::asio::post(pool, boost::bind(&Bootstrap::threadBootstrapRelationTask, this, relationTask));
+            group.post(boost::bind(&Bootstrap::threadBootstrapRelationTask, this, relationTask));
         }
 
-        pool.join();
+        group.wait();
 
         auto queries = allTasksQueries(tasks);
         for (auto it = queries.underpass.begin(); it != queries.underpass.end(); ++it) {
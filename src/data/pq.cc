@@ -164,6 +164,21 @@ Pq::query(const std::string &query)
     return result;
 }
 
+bool
+Pq::transaction(const std::string &query)
+{
+    std::scoped_lock write_lock{pqxx_mutex};
+    try {
+        pqxx::work worker(*sdb);
+        worker.exec(query);
+        worker.commit();
+    } catch (std::exception &e) {
+        log_error("ERROR executing transaction %1%", e.what());
+        return false;
+    }
+    return true;
+}
+
 std::string
 Pq::escapedString(const std::string &s)
 {
@@ -171,7 +186,7 @@ Pq::escapedString(const std::string &s)
 }
 
 std::string
-Pq::escapedJSON(const std::string &s) {
+Pq::escapedJSON(std::string_view s) {
     std::ostringstream o;
     for (auto c = s.cbegin(); c != s.cend(); c++) {
         switch (*c) {
@@ -35,6 +35,7 @@
 #include <iostream>
 #include <pqxx/pqxx>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <mutex>
 
@@ -57,6 +58,9 @@ class Pq {
 
     /// Run query into the database
     pqxx::result query(const std::string &query);
+    /// Run all the statements in \a query as a single transaction.
+    /// Returns false if it failed and was rolled back.
+    bool transaction(const std::string &query);
     /// Parse the URL for the database connection
     bool parseURL(const std::string &query);
 
@@ -67,7 +71,7 @@ class Pq {
     std::string escapedString(const std::string &s);
 
     // Escape JSON
-    std::string escapedJSON(const std::string &s);
+    std::string escapedJSON(std::string_view s);
 
     // Database connection
     std::shared_ptr<pqxx::connection> sdb;
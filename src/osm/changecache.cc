@@ -0,0 +1,390 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <zlib.h>
+
+#include "osm/changecache.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace changecache {
+
+/// \struct Header
+/// \brief The start of a binary file
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;        ///< byte_order_mark as written
+    uint64_t size;              ///< The size of the rest of the file
+    uint32_t crc;               ///< The CRC32 of the rest of the file
+    uint32_t parser;            ///< parser_revision as written
+};
+
+static const char magic[8] = {'U', 'P', 'O', 'S', 'C', 'B', 'I', 'N'};
+static const uint32_t byte_order_mark = 0x01020304;
+static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+static const int64_t no_time = std::numeric_limits<int64_t>::min();
+
+// zlib is much faster than boost::crc, which does a byte at a time
+static uint32_t
+checksum(const unsigned char *data, size_t size)
+{
+    uLong crc = crc32(0L, Z_NULL, 0);
+    while (size > 0) {
+        uInt chunk = std::min<size_t>(size, std::numeric_limits<uInt>::max());
+        crc = crc32(crc, data, chunk);
+        data += chunk;
+        size -= chunk;
+    }
+    return crc;
+}
+
+/// \class Writer
+/// \brief Serialize the objects, with the strings in a table
+class Writer {
+  public:
+    template <typename T>
+    void put(T value) {
+        body.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    };
+    void putString(std::string_view str) {
+        auto it = index.find(str);
+        if (it != index.end()) {
+            put<uint32_t>(it->second);
+            return;
+        }
+        uint32_t id = strings.size();
+        strings.emplace_back(str);
+        index.emplace(strings.back(), id);
+        put<uint32_t>(id);
+    };
+    void putTime(const ptime &time) {
+        put<int64_t>(time.is_not_a_date_time() ? no_time : (time - epoch).total_seconds());
+    };
+    void putObject(const osmobjects::OsmObject &object) {
+        put<int64_t>(object.id);
+        put<int32_t>(object.version);
+        put<uint8_t>(object.action);
+        putTime(object.timestamp);
+        put<int64_t>(object.uid);
+        putString(object.user.str());
+        put<int64_t>(object.changeset);
+        put<uint32_t>(object.tags.size());
+        for (auto it = object.tags.begin(); it != object.tags.end(); ++it) {
+            putString(it->first);
+            putString(it->second);
+        }
+    };
+    /// The string table followed by the objects
+    std::string payload(void) const {
+        std::string out;
+        size_t size = sizeof(uint32_t) + body.size();
+        for (auto it = strings.begin(); it != strings.end(); ++it) {
+            size += sizeof(uint32_t) + it->size();
+        }
+        out.reserve(size);
+        uint32_t count = strings.size();
+        out.append(reinterpret_cast<const char *>(&count), sizeof(count));
+        for (auto it = strings.begin(); it != strings.end(); ++it) {
+            uint32_t length = it->size();
+            out.append(reinterpret_cast<const char *>(&length), sizeof(length));
+            out.append(*it);
+        }
+        out.append(body);
+        return out;
+    };
+
+  private:
+    std::string body;
+    /// A deque, so the keys of the index stay valid
+    std::deque<std::string> strings;
+    std::unordered_map<std::string_view, uint32_t> index;
+};
+
+/// \class Reader
+/// \brief Read the objects straight from the mapped file
+///
+/// The strings point into the data, and are only copied when they are
+/// set in the objects. Nothing in the file is aligned, so the numbers
+/// are copied out.
+class Reader {
+  public:
+    Reader(const unsigned char *data, size_t size) : pos(data), end(data + size) {};
+
+    bool good(void) const { return ok; };
+    template <typename T>
+    T get(void) {
+        T value{};
+        if (static_cast<size_t>(end - pos) < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    };
+    bool readStrings(void) {
+        uint32_t count = get<uint32_t>();
+        // Each one takes at least 4 bytes
+        if (!ok || count > static_cast<size_t>(end - pos) / sizeof(uint32_t)) {
+            return false;
+        }
+        strings.reserve(count);
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t length = get<uint32_t>();
+            if (!ok || length > static_cast<size_t>(end - pos)) {
+                return false;
+            }
+            strings.emplace_back(reinterpret_cast<const char *>(pos), length);
+            pos += length;
+        }
+        return true;
+    };
+    std::string_view getString(void) {
+        uint32_t id = get<uint32_t>();
+        if (id >= strings.size()) {
+            ok = false;
+            return std::string_view();
+        }
+        return strings[id];
+    };
+    ptime getTime(void) {
+        int64_t seconds = get<int64_t>();
+        if (seconds == no_time) {
+            return ptime(boost::posix_time::not_a_date_time);
+        }
+        return epoch + boost::posix_time::seconds(seconds);
+    };
+    /// Check a count against the bytes left, so corrupted data
+    /// doesn't allocate huge vectors
+    uint32_t getCount(size_t item_size) {
+        uint32_t count = get<uint32_t>();
+        if (count > static_cast<size_t>(end - pos) / item_size) {
+            ok = false;
+            return 0;
+        }
+        return count;
+    };
+    void getObject(osmobjects::OsmObject &object) {
+        object.id = get<int64_t>();
+        object.version = get<int32_t>();
+        object.action = static_cast<osmobjects::action_t>(get<uint8_t>());
+        object.timestamp = getTime();
+        object.uid = get<int64_t>();
+        object.user = getString();
+        object.changeset = get<int64_t>();
+        uint32_t count = getCount(2 * sizeof(uint32_t));
+        for (uint32_t i = 0; i < count && ok; i++) {
+            std::string_view key = getString();
+            std::string_view value = getString();
+            object.tags.set(key, value);
+        }
+    };
+    bool atEnd(void) const { return pos == end; };
+
+  private:
+    const unsigned char *pos;
+    const unsigned char *end;
+    bool ok = true;
+    std::vector<std::string_view> strings;
+};
+
+std::string
+cachePath(const std::string &filespec)
+{
+    std::string path = filespec;
+    if (boost::algorithm::ends_with(path, ".gz")) {
+        path.resize(path.size() - 3);
+    }
+    return path + ".bin";
+}
+
+bool
+writeFile(const osmchange::OsmChangeFile &osc, const std::string &filespec)
+{
+    Writer writer;
+    writer.put<uint32_t>(osc.changes.size());
+    for (auto it = osc.changes.begin(); it != osc.changes.end(); ++it) {
+        const osmchange::OsmChange &change = **it;
+        writer.put<uint8_t>(change.action);
+        writer.putTime(change.final_entry);
+        writer.put<uint32_t>(change.nodes.size());
+        for (auto nit = change.nodes.begin(); nit != change.nodes.end(); ++nit) {
+            const osmobjects::OsmNode &node = *nit;
+            writer.putObject(node);
+            writer.put<double>(node.point.get<0>());
+            writer.put<double>(node.point.get<1>());
+        }
+        writer.put<uint32_t>(change.ways.size());
+        for (auto wit = change.ways.begin(); wit != change.ways.end(); ++wit) {
+            const osmobjects::OsmWay &way = *wit;
+            writer.putObject(way);
+            writer.put<uint32_t>(way.refs.size());
+            for (auto rit = way.refs.begin(); rit != way.refs.end(); ++rit) {
+                writer.put<int64_t>(*rit);
+            }
+        }
+        writer.put<uint32_t>(change.relations.size());
+        for (auto rit = change.relations.begin(); rit != change.relations.end(); ++rit) {
+            const osmobjects::OsmRelation &relation = *rit;
+            writer.putObject(relation);
+            writer.put<uint32_t>(relation.members.size());
+            for (auto mit = relation.members.begin(); mit != relation.members.end(); ++mit) {
+                writer.put<int64_t>(mit->ref);
+                writer.put<uint8_t>(mit->type);
+                writer.putString(mit->role);
+            }
+        }
+    }
+    // The parsers cache the nodes with a location
+    writer.put<uint32_t>(osc.nodecache.size());
+    for (auto it = osc.nodecache.begin(); it != osc.nodecache.end(); ++it) {
+        writer.put<int64_t>(it->first);
+        writer.put<double>(it->second.get<0>());
+        writer.put<double>(it->second.get<1>());
+    }
+
+    std::string payload = writer.payload();
+    Header header;
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = format_version;
+    header.byte_order = byte_order_mark;
+    header.size = payload.size();
+    header.crc = checksum(reinterpret_cast<const unsigned char *>(payload.data()), payload.size());
+    header.parser = parser_revision;
+
+    std::string tmpfile = filespec + ".tmp";
+    std::ofstream out(tmpfile, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(payload.data(), payload.size());
+    out.close();
+    if (!out || std::rename(tmpfile.c_str(), filespec.c_str()) != 0) {
+        log_error("Couldn't write %1%", filespec);
+        std::remove(tmpfile.c_str());
+        return false;
+    }
+    log_debug("Wrote parsed file %1%", filespec);
+    return true;
+}
+
+bool
+readData(osmchange::OsmChangeFile &osc, const unsigned char *data, size_t size)
+{
+    Header header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+        header.version != format_version || header.parser != parser_revision ||
+        header.byte_order != byte_order_mark || header.size != size - sizeof(header)) {
+        log_debug("Parsed file with another format");
+        return false;
+    }
+    data += sizeof(header);
+    size -= sizeof(header);
+    if (checksum(data, size) != header.crc) {
+        log_error("Parsed file has a bad checksum");
+        return false;
+    }
+
+    Reader reader(data, size);
+    if (!reader.readStrings()) {
+        return false;
+    }
+    uint32_t changes = reader.get<uint32_t>();
+    for (uint32_t i = 0; i < changes && reader.good(); i++) {
+        auto action = static_cast<osmobjects::action_t>(reader.get<uint8_t>());
+        auto change = osc.newChange(action);
+        change->final_entry = reader.getTime();
+        uint32_t count = reader.getCount(1);
+        change->nodes.reserve(count);
+        for (uint32_t j = 0; j < count && reader.good(); j++) {
+            auto node = &change->newNode();
+            reader.getObject(*node);
+            double lon = reader.get<double>();
+            double lat = reader.get<double>();
+            node->setPoint(lat, lon);
+        }
+        count = reader.getCount(1);
+        change->ways.reserve(count);
+        for (uint32_t j = 0; j < count && reader.good(); j++) {
+            auto way = &change->newWay();
+            reader.getObject(*way);
+            uint32_t refs = reader.getCount(sizeof(int64_t));
+            way->refs.reserve(refs);
+            for (uint32_t k = 0; k < refs; k++) {
+                way->addRef(reader.get<int64_t>());
+            }
+        }
+        count = reader.getCount(1);
+        change->relations.reserve(count);
+        for (uint32_t j = 0; j < count && reader.good(); j++) {
+            auto relation = &change->newRelation();
+            reader.getObject(*relation);
+            uint32_t members = reader.getCount(sizeof(int64_t));
+            relation->members.reserve(members);
+            for (uint32_t k = 0; k < members && reader.good(); k++) {
+                long ref = reader.get<int64_t>();
+                auto type = static_cast<osmobjects::osmtype_t>(reader.get<uint8_t>());
+                relation->addMember(ref, type, reader.getString());
+            }
+        }
+    }
+    uint32_t count = reader.getCount(sizeof(int64_t) + 2 * sizeof(double));
+    for (uint32_t i = 0; i < count; i++) {
+        long id = reader.get<int64_t>();
+        double lon = reader.get<double>();
+        double lat = reader.get<double>();
+        osc.nodecache.set(id, point_t(lon, lat));
+    }
+    if (!reader.good() || !reader.atEnd()) {
+        log_error("Parsed file is corrupted");
+        osc.changes.clear();
+        osc.nodecache.clear();
+        return false;
+    }
+    return true;
+}
+
+} // namespace changecache
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,80 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __CHANGECACHE_HH__
+#define __CHANGECACHE_HH__
+
+/// \file changecache.hh
+/// \brief Keep parsed osmChange files in the disk cache
+///
+/// Processing cached files again, for example after changing the
+/// statistics or validation config, spends most of its time
+/// decompressing and parsing the XML. The parsed objects can be saved
+/// next to the compressed file in a compact binary format, which is
+/// loaded straight from a memory map instead.
+///
+/// The file starts with a header with a magic number, the version of
+/// the format, the revision of the parsers and a CRC32 of the rest. Then comes a table of all the
+/// strings, which the objects refer to by their index. Numbers are in
+/// the byte order of the machine, which is checked too. A file that
+/// doesn't match is ignored and the XML is parsed again.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "osm/osmchange.hh"
+
+/// \namespace changecache
+namespace changecache {
+
+/// Files written with another version of the format are ignored
+const uint32_t format_version = 1;
+
+/// The revision of the objects the parsers make. Bump it when a parser
+/// changes what it reads, so the files cached with the older objects
+/// are parsed again.
+const uint32_t parser_revision = 1;
+
+/// The name of the binary file for the osmChange file \a filespec,
+/// like 123.osc.bin for 123.osc.gz
+std::string cachePath(const std::string &filespec);
+
+/// Write \a osc to \a filespec. This writes a temporary file which is
+/// renamed, so another thread never reads a partial file. Returns
+/// false if it couldn't be written.
+bool writeFile(const osmchange::OsmChangeFile &osc, const std::string &filespec);
+
+/// Load a binary file in \a data into \a osc, which should be empty.
+/// Returns false if the data is corrupted or in another format.
+bool readData(osmchange::OsmChangeFile &osc, const unsigned char *data, size_t size);
+
+} // namespace changecache
+
+#endif // EOF __CHANGECACHE_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -74,9 +74,10 @@ using namespace boost::gregorian;
 #include <boost/tokenizer.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/timer/timer.hpp>
-#include <regex>
 
 #include "osm/changeset.hh"
+#include "osm/hashtags.hh"
+#include "osm/xmlchunks.hh"
 #include "stats/querystats.hh"
 
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS 1
@@ -90,8 +91,7 @@ namespace changesets {
 bool
 ChangeSetFile::readChanges(const std::vector<unsigned char> &buffer)
 {
-
-    // parse_memory((const Glib::ustring &)buffer);
+    return readXML(buffer.data(), buffer.size());
 }
 
 // Read a changeset file from disk or memory into internal storage
@@ -130,7 +130,7 @@ ChangeSetFile::readChanges(const std::string &file)
 }
 
 void
-ChangeSetFile::areaFilter(const multipolygon_t &poly)
+ChangeSetFile::areaFilter(const geoutil::PreparedBoundary &poly)
 {
 #ifdef TIMING_DEBUG_X
     boost::timer::auto_cpu_timer timer("ChangeSetFile::areaFilter: took %w seconds\n");
@@ -151,7 +151,7 @@ ChangeSetFile::areaFilter(const multipolygon_t &poly)
         boost::geometry::append(change->bbox, point_t(change->max_lon, change->max_lat));
         // point_t pt;
         // boost::geometry::centroid(change->bbox, pt);
-        if (!boost::geometry::intersects(change->bbox, poly)) {
+        if (!poly.intersects(change->bbox)) {
             // log_debug("Validating changeset %1% is not in a priority area", change->id);
 
             change->priority = false;
@@ -166,6 +166,21 @@ ChangeSetFile::areaFilter(const multipolygon_t &poly)
     // changeset->changes.size());
 }
 
+void
+ChangeSetFile::regionFilter(const geoutil::RegionSet &regions)
+{
+    for (auto it = std::begin(changes); it != std::end(changes); it++) {
+        ChangeSet *change = it->get();
+        polygon_t bbox;
+        boost::geometry::append(bbox, point_t(change->max_lon, change->max_lat));
+        boost::geometry::append(bbox, point_t(change->max_lon, change->min_lat));
+        boost::geometry::append(bbox, point_t(change->min_lon, change->min_lat));
+        boost::geometry::append(bbox, point_t(change->min_lon, change->max_lat));
+        boost::geometry::append(bbox, point_t(change->max_lon, change->max_lat));
+        change->regions = regions.find(bbox);
+    }
+}
+
 void
 ChangeSet::dump(void)
 {
@@ -269,6 +284,30 @@ ChangeSetFile::dump(void)
 
 // Read an istream of the data and parse the XML
 //
+bool
+ChangeSetFile::readXML(const unsigned char *data, size_t size)
+{
+    setlocale(LC_NUMERIC, "C");
+#ifdef LIBXML
+    try {
+        set_substitute_entities(true);
+        xmlchunks::parse(*this, data, size);
+    } catch (const xmlpp::exception &ex) {
+        log_error("libxml++ exception: %1%", ex.what());
+        return false;
+    }
+    return true;
+#else
+    boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
+    if (xmlchunks::isGzipped(data, size)) {
+        inbuf.push(boost::iostreams::gzip_decompressor());
+    }
+    inbuf.push(boost::iostreams::array_source{reinterpret_cast<const char *>(data), size});
+    std::istream instream(&inbuf);
+    return readXML(instream);
+#endif
+}
+
 bool
 ChangeSetFile::readXML(std::istream &xml)
 {
@@ -382,21 +421,9 @@ ChangeSetFile::on_start_element(const Glib::ustring &name,
 
             if (hashit && attr_pair.name == "v") {
                 hashit = false;
-                std::size_t pos = attr_pair.value.find('#', 0);
-                if (pos != std::string::npos) {
-                    // Don't allow really short hashtags, they're usually a typo
-                    if (attr_pair.value.length() < 3) {
-                        continue;
-                    }
-                    char *token = std::strtok((char *)attr_pair.value.c_str(), "#;");
-                    while (token != NULL) {
-                        if (token) {
-                            changes.back()->addHashtags(token);
-                        }
-                        token = std::strtok(NULL, "#;");
-                    }
-                } else {
-                    changes.back()->addHashtags(attr_pair.value);
+                auto found = hashtags::fromTag(attr_pair.value.raw());
+                for (auto it = found.begin(); it != found.end(); ++it) {
+                    changes.back()->addHashtags(std::string(*it));
                 }
             }
             // Hashtags start with an # of course. The hashtag tag wasn't
@@ -405,18 +432,9 @@ ChangeSetFile::on_start_element(const Glib::ustring &name,
             if (comhit && attr_pair.name == "v") {
                 comhit = false;
                 changes.back()->addComment(attr_pair.value);
-                std::string value = attr_pair.value;
-                // Treat most punctuation (except -, _, +, &) as hashtag delimiters
-                // https://github.com/openstreetmap/iD/blob/develop/modules/ui/commit.js
-                std::regex subjectRx("(#[^\u2000-\u206F\u2E00-\u2E7F\\s\\'!\"#$%()*,.\\/:;<=>?@\\[\\]^`{|}~]+)", std::regex_constants::icase);
-                std::regex_iterator<std::string::iterator> it (value.begin(), value.end(), subjectRx);
-                std::regex_iterator<std::string::iterator> end;
-                while (it != end) {
-                    std::string hashtag = it->str(1).erase(0,1);
-                    if (hashtag.size() > 2) {
-                        changes.back()->addHashtags(hashtag);
-                    }
-                    ++it;
+                auto found = hashtags::fromComment(attr_pair.value.raw());
+                for (auto it = found.begin(); it != found.end(); ++it) {
+                    changes.back()->addHashtags(std::string(*it));
                 }
             }
             if (cbyhit && attr_pair.name == "v") {
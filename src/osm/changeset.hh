@@ -54,6 +54,8 @@ using namespace boost::gregorian;
 
 #include "osm/osmobjects.hh"
 #include "stats/querystats.hh"
+#include "utils/boundary.hh"
+#include "utils/regions.hh"
 
 
 // Forward declaration
@@ -126,6 +128,7 @@ class ChangeSet {
     std::string source;  ///< The imagery source
     polygon_t bbox;
     bool priority;        ///< Is this feature in the boundary area
+    std::vector<stringpool::string_id_t> regions; ///< The regions the bounding box is in
 };
 
 /// \class ChangeSetFile
@@ -145,7 +148,9 @@ class ChangeSetFile
     ChangeSetFile(void){};
 
     /// Delete features not in the boundary
-    void areaFilter(const multipolygon_t &poly);
+    void areaFilter(const geoutil::PreparedBoundary &poly);
+    /// Set the regions the bounding box of each changeset intersects
+    void regionFilter(const geoutil::RegionSet &regions);
 
     /// Read a changeset file from disk or memory into internal storage
     bool readChanges(const std::string &file);
@@ -164,6 +169,10 @@ class ChangeSetFile
     /// Read an istream of the data and parse the XML
     bool readXML(std::istream &xml);
 
+    /// Parse a buffer with the data, which may be gzipped. The data
+    /// is decompressed and parsed a chunk at a time.
+    bool readXML(const unsigned char *data, size_t size);
+
     /// Dump the data of this class to the terminal. This should only
     /// be used for debugging.
     void dump(void);
@@ -0,0 +1,154 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <string_view>
+#include <vector>
+
+#include "osm/hashtags.hh"
+
+namespace hashtags {
+
+/// \struct AsciiDelimiters
+/// \brief Which of the ASCII characters end a hashtag
+struct AsciiDelimiters {
+    bool table[128] = {};
+
+    constexpr AsciiDelimiters(void) {
+        // The whitespace of \s and the punctuation iD uses
+        for (char c: std::string_view(" \t\n\v\f\r\\'!\"#$%()*,./:;<=>?@[]^`{|}~")) {
+            table[static_cast<unsigned char>(c)] = true;
+        }
+    };
+};
+
+static constexpr AsciiDelimiters ascii;
+
+bool
+isDelimiter(char32_t code)
+{
+    if (code < 128) {
+        return ascii.table[code];
+    }
+    // General and supplemental punctuation, and the other characters
+    // matched by \s in JavaScript
+    return (code >= 0x2000 && code <= 0x206f) || (code >= 0x2e00 && code <= 0x2e7f) ||
+        code == 0xa0 || code == 0x1680 || code == 0x3000 || code == 0xfeff;
+}
+
+// Decode the UTF-8 character at pos, returns its length. A broken
+// sequence is taken as a single byte, which doesn't end a hashtag.
+static size_t
+decode(std::string_view text, size_t pos, char32_t &code)
+{
+    unsigned char lead = text[pos];
+    if (lead < 0x80) {
+        code = lead;
+        return 1;
+    }
+    size_t length = 0;
+    if ((lead & 0xe0) == 0xc0) {
+        length = 2;
+        code = lead & 0x1f;
+    } else if ((lead & 0xf0) == 0xe0) {
+        length = 3;
+        code = lead & 0x0f;
+    } else if ((lead & 0xf8) == 0xf0) {
+        length = 4;
+        code = lead & 0x07;
+    }
+    if (length == 0 || pos + length > text.size()) {
+        code = 0xfffd;
+        return 1;
+    }
+    for (size_t i = 1; i < length; i++) {
+        unsigned char next = text[pos + i];
+        if ((next & 0xc0) != 0x80) {
+            code = 0xfffd;
+            return 1;
+        }
+        code = (code << 6) | (next & 0x3f);
+    }
+    return length;
+}
+
+std::vector<std::string_view>
+fromComment(std::string_view comment)
+{
+    std::vector<std::string_view> found;
+    size_t pos = comment.find('#');
+    while (pos != std::string_view::npos) {
+        size_t start = pos + 1;
+        size_t end = start;
+        size_t characters = 0;
+        while (end < comment.size()) {
+            char32_t code;
+            size_t length = decode(comment, end, code);
+            if (isDelimiter(code)) {
+                break;
+            }
+            end += length;
+            characters++;
+        }
+        if (characters >= min_length) {
+            found.push_back(comment.substr(start, end - start));
+        }
+        // The delimiter may be the # of the next one
+        pos = comment.find('#', end);
+    }
+    return found;
+}
+
+std::vector<std::string_view>
+fromTag(std::string_view value)
+{
+    std::vector<std::string_view> found;
+    if (value.find('#') == std::string_view::npos) {
+        if (!value.empty()) {
+            found.push_back(value);
+        }
+        return found;
+    }
+    if (value.size() < min_length) {
+        return found;
+    }
+    size_t start = 0;
+    while (start < value.size()) {
+        size_t end = value.find_first_of("#;", start);
+        if (end == std::string_view::npos) {
+            end = value.size();
+        }
+        if (end > start) {
+            found.push_back(value.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return found;
+}
+
+} // namespace hashtags
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,66 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __HASHTAGS_HH__
+#define __HASHTAGS_HH__
+
+/// \file hashtags.hh
+/// \brief Find the hashtags in the tags of a changeset
+///
+/// The hashtags of a changeset are in its hashtags tag, or for older
+/// changesets only in the comment. The comment is scanned in a single
+/// pass over the UTF-8 text, instead of with a regular expression,
+/// which was the slowest part of reading a changeset file.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+/// \namespace hashtags
+namespace hashtags {
+
+/// Hashtags shorter than this are usually a typo
+const size_t min_length = 3;
+
+/// The hashtags in a comment, without the #. A hashtag ends at a space
+/// or most punctuation, except -, _, + and &, the same as in iD:
+/// https://github.com/openstreetmap/iD/blob/develop/modules/ui/commit.js
+/// Only the ones with at least min_length characters are returned.
+std::vector<std::string_view> fromComment(std::string_view comment);
+
+/// The hashtags in the value of a hashtags tag, which is a list like
+/// #one;#two. A value without a # is a single hashtag.
+std::vector<std::string_view> fromTag(std::string_view value);
+
+/// True if the character \a code ends a hashtag
+bool isDelimiter(char32_t code);
+
+} // namespace hashtags
+
+#endif // EOF __HASHTAGS_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
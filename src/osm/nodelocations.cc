@@ -0,0 +1,297 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "osm/nodelocations.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace nodelocations {
+
+size_t
+HashLocations::find(long id) const
+{
+    size_t mask = slots.size() - 1;
+    size_t index = home(id);
+    while (slots[index].first != empty_id && slots[index].first != id) {
+        index = (index + 1) & mask;
+    }
+    return index;
+}
+
+void
+HashLocations::grow(void)
+{
+    // Starts with 16 slots
+    shift = slots.empty() ? 60 : shift - 1;
+    std::vector<value_type> previous(slots.empty() ? 16 : slots.size() * 2,
+                                     value_type(empty_id, point_t()));
+    previous.swap(slots);
+    for (auto it = previous.begin(); it != previous.end(); ++it) {
+        if (it->first != empty_id) {
+            slots[find(it->first)] = *it;
+        }
+    }
+}
+
+void
+HashLocations::set(long id, const point_t &point)
+{
+    if (id == empty_id) {
+        return;
+    }
+    // Probing gets slow once the table is more than 3/4 full
+    if ((count + 1) * 4 > slots.size() * 3) {
+        grow();
+    }
+    auto &slot = slots[find(id)];
+    if (slot.first == empty_id) {
+        slot.first = id;
+        count++;
+    }
+    slot.second = point;
+}
+
+bool
+HashLocations::get(long id, point_t &point) const
+{
+    if (count == 0 || id == empty_id) {
+        return false;
+    }
+    auto &slot = slots[find(id)];
+    if (slot.first == empty_id) {
+        return false;
+    }
+    point = slot.second;
+    return true;
+}
+
+void
+HashLocations::remove(long id)
+{
+    if (count == 0 || id == empty_id) {
+        return;
+    }
+    size_t mask = slots.size() - 1;
+    size_t hole = find(id);
+    if (slots[hole].first == empty_id) {
+        return;
+    }
+    count--;
+    // Move back the entries after it that would no longer be found,
+    // rather than leaving a marker that slows down the lookups
+    for (size_t next = (hole + 1) & mask; slots[next].first != empty_id; next = (next + 1) & mask) {
+        size_t wanted = home(slots[next].first);
+        bool stays = hole <= next ? (hole < wanted && wanted <= next) : (hole < wanted || wanted <= next);
+        if (!stays) {
+            slots[hole] = slots[next];
+            hole = next;
+        }
+    }
+    slots[hole].first = empty_id;
+}
+
+void
+HashLocations::merge(HashLocations &other)
+{
+    if (count == 0) {
+        slots.swap(other.slots);
+        std::swap(count, other.count);
+        std::swap(shift, other.shift);
+        other.clear();
+        return;
+    }
+    for (auto it = other.begin(); it != other.end(); ++it) {
+        set(it->first, it->second);
+    }
+    other.clear();
+}
+
+MmapLocations::~MmapLocations(void)
+{
+    if (slots) {
+        munmap(slots, reserved);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool
+MmapLocations::open(const std::string &filespec)
+{
+    static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t),
+                  "The slots are mapped straight from the file");
+    fd = ::open(filespec.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        log_error("Couldn't open %1%: %2%", filespec, std::strerror(errno));
+        return false;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    reserved = (capacity * sizeof(uint64_t) + page - 1) / page * page;
+    // Only address space, nothing is allocated until the file is
+    // mapped over it
+    void *base = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        log_error("Couldn't reserve %1% bytes for %2%: %3%", reserved, filespec, std::strerror(errno));
+        return false;
+    }
+    slots = static_cast<std::atomic<uint64_t> *>(base);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        log_error("Couldn't stat %1%: %2%", filespec, std::strerror(errno));
+        return false;
+    }
+    // The nodes already in the file. A file from an older version may
+    // not end on a chunk.
+    size_t existing = std::min<size_t>(st.st_size, reserved);
+    if (existing > 0 && !extend((existing + grow_step - 1) / grow_step * grow_step)) {
+        log_error("Couldn't map %1%: %2%", filespec, std::strerror(errno));
+        return false;
+    }
+    log_debug("Using node locations in %1%", filespec);
+    return true;
+}
+
+bool
+MmapLocations::extend(size_t bytes)
+{
+    bytes = std::min(bytes, reserved);
+    if (bytes <= mapped_bytes) {
+        return true;
+    }
+    struct stat st;
+    // This doesn't write anything, the file stays sparse
+    if (fstat(fd, &st) < 0 || (static_cast<size_t>(st.st_size) < bytes && ftruncate(fd, bytes) < 0)) {
+        return false;
+    }
+    char *start = reinterpret_cast<char *>(slots) + mapped_bytes;
+    void *added = mmap(start, bytes - mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                       fd, mapped_bytes);
+    if (added == MAP_FAILED) {
+        return false;
+    }
+    // Lookups are all over the file
+    madvise(added, bytes - mapped_bytes, MADV_RANDOM);
+    mapped_bytes = bytes;
+    mapped.store(std::min(capacity, bytes / sizeof(uint64_t)), std::memory_order_release);
+    return true;
+}
+
+bool
+MmapLocations::reach(long id)
+{
+    if (!slots || id <= 0 || static_cast<size_t>(id) >= capacity) {
+        return false;
+    }
+    if (static_cast<size_t>(id) < mapped.load(std::memory_order_acquire)) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(grow_mutex);
+    size_t bytes = (id + 1) * sizeof(uint64_t);
+    if (!extend((bytes + grow_step - 1) / grow_step * grow_step)) {
+        log_error("Couldn't grow the node locations to %1% bytes: %2%", bytes, std::strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+uint64_t
+MmapLocations::encode(const point_t &point)
+{
+    double lon = point.get<0>();
+    double lat = point.get<1>();
+    if (!(std::fabs(lon) <= 180 && std::fabs(lat) <= 90)) {
+        return 0;
+    }
+    uint32_t x = static_cast<int32_t>(std::lround(lon * 1e7));
+    uint32_t y = static_cast<int32_t>(std::lround(lat * 1e7) + 1000000000);
+    return static_cast<uint64_t>(y) << 32 | x;
+}
+
+point_t
+MmapLocations::decode(uint64_t value)
+{
+    int32_t x = static_cast<int32_t>(value & 0xffffffff);
+    int32_t y = static_cast<int32_t>(value >> 32) - 1000000000;
+    return point_t(x / 1e7, y / 1e7);
+}
+
+void
+MmapLocations::set(long id, const point_t &point)
+{
+    uint64_t value = encode(point);
+    if (value && reach(id)) {
+        slots[id].store(value, std::memory_order_relaxed);
+    }
+}
+
+void
+MmapLocations::setIfMissing(long id, const point_t &point)
+{
+    uint64_t value = encode(point);
+    if (value && reach(id)) {
+        uint64_t empty = 0;
+        slots[id].compare_exchange_strong(empty, value, std::memory_order_relaxed);
+    }
+}
+
+bool
+MmapLocations::get(long id, point_t &point) const
+{
+    // A slot past the end of the file was never set
+    if (id <= 0 || static_cast<size_t>(id) >= mapped.load(std::memory_order_acquire)) {
+        return false;
+    }
+    uint64_t value = slots[id].load(std::memory_order_relaxed);
+    if (value == 0) {
+        return false;
+    }
+    point = decode(value);
+    return true;
+}
+
+void
+MmapLocations::remove(long id)
+{
+    if (id > 0 && static_cast<size_t>(id) < mapped.load(std::memory_order_acquire)) {
+        slots[id].store(0, std::memory_order_relaxed);
+    }
+}
+
+} // namespace nodelocations
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
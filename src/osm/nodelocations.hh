@@ -0,0 +1,225 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __NODELOCATIONS_HH__
+#define __NODELOCATIONS_HH__
+
+/// \file nodelocations.hh
+/// \brief Look up the location of a node by its ID
+///
+/// The geometry of a way is built from the locations of its nodes,
+/// which are either in the same change file, or have to be queried
+/// from the database. Each change file has a hash table of the ones
+/// it has seen. A store kept in a memory mapped file can also be
+/// used, so nodes seen in earlier files, or even by an earlier run,
+/// don't need a query.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/geometry.hpp>
+
+typedef boost::geometry::model::d2::point_xy<double> point_t;
+
+/// \namespace nodelocations
+namespace nodelocations {
+
+/// \class NodeLocationStore
+/// \brief The interface to the different ways of storing the locations
+class NodeLocationStore {
+  public:
+    virtual ~NodeLocationStore(void) {};
+
+    virtual void set(long id, const point_t &point) = 0;
+    /// Set the location only if it isn't known yet. This is for the
+    /// locations from the database, which may be older than the one
+    /// from a file that was just processed.
+    virtual void setIfMissing(long id, const point_t &point) {
+        point_t existing;
+        if (!get(id, existing)) {
+            set(id, point);
+        }
+    };
+    /// Returns false if the location of \a id isn't known
+    virtual bool get(long id, point_t &point) const = 0;
+    virtual void remove(long id) = 0;
+
+    bool contains(long id) const {
+        point_t point;
+        return get(id, point);
+    };
+};
+
+/// \class HashLocations
+/// \brief The locations used by a single change file
+///
+/// This is an open addressing hash table with linear probing, so a
+/// lookup reads consecutive slots of one array instead of following
+/// the pointers of a node based map.
+class HashLocations : public NodeLocationStore {
+  public:
+    typedef std::pair<long, point_t> value_type;
+
+    /// \class const_iterator
+    /// \brief Goes through the slots that are in use
+    class const_iterator {
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef HashLocations::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type *pointer;
+        typedef const value_type &reference;
+
+        const_iterator(void) {};
+        const_iterator(pointer slot, pointer last) : slot(slot), last(last) { skip(); };
+
+        reference operator*(void) const { return *slot; };
+        pointer operator->(void) const { return slot; };
+        const_iterator &operator++(void) {
+            ++slot;
+            skip();
+            return *this;
+        };
+        const_iterator operator++(int) {
+            const_iterator previous = *this;
+            ++*this;
+            return previous;
+        };
+        bool operator==(const const_iterator &other) const { return slot == other.slot; };
+        bool operator!=(const const_iterator &other) const { return slot != other.slot; };
+
+      private:
+        void skip(void) {
+            while (slot != last && slot->first == empty_id) {
+                ++slot;
+            }
+        };
+        pointer slot = nullptr;
+        pointer last = nullptr;
+    };
+
+    void set(long id, const point_t &point) override;
+    bool get(long id, point_t &point) const override;
+    void remove(long id) override;
+
+    /// Add the locations of \a other, which replace the ones here
+    void merge(HashLocations &other);
+
+    size_t size(void) const { return count; };
+    bool empty(void) const { return count == 0; };
+    void clear(void) {
+        slots.clear();
+        count = 0;
+        shift = 64;
+    };
+    const_iterator begin(void) const { return const_iterator(slots.data(), slots.data() + slots.size()); };
+    const_iterator end(void) const {
+        return const_iterator(slots.data() + slots.size(), slots.data() + slots.size());
+    };
+
+  private:
+    /// Marks an empty slot, it's never the ID of an object
+    static constexpr long empty_id = std::numeric_limits<long>::min();
+
+    /// The first slot to look at for \a id
+    size_t home(long id) const {
+        // The high bits of the product are the best mixed
+        return (static_cast<uint64_t>(id) * 0x9e3779b97f4a7c15ULL) >> shift;
+    };
+    /// The slot of \a id, or the empty one where it would go
+    size_t find(long id) const;
+    /// Double the number of slots
+    void grow(void);
+
+    std::vector<value_type> slots;  ///< Always a power of 2 of them
+    size_t count = 0;               ///< The slots in use
+    int shift = 64;                 ///< 64 minus the log2 of the slots
+};
+
+/// \class MmapLocations
+/// \brief A persistent dense array of locations, indexed by node ID
+///
+/// Each location takes 8 bytes, the coordinates are stored as fixed
+/// point numbers with 7 decimals like in the OSM database. The file
+/// grows a chunk at a time as larger node IDs are seen, and is sparse,
+/// so only the pages with nodes that were seen take up disk space.
+///
+/// The address space for the largest node ID is reserved when the file
+/// is opened, and the file is mapped into it as it grows, so the slots
+/// never move. This is lock free, the slots are atomic, so any thread
+/// can use it. It is only a cache of the database, so the file has to
+/// be removed when the database is imported again.
+class MmapLocations : public NodeLocationStore {
+  public:
+    /// Nodes with an ID up to \a max_id can be stored. This only
+    /// reserves address space, the file is as big as the nodes seen.
+    MmapLocations(long max_id = 1L << 34) : capacity(max_id + 1) {};
+    ~MmapLocations(void);
+
+    /// Open or create the file. Returns false if it can't be mapped.
+    bool open(const std::string &filespec);
+
+    void set(long id, const point_t &point) override;
+    void setIfMissing(long id, const point_t &point) override;
+    bool get(long id, point_t &point) const override;
+    void remove(long id) override;
+
+  private:
+    /// 0 is an empty slot, the latitude is offset so a valid location
+    /// is never 0. Returns 0 for an invalid location.
+    static uint64_t encode(const point_t &point);
+    static point_t decode(uint64_t value);
+
+    /// Make sure the slot of \a id is in the file, returns false if
+    /// it can't be
+    bool reach(long id);
+    /// Map the file up to \a bytes, which is a multiple of the page size
+    bool extend(size_t bytes);
+
+    int fd = -1;
+    std::atomic<uint64_t> *slots = nullptr;
+    size_t capacity;                    ///< The slots reserved
+    size_t reserved = 0;                ///< The bytes of address space reserved
+    size_t mapped_bytes = 0;            ///< The bytes of the file mapped
+    std::atomic<size_t> mapped{0};      ///< The slots that can be used
+    std::mutex grow_mutex;
+    /// How much the file grows by, 8M nodes
+    static const size_t grow_step = 64 * 1024 * 1024;
+};
+
+} // namespace nodelocations
+
+#endif // EOF __NODELOCATIONS_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
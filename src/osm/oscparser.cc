@@ -0,0 +1,638 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/timer/timer.hpp>
+
+#include "osm/oscparser.hh"
+#include "osm/xmlchunks.hh"
+#include "utils/executor.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace oscparser {
+
+// memchr() is vectorized by the C library, so the delimiters are
+// found many bytes at a time
+static inline const char *
+find(const char *start, const char *end, char c)
+{
+    return static_cast<const char *>(std::memchr(start, c, end - start));
+}
+
+static inline bool
+isSpace(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+// True if there is anything but white space in the data
+static bool
+hasText(const char *start, const char *end)
+{
+    return std::find_if(start, end, [](char c) { return !isSpace(c); }) != end;
+}
+
+bool
+OscParser::parse(const unsigned char *data, size_t size)
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("OscParser::parse: took %w seconds\n");
+#endif
+    // The numbers are parsed without using the locale, so unlike
+    // libxml there is no need to call setlocale() first
+    xmlchunks::inflate(data, size, [this](const char *chunk, size_t count) {
+        feed(chunk, count);
+    });
+    return finish();
+}
+
+bool
+OscParser::feed(const char *data, size_t size)
+{
+    if (broken) {
+        return false;
+    }
+    const char *start = data;
+    const char *end = data + size;
+    if (!pending.empty()) {
+        // A '<' can't be in an attribute value, so the rest of the
+        // split element is before the next one
+        const char *lt = find(data, end, '<');
+        const char *split = lt ? lt : end;
+        pending.append(data, split - data);
+        if (!lt) {
+            return true;
+        }
+        const char *done = scan(pending.data(), pending.data() + pending.size());
+        if (!done || hasText(done, pending.data() + pending.size())) {
+            log_error("Broken XML element: %1%", pending.substr(0, 80));
+            broken = true;
+            return false;
+        }
+        pending.clear();
+        start = split;
+    }
+    const char *done = scan(start, end);
+    if (!done) {
+        broken = true;
+        return false;
+    }
+    pending.assign(done, end - done);
+    return true;
+}
+
+bool
+OscParser::finish(void)
+{
+    if (!broken && !pending.empty()) {
+        // The last element is only complete once there is no more data
+        const char *end = pending.data() + pending.size();
+        const char *done = scan(pending.data(), end);
+        if (!done || hasText(done, end)) {
+            log_error("The XML data ends in the middle of an element");
+            broken = true;
+        }
+    }
+    pending.clear();
+    change.reset();
+    return !broken;
+}
+
+void
+OscParser::resume(void)
+{
+    change = osc.newChange(osmobjects::none);
+}
+
+const char *
+OscParser::scan(const char *start, const char *end)
+{
+    const char *p = start;
+    while (p < end) {
+        // Only white space is between the elements
+        const char *lt = find(p, end, '<');
+        if (!lt) {
+            return end;
+        }
+        p = lt;
+        if (end - p < 2) {
+            return p;
+        }
+        // The end elements, the XML declaration, and comments, none
+        // of them have anything needed
+        if (p[1] == '/' || p[1] == '?') {
+            const char *gt = find(p, end, '>');
+            if (!gt) {
+                return p;
+            }
+            p = gt + 1;
+            continue;
+        }
+        if (p[1] == '!') {
+            const char *close;
+            if (end - p >= 4 && p[2] == '-' && p[3] == '-') {
+                static const char dashes[] = "-->";
+                close = std::search(p + 4, end, dashes, dashes + 3);
+                if (close == end) {
+                    return p;
+                }
+                close += 2;
+            } else {
+                close = find(p, end, '>');
+                if (!close) {
+                    return p;
+                }
+            }
+            p = close + 1;
+            continue;
+        }
+
+        const char *q = p + 1;
+        while (q < end && !isSpace(*q) && *q != '/' && *q != '>') {
+            q++;
+        }
+        if (q == end) {
+            return p;
+        }
+        std::string_view name(p + 1, q - p - 1);
+
+        count = 0;
+        while (true) {
+            while (q < end && isSpace(*q)) {
+                q++;
+            }
+            if (q == end) {
+                return p;
+            }
+            if (*q == '>') {
+                q++;
+                break;
+            }
+            if (*q == '/') {
+                if (q + 1 == end) {
+                    return p;
+                }
+                q += 2;
+                break;
+            }
+            const char *equals = find(q, end, '=');
+            if (!equals) {
+                return p;
+            }
+            const char *name_end = equals;
+            while (name_end > q && isSpace(name_end[-1])) {
+                name_end--;
+            }
+            const char *quote = equals + 1;
+            while (quote < end && isSpace(*quote)) {
+                quote++;
+            }
+            if (quote == end) {
+                return p;
+            }
+            if (*quote != '"' && *quote != '\'') {
+                log_error("Bad attribute in element %1%", name);
+                return nullptr;
+            }
+            const char *close = find(quote + 1, end, *quote);
+            if (!close) {
+                return p;
+            }
+
+            if (count == attributes.size()) {
+                attributes.emplace_back();
+            }
+            Attribute &attribute = attributes[count++];
+            attribute.name = std::string_view(q, name_end - q);
+            attribute.raw = std::string_view(quote + 1, close - quote - 1);
+            attribute.entities = find(quote + 1, close, '&') != nullptr;
+            if (attribute.entities) {
+                decodeEntities(attribute.raw, attribute.decoded);
+            }
+            q = close + 1;
+        }
+        element(name);
+        p = q;
+    }
+    return p;
+}
+
+void
+OscParser::element(std::string_view name)
+{
+    // There are 3 change states to handle, each one contains possibly
+    // multiple nodes, ways and relations
+    if (name == "create" || name == "modify" || name == "delete") {
+        osmobjects::action_t action = osmobjects::remove;
+        if (name == "create") {
+            action = osmobjects::create;
+        } else if (name == "modify") {
+            action = osmobjects::modify;
+        }
+        change = osc.newChange(action);
+        return;
+    }
+    if (!change) {
+        // The top level element, or data outside of a change
+        return;
+    }
+
+    if (name == "tag") {
+        if (!change->obj) {
+            return;
+        }
+        std::string_view key;
+        std::string_view value;
+        for (size_t i = 0; i < count; i++) {
+            if (attributes[i].name == "k") {
+                key = attributes[i].value();
+            } else if (attributes[i].name == "v") {
+                value = attributes[i].value();
+            }
+        }
+        change->obj->tags.set(key, value);
+        return;
+    }
+    if (name == "nd") {
+        for (size_t i = 0; i < count; i++) {
+            if (attributes[i].name == "ref") {
+                change->addRef(parseLong(attributes[i].value()));
+            }
+        }
+        return;
+    }
+    if (name == "member") {
+        long ref = -1;
+        osmobjects::osmtype_t type = osmobjects::osmtype_t::empty;
+        std::string_view role;
+        for (size_t i = 0; i < count; i++) {
+            const Attribute &attribute = attributes[i];
+            if (attribute.name == "type") {
+                if (attribute.value() == "way") {
+                    type = osmobjects::osmtype_t::way;
+                } else if (attribute.value() == "node") {
+                    type = osmobjects::osmtype_t::node;
+                } else if (attribute.value() == "relation") {
+                    type = osmobjects::osmtype_t::relation;
+                } else {
+                    log_debug("Invalid relation type '%1%'!", attribute.value());
+                }
+            } else if (attribute.name == "ref") {
+                ref = parseLong(attribute.value());
+            } else if (attribute.name == "role") {
+                role = attribute.value();
+            }
+        }
+        if (ref != -1 && type != osmobjects::osmtype_t::empty) {
+            change->addMember(ref, type, role);
+        } else {
+            log_debug("Invalid relation member (ref: %1%, type: %2%)", ref, type);
+        }
+        return;
+    }
+
+    osmobjects::OsmNode *node = nullptr;
+    if (name == "node") {
+        node = &change->newNode();
+    } else if (name == "way") {
+        change->newWay();
+    } else if (name == "relation") {
+        change->newRelation();
+    } else {
+        return;
+    }
+    auto &object = *change->obj;
+    object.action = change->action;
+    bool located = false;
+    for (size_t i = 0; i < count; i++) {
+        const Attribute &attribute = attributes[i];
+        const std::string_view &key = attribute.name;
+        if (key == "id") {
+            object.id = parseLong(attribute.value());
+        } else if (key == "version") {
+            object.version = parseLong(attribute.value());
+        } else if (key == "timestamp") {
+            object.timestamp = parseTimestamp(attribute.value());
+            change->final_entry = object.timestamp;
+        } else if (key == "uid") {
+            object.uid = parseLong(attribute.value());
+        } else if (key == "user") {
+            object.user = attribute.value();
+        } else if (key == "changeset") {
+            object.changeset = parseLong(attribute.value());
+        } else if (node && key == "lat") {
+            node->setLatitude(parseDouble(attribute.value()));
+            located = true;
+        } else if (node && key == "lon") {
+            node->setLongitude(parseDouble(attribute.value()));
+            located = true;
+        }
+    }
+    if (located) {
+        osc.nodecache.set(node->id, node->point);
+    }
+}
+
+// The start of the first node, way or relation at or after start.
+// These are never inside another element, and a '<' is always the
+// start of an element.
+static const char *
+nextObject(const char *start, const char *end)
+{
+    for (const char *p = find(start, end, '<'); p; p = find(p + 1, end, '<')) {
+        std::string_view name(p + 1, std::min<size_t>(end - p - 1, 9));
+        for (auto object: {"node", "way", "relation"}) {
+            size_t length = std::strlen(object);
+            if (name.size() > length && name.compare(0, length, object) == 0 &&
+                isSpace(name[length])) {
+                return p;
+            }
+        }
+    }
+    return end;
+}
+
+// Add the objects in a change at the start of a chunk to the change
+// the previous chunk ended in
+static void
+continueChange(osmchange::OsmChange &last, osmchange::OsmChange &next)
+{
+    for (auto it = next.nodes.begin(); it != next.nodes.end(); ++it) {
+        it->action = last.action;
+    }
+    for (auto it = next.ways.begin(); it != next.ways.end(); ++it) {
+        it->action = last.action;
+    }
+    for (auto it = next.relations.begin(); it != next.relations.end(); ++it) {
+        it->action = last.action;
+    }
+    last.nodes.insert(last.nodes.end(), std::make_move_iterator(next.nodes.begin()),
+                      std::make_move_iterator(next.nodes.end()));
+    last.ways.insert(last.ways.end(), std::make_move_iterator(next.ways.begin()),
+                     std::make_move_iterator(next.ways.end()));
+    last.relations.insert(last.relations.end(), std::make_move_iterator(next.relations.begin()),
+                          std::make_move_iterator(next.relations.end()));
+    next.nodes.clear();
+    next.ways.clear();
+    next.relations.clear();
+    if (next.final_entry != boost::posix_time::not_a_date_time) {
+        last.final_entry = next.final_entry;
+    }
+    // The objects have moved, so the current one is the last of its type
+    if (next.obj) {
+        last.type = next.type;
+        if (last.type == osmchange::node) {
+            last.obj = &last.nodes.back();
+        } else if (last.type == osmchange::way) {
+            last.obj = &last.ways.back();
+        } else if (last.type == osmchange::relation) {
+            last.obj = &last.relations.back();
+        }
+        next.obj = nullptr;
+    }
+}
+
+bool
+parseParallel(osmchange::OsmChangeFile &osc, const unsigned char *data, size_t size,
+              size_t chunk_size)
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("oscparser::parseParallel: took %w seconds\n");
+#endif
+    if (size < chunk_size) {
+        OscParser parser(osc);
+        return parser.parse(data, size);
+    }
+
+    // The chunks have to be split at the objects, so all of the XML
+    // is needed first
+    std::string xml;
+    const char *begin = reinterpret_cast<const char *>(data);
+    const char *end = begin + size;
+    if (xmlchunks::isGzipped(data, size)) {
+        // The uncompressed size, modulo 4G, is at the end of the file
+        uint32_t isize = data[size - 4] | data[size - 3] << 8 | data[size - 2] << 16 |
+            static_cast<uint32_t>(data[size - 1]) << 24;
+        xml.reserve(std::max<size_t>(isize, size));
+        xmlchunks::inflate(data, size, [&xml](const char *chunk, size_t count) {
+            xml.append(chunk, count);
+        });
+        begin = xml.data();
+        end = begin + xml.size();
+    }
+    std::vector<const char *> splits = {begin};
+    for (size_t offset = chunk_size; offset < static_cast<size_t>(end - begin); offset += chunk_size) {
+        const char *split = nextObject(std::max(begin + offset, splits.back()), end);
+        if (split == end) {
+            break;
+        }
+        if (split > splits.back()) {
+            splits.push_back(split);
+        }
+    }
+    splits.push_back(end);
+
+    size_t chunks = splits.size() - 1;
+    std::vector<std::shared_ptr<osmchange::OsmChangeFile>> parts(chunks);
+    std::vector<char> parsed(chunks, false);
+    {
+        executor::TaskGroup group("parser");
+        for (size_t i = 0; i < chunks; i++) {
+            group.post([i, &splits, &parts, &parsed] {
+                parts[i] = std::make_shared<osmchange::OsmChangeFile>();
+                OscParser parser(*parts[i]);
+                if (i > 0) {
+                    parser.resume();
+                }
+                parsed[i] = parser.feed(splits[i], splits[i + 1] - splits[i]) && parser.finish();
+            });
+        }
+        group.wait();
+    }
+
+    // Put the chunks back together in the order of the file
+    bool ok = true;
+    for (size_t i = 0; i < chunks; i++) {
+        // The entries from later chunks replace the earlier ones
+        osc.nodecache.merge(parts[i]->nodecache);
+    }
+    for (size_t i = 0; i < chunks; i++) {
+        ok = ok && parsed[i];
+        auto &part = *parts[i];
+        if (i > 0 && !part.changes.empty() && part.changes.front()->action == osmobjects::none) {
+            if (!osc.changes.empty()) {
+                continueChange(*osc.changes.back(), *part.changes.front());
+            }
+            part.changes.pop_front();
+        }
+        osc.changes.splice(osc.changes.end(), part.changes);
+    }
+    return ok;
+}
+
+long
+parseLong(std::string_view value)
+{
+    long result = 0;
+    std::from_chars(value.data(), value.data() + value.size(), result);
+    return result;
+}
+
+double
+parseDouble(std::string_view value)
+{
+    // This is exact, and doesn't depend on the locale
+    double result = 0;
+    std::from_chars(value.data(), value.data() + value.size(), result);
+    return result;
+}
+
+// Convert the digits at \a start, there have to be \a size of them.
+// Returns -1 if there is anything else.
+static inline int
+digits(const char *start, int size)
+{
+    int result = 0;
+    for (int i = 0; i < size; i++) {
+        if (start[i] < '0' || start[i] > '9') {
+            return -1;
+        }
+        result = result * 10 + (start[i] - '0');
+    }
+    return result;
+}
+
+ptime
+parseTimestamp(std::string_view value)
+{
+    // The format is always 2020-10-30T20:40:38Z
+    if (value.size() >= 19 && value[4] == '-' && value[7] == '-' && value[10] == 'T' &&
+        value[13] == ':' && value[16] == ':') {
+        const char *s = value.data();
+        int year = digits(s, 4);
+        int month = digits(s + 5, 2);
+        int day = digits(s + 8, 2);
+        int hours = digits(s + 11, 2);
+        int minutes = digits(s + 14, 2);
+        int seconds = digits(s + 17, 2);
+        if (year >= 0 && month >= 0 && day >= 0 && hours >= 0 && hours < 24 &&
+            minutes >= 0 && minutes < 60 && seconds >= 0 && seconds < 61) {
+            try {
+                // This checks the month and the day
+                boost::gregorian::date date(year, month, day);
+                return ptime(date, boost::posix_time::time_duration(hours, minutes, seconds));
+            } catch (const std::out_of_range &) {
+            }
+        }
+    }
+    log_error("Bad timestamp: %1%", value);
+    return boost::posix_time::not_a_date_time;
+}
+
+// Append the UTF-8 encoding of \a code
+static void
+appendUTF8(unsigned long code, std::string &result)
+{
+    if (code < 0x80) {
+        result += static_cast<char>(code);
+    } else if (code < 0x800) {
+        result += static_cast<char>(0xc0 | (code >> 6));
+        result += static_cast<char>(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+        result += static_cast<char>(0xe0 | (code >> 12));
+        result += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        result += static_cast<char>(0x80 | (code & 0x3f));
+    } else {
+        result += static_cast<char>(0xf0 | (code >> 18));
+        result += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+        result += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        result += static_cast<char>(0x80 | (code & 0x3f));
+    }
+}
+
+void
+decodeEntities(std::string_view value, std::string &result)
+{
+    result.clear();
+    const char *p = value.data();
+    const char *end = p + value.size();
+    while (p < end) {
+        const char *amp = find(p, end, '&');
+        if (!amp) {
+            result.append(p, end - p);
+            break;
+        }
+        result.append(p, amp - p);
+        const char *semi = find(amp, end, ';');
+        if (!semi) {
+            result.append(amp, end - amp);
+            break;
+        }
+        std::string_view entity(amp + 1, semi - amp - 1);
+        if (entity == "amp") {
+            result += '&';
+        } else if (entity == "lt") {
+            result += '<';
+        } else if (entity == "gt") {
+            result += '>';
+        } else if (entity == "quot") {
+            result += '"';
+        } else if (entity == "apos") {
+            result += '\'';
+        } else if (entity.size() > 1 && entity[0] == '#') {
+            unsigned long code = 0;
+            if (entity[1] == 'x') {
+                std::from_chars(entity.data() + 2, entity.data() + entity.size(), code, 16);
+            } else {
+                std::from_chars(entity.data() + 1, entity.data() + entity.size(), code);
+            }
+            appendUTF8(code, result);
+        } else {
+            // Not an entity, so keep it as it is
+            result.append(amp, semi + 1 - amp);
+        }
+        p = semi + 1;
+    }
+}
+
+} // namespace oscparser
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
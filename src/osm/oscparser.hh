@@ -0,0 +1,129 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __OSCPARSER_HH__
+#define __OSCPARSER_HH__
+
+/// \file oscparser.hh
+/// \brief A fast parser for osmChange files
+///
+/// libxml++ hands every element over as Glib::ustrings, which are
+/// then compared and converted to numbers one at a time. The osmChange
+/// format is simple and fixed, so this scans the XML in place instead,
+/// and only makes strings for the user names and the tags.
+///
+/// Large files, like the daily ones, are split into chunks at the
+/// objects, which get parsed by several threads.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "osm/osmchange.hh"
+
+/// \namespace oscparser
+namespace oscparser {
+
+/// \class OscParser
+/// \brief Parse osmChange XML straight into an OsmChangeFile
+///
+/// This only handles the subset of XML used by osmChange files: no
+/// DTD, no namespaces, and only the predefined and numeric entities.
+class OscParser {
+  public:
+    OscParser(osmchange::OsmChangeFile &osc) : osc(osc) {};
+
+    /// Parse all of \a data, which may be gzipped. Returns false if the
+    /// XML is broken.
+    bool parse(const unsigned char *data, size_t size);
+
+    /// Parse the next part of the XML. An element split at the end of
+    /// the data is kept until the next call.
+    bool feed(const char *data, size_t size);
+    /// Returns false if the data ended in the middle of an element
+    bool finish(void);
+
+    /// The data starts in the middle of a change. The objects before
+    /// the next change go in one with no action, which is fixed when
+    /// the chunks get merged.
+    void resume(void);
+
+  private:
+    /// \struct Attribute
+    /// \brief An attribute, pointing into the buffer being parsed
+    struct Attribute {
+        std::string_view name;
+        std::string_view raw;           ///< The value as it is in the XML
+        std::string decoded;            ///< The value with the entities replaced
+        bool entities = false;
+        std::string_view value(void) const {
+            return entities ? std::string_view(decoded) : raw;
+        };
+    };
+
+    /// Parse the elements in the buffer. Returns where the last
+    /// complete element ends, or nullptr if the XML is broken.
+    const char *scan(const char *start, const char *end);
+    /// Handle one start element
+    void element(std::string_view name);
+
+    osmchange::OsmChangeFile &osc;
+    std::shared_ptr<osmchange::OsmChange> change;
+    /// The attributes of the current element, the entries are reused
+    std::vector<Attribute> attributes;
+    size_t count = 0;
+    /// An element split between two calls to feed()
+    std::string pending;
+    bool broken = false;
+};
+
+/// The size of the inflated XML parsed by each thread
+const size_t parallel_chunk_size = 4 * 1024 * 1024;
+
+/// Parse \a data using all the threads of the executor. The data is
+/// inflated first, and split into chunks of about \a chunk_size at
+/// the objects. Data that is too small to be worth it is parsed by a
+/// single OscParser, without inflating it all first.
+bool parseParallel(osmchange::OsmChangeFile &osc, const unsigned char *data, size_t size,
+                   size_t chunk_size = parallel_chunk_size);
+
+/// Parse a decimal integer, stopping at the first other character
+long parseLong(std::string_view value);
+/// Parse a decimal number
+double parseDouble(std::string_view value);
+/// Parse an ISO 8601 timestamp like 2020-10-30T20:40:38Z
+ptime parseTimestamp(std::string_view value);
+/// Replace the XML entities in \a value
+void decodeEntities(std::string_view value, std::string &result);
+
+} // namespace oscparser
+
+#endif // EOF __OSCPARSER_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
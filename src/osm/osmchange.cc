@@ -28,8 +28,10 @@
 #include <memory>
 #include <iostream>
 #include <algorithm>
+#include <iterator>
 #include <pqxx/pqxx>
 #include <list>
+#include <map>
 #include <locale>
 
 #ifdef LIBXML
@@ -48,12 +50,14 @@ using namespace boost::gregorian;
 #include <boost/units/systems/si/length.hpp>
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/device/array.hpp>
 #include <boost/timer/timer.hpp>
 #include <boost/geometry/geometries/adapted/boost_range/sliced.hpp>
 
 #include "validate/validate.hh"
 #include "osm/osmobjects.hh"
 #include "osm/osmchange.hh"
+#include "osm/xmlchunks.hh"
 #include <ogr_geometry.h>
 
 #include "stats/statsconfig.hh"
@@ -130,9 +134,12 @@ OsmChangeFile::buildGeometriesFromNodeCache() {
     for (auto it = std::begin(changes); it != std::end(changes); ++it) {
         osmchange::OsmChange *change = it->get();
         for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
-            osmobjects::OsmWay *way = wit->get();
+            osmobjects::OsmWay *way = &*wit;
+            point_t point;
             for (auto lit = std::begin(way->refs); lit != std::end(way->refs); ++lit) {
-                bg::append(way->linestring, nodecache[*lit]);
+                if (getLocation(*lit, point)) {
+                    bg::append(way->linestring, point);
+                }
             }
             if (way->isClosed()) {
                 way->polygon = { {std::begin(way->linestring), std::end(way->linestring)} };
@@ -286,7 +293,7 @@ OsmChangeFile::buildRelationGeometry(osmobjects::OsmRelation &relation) {
                 }
             }
 
-            lastLinestring = way->linestring;
+            lastLinestring.assign(way->linestring.begin(), way->linestring.end());
 
         } else {
 
@@ -300,12 +307,12 @@ OsmChangeFile::buildRelationGeometry(osmobjects::OsmRelation &relation) {
                 bg::assign_points(way->linestring, way->polygon.outer());
                 if (mit->role == "inner") {
                         parts_inner.push_back({
-                            { way->linestring },
+                            linestring_t(way->linestring.begin(), way->linestring.end()),
                             polygon_t()
                         });
                 } else {
                         parts_outer.push_back({
-                            { way->linestring },
+                            linestring_t(way->linestring.begin(), way->linestring.end()),
                             polygon_t()
                         });
                 }
@@ -323,7 +330,7 @@ OsmChangeFile::buildRelationGeometry(osmobjects::OsmRelation &relation) {
                         });
                     } else {
                         parts_outer.push_back({
-                            { way->linestring },
+                            linestring_t(way->linestring.begin(), way->linestring.end()),
                             polygon_t()
                         });
                     }
@@ -417,6 +424,35 @@ OsmChangeFile::buildRelationGeometry(osmobjects::OsmRelation &relation) {
     }
 }
 
+bool
+OsmChangeFile::readXML(const unsigned char *data, size_t size)
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("OsmChangeFile::readXML: took %w seconds\n");
+#endif
+    setlocale(LC_NUMERIC, "C");
+#ifdef LIBXML
+    try {
+        set_substitute_entities(true);
+        xmlchunks::parse(*this, data, size);
+    } catch (const xmlpp::exception &ex) {
+        // The objects before the error are kept, but the caller has
+        // to know the file wasn't all there, so it doesn't cache it
+        log_error("libxml++ exception: %1%", ex.what());
+        return false;
+    }
+    return true;
+#else
+    boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
+    if (xmlchunks::isGzipped(data, size)) {
+        inbuf.push(boost::iostreams::gzip_decompressor());
+    }
+    inbuf.push(boost::iostreams::array_source{reinterpret_cast<const char *>(data), size});
+    std::istream instream(&inbuf);
+    return readXML(instream);
+#endif
+}
+
 bool
 OsmChangeFile::readXML(std::istream &xml)
 {
@@ -543,16 +579,13 @@ OsmChangeFile::on_start_element(const Glib::ustring &name,
     // There are 3 change states to handle, each one contains possibly multiple
     // nodes and ways.
     if (name == "create") {
-        change = std::make_shared<OsmChange>(osmobjects::create);
-        changes.push_back(change);
+        newChange(osmobjects::create);
         return;
     } else if (name == "modify") {
-        change = std::make_shared<OsmChange>(osmobjects::modify);
-        changes.push_back(change);
+        newChange(osmobjects::modify);
         return;
     } else if (name == "delete") {
-        change = std::make_shared<OsmChange>(osmobjects::remove);
-        changes.push_back(change);
+        newChange(osmobjects::remove);
         return;
     } else {
         change = changes.back();
@@ -560,20 +593,18 @@ OsmChangeFile::on_start_element(const Glib::ustring &name,
 
     // std::shared_ptr<OsmObject> obj;
     if (name == "node") {
-        change->obj.reset();
-        change->obj = changes.back()->newNode();
+        changes.back()->newNode();
         change->obj->action = changes.back()->action;
     } else if (name == "tag") {
         // A tag element has only has 1 attribute, and numbers are stored as
         // strings
-        change->obj->tags[attributes[0].value] = attributes[1].value;
+        change->obj->tags.set(attributes[0].value.raw(), attributes[1].value.raw());
         return;
     } else if (name == "way") {
-        change->obj.reset();
-        change->obj = changes.back()->newWay();
+        changes.back()->newWay();
         change->obj->action = changes.back()->action;
     } else if (name == "relation") {
-        change->obj = changes.back()->newRelation();
+        changes.back()->newRelation();
         change->obj->action = changes.back()->action;
     } else if (name == "member") {
         // Process relation attributes
@@ -649,13 +680,13 @@ OsmChangeFile::on_start_element(const Glib::ustring &name,
         } else if (attr_pair.name == "changeset") {
             change->obj->changeset = std::stol(attr_pair.value);
         } else if (attr_pair.name == "lat") {
-            auto lat = reinterpret_cast<OsmNode *>(change->obj.get());
+            auto lat = reinterpret_cast<OsmNode *>(change->obj);
             lat->setLatitude(std::stod(attr_pair.value));
-            nodecache[lat->id] = lat->point;
+            nodecache.set(lat->id, lat->point);
         } else if (attr_pair.name == "lon") {
-            auto lon = reinterpret_cast<OsmNode *>(change->obj.get());
+            auto lon = reinterpret_cast<OsmNode *>(change->obj);
             lon->setLongitude(std::stod(attr_pair.value));
-            nodecache[lon->id] = lon->point;
+            nodecache.set(lon->id, lon->point);
         }
     }
 }
@@ -679,15 +710,13 @@ OsmChange::dump(void)
     if (nodes.size() > 0) {
         std::cerr << "\tDumping nodes:" << std::endl;
         for (auto it = std::begin(nodes); it != std::end(nodes); ++it) {
-            std::shared_ptr<OsmNode> node = *it;
-            node->dump();
+            it->dump();
         }
     }
     if (ways.size() > 0) {
         std::cerr << "\tDumping ways:" << std::endl;
         for (auto it = std::begin(ways); it != std::end(ways); ++it) {
-            std::shared_ptr<OsmWay> way = *it;
-            way->dump();
+            it->dump();
         }
     }
     // if (relations.size() > 0) {
@@ -724,39 +753,143 @@ OsmChangeFile::dump(void)
 #endif
 }
 
+bool
+OsmChangeFile::getLocation(long id, point_t &point) const
+{
+    return nodecache.get(id, point) || (locations && locations->get(id, point));
+}
+
+std::shared_ptr<OsmChange>
+OsmChangeFile::newChange(osmobjects::action_t action)
+{
+    auto change = std::make_shared<OsmChange>(action, arena);
+    changes.push_back(change);
+    return change;
+}
+
+void
+OsmChangeFile::append(OsmChangeFile &other)
+{
+    changes.splice(changes.end(), other.changes);
+    superseded.splice(superseded.end(), other.superseded);
+    // The later file has the latest locations
+    nodecache.merge(other.nodecache);
+    for (auto it = std::begin(other.waycache); it != std::end(other.waycache); ++it) {
+        waycache[it->first] = it->second;
+    }
+    other.waycache.clear();
+}
+
+// Move all but the latest version of each object in the changes to
+// the same list in old
+template <typename T>
+static void
+dropSuperseded(std::list<std::shared_ptr<OsmChange>> &changes,
+               std::pmr::vector<T> OsmChange::*objects,
+               OsmChange &old)
+{
+    // For the same version, the one in the later file wins
+    std::map<long, const T *> latest;
+    for (auto it = std::begin(changes); it != std::end(changes); ++it) {
+        auto &list = it->get()->*objects;
+        for (auto oit = std::begin(list); oit != std::end(list); ++oit) {
+            auto &kept = latest[oit->id];
+            if (!kept || oit->version >= kept->version) {
+                kept = &*oit;
+            }
+        }
+    }
+    for (auto it = std::begin(changes); it != std::end(changes); ++it) {
+        auto &list = it->get()->*objects;
+        auto kept = std::begin(list);
+        for (auto oit = std::begin(list); oit != std::end(list); ++oit) {
+            if (latest[oit->id] != &*oit) {
+                (old.*objects).push_back(std::move(*oit));
+            } else if (kept != oit) {
+                *kept++ = std::move(*oit);
+            } else {
+                ++kept;
+            }
+        }
+        list.erase(kept, std::end(list));
+    }
+}
+
+void
+OsmChangeFile::coalesce(void)
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("OsmChangeFile::coalesce: took %w seconds\n");
+#endif
+    // Each object keeps the action it was in, so one change can hold
+    // all of them
+    auto old = std::make_shared<OsmChange>(osmobjects::none, arena);
+    dropSuperseded(changes, &OsmChange::nodes, *old);
+    dropSuperseded(changes, &OsmChange::ways, *old);
+    dropSuperseded(changes, &OsmChange::relations, *old);
+    if (old->nodes.size() > 0 || old->ways.size() > 0 || old->relations.size() > 0) {
+        log_debug("Coalescing dropped %1% nodes, %2% ways and %3% relations",
+                  old->nodes.size(), old->ways.size(), old->relations.size());
+        superseded.push_back(old);
+    }
+    changes.remove_if([](const std::shared_ptr<OsmChange> &change) {
+        return change->nodes.empty() && change->ways.empty() && change->relations.empty();
+    });
+}
 
 void
-OsmChangeFile::areaFilter(const multipolygon_t &poly)
+OsmChangeFile::areaFilter(const geoutil::PreparedBoundary &poly)
 {
 #ifdef TIMING_DEBUG_X
     boost::timer::auto_cpu_timer timer("OsmChangeFile::areaFilter: took %w seconds\n");
 #endif
     std::map<long, bool> priority;
-    for (auto it = std::begin(changes); it != std::end(changes); it++) {
+    // The older versions go first, so the caches end up with the latest
+    std::list<std::shared_ptr<OsmChange>> all(superseded);
+    all.insert(all.end(), changes.begin(), changes.end());
+    size_t older = superseded.size();
+    std::vector<double> lon;
+    std::vector<double> lat;
+    std::vector<uint8_t> inside;
+    for (auto it = std::begin(all); it != std::end(all); it++) {
 
         OsmChange *change = it->get();
+        // Only the latest version of a node has its current location
+        bool latest = older == 0;
+        if (older > 0) {
+            older--;
+        }
         bool debug = false;
 
-        // Filter nodes
-        for (auto nit = std::begin(change->nodes); nit != std::end(change->nodes); ++nit) {
-            OsmNode *node = nit->get();
-            if (poly.empty() || bg::within(node->point, poly)) {
-                node->priority = true;
-                nodecache[node->id] = node->point;
-            } else if (!bg::within(node->point, poly)) {
-                node->priority = false;
+        // Filter nodes, their coordinates are tested all at once
+        if (!poly.empty()) {
+            lon.clear();
+            lat.clear();
+            for (auto nit = std::begin(change->nodes); nit != std::end(change->nodes); ++nit) {
+                lon.push_back(nit->point.x());
+                lat.push_back(nit->point.y());
+            }
+            inside.resize(change->nodes.size());
+            poly.within(lon.data(), lat.data(), lon.size(), inside.data());
+        }
+        for (size_t i = 0; i < change->nodes.size(); i++) {
+            OsmNode *node = &change->nodes[i];
+            node->priority = poly.empty() || inside[i];
+            if (latest) {
+                nodecache.set(node->id, node->point);
             }
         }
 
         // Filter ways
         for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
-            OsmWay *way = wit->get();
+            OsmWay *way = &*wit;
             if (poly.empty()) {
                 way->priority = true;
             } else {
                 way->priority = false;
+                point_t point;
                 for (auto rit = std::begin(way->refs); rit != std::end(way->refs); ++rit) {
-                    if (nodecache.count(*rit) && bg::within(nodecache[*rit], poly)) {
+                    if (getLocation(*rit, point) && poly.within(point)) {
                         way->priority = true;
                         break;
                     }
@@ -770,7 +903,7 @@ OsmChangeFile::areaFilter(const multipolygon_t &poly)
 
         // Filter relations
         for (auto rit = std::begin(change->relations); rit != std::end(change->relations); ++rit) {
-            OsmRelation *relation = rit->get();
+            OsmRelation *relation = &*rit;
             if (poly.empty()) {
                 relation->priority = true;
             } else {
@@ -787,8 +920,54 @@ OsmChangeFile::areaFilter(const multipolygon_t &poly)
     }
 }
 
+void
+OsmChangeFile::regionFilter(const geoutil::RegionSet &regions)
+{
+#ifdef TIMING_DEBUG_X
+    boost::timer::auto_cpu_timer timer("OsmChangeFile::regionFilter: took %w seconds\n");
+#endif
+    // Merge the regions of the parts, keeping them sorted
+    auto merge = [](std::pmr::vector<geoutil::region_t> &into, const auto &from) {
+        std::vector<geoutil::region_t> both;
+        std::set_union(into.begin(), into.end(), from.begin(), from.end(), std::back_inserter(both));
+        into.assign(both.begin(), both.end());
+    };
+    std::list<std::shared_ptr<OsmChange>> all(superseded);
+    all.insert(all.end(), changes.begin(), changes.end());
+    for (auto it = std::begin(all); it != std::end(all); it++) {
+        OsmChange *change = it->get();
+        for (auto nit = std::begin(change->nodes); nit != std::end(change->nodes); ++nit) {
+            OsmNode *node = &*nit;
+            auto found = regions.find(node->point);
+            node->regions.assign(found.begin(), found.end());
+        }
+        for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
+            OsmWay *way = &*wit;
+            way->regions.clear();
+            point_t point;
+            for (auto rit = std::begin(way->refs); rit != std::end(way->refs); ++rit) {
+                if (getLocation(*rit, point)) {
+                    merge(way->regions, regions.find(point));
+                }
+            }
+            if (waycache.count(way->id)) {
+                waycache.at(way->id)->regions = way->regions;
+            }
+        }
+        for (auto rit = std::begin(change->relations); rit != std::end(change->relations); ++rit) {
+            OsmRelation *relation = &*rit;
+            relation->regions.clear();
+            for (auto mit = std::begin(relation->members); mit != std::end(relation->members); ++mit) {
+                if (waycache.count(mit->ref)) {
+                    merge(relation->regions, waycache.at(mit->ref)->regions);
+                }
+            }
+        }
+    }
+}
+
 std::shared_ptr<std::map<long, std::shared_ptr<ChangeStats>>>
-OsmChangeFile::collectStats(const multipolygon_t &poly)
+OsmChangeFile::collectStats(void)
 {
 #ifdef TIMING_DEBUG_X
     boost::timer::auto_cpu_timer timer("OsmChangeFile::collectStats: took %w seconds\n");
@@ -797,12 +976,18 @@ OsmChangeFile::collectStats(const multipolygon_t &poly)
     auto mstats =
         std::make_shared<std::map<long, std::shared_ptr<ChangeStats>>>();
         std::shared_ptr<ChangeStats> ostats;
-
-    for (auto it = std::begin(changes); it != std::end(changes); ++it) {
+    // Compiled once, and shared by all the threads
+    auto classifier = statsconfig::StatsConfig::classifier();
+
+    // Every edit counts for its changeset, including the versions
+    // dropped by coalesce()
+    std::list<std::shared_ptr<OsmChange>> all(superseded);
+    all.insert(all.end(), changes.begin(), changes.end());
+    for (auto it = std::begin(all); it != std::end(all); ++it) {
         OsmChange *change = it->get();
         // Stats for Nodes
         for (auto it = std::begin(change->nodes); it != std::end(change->nodes); ++it) {
-            OsmNode *node = it->get();
+            OsmNode *node = &*it;
             if (!node->priority) {
                 continue;
             }
@@ -821,7 +1006,8 @@ OsmChangeFile::collectStats(const multipolygon_t &poly)
                 ostats->closed_at = node->timestamp;
                 (*mstats)[node->changeset] = ostats;
             }
-            auto hits = scanTags(node->tags, osmchange::node);
+            ostats->regions.insert(node->regions.begin(), node->regions.end());
+            auto hits = scanTags(node->tags, osmchange::node, *classifier);
             for (auto hit = std::begin(*hits); hit != std::end(*hits); ++hit) {
                 if (node->action == osmobjects::create) {
                     ostats->added[*hit]++;
@@ -833,7 +1019,7 @@ OsmChangeFile::collectStats(const multipolygon_t &poly)
 
         // Stats for Ways
         for (auto it = std::begin(change->ways); it != std::end(change->ways); ++it) {
-            OsmWay *way = it->get();
+            OsmWay *way = &*it;
             if (!way->priority) {
                 continue;
             }
@@ -859,8 +1045,9 @@ OsmChangeFile::collectStats(const multipolygon_t &poly)
                 ostats->closed_at = way->timestamp;
                 (*mstats)[way->changeset] = ostats;
             }
+            ostats->regions.insert(way->regions.begin(), way->regions.end());
 
-            auto hits = scanTags(way->tags, osmchange::way);
+            auto hits = scanTags(way->tags, osmchange::way, *classifier);
             for (auto hit = std::begin(*hits); hit != std::end(*hits); ++hit) {
 
                 if (way->action == osmobjects::create) {
@@ -873,12 +1060,11 @@ OsmChangeFile::collectStats(const multipolygon_t &poly)
                 if ( (*hit == "highway" || *hit == "waterway") && way->action == osmobjects::create) {
                     // Get the geometry behind each reference
                     bg::model::linestring<sphere_t> globe;
+                    point_t point;
                     for (auto lit = std::begin(way->refs); lit != std::end(way->refs); ++lit) {
-                        double x = nodecache[*lit].get<0>();
-                        double y = nodecache[*lit].get<1>();
-                        if (x != 0 && y != 0) {
-                            globe.push_back(sphere_t(x,y));
-                            bg::append(way->linestring, nodecache[*lit]);
+                        if (getLocation(*lit, point)) {
+                            globe.push_back(sphere_t(point.get<0>(), point.get<1>()));
+                            bg::append(way->linestring, point);
                         }
                     }
                     std::string tag;
@@ -898,7 +1084,7 @@ OsmChangeFile::collectStats(const multipolygon_t &poly)
 
         // Stats for Relations
         for (auto it = std::begin(change->relations); it != std::end(change->relations); ++it) {
-            OsmRelation *relation = it->get();
+            OsmRelation *relation = &*it;
             if (!relation->priority) {
                 continue;
             }
@@ -915,7 +1101,8 @@ OsmChangeFile::collectStats(const multipolygon_t &poly)
                 ostats->closed_at = relation->timestamp;
                 (*mstats)[relation->changeset] = ostats;
             }
-            auto hits = scanTags(relation->tags, osmchange::relation);
+            ostats->regions.insert(relation->regions.begin(), relation->regions.end());
+            auto hits = scanTags(relation->tags, osmchange::relation, *classifier);
             for (auto hit = std::begin(*hits); hit != std::end(*hits); ++hit) {
                 if (relation->action == osmobjects::create) {
                     ostats->added[*hit]++;
@@ -929,22 +1116,15 @@ OsmChangeFile::collectStats(const multipolygon_t &poly)
 }
 
 std::shared_ptr<std::vector<std::string>>
-OsmChangeFile::scanTags(std::map<std::string, std::string> tags, osmchange::osmtype_t type)
+OsmChangeFile::scanTags(const osmobjects::TagMap &tags, osmchange::osmtype_t type,
+                        const statsconfig::StatsClassifier &classifier)
 {
-    auto statsconfig = statsconfig::StatsConfig();
     auto hits = std::make_shared<std::vector<std::string>>();
     for (auto it = std::begin(tags); it != std::end(tags); ++it) {
         if (!it->second.empty()) {
-            std::string hit = "";
-            if (type == node) {
-                hit = statsconfig.search(it->first, it->second, node);
-            } else if (type == way) {
-                hit = statsconfig.search(it->first, it->second, way);
-            } else if (type == relation) {
-                hit = statsconfig.search(it->first, it->second, relation);
-            }
-            if (!hit.empty()) {
-                hits->push_back(hit);
+            statsconfig::category_t category = classifier.classify(type, it->first, it->second);
+            if (category != statsconfig::StatsClassifier::none) {
+                hits->push_back(classifier.name(category, it->first, it->second));
             }
         }
     }
@@ -974,7 +1154,7 @@ ChangeStats::dump(void)
 };
 
 std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>>
-OsmChangeFile::validateNodes(const multipolygon_t &poly, std::shared_ptr<Validate> &plugin)
+OsmChangeFile::validateNodes(std::shared_ptr<Validate> &plugin)
 {
 #ifdef TIMING_DEBUG_X
     boost::timer::auto_cpu_timer timer("OsmChangeFile::validateNodes: took %w seconds\n");
@@ -985,7 +1165,7 @@ OsmChangeFile::validateNodes(const multipolygon_t &poly, std::shared_ptr<Validat
         OsmChange *change = it->get();
         for (auto nit = std::begin(change->nodes);
             nit != std::end(change->nodes); ++nit) {
-            OsmNode *node = nit->get();
+            OsmNode *node = &*nit;
             if (!node->priority || node->tags.empty() || node->action == osmobjects::remove) {
                 continue;
             }
@@ -1002,7 +1182,7 @@ OsmChangeFile::validateNodes(const multipolygon_t &poly, std::shared_ptr<Validat
 }
 
 std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>>
-OsmChangeFile::validateWays(const multipolygon_t &poly, std::shared_ptr<Validate> &plugin)
+OsmChangeFile::validateWays(std::shared_ptr<Validate> &plugin)
 {
 #ifdef TIMING_DEBUG_X
     boost::timer::auto_cpu_timer timer("OsmChangeFile::validateWays: took %w seconds\n");
@@ -1011,7 +1191,7 @@ OsmChangeFile::validateWays(const multipolygon_t &poly, std::shared_ptr<Validate
     for (auto it = std::begin(changes); it != std::end(changes); ++it) {
         OsmChange *change = it->get();
         for (auto nit = std::begin(change->ways); nit != std::end(change->ways); ++nit) {
-            OsmWay *way = nit->get();
+            OsmWay *way = &*nit;
             if (!way->priority) {
                 continue;
             }
@@ -38,6 +38,7 @@
 #include <memory>
 #include <iostream>
 #include <list>
+#include <set>
 
 //#include <pqxx/pqxx>
 #ifdef LIBXML
@@ -52,8 +53,17 @@ using namespace boost::gregorian;
 #include "validate/validate.hh"
 #include "osm/osmobjects.hh"
 #include "osm/osmchange.hh"
+#include "osm/nodelocations.hh"
+#include "utils/arena.hh"
+#include "utils/boundary.hh"
+#include "utils/regions.hh"
 #include <ogr_geometry.h>
 
+// statsconfig.hh needs this file for the OSM types
+namespace statsconfig {
+class StatsClassifier;
+}
+
 /// \namespace osmchange
 namespace osmchange {
 
@@ -76,6 +86,7 @@ class ChangeStats {
     std::map<std::string, int> added; ///< Array of added features
     std::map<std::string, int> modified; ///< Array of modified features
     std::map<std::string, int> deleted; ///< Array of deleted features
+    std::set<stringpool::string_id_t> regions; ///< The regions of the counted features
     /// Dump internal data to the terminal, only for debugging
     void dump(void);
 };
@@ -84,10 +95,15 @@ class ChangeStats {
 /// \brief This contains the data for a change
 ///
 /// This contains all the data in a change. Redirection is used
-/// so the object type has a generic API
+/// so the object type has a generic API. The objects are kept by
+/// value in the arena of the change, if it has one.
 class OsmChange {
   public:
-    OsmChange(osmobjects::action_t act) { action = act; };
+    OsmChange(osmobjects::action_t act, std::shared_ptr<arena::Arena> arena = nullptr)
+        : arena(std::move(arena)), nodes(resource()), ways(resource()), relations(resource())
+    {
+        action = act;
+    };
 
     ///< dump internal data, for debugging only
     void dump(void);
@@ -97,59 +113,59 @@ class OsmChange {
     void setLatitude(double lat)
     {
         if (type == node) {
-            nodes.back()->setLatitude(lat);
+            nodes.back().setLatitude(lat);
         }
     };
     /// Set the longitude of the current node
     void setLongitude(double lon)
     {
         if (type == node) {
-            nodes.back()->setLongitude(lon);
+            nodes.back().setLongitude(lon);
         }
     };
     /// Set the timestamp of the current node or way
     void setTimestamp(const std::string &val)
     {
         if (type == node) {
-            nodes.back()->timestamp = time_from_string(val);
+            nodes.back().timestamp = time_from_string(val);
         }
         if (type == way) {
-            ways.back()->timestamp = time_from_string(val);
+            ways.back().timestamp = time_from_string(val);
         }
     };
     /// Set the version number of the current node or way
     void setVersion(double val)
     {
         if (type == node) {
-            nodes.back()->version = val;
+            nodes.back().version = val;
         }
         if (type == way) {
-            ways.back()->version = val;
+            ways.back().version = val;
         }
     };
     /// Add a tag to the current node or way
     void addTag(const std::string &key, const std::string &value)
     {
         if (type == node) {
-            nodes.back()->addTag(key, value);
+            nodes.back().addTag(key, value);
         }
         if (type == way) {
-            ways.back()->addTag(key, value);
+            ways.back().addTag(key, value);
         }
     };
     /// Add a node reference to the current way
     void addRef(long ref)
     {
         if (type == way) {
-            ways.back()->addRef(ref);
+            ways.back().addRef(ref);
         }
     };
     /// Add a member reference to the current relation
     void addMember(long ref, osmobjects::osmtype_t _type,
-                   const std::string role)
+                   std::string_view role)
     {
         if (type == relation && relations.size() > 0) {
-            relations.back()->addMember(ref, _type, role);
+            relations.back().addMember(ref, _type, role);
         } else {
             log_debug("Could not add member to relation!");
         }
@@ -158,66 +174,73 @@ class OsmChange {
     void setUID(long val)
     {
         if (type == node) {
-            nodes.back()->uid = val;
+            nodes.back().uid = val;
         }
         if (type == way) {
-            ways.back()->uid = val;
+            ways.back().uid = val;
         }
     };
     /// Set the Change ID for the current node or way
     void setChangeID(long val)
     {
         if (type == node) {
-            nodes.back()->id = val;
+            nodes.back().id = val;
         }
         if (type == way) {
-            ways.back()->id = val;
+            ways.back().id = val;
         }
     };
     /// Set the User name for the current node or way
     void setUser(const std::string &val)
     {
         if (type == node) {
-            nodes.back()->user = val;
+            nodes.back().user = val;
         }
         if (type == way) {
-            ways.back()->user = val;
+            ways.back().user = val;
         }
     };
-    /// Instantiate a new node
-    std::shared_ptr<osmobjects::OsmNode> newNode(void)
+    /// Instantiate a new node, the reference is valid until the next one
+    osmobjects::OsmNode &newNode(void)
     {
-        auto tmp = std::make_shared<osmobjects::OsmNode>();
         type = node;
-        nodes.push_back(tmp);
-        return tmp;
+        obj = &nodes.emplace_back();
+        return nodes.back();
     };
-    /// Instantiate a new way
-    std::shared_ptr<osmobjects::OsmWay> newWay(void)
+    /// Instantiate a new way, the reference is valid until the next one
+    osmobjects::OsmWay &newWay(void)
     {
-        std::shared_ptr<osmobjects::OsmWay> tmp =
-            std::make_shared<osmobjects::OsmWay>();
         type = way;
-        ways.push_back(tmp);
-        return tmp;
+        obj = &ways.emplace_back();
+        return ways.back();
     };
-    /// Instantiate a new relation
-    std::shared_ptr<osmobjects::OsmRelation> newRelation(void)
+    /// Instantiate a new relation, the reference is valid until the next one
+    osmobjects::OsmRelation &newRelation(void)
     {
-        std::shared_ptr<osmobjects::OsmRelation> tmp =
-            std::make_shared<osmobjects::OsmRelation>();
         type = relation;
-        relations.push_back(tmp);
-        return tmp;
+        obj = &relations.emplace_back();
+        return relations.back();
     };
 
+    /// Where the objects are allocated, the heap if not set. The whole
+    /// change shares it, so the objects themselves have no reference
+    /// count.
+    std::shared_ptr<arena::Arena> arena;
+
     ptime final_entry;    ///< The timestamp of the last change in the file
     osmobjects::action_t action = osmobjects::none; ///< The change action
     osmtype_t type;                                 ///< The OSM object type
-    std::list<std::shared_ptr<osmobjects::OsmNode>> nodes; ///< The nodes in this change
-    std::list<std::shared_ptr<osmobjects::OsmWay>> ways; ///< The ways in this change
-    std::list<std::shared_ptr<osmobjects::OsmRelation>> relations; ///< The relations in this change
-    std::shared_ptr<osmobjects::OsmObject> obj;
+    std::pmr::vector<osmobjects::OsmNode> nodes; ///< The nodes in this change
+    std::pmr::vector<osmobjects::OsmWay> ways; ///< The ways in this change
+    std::pmr::vector<osmobjects::OsmRelation> relations; ///< The relations in this change
+    /// The object being parsed, the last one of its type
+    osmobjects::OsmObject *obj = nullptr;
+
+  private:
+    std::pmr::memory_resource *resource(void) const
+    {
+        return arena ? arena.get() : std::pmr::get_default_resource();
+    };
 };
 
 /// \class OsmChangeFile
@@ -243,7 +266,10 @@ class OsmChangeFile
     bool readChanges(const std::string &osc);
 
     /// Delete any data not in the boundary polygon
-    void areaFilter(const multipolygon_t &poly);
+    void areaFilter(const geoutil::PreparedBoundary &poly);
+    /// Set the regions of the data, a way is in the regions of its
+    /// nodes, and a relation in the regions of its ways
+    void regionFilter(const geoutil::RegionSet &regions);
 
     void buildGeometriesFromNodeCache();
     void buildRelationGeometry(osmobjects::OsmRelation &relation);
@@ -257,29 +283,60 @@ class OsmChangeFile
     /// Read an istream of the data and parse the XML
     bool readXML(std::istream &xml);
 
+    /// Parse a buffer with the data, which may be gzipped. The data
+    /// is decompressed and parsed a chunk at a time. Returns false if
+    /// the XML is malformed.
+    bool readXML(const unsigned char *data, size_t size);
+
     std::map<long, std::shared_ptr<ChangeStats>> userstats; ///< User statistics for this file
 
     std::list<std::shared_ptr<OsmChange>> changes;      ///< All the changes in this file
-
-    std::map<double, point_t> nodecache;                ///< Cache nodes across multiple changesets
+    /// The changes and objects of this file are allocated here, so they
+    /// are freed together when the last change using it goes
+    std::shared_ptr<arena::Arena> arena = std::make_shared<arena::Arena>();
+
+    /// Add a change, which allocates its objects in the arena
+    std::shared_ptr<OsmChange> newChange(osmobjects::action_t action);
+    /// The older versions of objects dropped by coalesce(), these are
+    /// only used for the statistics
+    std::list<std::shared_ptr<OsmChange>> superseded;
+
+    nodelocations::HashLocations nodecache;             ///< Cache nodes across multiple changesets
+    /// The locations kept across files, if any
+    std::shared_ptr<nodelocations::NodeLocationStore> locations;
+
+    /// Get the location of a node from the nodecache, or the locations
+    /// kept across files. Returns false if it isn't known.
+    bool getLocation(long id, point_t &point) const;
     
     std::map<long, std::shared_ptr<osmobjects::OsmWay>> waycache; ///< Cache ways across multiple changesets
 
-    /// Collect statistics for each user
+    /// Add the changes of a later file to this one
+    void append(OsmChangeFile &other);
+
+    /// Keep only the latest version of each object in the changes, so
+    /// the raw data, geometries and validation are done once for the
+    /// net result of several files. The other versions are moved to
+    /// superseded, so the statistics still count every edit.
+    void coalesce(void);
+
+    /// Collect statistics for each user, from the objects areaFilter()
+    /// left as priority
     std::shared_ptr<std::map<long, std::shared_ptr<ChangeStats>>>
-    collectStats(const multipolygon_t &poly);
+    collectStats(void);
 
     /// Validate multiple nodes
     std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>>
-    validateNodes(const multipolygon_t &poly, std::shared_ptr<Validate> &plugin);
+    validateNodes(std::shared_ptr<Validate> &plugin);
 
     /// Validate multi ways
     std::shared_ptr<std::vector<std::shared_ptr<ValidateStatus>>>
-    validateWays(const multipolygon_t &poly, std::shared_ptr<Validate> &plugin);
+    validateWays(std::shared_ptr<Validate> &plugin);
 
     /// Scan tags for the proper values
     std::shared_ptr<std::vector<std::string>>
-    scanTags(std::map<std::string, std::string> tags, osmchange::osmtype_t type);
+    scanTags(const osmobjects::TagMap &tags, osmchange::osmtype_t type,
+             const statsconfig::StatsClassifier &classifier);
 
 //    std::map<long, bool> priority;
     /// dump internal data, for debugging only
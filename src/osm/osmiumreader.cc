@@ -0,0 +1,245 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <exception>
+#include <string>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <osmium/visitor.hpp>
+
+#include "osm/osmiumreader.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace osmiumreader {
+
+bool
+isOsmiumFile(const std::string &filespec)
+{
+    std::string name = filespec;
+    for (auto compression: {".gz", ".bz2"}) {
+        if (boost::algorithm::ends_with(name, compression)) {
+            name.resize(name.size() - std::char_traits<char>::length(compression));
+        }
+    }
+    for (auto suffix: {".pbf", ".opl", ".o5m", ".o5c"}) {
+        if (boost::algorithm::ends_with(name, suffix)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+OsmiumReader::OsmiumReader(const std::string &filespec)
+    : filespec(filespec)
+{
+}
+
+OsmiumReader::~OsmiumReader(void)
+{
+    close();
+}
+
+bool
+OsmiumReader::open(void)
+{
+    try {
+        // The format is given for PBF, so a name like x.osc.pbf isn't
+        // taken for osmChange XML
+        std::string format;
+        if (boost::algorithm::ends_with(filespec, ".pbf")) {
+            format = "pbf";
+        }
+        osmium::io::File input(filespec, format);
+        // Only the files of changes have objects that aren't created,
+        // the extracts have the current version of everything
+        snapshot = !input.has_multiple_object_versions() &&
+            filespec.find(".osc") == std::string::npos &&
+            !boost::algorithm::ends_with(filespec, ".o5c");
+        // The PBF blocks are decoded by the thread pool of libosmium
+        reader = std::make_unique<osmium::io::Reader>(input, osmium::osm_entity_bits::nwr);
+    } catch (const std::exception &e) {
+        log_error("Couldn't open %1%: %2%", filespec, e.what());
+        reader.reset();
+        return false;
+    }
+    log_debug("Reading %1% as %2%", filespec, snapshot ? "a snapshot" : "changes");
+    return true;
+}
+
+bool
+OsmiumReader::read(osmchange::OsmChangeFile &file, size_t max_objects)
+{
+    if (!reader) {
+        return false;
+    }
+    osc = &file;
+    objects = 0;
+    try {
+        // A whole block is read at a time, so this can go a bit
+        // over max_objects
+        while (osmium::memory::Buffer buffer = reader->read()) {
+            osmium::apply(buffer, *this);
+            if (max_objects && objects >= max_objects) {
+                osc = nullptr;
+                return true;
+            }
+        }
+    } catch (const std::exception &e) {
+        log_error("%1% is corrupted: %2%", filespec, e.what());
+        corrupted = true;
+    }
+    osc = nullptr;
+    close();
+    return false;
+}
+
+void
+OsmiumReader::close(void)
+{
+    if (reader) {
+        try {
+            reader->close();
+        } catch (const std::exception &e) {
+            log_error("Couldn't close %1%: %2%", filespec, e.what());
+        }
+        reader.reset();
+    }
+}
+
+osmobjects::action_t
+OsmiumReader::actionOf(const osmium::OSMObject &from) const
+{
+    if (snapshot) {
+        return osmobjects::create;
+    }
+    if (from.deleted()) {
+        return osmobjects::remove;
+    }
+    return from.version() <= 1 ? osmobjects::create : osmobjects::modify;
+}
+
+osmchange::OsmChange &
+OsmiumReader::changeFor(osmobjects::action_t action)
+{
+    if (osc->changes.empty() || osc->changes.back()->action != action) {
+        return *osc->newChange(action);
+    }
+    return *osc->changes.back();
+}
+
+void
+OsmiumReader::copyObject(const osmium::OSMObject &from, osmobjects::OsmObject &to)
+{
+    to.id = from.id();
+    to.version = from.version();
+    to.timestamp = boost::posix_time::from_time_t(from.timestamp().seconds_since_epoch());
+    to.uid = from.uid();
+    to.user = from.user();
+    to.changeset = from.changeset();
+    for (const osmium::Tag &tag: from.tags()) {
+        to.tags.set(tag.key(), tag.value());
+    }
+    objects++;
+}
+
+void
+OsmiumReader::node(const osmium::Node &from)
+{
+    auto action = actionOf(from);
+    auto &change = changeFor(action);
+    auto node = &change.newNode();
+    node->action = action;
+    copyObject(from, *node);
+    change.final_entry = node->timestamp;
+    if (from.location().valid()) {
+        node->setPoint(from.location().lat(), from.location().lon());
+        osc->nodecache.set(node->id, node->point);
+    }
+}
+
+void
+OsmiumReader::way(const osmium::Way &from)
+{
+    auto action = actionOf(from);
+    auto &change = changeFor(action);
+    auto way = &change.newWay();
+    way->action = action;
+    copyObject(from, *way);
+    change.final_entry = way->timestamp;
+    way->refs.reserve(from.nodes().size());
+    for (const osmium::NodeRef &ref: from.nodes()) {
+        way->addRef(ref.ref());
+    }
+}
+
+void
+OsmiumReader::relation(const osmium::Relation &from)
+{
+    auto action = actionOf(from);
+    auto &change = changeFor(action);
+    auto relation = &change.newRelation();
+    relation->action = action;
+    copyObject(from, *relation);
+    change.final_entry = relation->timestamp;
+    for (const osmium::RelationMember &member: from.members()) {
+        osmobjects::osmtype_t type = osmobjects::osmtype_t::empty;
+        switch (member.type()) {
+            case osmium::item_type::node:
+                type = osmobjects::osmtype_t::node;
+                break;
+            case osmium::item_type::way:
+                type = osmobjects::osmtype_t::way;
+                break;
+            case osmium::item_type::relation:
+                type = osmobjects::osmtype_t::relation;
+                break;
+            default:
+                log_debug("Invalid relation member (ref: %1%)", member.ref());
+                continue;
+        }
+        relation->addMember(member.ref(), type, member.role());
+    }
+}
+
+bool
+readFile(osmchange::OsmChangeFile &osc, const std::string &filespec)
+{
+    OsmiumReader reader(filespec);
+    if (!reader.open()) {
+        return false;
+    }
+    reader.read(osc);
+    return reader.good();
+}
+
+} // namespace osmiumreader
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,111 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __OSMIUMREADER_HH__
+#define __OSMIUMREADER_HH__
+
+/// \file osmiumreader.hh
+/// \brief Read the binary and text formats libosmium supports
+///
+/// The replication files are XML, but the initial load of a country,
+/// or replaying a range of history, is much faster from PBF, which
+/// libosmium decodes on several threads. This also reads OPL and
+/// o5m/o5c files. The objects go into an OsmChangeFile, so they are
+/// processed like the ones from a replication file.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include <osmium/handler.hpp>
+#include <osmium/io/any_input.hpp>
+#include <osmium/osm.hpp>
+
+#include "osm/osmchange.hh"
+
+/// \namespace osmiumreader
+namespace osmiumreader {
+
+/// \class OsmiumReader
+/// \brief Fill an OsmChangeFile from a file read by libosmium
+///
+/// The action of each object comes from its metadata, as only the XML
+/// osmChange format has them. A deleted object is removed, the first
+/// version of an object is created, and any other version modified.
+/// A file that is a snapshot, like a country extract, only has objects
+/// to create.
+///
+/// A large file can be read in batches, each one into its own
+/// OsmChangeFile, so it never has to be all in memory.
+class OsmiumReader : public osmium::handler::Handler {
+  public:
+    OsmiumReader(const std::string &filespec);
+    ~OsmiumReader(void);
+
+    /// Open the file. Returns false if libosmium can't read it.
+    bool open(void);
+    /// Read about \a max_objects objects into \a osc, or the rest of
+    /// the file if it's 0. Returns false once the file is all read.
+    bool read(osmchange::OsmChangeFile &osc, size_t max_objects = 0);
+    void close(void);
+    /// False if the file turned out to be corrupted
+    bool good(void) const { return !corrupted; };
+
+    /// The callbacks for libosmium
+    void node(const osmium::Node &node);
+    void way(const osmium::Way &way);
+    void relation(const osmium::Relation &relation);
+
+  private:
+    /// The change for \a action, a new one if the last object
+    /// had a different action
+    osmchange::OsmChange &changeFor(osmobjects::action_t action);
+    osmobjects::action_t actionOf(const osmium::OSMObject &from) const;
+    /// Copy the metadata and tags shared by all the object types
+    void copyObject(const osmium::OSMObject &from, osmobjects::OsmObject &to);
+
+    std::string filespec;
+    std::unique_ptr<osmium::io::Reader> reader;
+    /// The file has objects to create only
+    bool snapshot = true;
+    bool corrupted = false;
+    /// The file being filled by read()
+    osmchange::OsmChangeFile *osc = nullptr;
+    size_t objects = 0;
+};
+
+/// True if \a filespec is in a format read by OsmiumReader
+bool isOsmiumFile(const std::string &filespec);
+
+/// Read all of \a filespec into \a osc. Returns false if it can't be read.
+bool readFile(osmchange::OsmChangeFile &osc, const std::string &filespec);
+
+} // namespace osmiumreader
+
+#endif // EOF __OSMIUMREADER_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -26,8 +26,10 @@
 #endif
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
+#include <memory_resource>
 #include <boost/geometry.hpp>
 #include <boost/date_time.hpp>
 #include "boost/date_time/posix_time/posix_time.hpp"
@@ -35,7 +37,11 @@ using namespace boost::posix_time;
 using namespace boost::gregorian;
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS 1
 
+#include "osm/tagmap.hh"
+#include "utils/arena.hh"
+#include "utils/boundary.hh"
 #include "utils/log.hh"
+#include "utils/stringpool.hh"
 using namespace logger;
 
 typedef boost::geometry::model::d2::point_xy<double> point_t;
@@ -67,11 +73,21 @@ typedef enum { empty, node, way, relation, member } osmtype_t;
 
 /// \class OsmObject
 /// \brief This is the base class for the common data fields used by all OSM objects
+///
+/// The objects of a change file are kept by value in vectors using an
+/// arena, which hand their allocator to the objects, so the tags and
+/// the other containers are in the same arena. Copying an object
+/// without an allocator makes a copy on the heap.
 class OsmObject {
   public:
+    typedef arena::allocator_type allocator_type;
+
+    OsmObject(void) {};
+    explicit OsmObject(const allocator_type &alloc) : tags(alloc), regions(alloc) {};
+
     /// Add a metadata tag to an OSM object
     void addTag(const std::string &key, const std::string &value) {
-        tags[key] = value;
+        tags.set(key, value);
     };
 
     void setAction(action_t act) { action = act; };
@@ -84,19 +100,22 @@ class OsmObject {
     int version = 0;                         ///< The version of this object
     ptime timestamp;                         ///< The timestamp of this object's creation or modification
     long uid = 0;                            ///< The User ID of the mapper of this object
-    std::string user;                        ///< The User name  of the mapper of this object
+    stringpool::PooledString user;           ///< The User name  of the mapper of this object
     long changeset = 0;                      ///< The changeset ID this object is contained in
-    std::map<std::string, std::string> tags; ///< OSM metadata tags
+    TagMap tags;                             ///< OSM metadata tags
 
     bool priority = false; ///< Whether it's in the priority area
+    std::pmr::vector<stringpool::string_id_t> regions; ///< The regions it's in, see geoutil::RegionSet
     /// Dump internal data to the terminal, only for debugging
     void dump(void) const;
-    std::string getTagValue(const std::string &key) { return tags[key] ; };
-    bool containsKey(const std::string &key) { return tags.count(key); };
+    std::string_view getTagValue(std::string_view key) const { return tags.get(key); };
+    bool containsKey(const std::string &key) const { return tags.count(key); };
+    /// The same, using the ID of the key in the string pool
+    bool containsKey(stringpool::string_id_t key) const { return tags.contains(key); };
     bool containsValue(const std::string &key, const std::string &value)
     {
         std::string lower = boost::algorithm::to_lower_copy(value);
-        if (tags[key].size() == 0) {
+        if (tags.get(key).empty()) {
             return true;
         }
         for (auto it = tags.begin(); it != tags.end(); ++it) {
@@ -117,6 +136,14 @@ class OsmNode : public OsmObject {
     OsmNode(long nid) { id = nid; };
     point_t point; ///< The location of this node
     OsmNode(void) { type = node; };
+    explicit OsmNode(const allocator_type &alloc) : OsmObject(alloc) { type = node; };
+    /// Copy or move \a other into the arena of \a alloc
+    OsmNode(const OsmNode &other, const allocator_type &alloc) : OsmObject(alloc) { *this = other; };
+    OsmNode(OsmNode &&other, const allocator_type &alloc) : OsmObject(alloc) { *this = std::move(other); };
+    OsmNode(const OsmNode &other) = default;
+    OsmNode(OsmNode &&other) = default;
+    OsmNode &operator=(const OsmNode &other) = default;
+    OsmNode &operator=(OsmNode &&other) = default;
     OsmNode(double lat, double lon)
     {
         setPoint(lat, lon);
@@ -160,9 +187,17 @@ class OsmWay : public OsmObject {
         type = way;
         refs.clear();
     };
-
-    std::vector<long> refs;  ///< Store all the nodes by reference ID
-    linestring_t linestring; ///< Store the node as a linestring
+    explicit OsmWay(const allocator_type &alloc) : OsmObject(alloc), refs(alloc), linestring(alloc) { type = way; };
+    /// Copy or move \a other into the arena of \a alloc
+    OsmWay(const OsmWay &other, const allocator_type &alloc) : OsmWay(alloc) { *this = other; };
+    OsmWay(OsmWay &&other, const allocator_type &alloc) : OsmWay(alloc) { *this = std::move(other); };
+    OsmWay(const OsmWay &other) = default;
+    OsmWay(OsmWay &&other) = default;
+    OsmWay &operator=(const OsmWay &other) = default;
+    OsmWay &operator=(OsmWay &&other) = default;
+
+    std::pmr::vector<long> refs;  ///< Store all the nodes by reference ID
+    pmr_linestring_t linestring; ///< Store the node as a linestring
     polygon_t polygon;       ///< Store the nodes as a polygon
     point_t center;          ///< Store the centroid of the way
 
@@ -193,6 +228,21 @@ class OsmWay : public OsmObject {
 ///
 /// A relation contains multiple ways, and contains tags about the relation
 struct OsmRelationMember {
+    typedef arena::allocator_type allocator_type;
+
+    OsmRelationMember(void) {};
+    explicit OsmRelationMember(const allocator_type &alloc) : role(alloc) {};
+    OsmRelationMember(long ref, osmtype_t type, std::string_view role, const allocator_type &alloc = {})
+        : ref(ref), type(type), role(role, alloc) {};
+    /// Copy or move \a other into the arena of \a alloc
+    OsmRelationMember(const OsmRelationMember &other, const allocator_type &alloc)
+        : ref(other.ref), type(other.type), role(other.role, alloc) {};
+    OsmRelationMember(OsmRelationMember &&other, const allocator_type &alloc)
+        : ref(other.ref), type(other.type), role(std::move(other.role), alloc) {};
+    OsmRelationMember(const OsmRelationMember &other) = default;
+    OsmRelationMember(OsmRelationMember &&other) = default;
+    OsmRelationMember &operator=(const OsmRelationMember &other) = default;
+    OsmRelationMember &operator=(OsmRelationMember &&other) = default;
 
     ///
     /// \brief ref reference id of the member object
@@ -207,7 +257,7 @@ struct OsmRelationMember {
     ///
     /// \brief role of the member
     ///
-    std::string role;
+    std::pmr::string role;
 
     /// Dump internal data to the terminal, only for debugging
     void dump(void) const;
@@ -220,16 +270,24 @@ struct OsmRelationMember {
 class OsmRelation : public OsmObject {
   public:
     OsmRelation(void) { type = relation; };
+    explicit OsmRelation(const allocator_type &alloc) : OsmObject(alloc), members(alloc) { type = relation; };
+    /// Copy or move \a other into the arena of \a alloc
+    OsmRelation(const OsmRelation &other, const allocator_type &alloc) : OsmRelation(alloc) { *this = other; };
+    OsmRelation(OsmRelation &&other, const allocator_type &alloc) : OsmRelation(alloc) { *this = std::move(other); };
+    OsmRelation(const OsmRelation &other) = default;
+    OsmRelation(OsmRelation &&other) = default;
+    OsmRelation &operator=(const OsmRelation &other) = default;
+    OsmRelation &operator=(OsmRelation &&other) = default;
 
     multilinestring_t multilinestring; ///< Store the members as a multilinestring
     polygon_t multipolygon; ///< Store the members as a multipolygon
     point_t center;          ///< Store the centroid of the relation
 
     /// Add a member to this relation
-    void addMember(long ref, osmtype_t _type, const std::string role) { members.push_back({ref, _type, role}); };
+    void addMember(long ref, osmtype_t _type, std::string_view role) { members.emplace_back(ref, _type, role); };
 
     ///< The members contained in this relation
-    std::list<OsmRelationMember> members;
+    std::pmr::vector<OsmRelationMember> members;
 
     /// Dump internal data to the terminal, only for debugging
     void dump(void) const;
@@ -237,9 +295,8 @@ class OsmRelation : public OsmObject {
     /// Relation can be composed of closed ways, resulting in a multipolygon
     bool isMultiPolygon(void) const
     {
-        return (tags.count("type") &&
-            (tags.at("type") == "multipolygon" || tags.at("type") == "boundary")
-        );
+        std::string_view type = tags.get("type");
+        return type == "multipolygon" || type == "boundary";
     };
 
 };
@@ -0,0 +1,218 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "osm/tagmap.hh"
+
+using namespace stringpool;
+
+namespace osmobjects {
+
+// The values of these are mostly unique, so interning them would only
+// fill up the pool
+static bool
+isFreeText(std::string_view key)
+{
+    static const std::string_view prefixes[] = {
+        "name", "old_name", "alt_name", "official_name", "short_name", "addr:",
+        "note", "description", "fixme", "FIXME", "website", "url", "phone",
+        "email", "wikidata", "wikipedia", "ref", "opening_hours", "source:date"
+    };
+    for (auto it = std::begin(prefixes); it != std::end(prefixes); ++it) {
+        if (key.compare(0, it->size(), *it) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TagMap::id_t
+TagMap::store(std::string_view str, bool intern)
+{
+    if (intern) {
+        id_t id = StringPool::getDefault().intern(str);
+        if (id != not_interned) {
+            return id;
+        }
+    }
+    local.emplace_back(str);
+    return local_bit | (local.size() - 1);
+}
+
+void
+TagMap::release(id_t id)
+{
+    if (!(id & local_bit)) {
+        return;
+    }
+    local.erase(local.begin() + (id & ~local_bit));
+    // Decrementing keeps the order of the keys
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if ((it->key & local_bit) && it->key > id) {
+            it->key--;
+        }
+        if ((it->value & local_bit) && it->value > id) {
+            it->value--;
+        }
+    }
+}
+
+size_t
+TagMap::position(id_t key) const
+{
+    auto it = std::lower_bound(entries.begin(), entries.end(), key,
+                               [](const Entry &entry, id_t key) { return entry.key < key; });
+    if (it != entries.end() && it->key == key) {
+        return it - entries.begin();
+    }
+    return entries.size();
+}
+
+size_t
+TagMap::position(std::string_view key) const
+{
+    id_t id = StringPool::getDefault().lookup(key);
+    if (id != not_interned) {
+        return position(id);
+    }
+    // A key that isn't in the pool can only be stored here, and those
+    // come last
+    for (size_t i = entries.size(); i > 0; i--) {
+        if (!(entries[i - 1].key & local_bit)) {
+            break;
+        }
+        if (str(entries[i - 1].key) == key) {
+            return i - 1;
+        }
+    }
+    return entries.size();
+}
+
+void
+TagMap::set(std::string_view key, std::string_view value)
+{
+    size_t pos = position(key);
+    if (pos < entries.size()) {
+        id_t old = entries[pos].value;
+        entries[pos].value = store(value, !isFreeText(key));
+        release(old);
+        return;
+    }
+    Entry entry{store(key), 0};
+    entry.value = store(value, !isFreeText(key));
+    auto it = std::lower_bound(entries.begin(), entries.end(), entry.key,
+                               [](const Entry &entry, id_t key) { return entry.key < key; });
+    entries.insert(it, entry);
+}
+
+std::string_view
+TagMap::get(std::string_view key) const
+{
+    size_t pos = position(key);
+    if (pos < entries.size()) {
+        return str(entries[pos].value);
+    }
+    return std::string_view();
+}
+
+std::string_view
+TagMap::at(std::string_view key) const
+{
+    size_t pos = position(key);
+    if (pos < entries.size()) {
+        return str(entries[pos].value);
+    }
+    throw std::out_of_range("No tag " + std::string(key));
+}
+
+TagMap::const_iterator
+TagMap::find(std::string_view key) const
+{
+    return const_iterator(this, position(key));
+}
+
+size_t
+TagMap::erase(std::string_view key)
+{
+    size_t pos = position(key);
+    if (pos == entries.size()) {
+        return 0;
+    }
+    Entry entry = entries[pos];
+    entries.erase(entries.begin() + pos);
+    // The higher index first, so the other one stays valid
+    release(std::max(entry.key, entry.value));
+    release(std::min(entry.key, entry.value));
+    return 1;
+}
+
+bool
+TagMap::contains(id_t key) const
+{
+    return key != not_interned && position(key) < entries.size();
+}
+
+TagMap::id_t
+TagMap::getId(id_t key) const
+{
+    if (key == not_interned) {
+        return not_interned;
+    }
+    size_t pos = position(key);
+    if (pos == entries.size() || (entries[pos].value & local_bit)) {
+        return not_interned;
+    }
+    return entries[pos].value;
+}
+
+bool
+TagMap::operator==(const TagMap &other) const
+{
+    if (entries.size() != other.entries.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        const Entry &entry = entries[i];
+        if (!(entry.key & local_bit) && !(entry.value & local_bit)) {
+            if (other.getId(entry.key) != entry.value) {
+                return false;
+            }
+            continue;
+        }
+        size_t pos = other.position(str(entry.key));
+        if (pos == other.entries.size() || other.str(other.entries[pos].value) != str(entry.value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace osmobjects
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
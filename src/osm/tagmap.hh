@@ -0,0 +1,168 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __TAGMAP_HH__
+#define __TAGMAP_HH__
+
+/// \file tagmap.hh
+/// \brief Compact storage for the tags of an OSM object
+///
+/// Most objects have a handful of tags, and a std::map with two
+/// std::strings per tag costs well over a hundred bytes each. The keys
+/// and values are interned instead, so each tag is a pair of IDs in a
+/// small sorted vector. Values like names and addresses are nearly all
+/// different, so those are kept in the object.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstddef>
+#include <iterator>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "utils/arena.hh"
+#include "utils/stringpool.hh"
+
+/// \namespace osmobjects
+namespace osmobjects {
+
+/// \class TagMap
+/// \brief The tags of an object, stored as interned IDs
+///
+/// This has the parts of the std::map API the rest of the code uses,
+/// iterating gives the key and value as first and second. Strings that
+/// couldn't be interned are kept in the map itself, in the same arena
+/// as the object when it has one.
+class TagMap {
+  public:
+    typedef stringpool::string_id_t id_t;
+    typedef arena::allocator_type allocator_type;
+
+    /// \struct Tag
+    /// \brief A key and value, used like a std::pair
+    struct Tag {
+        std::string_view first;
+        std::string_view second;
+    };
+
+    /// \class const_iterator
+    /// \brief Iterate through the tags, ordered by the ID of the key
+    class const_iterator {
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Tag value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Tag *pointer;
+        typedef Tag reference;
+
+        /// So it->first works with a Tag made on the fly
+        struct Arrow {
+            Tag tag;
+            const Tag *operator->(void) const { return &tag; };
+        };
+
+        const_iterator(const TagMap *map, size_t pos) : map(map), pos(pos) {};
+        Tag operator*(void) const { return map->tag(pos); };
+        Arrow operator->(void) const { return Arrow{map->tag(pos)}; };
+        const_iterator &operator++(void) { pos++; return *this; };
+        const_iterator operator++(int) { auto tmp = *this; pos++; return tmp; };
+        bool operator==(const const_iterator &other) const { return pos == other.pos; };
+        bool operator!=(const const_iterator &other) const { return pos != other.pos; };
+        /// The interned IDs of the current tag
+        id_t keyId(void) const { return map->entries[pos].key; };
+        id_t valueId(void) const { return map->entries[pos].value; };
+
+      private:
+        const TagMap *map;
+        size_t pos;
+    };
+    typedef const_iterator iterator;
+
+    TagMap(void) {};
+    explicit TagMap(const allocator_type &alloc) : entries(alloc), local(alloc) {};
+
+    /// Add a tag, or replace the value of an existing one
+    void set(std::string_view key, std::string_view value);
+    /// The value of \a key, or an empty string if it isn't there
+    std::string_view get(std::string_view key) const;
+    /// The value of \a key, throws std::out_of_range if it isn't there
+    std::string_view at(std::string_view key) const;
+    const_iterator find(std::string_view key) const;
+    size_t count(std::string_view key) const { return find(key) != end(); };
+    /// Remove a tag, returns the number of tags removed
+    size_t erase(std::string_view key);
+    void clear(void) { entries.clear(); local.clear(); };
+
+    /// Lookups by interned ID, which don't have to hash the string
+    bool contains(id_t key) const;
+    /// The interned ID of the value of \a key, or not_interned
+    id_t getId(id_t key) const;
+
+    size_t size(void) const { return entries.size(); };
+    bool empty(void) const { return entries.empty(); };
+    const_iterator begin(void) const { return const_iterator(this, 0); };
+    const_iterator end(void) const { return const_iterator(this, entries.size()); };
+
+    /// Two maps are equal if they have the same tags, however stored
+    bool operator==(const TagMap &other) const;
+    bool operator!=(const TagMap &other) const { return !(*this == other); };
+
+  private:
+    /// IDs with this bit set are an index into local
+    static const id_t local_bit = 0x80000000;
+
+    /// \struct Entry
+    /// \brief A tag, ordered by the key ID, which puts the keys
+    /// that aren't interned at the end
+    struct Entry {
+        id_t key;
+        id_t value;
+    };
+
+    id_t store(std::string_view str, bool intern = true);
+    std::string_view str(id_t id) const {
+        if (id & local_bit) {
+            return local[id & ~local_bit];
+        }
+        return stringpool::StringPool::getDefault().get(id);
+    };
+    Tag tag(size_t pos) const { return Tag{str(entries[pos].key), str(entries[pos].value)}; };
+    /// The position of \a key, or entries.size()
+    size_t position(std::string_view key) const;
+    size_t position(id_t key) const;
+    /// Forget a local string, and renumber the ones after it
+    void release(id_t id);
+
+    std::pmr::vector<Entry> entries;
+    std::pmr::vector<std::pmr::string> local;
+};
+
+} // namespace osmobjects
+
+#endif // EOF __TAGMAP_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,88 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <exception>
+#include <istream>
+#include <vector>
+
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_streambuf.hpp>
+
+#include "osm/xmlchunks.hh"
+
+namespace xmlchunks {
+
+void
+inflate(const unsigned char *data, size_t size,
+        const std::function<void(const char *, size_t)> &fn)
+{
+    if (!isGzipped(data, size)) {
+        // Already uncompressed, so no copy is needed at all
+        fn(reinterpret_cast<const char *>(data), size);
+        return;
+    }
+
+    boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
+    inbuf.push(boost::iostreams::gzip_decompressor());
+    inbuf.push(boost::iostreams::array_source{reinterpret_cast<const char *>(data), size});
+    std::istream instream(&inbuf);
+    instream.exceptions(std::istream::badbit);
+
+    std::vector<char> buffer(chunk_size);
+    while (instream) {
+        instream.read(buffer.data(), buffer.size());
+        auto count = instream.gcount();
+        if (count > 0) {
+            fn(buffer.data(), count);
+        }
+    }
+}
+
+#ifdef LIBXML
+void
+parse(xmlpp::SaxParser &parser, const unsigned char *data, size_t size)
+{
+    try {
+        inflate(data, size, [&parser](const char *chunk, size_t count) {
+            parser.parse_chunk_raw(reinterpret_cast<const unsigned char *>(chunk), count);
+        });
+    } catch (const std::exception &ex) {
+        // Release the parser context, so the parser can be used again
+        try {
+            parser.finish_chunk_parsing();
+        } catch (const std::exception &) {
+        }
+        throw;
+    }
+    parser.finish_chunk_parsing();
+}
+#endif
+
+} // namespace xmlchunks
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,76 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __XMLCHUNKS_HH__
+#define __XMLCHUNKS_HH__
+
+/// \file xmlchunks.hh
+/// \brief Feed a replication file to a SAX parser a chunk at a time
+///
+/// Replication files are decompressed into a small buffer which goes
+/// straight to the parser, so the uncompressed XML never has to be in
+/// memory all at once. Daily change files are hundreds of megabytes.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstddef>
+#include <functional>
+
+#ifdef LIBXML
+#include <libxml++/libxml++.h>
+#endif
+
+/// \namespace xmlchunks
+namespace xmlchunks {
+
+/// The size of the buffer for the uncompressed data
+const size_t chunk_size = 64 * 1024;
+
+/// Check the magic number for gzip
+inline bool
+isGzipped(const unsigned char *data, size_t size)
+{
+    return size >= 2 && data[0] == 0x1f && data[1] == 0x8b;
+}
+
+/// Decompress \a data if it is gzipped, and call \a fn for each chunk
+/// of the uncompressed data. Uncompressed data is passed on in one
+/// go, without a copy. Decompression errors are thrown as
+/// std::exception.
+void inflate(const unsigned char *data, size_t size,
+             const std::function<void(const char *, size_t)> &fn);
+
+#ifdef LIBXML
+/// Decompress \a data if it is gzipped, and parse it with \a parser.
+/// Decompression errors are thrown as std::exception, and parse
+/// errors as xmlpp::exception.
+void parse(xmlpp::SaxParser &parser, const unsigned char *data, size_t size);
+#endif
+
+} // namespace xmlchunks
+
+#endif // EOF __XMLCHUNKS_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -63,7 +63,7 @@ QueryRaw::QueryRaw(std::shared_ptr<Pq> db) {
 // Receives a dictionary of tags (key: value) and returns
 // a JSONB string for doing an insert operation into the database.
 std::string
-QueryRaw::buildTagsQuery(std::map<std::string, std::string> tags) const {
+QueryRaw::buildTagsQuery(const osmobjects::TagMap &tags) const {
     if (tags.size() > 0) {
         std::string tagsStr = "jsonb_build_object(";
         int count = 0;
@@ -94,7 +94,7 @@ QueryRaw::buildTagsQuery(std::map<std::string, std::string> tags) const {
 // Receives a list of Relation members and returns
 // a JSONB string for doing an insert operation into the database.
 std::string
-buildMembersQuery(std::list<OsmRelationMember> members) {
+buildMembersQuery(const std::pmr::vector<OsmRelationMember> &members) {
     if (members.size() > 0) {
         std::string membersStr = "'[";
         for (auto mit = std::begin(members); mit != std::end(members); ++mit) {
@@ -484,10 +484,10 @@ QueryRaw::applyChange(const OsmRelation &relation) const
 // Receives a string of comma separated values and
 // returns a vector. This function is useful for
 // getting a vector of references from a query result
-std::vector<long> arrayStrToVector(std::string refs_str) {
+std::pmr::vector<long> arrayStrToVector(std::string refs_str) {
     refs_str.erase(0, 1);
     refs_str.erase(refs_str.size() - 1);
-    std::vector<long> refs;
+    std::pmr::vector<long> refs;
     std::stringstream ss(refs_str);
     std::string token;
     while (std::getline(ss, token, ',')) {
@@ -600,7 +600,7 @@ QueryRaw::getWaysByIds(std::string &waysIds, std::map<long, std::shared_ptr<osmo
 //
 // TODO: divide this function into multiple ones
 //
-void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const multipolygon_t &poly)
+void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const geoutil::PreparedBoundary &poly)
 {
 #ifdef TIMING_DEBUG
     boost::timer::auto_cpu_timer timer("buildGeometries(osmchanges, poly): took %w seconds\n");
@@ -614,18 +614,19 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
     for (auto it = std::begin(osmchanges->changes); it != std::end(osmchanges->changes); it++) {
         OsmChange *change = it->get();
         for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
-            OsmWay *way = wit->get();
+            OsmWay *way = &*wit;
             if (way->action != osmobjects::remove) {
 
                 // Save referenced Nodes ids for later use. The geometries of these
                 // Nodes will be needed later when building geometries for Ways
                 for (auto rit = std::begin(way->refs); rit != std::end(way->refs); ++rit) {
-                    if (!osmchanges->nodecache.count(*rit)) {
+                    if (!osmchanges->nodecache.contains(*rit) &&
+                        !(osmchanges->locations && osmchanges->locations->contains(*rit))) {
                         referencedNodeIds += std::to_string(*rit) + ",";
                     }
                 }
                 // Save Ways in waycache, pre-filter by priority area
-                if (poly.empty() || bg::within(way->linestring, poly)) {
+                if (poly.empty() || poly.within(way->linestring)) {
                     osmchanges->waycache.insert(std::make_pair(way->id, std::make_shared<osmobjects::OsmWay>(*way)));
                 }
             } else {
@@ -638,10 +639,10 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
         // Save modified nodes for later use. This list will be used for getting
         // indirectly modified Ways
         for (auto nit = std::begin(change->nodes); nit != std::end(change->nodes); ++nit) {
-            OsmNode *node = nit->get();
+            OsmNode *node = &*nit;
             if (node->action == osmobjects::modify) {
                 // Get only modified nodes ids inside the priority area
-                if (poly.empty() || bg::within(node->point, poly)) {
+                if (poly.empty() || poly.within(node->point)) {
                     modifiedNodesIds += std::to_string(node->id) + ",";
                 }
             }
@@ -650,7 +651,7 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
         // Save removed Relations for later use. This list will be used to known
         // which Relations will be skipped when building geometries
         for (auto rel_it = std::begin(change->relations); rel_it != std::end(change->relations); ++rel_it) {
-            OsmRelation *relation = rel_it->get();
+            OsmRelation *relation = &*rel_it;
             removedRelations.push_back(relation->id);
         }
     }
@@ -664,16 +665,17 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
         auto modifiedWays = getWaysByNodesRefs(modifiedNodesIds);
 
         // Add a new change for the indirectly modified Way
-        auto change = std::make_shared<OsmChange>(none);
+        auto change = std::make_shared<OsmChange>(none, osmchanges->arena);
         for (auto wit = modifiedWays.begin(); wit != modifiedWays.end(); ++wit) {
-           auto way = std::make_shared<OsmWay>(*wit->get());
+           OsmWay *way = wit->get();
            // If the Way is not removed
            if (std::find(removedWays.begin(), removedWays.end(), way->id) == removedWays.end()) {
 
                 // Save referenced Nodes. This list will be used for getting the geometries of
                 // these Nodes, used when building the Way geometry
                 for (auto rit = std::begin(way->refs); rit != std::end(way->refs); ++rit) {
-                    if (!osmchanges->nodecache.count(*rit)) {
+                    if (!osmchanges->nodecache.contains(*rit) &&
+                        !(osmchanges->locations && osmchanges->locations->contains(*rit))) {
                         referencedNodeIds += std::to_string(*rit) + ",";
                     }
                 }
@@ -683,7 +685,7 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
                 way->action = osmobjects::modify_geom;
 
                 // Add the Way to the list of Ways in the OsmChange
-                change->ways.push_back(way);
+                change->ways.push_back(*way);
 
                 // Save the id of the indirectly modified Way for later use. This will be used
                 // for identifying which Relations were indirectly modified by this change.
@@ -703,9 +705,9 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
         auto modifiedRelations = getRelationsByWaysRefs(modifiedWaysIds);
 
         // Create a new change for the indirecty modified Relation
-        auto change = std::make_shared<OsmChange>(none);
+        auto change = std::make_shared<OsmChange>(none, osmchanges->arena);
         for (auto rel_it = modifiedRelations.begin(); rel_it != modifiedRelations.end(); ++rel_it) {
-           auto relation = std::make_shared<OsmRelation>(*rel_it->get());
+           OsmRelation *relation = rel_it->get();
            // If the Relation is not removed
            if (std::find(removedRelations.begin(), removedRelations.end(), relation->id) == removedRelations.end()) {
                 // Flag it as modified geometry. This means that only the geometry was modified,
@@ -713,7 +715,7 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
                 relation->action = osmobjects::modify_geom;
 
                 // Add the Relation to the list of Relation in the OsmChange
-                change->relations.push_back(relation);
+                change->relations.push_back(*relation);
            }
         }
         osmchanges->changes.push_back(change);
@@ -736,7 +738,11 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
             auto node_lat = (*node_it)[2].as<double>();
             auto node_lon = (*node_it)[1].as<double>();
             OsmNode node(node_lat, node_lon);
-            osmchanges->nodecache[node_id] = node.point;
+            osmchanges->nodecache.set(node_id, node.point);
+            // A later file may already have moved it
+            if (osmchanges->locations) {
+                osmchanges->locations->setIfMissing(node_id, node.point);
+            }
         }
     }
 
@@ -744,14 +750,15 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
     for (auto it = std::begin(osmchanges->changes); it != std::end(osmchanges->changes); it++) {
         OsmChange *change = it->get();
         for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
-            OsmWay *way = wit->get();
+            OsmWay *way = &*wit;
 
             // Only build geometries for Ways with incomplete geometries
             if (bg::num_points(way->linestring) != way->refs.size()) {
                 way->linestring.clear();
+                point_t point;
                 for (auto rit = way->refs.begin(); rit != way->refs.end(); ++rit) {
-                    if (osmchanges->nodecache.count(*rit)) {
-                        bg::append(way->linestring, osmchanges->nodecache.at(*rit));
+                    if (osmchanges->getLocation(*rit, point)) {
+                        bg::append(way->linestring, point);
                     }
                 }
                 if (way->isClosed()) {
@@ -761,7 +768,7 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
             }
 
             // Save Way pointer for later use. This will be used when building Relations geometries.
-            if (poly.empty() || bg::within(way->linestring, poly)) {
+            if (poly.empty() || poly.within(way->linestring)) {
                 if (osmchanges->waycache.count(way->id)) {
                     if (way->isClosed()) {
                         osmchanges->waycache.at(way->id)->polygon = way->polygon;
@@ -782,7 +789,7 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
     for (auto it = std::begin(osmchanges->changes); it != std::end(osmchanges->changes); it++) {
         OsmChange *change = it->get();
         for (auto rel_it = std::begin(change->relations); rel_it != std::end(change->relations); ++rel_it) {
-            OsmRelation *relation = rel_it->get();
+            OsmRelation *relation = &*rel_it;
             if (relation->action != osmobjects::remove) {
                 for (auto mit = relation->members.begin(); mit != relation->members.end(); ++mit) {
                     if (mit->type == osmobjects::way && !osmchanges->waycache.count(mit->ref)) {
@@ -802,7 +809,7 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
     for (auto it = std::begin(osmchanges->changes); it != std::end(osmchanges->changes); it++) {
         OsmChange *change = it->get();
         for (auto rel_it = std::begin(change->relations); rel_it != std::end(change->relations); ++rel_it) {
-            OsmRelation *relation = rel_it->get();
+            OsmRelation *relation = &*rel_it;
             // Skip removed relations
             if (relation->action != osmobjects::remove) {
                 osmchanges->buildRelationGeometry(*relation);
@@ -813,7 +820,7 @@ void QueryRaw::buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const
 
 // Fill Node cache with Nodes referenced from Ways
 void
-QueryRaw::getNodeCacheFromWays(std::shared_ptr<std::vector<OsmWay>> ways, std::map<double, point_t> &nodecache) const
+QueryRaw::getNodeCacheFromWays(std::shared_ptr<std::vector<OsmWay>> ways, nodelocations::NodeLocationStore &nodecache) const
 {
 #ifdef TIMING_DEBUG
     boost::timer::auto_cpu_timer timer("getNodeCacheFromWays(ways, nodecache): took %w seconds\n");
@@ -823,7 +830,10 @@ QueryRaw::getNodeCacheFromWays(std::shared_ptr<std::vector<OsmWay>> ways, std::m
     std::string nodeIds;
     for (auto wit = ways->begin(); wit != ways->end(); ++wit) {
         for (auto rit = std::begin(wit->refs); rit != std::end(wit->refs); ++rit) {
-            nodeIds += std::to_string(*rit) + ",";
+            // Only the ones not known yet need a query
+            if (!nodecache.contains(*rit)) {
+                nodeIds += std::to_string(*rit) + ",";
+            }
         }
     }
 
@@ -844,7 +854,7 @@ QueryRaw::getNodeCacheFromWays(std::shared_ptr<std::vector<OsmWay>> ways, std::m
             auto node_lat = (*node_it)[1].as<double>();
             auto node_lon = (*node_it)[2].as<double>();
             auto point = point_t(node_lat, node_lon);
-            nodecache.insert(std::make_pair(node_id, point));
+            nodecache.setIfMissing(node_id, point);
         }
     }
 }
@@ -69,9 +69,9 @@ class QueryRaw {
     /// Build query for processed Relation
     std::shared_ptr<std::vector<std::string>> applyChange(const OsmRelation &relation) const;
     /// Build all geometries for a OsmChange file
-    void buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const multipolygon_t &poly);
+    void buildGeometries(std::shared_ptr<OsmChangeFile> osmchanges, const geoutil::PreparedBoundary &poly);
     /// Get nodes for filling Node cache from refs on ways 
-    void getNodeCacheFromWays(std::shared_ptr<std::vector<OsmWay>> ways, std::map<double, point_t> &nodecache) const;
+    void getNodeCacheFromWays(std::shared_ptr<std::vector<OsmWay>> ways, nodelocations::NodeLocationStore &nodecache) const;
     // Get ways by node refs (used for ways geometries)
     std::list<std::shared_ptr<OsmWay>> getWaysByNodesRefs(std::string &nodeIds) const;
     // Get ways by ids (used for relations geometries)
@@ -83,7 +83,7 @@ class QueryRaw {
     // Get object (nodes, ways or relations) count from the database
     int getCount(const std::string &tableName);
     // Build tags query for insert tags into the databse
-    std::string buildTagsQuery(std::map<std::string, std::string> tags) const;
+    std::string buildTagsQuery(const osmobjects::TagMap &tags) const;
     // Get ways by page
     std::shared_ptr<std::vector<OsmWay>> getWaysFromDB(long lastid, int pageSize, const std::string &tableName);
     // Get ways by page, without refs (useful for non OSM databases)
@@ -0,0 +1,348 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <chrono>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/ssl/error.hpp>
+#include <boost/beast/version.hpp>
+
+#include "replicator/connectionpool.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace net = boost::asio;
+namespace ssl = boost::asio::ssl;
+namespace http = boost::beast::http;
+using tcp = net::ip::tcp;
+
+namespace replication {
+
+// Run the operation started by \a start on the connection, giving up
+// if it takes longer than \a timeout
+template <typename Start>
+static void
+runFor(ConnectionPool::Connection &conn, std::chrono::seconds timeout,
+       boost::system::error_code &ec, Start start)
+{
+    conn.ioc.restart();
+    start([&ec](boost::system::error_code result, auto...) { ec = result; });
+    conn.ioc.run_for(timeout);
+    if (!conn.ioc.stopped()) {
+        // Let the handler run, the connection is unusable after this
+        boost::system::error_code ignored;
+        conn.stream.next_layer().cancel(ignored);
+        conn.ioc.run();
+        if (ec == net::error::operation_aborted) {
+            ec = net::error::timed_out;
+        }
+    }
+}
+
+ConnectionPool::ConnectionPool(const std::string &domain, int port)
+    : domain(domain), port(port)
+{
+    // Verify the remote server's certificate
+    ctx.set_verify_mode(ssl::verify_none);
+    // Keep the sessions on the client side, so they can be resumed
+    SSL_CTX_set_session_cache_mode(ctx.native_handle(), SSL_SESS_CACHE_CLIENT);
+}
+
+ConnectionPool::~ConnectionPool(void)
+{
+    closeIdle();
+    if (session) {
+        SSL_SESSION_free(session);
+    }
+}
+
+std::shared_ptr<ConnectionPool>
+ConnectionPool::getPool(const std::string &domain, int port)
+{
+    static std::mutex pools_mutex;
+    static std::map<std::string, std::shared_ptr<ConnectionPool>> pools;
+
+    // Strip off the https part, if any
+    std::string host = domain;
+    auto pos = host.find("://");
+    if (pos != std::string::npos) {
+        host = host.substr(pos + 3);
+    }
+    pos = host.find('/');
+    if (pos != std::string::npos) {
+        host = host.substr(0, pos);
+    }
+
+    std::string key = host + ":" + std::to_string(port);
+    std::lock_guard<std::mutex> lock(pools_mutex);
+    auto it = pools.find(key);
+    if (it != pools.end()) {
+        return it->second;
+    }
+    auto pool = std::make_shared<ConnectionPool>(host, port);
+    pools[key] = pool;
+    return pool;
+}
+
+bool
+ConnectionPool::cachedEndpoints(tcp::resolver::results_type &results)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (!endpoints.empty() && std::chrono::steady_clock::now() - resolved_at < dns_ttl) {
+        results = endpoints;
+        return true;
+    }
+    return false;
+}
+
+void
+ConnectionPool::saveEndpoints(const tcp::resolver::results_type &results)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    endpoints = results;
+    resolved_at = std::chrono::steady_clock::now();
+}
+
+tcp::resolver::results_type
+ConnectionPool::resolve(boost::system::error_code &ec)
+{
+    tcp::resolver::results_type results;
+    if (cachedEndpoints(results)) {
+        return results;
+    }
+    tcp::resolver resolver{ioc};
+    results = resolver.resolve(domain, std::to_string(port), ec);
+    if (ec) {
+        log_error("Couldn't resolve %1%: %2%", domain, ec.message());
+        return results;
+    }
+    saveEndpoints(results);
+    return results;
+}
+
+SSL_SESSION *
+ConnectionPool::getSession(void)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (session) {
+        SSL_SESSION_up_ref(session);
+    }
+    return session;
+}
+
+void
+ConnectionPool::saveSession(SSL *ssl)
+{
+    SSL_SESSION *latest = SSL_get1_session(ssl);
+    if (!latest) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (session) {
+        SSL_SESSION_free(session);
+    }
+    session = latest;
+}
+
+std::unique_ptr<ConnectionPool::Connection>
+ConnectionPool::open(boost::system::error_code &ec)
+{
+    auto results = resolve(ec);
+    if (ec) {
+        return nullptr;
+    }
+    auto conn = std::make_unique<Connection>(ctx);
+
+    // Some servers need SNI to pick the right certificate
+    SSL_set_tlsext_host_name(conn->stream.native_handle(), domain.c_str());
+    SSL_SESSION *previous = getSession();
+    if (previous) {
+        SSL_set_session(conn->stream.native_handle(), previous);
+        SSL_SESSION_free(previous);
+    }
+
+    runFor(*conn, timeout, ec, [&conn, &results](auto handler) {
+        net::async_connect(conn->stream.next_layer(), results, handler);
+    });
+    if (ec) {
+        log_error("stream connect failed %1%", ec.message());
+        // The address may have changed
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        endpoints = tcp::resolver::results_type();
+        return nullptr;
+    }
+    runFor(*conn, timeout, ec, [&conn](auto handler) {
+        conn->stream.async_handshake(ssl::stream_base::client, handler);
+    });
+    if (ec) {
+        log_error("stream handshake failed %1%", ec.message());
+        return nullptr;
+    }
+    if (SSL_session_reused(conn->stream.native_handle())) {
+        log_debug("Resumed TLS session with %1%", domain);
+    } else {
+        saveSession(conn->stream.native_handle());
+    }
+    return conn;
+}
+
+std::unique_ptr<ConnectionPool::Connection>
+ConnectionPool::acquire(boost::system::error_code &ec)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        auto now = std::chrono::steady_clock::now();
+        while (!idle.empty()) {
+            auto conn = std::move(idle.back());
+            idle.pop_back();
+            if (now - conn->last_used < idle_timeout) {
+                return conn;
+            }
+            // The server has most likely closed it already
+            boost::system::error_code ignored;
+            conn->stream.next_layer().close(ignored);
+        }
+    }
+    return open(ec);
+}
+
+void
+ConnectionPool::release(std::unique_ptr<Connection> conn)
+{
+    conn->last_used = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (idle.size() < max_idle) {
+        idle.push_back(std::move(conn));
+        return;
+    }
+    boost::system::error_code ignored;
+    conn->stream.next_layer().close(ignored);
+}
+
+void
+ConnectionPool::shutdown(std::unique_ptr<Connection> conn)
+{
+    // Gracefully close the stream
+    boost::system::error_code ec;
+    runFor(*conn, timeout, ec, [&conn](auto handler) {
+        conn->stream.async_shutdown(handler);
+    });
+    if (ec == net::error::eof) {
+        // Rationale:
+        // http://stackoverflow.com/questions/25587403/boost-asio-ssl-async-shutdown-always-finishes-with-an-error
+        ec = {};
+    }
+    conn->stream.next_layer().close(ec);
+}
+
+bool
+ConnectionPool::connect(void)
+{
+    boost::system::error_code ec;
+    auto conn = acquire(ec);
+    if (!conn) {
+        log_error("Connection to %1% failed: %2%", domain, ec.message());
+        return false;
+    }
+    release(std::move(conn));
+    return true;
+}
+
+bool
+ConnectionPool::get(const std::string &target, response_t &response,
+                    const headers_t &headers)
+{
+    http::request<http::empty_body> req{http::verb::get, target, 11};
+    req.set(http::field::host, domain);
+    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    for (auto it = headers.begin(); it != headers.end(); ++it) {
+        req.set(it->first, it->second);
+    }
+    req.keep_alive(true);
+
+    // A reused connection may have been closed by the server in the
+    // meantime, in which case retry once with a new one.
+    for (int attempt = 0; attempt < 2; attempt++) {
+        boost::system::error_code ec;
+        auto conn = acquire(ec);
+        if (!conn) {
+            return false;
+        }
+        runFor(*conn, timeout, ec, [&conn, &req](auto handler) {
+            http::async_write(conn->stream, req, handler);
+        });
+        if (ec) {
+            log_debug("stream write failed: %1%", ec.message());
+            continue;
+        }
+        http::response_parser<http::string_body> parser;
+        // Daily change files are much bigger than the default limit
+        parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+        // A big file can take minutes to arrive, so the timeout only
+        // catches a server that has gone quiet
+        while (!ec && !parser.is_done()) {
+            runFor(*conn, timeout, ec, [&conn, &parser](auto handler) {
+                http::async_read_some(conn->stream, conn->buffer, parser, handler);
+            });
+        }
+        if (ec) {
+            log_debug("stream read failed: %1%", ec.message());
+            continue;
+        }
+        response = parser.release();
+        if (response.keep_alive()) {
+            release(std::move(conn));
+        } else {
+            shutdown(std::move(conn));
+        }
+        return true;
+    }
+    log_error("Request for %1% on %2% failed", target, domain);
+    return false;
+}
+
+void
+ConnectionPool::closeIdle(void)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    for (auto it = idle.begin(); it != idle.end(); ++it) {
+        boost::system::error_code ignored;
+        (*it)->stream.next_layer().close(ignored);
+    }
+    idle.clear();
+}
+
+} // namespace replication
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,150 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __CONNECTIONPOOL_HH__
+#define __CONNECTIONPOOL_HH__
+
+/// \file connectionpool.hh
+/// \brief Keep-alive HTTPS connections to the planet servers
+///
+/// Replication files are small, so when catching up most of the time
+/// used to go into the DNS lookup, the TCP connect and the TLS
+/// handshake. The pool keeps idle connections open between requests,
+/// caches the DNS lookup, and resumes the TLS session when it has to
+/// open a new connection.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http.hpp>
+
+/// \namespace replication
+namespace replication {
+
+/// \class ConnectionPool
+/// \brief A pool of HTTPS connections to a single server
+///
+/// There is one pool per server for the whole process, so all the
+/// Planet objects talking to the same server share the connections.
+class ConnectionPool {
+  public:
+    typedef boost::beast::http::response<boost::beast::http::string_body> response_t;
+    typedef std::vector<std::pair<boost::beast::http::field, std::string>> headers_t;
+
+    ConnectionPool(const std::string &domain, int port);
+    ~ConnectionPool(void);
+
+    /// Get the pool for \a domain, creating it the first time
+    static std::shared_ptr<ConnectionPool> getPool(const std::string &domain, int port = 443);
+
+    /// Open a connection and keep it for later, mostly to check the
+    /// server is reachable
+    bool connect(void);
+
+    /// Send a GET request for \a target, which is the path part of
+    /// the URL, with optional extra \a headers. Returns false if there
+    /// was a network error.
+    bool get(const std::string &target, response_t &response,
+             const headers_t &headers = {});
+
+    /// Close all the idle connections
+    void closeIdle(void);
+
+    const std::string &getDomain(void) const { return domain; };
+    int getPort(void) const { return port; };
+
+    /// \struct Connection
+    /// \brief An open connection to the server
+    ///
+    /// The blocking calls have no timeout, so the operations are run
+    /// asynchronously on an io_context of the connection's own, with
+    /// a deadline. This way a thread only waits on its own connection.
+    struct Connection {
+        Connection(boost::asio::ssl::context &ctx) : stream(ioc, ctx) {};
+        boost::asio::io_context ioc;
+        boost::asio::ssl::stream<boost::asio::ip::tcp::socket> stream;
+        boost::beast::flat_buffer buffer;
+        std::chrono::steady_clock::time_point last_used;
+    };
+
+    /// Get an idle connection, or open a new one. Returns nullptr
+    /// if the server can't be reached.
+    std::unique_ptr<Connection> acquire(boost::system::error_code &ec);
+    /// Put a connection back into the pool, so it can be reused
+    void release(std::unique_ptr<Connection> conn);
+
+    /// The TLS session to use when opening a new connection
+    SSL_SESSION *getSession(void);
+    /// Save the TLS session of a connection for resumption
+    void saveSession(SSL *ssl);
+    /// Get the server addresses, looking them up only once in a while
+    boost::asio::ip::tcp::resolver::results_type resolve(boost::system::error_code &ec);
+    /// Get the cached server addresses, if they are still fresh, so a
+    /// caller with its own event loop can do the lookup asynchronously
+    bool cachedEndpoints(boost::asio::ip::tcp::resolver::results_type &results);
+    /// Cache the server addresses from a lookup
+    void saveEndpoints(const boost::asio::ip::tcp::resolver::results_type &results);
+
+    boost::asio::ssl::context &getContext(void) { return ctx; };
+
+  private:
+    std::unique_ptr<Connection> open(boost::system::error_code &ec);
+    void shutdown(std::unique_ptr<Connection> conn);
+
+    std::string domain;                 ///< The server host name
+    int port = 443;                     ///< Network port on the server
+    boost::asio::io_context ioc;        ///< Only used for the DNS lookup
+    boost::asio::ssl::context ctx{boost::asio::ssl::context::sslv23_client};
+    std::mutex pool_mutex;
+    std::vector<std::unique_ptr<Connection>> idle; ///< Connections ready for reuse
+    SSL_SESSION *session = nullptr;     ///< The last TLS session, for resumption
+    boost::asio::ip::tcp::resolver::results_type endpoints; ///< Cached DNS lookup
+    std::chrono::steady_clock::time_point resolved_at;
+    /// How long the cached DNS lookup is used for
+    std::chrono::seconds dns_ttl{300};
+    /// Servers drop idle keep-alive connections, so don't bother
+    /// trying to use one that has been idle for longer than this
+    std::chrono::seconds idle_timeout{30};
+    size_t max_idle = 16;               ///< Maximum number of idle connections kept
+    /// Give up if the server doesn't answer in time. This is for each
+    /// read, not for the whole file.
+    std::chrono::seconds timeout{60};
+};
+
+} // namespace replication
+
+#endif // EOF __CONNECTIONPOOL_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
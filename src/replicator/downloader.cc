@@ -0,0 +1,423 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include <boost/asio/coroutine.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+#include <boost/filesystem.hpp>
+
+#include "replicator/downloader.hh"
+#include "replicator/connectionpool.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace beast = boost::beast;
+namespace net = boost::asio;
+namespace ssl = boost::asio::ssl;
+namespace http = beast::http;
+using tcp = net::ip::tcp;
+
+namespace replication {
+
+#include <boost/asio/yield.hpp>
+
+/// \class AsyncDownloader::Request
+/// \brief A single download, written as a stackless coroutine
+///
+/// Each time an asynchronous operation completes, the coroutine is
+/// resumed where it left off. A reused connection may have been closed
+/// by the server, so a failed request is retried once on a new one.
+class AsyncDownloader::Request : public net::coroutine,
+                                 public std::enable_shared_from_this<Request> {
+  public:
+    /// Gets the file, and how long the server took to start answering
+    typedef std::function<void(RequestedFile, std::chrono::milliseconds)> result_t;
+
+    Request(AsyncDownloader &downloader, const RemoteURL &remote,
+            const std::string &domain, const std::string &target, result_t handler)
+        : downloader(downloader), remote(remote), handler(handler)
+    {
+        pool = ConnectionPool::getPool(domain);
+        req = {http::verb::get, target, 11};
+        req.set(http::field::host, pool->getDomain());
+        req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+        req.keep_alive(true);
+    };
+
+    void start(void)
+    {
+        started = std::chrono::steady_clock::now();
+        (*this)();
+    };
+
+    /// True once the response has started arriving
+    bool responding(void) const { return responded != std::chrono::steady_clock::time_point(); };
+
+    /// Give up, another server was faster
+    void cancel(void)
+    {
+        cancelled = true;
+        if (resolver) {
+            resolver->cancel();
+        }
+        if (conn) {
+            beast::get_lowest_layer(conn->stream).cancel();
+        }
+    };
+
+    void operator()(beast::error_code ec = {}, std::size_t bytes = 0)
+    {
+        reenter (*this) {
+            for (attempt = 0; attempt < 2 && !cancelled; attempt++) {
+                conn = downloader.getIdle(pool->getDomain());
+                if (!conn) {
+                    // The lookup runs on the event loop too, a blocking
+                    // one would hold up all the other downloads
+                    if (!pool->cachedEndpoints(endpoints)) {
+                        resolver = std::make_unique<tcp::resolver>(downloader.ioc);
+                        yield resolver->async_resolve(pool->getDomain(), std::to_string(pool->getPort()),
+                            [self = shared_from_this()](beast::error_code ec, tcp::resolver::results_type results) {
+                                self->endpoints = results;
+                                (*self)(ec);
+                            });
+                        resolver.reset();
+                        if (ec) {
+                            log_error("Couldn't resolve %1%: %2%", pool->getDomain(), ec.message());
+                            break;
+                        }
+                        pool->saveEndpoints(endpoints);
+                    }
+                    conn = std::make_unique<Connection>(downloader.ioc, pool->getContext());
+                    // Some servers need SNI to pick the right certificate
+                    SSL_set_tlsext_host_name(conn->stream.native_handle(), pool->getDomain().c_str());
+                    if (SSL_SESSION *session = pool->getSession()) {
+                        SSL_set_session(conn->stream.native_handle(), session);
+                        SSL_SESSION_free(session);
+                    }
+                    beast::get_lowest_layer(conn->stream).expires_after(downloader.request_timeout);
+                    yield beast::get_lowest_layer(conn->stream).async_connect(endpoints,
+                        [self = shared_from_this()](beast::error_code ec, const tcp::endpoint &) {
+                            (*self)(ec);
+                        });
+                    if (ec) {
+                        log_error("stream connect failed %1%", ec.message());
+                        continue;
+                    }
+                    yield conn->stream.async_handshake(ssl::stream_base::client,
+                        [self = shared_from_this()](beast::error_code ec) {
+                            (*self)(ec);
+                        });
+                    if (ec) {
+                        log_error("stream handshake failed %1%", ec.message());
+                        continue;
+                    }
+                    if (!SSL_session_reused(conn->stream.native_handle())) {
+                        pool->saveSession(conn->stream.native_handle());
+                    }
+                }
+
+                beast::get_lowest_layer(conn->stream).expires_after(downloader.request_timeout);
+                yield http::async_write(conn->stream, req,
+                    [self = shared_from_this()](beast::error_code ec, std::size_t bytes) {
+                        (*self)(ec, bytes);
+                    });
+                if (ec) {
+                    log_debug("stream write failed: %1%", ec.message());
+                    continue;
+                }
+
+                parser = std::make_unique<http::response_parser<http::string_body>>();
+                // Daily change files are much bigger than the default limit
+                parser->body_limit(std::numeric_limits<std::uint64_t>::max());
+                // An hourly or daily file can take minutes to arrive, so
+                // the timeout only catches a server that has gone quiet
+                while (!parser->is_done()) {
+                    beast::get_lowest_layer(conn->stream).expires_after(downloader.request_timeout);
+                    yield http::async_read_some(conn->stream, conn->buffer, *parser,
+                        [self = shared_from_this()](beast::error_code ec, std::size_t bytes) {
+                            (*self)(ec, bytes);
+                        });
+                    if (ec) {
+                        break;
+                    }
+                    if (!responding() && parser->is_header_done()) {
+                        responded = std::chrono::steady_clock::now();
+                    }
+                }
+                if (ec) {
+                    log_debug("stream read failed: %1%", ec.message());
+                    continue;
+                }
+                return complete();
+            }
+            if (!cancelled) {
+                log_error("Request for %1% on %2% failed", req.target(), pool->getDomain());
+            }
+            RequestedFile file;
+            file.status = reqfile_t::systemError;
+            downloader.finish(nullptr, pool->getDomain());
+            handler(file, latency());
+        }
+    };
+
+  private:
+    void complete(void)
+    {
+        RequestedFile file;
+        auto &response = parser->get();
+        if (response.result() == http::status::not_found ||
+            response.result() == http::status::gateway_timeout) {
+            log_error("Remote file not found: %1%%2%", pool->getDomain(), req.target());
+            file.status = reqfile_t::remoteNotFound;
+        } else if (response.result() != http::status::ok) {
+            log_error("Request for %1%%2% failed: %3%", pool->getDomain(), req.target(), response.result_int());
+            file.status = reqfile_t::systemError;
+        } else {
+            auto &body = response.body();
+            if (body.size() > 0) {
+                // Check the magic number of the file
+                const auto is_gzipped{body[0] == 0x1f};
+                // Add the last newline back if not gzipped (or we'll get decompression error: unexpected end of file)
+                if (!is_gzipped) {
+                    body.push_back('\n');
+                }
+            }
+            // The body is moved, not copied
+            file.data = std::make_shared<FileData>(std::move(body));
+            file.status = reqfile_t::success;
+        }
+        if (!response.keep_alive()) {
+            conn.reset();
+        }
+        downloader.finish(std::move(conn), pool->getDomain());
+        handler(file, latency());
+    };
+
+    /// The time to the first byte of the response, so it doesn't
+    /// depend on the size of the file
+    std::chrono::milliseconds latency(void) const
+    {
+        auto end = responding() ? responded : std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(end - started);
+    };
+
+    AsyncDownloader &downloader;
+    RemoteURL remote;
+    result_t handler;
+    std::shared_ptr<ConnectionPool> pool;
+    std::unique_ptr<Connection> conn;
+    std::unique_ptr<tcp::resolver> resolver;
+    tcp::resolver::results_type endpoints;
+    http::request<http::empty_body> req;
+    std::unique_ptr<http::response_parser<http::string_body>> parser;
+    int attempt = 0;
+    bool cancelled = false;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point responded;  ///< When the headers arrived
+};
+
+#include <boost/asio/unyield.hpp>
+
+AsyncDownloader::AsyncDownloader(size_t max_in_flight, std::shared_ptr<ServerSelector> selector)
+    : work(net::make_work_guard(ioc)), selector(selector),
+      max_in_flight(max_in_flight ? max_in_flight : 1)
+{
+    io_thread = std::thread([this] { ioc.run(); });
+}
+
+AsyncDownloader::~AsyncDownloader(void)
+{
+    work.reset();
+    ioc.stop();
+    if (io_thread.joinable()) {
+        io_thread.join();
+    }
+}
+
+void
+AsyncDownloader::fetch(const RemoteURL &remote, handler_t handler)
+{
+    // Use the cached file if there is one
+    std::string local_file_path = remote.destdir_base + remote.filespec;
+    if (std::filesystem::exists(local_file_path)) {
+        auto file = cache.readFile(local_file_path);
+        if (file.status == reqfile_t::success) {
+            handler(file);
+            return;
+        }
+        // If local file doesn't work, remove it and download it again
+        boost::filesystem::remove(local_file_path);
+    }
+    net::post(ioc, [this, remote, handler] {
+        queued.emplace_back(remote, handler);
+        startRequests();
+    });
+}
+
+void
+AsyncDownloader::startRequests(void)
+{
+    while (in_flight < max_in_flight && !queued.empty()) {
+        auto download = std::make_shared<Download>();
+        download->remote = std::move(queued.front().first);
+        download->handler = std::move(queued.front().second);
+        queued.pop_front();
+        if (selector) {
+            download->servers = selector->select(download->remote.sequence());
+        }
+        if (download->servers.empty()) {
+            download->servers.push_back(download->remote.domain);
+        }
+        startAttempt(download);
+    }
+}
+
+void
+AsyncDownloader::startAttempt(std::shared_ptr<Download> download)
+{
+    auto domain = download->servers[download->started++];
+    std::string target = "/" + download->remote.filespec;
+    if (selector) {
+        target = selector->getTarget(domain, download->remote);
+    }
+    in_flight++;
+    auto request = std::make_shared<Request>(*this, download->remote, domain, target,
+        [this, download, domain](RequestedFile file, std::chrono::milliseconds latency) {
+            onResult(download, domain, file, latency);
+        });
+    download->requests.push_back(request);
+
+    // If this server is slow to answer, ask the next one too. Once the
+    // file is arriving there is no point, a big hourly or daily file
+    // just takes a while.
+    if (download->started < download->servers.size()) {
+        download->timer = std::make_shared<net::steady_timer>(ioc);
+        download->timer->expires_after(selector->hedgeDelay(domain));
+        download->timer->async_wait([this, download](const beast::error_code &ec) {
+            bool responding = false;
+            for (auto it = download->requests.begin(); it != download->requests.end(); ++it) {
+                auto request = it->lock();
+                responding = responding || (request && request->responding());
+            }
+            if (!ec && !download->done && !responding && download->started < download->servers.size()) {
+                log_debug("Hedging %1% on %2%", download->remote.filespec,
+                          download->servers[download->started]);
+                startAttempt(download);
+            }
+        });
+    }
+    request->start();
+}
+
+void
+AsyncDownloader::onResult(std::shared_ptr<Download> download, const std::string &domain,
+                          RequestedFile file, std::chrono::milliseconds latency)
+{
+    // The other request has already won
+    if (download->done) {
+        return;
+    }
+    if (selector) {
+        selector->report(domain, download->remote.sequence(), file.status, latency);
+    }
+    if (file.status != reqfile_t::success) {
+        download->failed++;
+        download->last = file;
+        if (download->started < download->servers.size()) {
+            // Don't wait for the timer, try the next server now
+            if (download->timer) {
+                download->timer->cancel();
+            }
+            startAttempt(download);
+            return;
+        }
+        if (download->failed < download->started) {
+            // Another request is still going
+            return;
+        }
+    } else {
+        // Stop the other requests, if any
+        for (auto it = download->requests.begin(); it != download->requests.end(); ++it) {
+            if (auto request = it->lock()) {
+                request->cancel();
+            }
+        }
+#ifdef USE_CACHE
+        if (file.data->size() > 0) {
+            cache.writeFile(download->remote, file.data);
+        } else {
+            log_error("%1% does not exist!", download->remote.filespec);
+        }
+#endif
+    }
+    download->done = true;
+    if (download->timer) {
+        download->timer->cancel();
+    }
+    download->handler(file.status == reqfile_t::success ? file : download->last);
+}
+
+std::unique_ptr<AsyncDownloader::Connection>
+AsyncDownloader::getIdle(const std::string &domain)
+{
+    auto &conns = idle[domain];
+    auto now = std::chrono::steady_clock::now();
+    while (!conns.empty()) {
+        auto conn = std::move(conns.back());
+        conns.pop_back();
+        if (now - conn->last_used < idle_timeout) {
+            return conn;
+        }
+    }
+    return nullptr;
+}
+
+void
+AsyncDownloader::finish(std::unique_ptr<Connection> conn, const std::string &domain)
+{
+    in_flight--;
+    if (conn) {
+        beast::get_lowest_layer(conn->stream).expires_never();
+        conn->last_used = std::chrono::steady_clock::now();
+        auto &conns = idle[domain];
+        if (conns.size() < max_in_flight) {
+            conns.push_back(std::move(conn));
+        }
+    }
+    startRequests();
+}
+
+} // namespace replication
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,152 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __DOWNLOADER_HH__
+#define __DOWNLOADER_HH__
+
+/// \file downloader.hh
+/// \brief Asynchronous download of replication files
+///
+/// All the downloads run on a single I/O thread, so many requests
+/// can be in flight at once without tying up a thread for each one
+/// while it waits on the network. The threads are left for parsing
+/// and building geometries.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/ssl.hpp>
+
+#include "replicator/replication.hh"
+#include "replicator/serverselector.hh"
+
+/// \namespace replication
+namespace replication {
+
+/// \class AsyncDownloader
+/// \brief Download replication files without blocking a thread per file
+///
+/// Files already in the local cache are read from disk. Downloaded
+/// files are written to the cache when it is enabled. The DNS lookup
+/// and the TLS session are shared with the ConnectionPool for the
+/// server, but the connections themselves belong to the I/O thread.
+///
+/// With a ServerSelector, each file is downloaded from the best
+/// mirror. If it is slow to start answering, the same request is sent
+/// to the next best one and the first answer wins. A failed request
+/// is retried on the next best one straight away.
+class AsyncDownloader {
+  public:
+    typedef std::function<void(RequestedFile)> handler_t;
+
+    /// \a max_in_flight is the maximum number of requests sent to the
+    /// servers at the same time, the rest wait in a queue. Without a
+    /// \a selector, files come from the server in their URL.
+    AsyncDownloader(size_t max_in_flight = 16,
+                    std::shared_ptr<ServerSelector> selector = nullptr);
+    ~AsyncDownloader(void);
+
+    /// Download \a remote, \a handler gets called with the result on
+    /// the I/O thread, so it should not block
+    void fetch(const RemoteURL &remote, handler_t handler);
+
+    /// \struct Connection
+    /// \brief An open connection to a server, owned by the I/O thread
+    struct Connection {
+        Connection(boost::asio::io_context &ioc, boost::asio::ssl::context &ctx)
+            : stream(ioc, ctx) {};
+        boost::beast::ssl_stream<boost::beast::tcp_stream> stream;
+        boost::beast::flat_buffer buffer;
+        std::chrono::steady_clock::time_point last_used;
+    };
+
+  private:
+    class Request;
+    friend class Request;
+
+    /// \struct Download
+    /// \brief A file being downloaded, possibly from several servers
+    struct Download {
+        RemoteURL remote;
+        handler_t handler;
+        std::vector<std::string> servers;   ///< The servers to try, best first
+        size_t started = 0;                 ///< Requests sent so far
+        size_t failed = 0;                  ///< Requests that failed
+        bool done = false;                  ///< The handler has been called
+        RequestedFile last;                 ///< The last failure
+        std::shared_ptr<boost::asio::steady_timer> timer;
+        std::vector<std::weak_ptr<Request>> requests;
+    };
+
+    /// Start the queued requests, as long as there is room
+    void startRequests(void);
+    /// Send the request for \a download to the next server
+    void startAttempt(std::shared_ptr<Download> download);
+    /// Called when one of the requests for \a download is done
+    void onResult(std::shared_ptr<Download> download, const std::string &domain,
+                  RequestedFile file, std::chrono::milliseconds latency);
+    /// Called on the I/O thread when a request is done
+    void finish(std::unique_ptr<Connection> conn, const std::string &domain);
+    /// Get an idle connection to \a domain, if there is one
+    std::unique_ptr<Connection> getIdle(const std::string &domain);
+
+    boost::asio::io_context ioc;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+    std::thread io_thread;
+    Planet cache;                       ///< For reading and writing the cache
+    std::shared_ptr<ServerSelector> selector;
+
+    // These are only used from the I/O thread, so need no locking
+    size_t max_in_flight;
+    size_t in_flight = 0;
+    std::deque<std::pair<RemoteURL, handler_t>> queued;
+    std::map<std::string, std::vector<std::unique_ptr<Connection>>> idle;
+
+    /// Servers drop idle keep-alive connections, so don't bother
+    /// trying to use one that has been idle for longer than this
+    std::chrono::seconds idle_timeout{30};
+    /// Give up on a request if the server doesn't answer in time. This
+    /// is for each read, not for the whole file.
+    std::chrono::seconds request_timeout{60};
+};
+
+} // namespace replication
+
+#endif // EOF __DOWNLOADER_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
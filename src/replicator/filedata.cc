@@ -0,0 +1,83 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+
+#include "replicator/filedata.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace replication {
+
+FileData::~FileData(void)
+{
+    if (mapped) {
+        munmap(mapped, length);
+    }
+}
+
+std::shared_ptr<FileData>
+FileData::mapFile(const std::string &filespec)
+{
+    int fd = open(filespec.c_str(), O_RDONLY);
+    if (fd < 0) {
+        log_error("Couldn't open %1%: %2%", filespec, std::strerror(errno));
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        log_error("Couldn't stat %1%: %2%", filespec, std::strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+    auto file = std::make_shared<FileData>();
+    // An empty file can't be mapped, but it is still a valid file
+    if (st.st_size > 0) {
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            log_error("Couldn't map %1%: %2%", filespec, std::strerror(errno));
+            close(fd);
+            return nullptr;
+        }
+        // The file gets read from start to end by the decompressor
+        madvise(addr, st.st_size, MADV_SEQUENTIAL);
+        file->mapped = addr;
+        file->length = st.st_size;
+    }
+    // The mapping stays valid after the file is closed
+    close(fd);
+    return file;
+}
+
+} // namespace replication
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,81 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __FILEDATA_HH__
+#define __FILEDATA_HH__
+
+/// \file filedata.hh
+/// \brief The contents of a downloaded or cached replication file
+///
+/// The data is either the body of the HTTP response, moved in without
+/// copying it, or a read-only memory map of the file in the disk cache.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <memory>
+#include <string>
+
+/// \namespace replication
+namespace replication {
+
+/// \class FileData
+/// \brief Read-only data of a replication file
+class FileData {
+  public:
+    FileData(void) {};
+    /// Take over the body of an HTTP response
+    FileData(std::string &&body) : buffer(std::move(body)) {};
+    ~FileData(void);
+
+    FileData(const FileData &) = delete;
+    FileData &operator=(const FileData &) = delete;
+
+    /// Memory map a file from the disk cache. Returns nullptr if the
+    /// file can't be opened.
+    static std::shared_ptr<FileData> mapFile(const std::string &filespec);
+
+    const unsigned char *data(void) const {
+        if (mapped) {
+            return static_cast<const unsigned char *>(mapped);
+        }
+        return reinterpret_cast<const unsigned char *>(buffer.data());
+    };
+    size_t size(void) const { return mapped ? length : buffer.size(); };
+    bool empty(void) const { return size() == 0; };
+    const unsigned char *begin(void) const { return data(); };
+    const unsigned char *end(void) const { return data() + size(); };
+    const unsigned char &operator[](size_t index) const { return data()[index]; };
+
+  private:
+    std::string buffer;             ///< The downloaded data
+    void *mapped = nullptr;         ///< The mapped file, if any
+    size_t length = 0;              ///< The size of the mapped file
+};
+
+} // namespace replication
+
+#endif // EOF __FILEDATA_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
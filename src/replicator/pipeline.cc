@@ -0,0 +1,514 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/timer/timer.hpp>
+
+#include "replicator/pipeline.hh"
+#include "replicator/replication.hh"
+#include "osm/osmchange.hh"
+#include "data/pq.hh"
+#include "utils/executor.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+using namespace underpassconfig;
+
+namespace replicatorthreads {
+
+OsmChangePipeline::OsmChangePipeline(std::shared_ptr<replication::RemoteURL> &remote,
+                                     const geoutil::PreparedBoundary &poly,
+                                     const geoutil::RegionSet &regions,
+                                     std::shared_ptr<Validate> plugin,
+                                     std::shared_ptr<Pq> db,
+                                     std::shared_ptr<Pq> osmdb,
+                                     const UnderpassConfig &config)
+    : remote(remote), poly(poly), regions(regions), plugin(plugin), db(db), osmdb(osmdb), config(config)
+{
+    prepareReplicationState(db);
+    prepareReplicationState(osmdb);
+    marks = readHighWaterMarks(db, osmdb, replication::StateFile::freq_to_string(remote->frequency));
+    querystats = std::make_shared<QueryStats>(db);
+    queryvalidate = std::make_shared<QueryValidate>(db);
+    queryraw = std::make_shared<QueryRaw>(osmdb);
+    if (!config.node_locations.empty()) {
+        auto store = std::make_shared<nodelocations::MmapLocations>();
+        if (store->open(config.node_locations)) {
+            locations = store;
+        }
+    }
+
+    // The downloads share the DNS lookup and TLS session with the
+    // connection pool for the server
+    int cores = std::max(1U, config.concurrency);
+    // The files come from the fastest mirror that has them
+    selector = makeSelector(*remote, config);
+    downloader = std::make_shared<replication::AsyncDownloader>(config.downloads, selector);
+    poller = std::make_shared<replication::StatePoller>(*remote);
+
+    // Each queue only holds a few files, so memory use stays flat
+    // when one of the stages is slower than the others.
+    size_t depth = std::max(2, cores);
+    downloaded = std::make_shared<queue_t>(depth);
+    parsed = std::make_shared<queue_t>(depth);
+    merged = parsed;
+    if (config.coalesce > 1) {
+        merged = std::make_shared<queue_t>(depth);
+    }
+    built = std::make_shared<queue_t>(depth);
+    analyzed = std::make_shared<queue_t>(depth);
+
+    // Files are committed in sequence, starting with the one after
+    // the starting point
+    applied = remote->sequence();
+    // Room is needed for a whole group of files to be coalesced
+    max_ahead = depth * 4 + std::max(1U, config.downloads) + config.coalesce;
+}
+
+void
+OsmChangePipeline::run(void)
+{
+#ifdef TIMING_DEBUG
+    boost::timer::auto_cpu_timer timer("OsmChangePipeline::run: took %w seconds\n");
+#endif
+    int cores = std::max(1U, config.concurrency);
+
+    // Downloading is mostly waiting on the network, which is done by
+    // the I/O thread of the downloader
+    startStage(1, [this] { downloadStage(); }, downloaded);
+    // The stages using the CPU run on the executor, so together they
+    // never have more threads than there are cores
+    startTaskStage(std::max(1, cores / 2), [this](PipelineItem &item) { parseFile(item); },
+                   downloaded, parsed, "parse");
+    if (config.coalesce > 1) {
+        startStage(1, [this] { coalesceStage(); }, merged);
+    }
+    startTaskStage(cores, [this](PipelineItem &item) { buildFile(item); },
+                   merged, built, "geometry");
+    startTaskStage(std::max(1, cores / 2), [this](PipelineItem &item) { analyzeFile(item); },
+                   built, analyzed, "analyze");
+    // There is a single apply thread, the database serializes the
+    // writes anyway
+    startStage(1, [this] { applyStage(); }, nullptr);
+
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+    }
+    threads.clear();
+}
+
+void
+OsmChangePipeline::stop(void)
+{
+    std::lock_guard<std::mutex> lock(done_mutex);
+    stopping = true;
+    done_cond.notify_all();
+}
+
+void
+OsmChangePipeline::startStage(int workers, std::function<void()> stage,
+                              std::shared_ptr<queue_t> output)
+{
+    auto running = std::make_shared<std::atomic<int>>(workers);
+    for (int i = 0; i < workers; i++) {
+        threads.push_back(std::thread([stage, output, running] {
+            stage();
+            if (--(*running) == 0 && output) {
+                output->close();
+            }
+        }));
+    }
+}
+
+void
+OsmChangePipeline::startTaskStage(int workers, std::function<void(PipelineItem &)> process,
+                                  std::shared_ptr<queue_t> input, std::shared_ptr<queue_t> output,
+                                  const std::string &subsystem)
+{
+    // The files being worked on, the queue being full is what limits
+    // how many there are
+    typedef std::pair<std::shared_ptr<PipelineItem>, std::future<void>> task_t;
+    auto running = std::make_shared<BoundedQueue<task_t>>(workers);
+
+    // The tasks never wait on a queue, or all the threads of the
+    // executor could end up waiting for a stage that has none left.
+    // These two threads do the waiting instead.
+    threads.push_back(std::thread([process, input, running, subsystem] {
+        std::shared_ptr<PipelineItem> item;
+        while (input->pop(item)) {
+            auto task = std::make_shared<std::packaged_task<void()>>([process, item] { process(*item); });
+            auto done = task->get_future();
+            if (!running->push(task_t(item, std::move(done)))) {
+                // Let the stage before know too
+                input->close();
+                break;
+            }
+            executor::Executor::getDefault().post([task] { (*task)(); }, subsystem);
+        }
+        running->close();
+    }));
+    threads.push_back(std::thread([running, output] {
+        task_t task;
+        bool open = true;
+        while (running->pop(task)) {
+            // An exception from the stage ends up here, like it did in
+            // the stage's own thread
+            task.second.get();
+            if (open && !output->push(task.first)) {
+                // Nothing more is wanted, but the tasks running still
+                // have to finish
+                open = false;
+                running->close();
+            }
+        }
+        if (output) {
+            output->close();
+        }
+    }));
+}
+
+std::shared_ptr<replication::RemoteURL>
+OsmChangePipeline::nextRemote(void)
+{
+    std::lock_guard<std::mutex> lock(remote_mutex);
+    remote->increment();
+    if (!config.silent) {
+        remote->dump();
+    }
+    auto next = std::make_shared<replication::RemoteURL>(remote->getURL());
+    next->destdir_base = remote->destdir_base;
+    return next;
+}
+
+void
+OsmChangePipeline::downloadStage(void)
+{
+    // Files that failed, with the time to ask for them again. Files
+    // are never skipped.
+    std::multimap<std::chrono::steady_clock::time_point, std::shared_ptr<PipelineItem>> retries;
+    // Files not published yet, these are only requested once the
+    // state file says they are there
+    std::map<long, std::shared_ptr<PipelineItem>> waiting;
+    auto next_poll = std::chrono::steady_clock::now();
+    size_t in_flight = 0;
+
+    auto request = [this, &in_flight](std::shared_ptr<PipelineItem> item) {
+        in_flight++;
+        downloader->fetch(*item->remote, [this, item](replication::RequestedFile file) {
+            item->file = file;
+            std::lock_guard<std::mutex> lock(done_mutex);
+            done.push_back(item);
+            done_cond.notify_one();
+        });
+    };
+
+    while (true) {
+        // Once caught up there is no point asking for many files that
+        // don't exist yet
+        size_t window = caught_up ? 2 : std::max(1U, config.downloads);
+        // Don't get too far ahead of the commits, the files after one
+        // that is slow to download have to wait for it
+        long seen_applied = applied;
+        bool blocked = remote->sequence() - seen_applied >= max_ahead;
+        while (!stopping && !blocked && in_flight + retries.size() + waiting.size() < window) {
+            auto item = std::make_shared<PipelineItem>();
+            item->remote = nextRemote();
+            item->task.url = item->remote->subpath;
+            item->task.sequence = item->remote->sequence();
+            blocked = item->task.sequence - seen_applied >= max_ahead;
+            if (caught_up && !poller->isPublished(item->remote->sequence())) {
+                waiting.emplace(item->remote->sequence(), item);
+            } else {
+                request(item);
+            }
+        }
+        auto now = std::chrono::steady_clock::now();
+        while (!stopping && !retries.empty() && retries.begin()->first <= now) {
+            request(retries.begin()->second);
+            retries.erase(retries.begin());
+        }
+        if (!stopping && !waiting.empty() && next_poll <= now) {
+            poller->poll();
+            selector->refresh();
+            while (!waiting.empty() && poller->isPublished(waiting.begin()->first)) {
+                request(waiting.begin()->second);
+                waiting.erase(waiting.begin());
+            }
+            if (!waiting.empty()) {
+                now = std::chrono::steady_clock::now();
+                next_poll = now + poller->nextPoll(waiting.begin()->first);
+            }
+        }
+        // The handlers refer to this stage, so wait for all of them
+        if (in_flight == 0 && (stopping || (retries.empty() && waiting.empty()))) {
+            break;
+        }
+
+        std::shared_ptr<PipelineItem> item;
+        {
+            std::unique_lock<std::mutex> lock(done_mutex);
+            auto until = now + retry_interval;
+            if (!stopping) {
+                if (!retries.empty()) {
+                    until = retries.begin()->first;
+                }
+                if (!waiting.empty() && (retries.empty() || next_poll < until)) {
+                    until = next_poll;
+                }
+            }
+            done_cond.wait_until(lock, until, [this, &in_flight, blocked, seen_applied] {
+                return !done.empty() || (stopping && in_flight == 0) || (blocked && applied != seen_applied);
+            });
+            if (done.empty()) {
+                continue;
+            }
+            item = done.front();
+            done.pop_front();
+        }
+        in_flight--;
+
+        item->task.status = item->file.status;
+        if (item->file.status == replication::success) {
+            if (!downloaded->push(item)) {
+                stop();
+            }
+        } else if (!stopping) {
+            if (item->file.status == replication::remoteNotFound &&
+                !poller->isPublished(item->remote->sequence())) {
+                // Not published yet, so wait for the state file to change
+                waiting.emplace(item->remote->sequence(), item);
+            } else {
+                retries.emplace(std::chrono::steady_clock::now() + retry_interval, item);
+            }
+        }
+    }
+}
+
+void
+OsmChangePipeline::parseFile(PipelineItem &item)
+{
+    item.osmchanges = parseOsmChange(*item.remote, item.file, item.task, config);
+    item.osmchanges->locations = locations;
+    // The compressed data isn't needed anymore
+    item.file.data.reset();
+}
+
+void
+OsmChangePipeline::coalesceStage(void)
+{
+    Coalescer coalescer(applied + 1, config.coalesce, config.end_time);
+    std::shared_ptr<PipelineItem> item;
+    bool open = true;
+    while (open && parsed->pop(item)) {
+        auto groups = coalescer.add(item, caught_up);
+        for (auto it = std::begin(groups); open && it != std::end(groups); ++it) {
+            open = merged->push(*it);
+        }
+    }
+    if (open && (item = coalescer.finish())) {
+        merged->push(item);
+    }
+    if (coalescer.waiting() > 0) {
+        log_error("%1% files were not coalesced, sequence %2% never arrived",
+                  coalescer.waiting(), coalescer.missing());
+    }
+}
+
+void
+OsmChangePipeline::buildFile(PipelineItem &item)
+{
+    buildOsmChangeGeometries(item.osmchanges, poly, regions, queryraw, config);
+}
+
+void
+OsmChangePipeline::analyzeFile(PipelineItem &item)
+{
+    analyzeOsmChange(item.osmchanges, poly, plugin, querystats,
+                     queryvalidate, queryraw, config, item.task);
+    // The node locations are only updated once the file is
+    // committed, a later file may be built before that
+    if (locations) {
+        for (auto it = std::begin(item.osmchanges->changes); it != std::end(item.osmchanges->changes); ++it) {
+            auto &nodes = it->get()->nodes;
+            for (auto nit = std::begin(nodes); nit != std::end(nodes); ++nit) {
+                auto node = &*nit;
+                if (node->action == osmobjects::remove) {
+                    item.nodes.emplace_back(node->id, std::nullopt);
+                } else {
+                    item.nodes.emplace_back(node->id, node->point);
+                }
+            }
+        }
+    }
+    // Only the queries are needed from now on
+    item.osmchanges.reset();
+}
+
+void
+OsmChangePipeline::applyStage(void)
+{
+    std::string frequency = replication::StateFile::freq_to_string(remote->frequency);
+    // The files get analyzed in parallel, so they arrive in any order,
+    // but they are committed strictly in sequence
+    ReorderBuffer<std::shared_ptr<PipelineItem>> pending(applied + 1);
+    std::shared_ptr<PipelineItem> item;
+    long failed = -1;
+    while (analyzed->pop(item)) {
+        if (failed >= 0) {
+            // Nothing after a file that couldn't be committed can be,
+            // just let the other stages drain
+            continue;
+        }
+        pending.insert(item->task.sequence - item->count + 1, item, item->count);
+        while (pending.pop(item)) {
+            // Each file, or group of coalesced files, has its own
+            // transaction, so the high-water mark always matches what
+            // is in the database. A file that fails is retried, as
+            // skipping it would leave a gap.
+            bool committed = applyTask(item->task, frequency, db, osmdb, marks);
+            while (!committed && !stopping) {
+                log_error("Retrying sequence %1% in %2% seconds", item->task.sequence, retry_interval.count());
+                {
+                    std::unique_lock<std::mutex> lock(done_mutex);
+                    done_cond.wait_for(lock, retry_interval, [this] { return stopping.load(); });
+                }
+                committed = applyTask(item->task, frequency, db, osmdb, marks);
+            }
+            if (!committed) {
+                failed = item->task.sequence;
+                break;
+            }
+            for (auto it = std::begin(item->nodes); it != std::end(item->nodes); ++it) {
+                if (it->second) {
+                    locations->set(it->first, *it->second);
+                } else {
+                    locations->remove(it->first);
+                }
+            }
+            item->nodes.clear();
+            {
+                std::lock_guard<std::mutex> lock(done_mutex);
+                applied = item->task.sequence;
+                done_cond.notify_all();
+            }
+
+            ptime timestamp = item->task.timestamp;
+            if (timestamp == not_a_date_time) {
+                continue;
+            }
+            if (config.end_time != not_a_date_time && timestamp >= config.end_time) {
+                log_debug("Reached end time with: %1%", item->task.url);
+                stop();
+            }
+            // Check if caught up with now
+            if (!caught_up && isRecent(timestamp)) {
+                caught_up = true;
+                log_debug("Caught up with: %1%", item->task.url);
+            }
+        }
+    }
+    if (failed >= 0) {
+        log_error("Stopped before sequence %1% could be committed", failed);
+    } else if (!pending.empty()) {
+        log_error("%1% files were not committed, sequence %2% never arrived",
+                  pending.size(), pending.getNext());
+    }
+}
+
+std::vector<std::shared_ptr<PipelineItem>>
+Coalescer::add(std::shared_ptr<PipelineItem> item, bool hurry)
+{
+    std::vector<std::shared_ptr<PipelineItem>> groups;
+    pending.insert(item->task.sequence, item);
+    while (pending.pop(item)) {
+        if (!group) {
+            group = item;
+        } else {
+            group->osmchanges->append(*item->osmchanges);
+            group->remote = item->remote;
+            group->task.url = item->task.url;
+            group->task.sequence = item->task.sequence;
+            if (item->task.timestamp != not_a_date_time) {
+                group->task.timestamp = item->task.timestamp;
+            }
+            group->count++;
+        }
+        // The files close to now are applied as soon as they arrive,
+        // waiting for more would only add latency
+        ptime timestamp = group->task.timestamp;
+        if (group->count >= limit || hurry || isRecent(timestamp) ||
+            (end_time != not_a_date_time && timestamp != not_a_date_time && timestamp >= end_time)) {
+            groups.push_back(close());
+        }
+    }
+    return groups;
+}
+
+std::shared_ptr<PipelineItem>
+Coalescer::finish(void)
+{
+    if (!group) {
+        return nullptr;
+    }
+    return close();
+}
+
+std::shared_ptr<PipelineItem>
+Coalescer::close(void)
+{
+    auto done = group;
+    group.reset();
+    if (done->count > 1) {
+        log_debug("Coalesced %1% files up to %2%", done->count, done->task.url);
+        done->osmchanges->coalesce();
+    }
+    return done;
+}
+
+bool
+isRecent(ptime timestamp)
+{
+    if (timestamp == not_a_date_time) {
+        return false;
+    }
+    ptime now = boost::posix_time::second_clock::universal_time();
+    boost::posix_time::time_duration delta_closest = now - timestamp;
+    return delta_closest.hours() * 60 + delta_closest.minutes() <= 2;
+}
+
+} // namespace replicatorthreads
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,229 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __PIPELINE_HH__
+#define __PIPELINE_HH__
+
+/// \file pipeline.hh
+/// \brief A staged pipeline for processing osmChange replication files
+///
+/// Each replication file goes through these stages, each one running
+/// in its own set of threads and connected to the next one by a
+/// bounded queue:
+///         - download from the planet server, many files at once
+///         - decompress and parse the XML
+///         - when catching up, merge several files into one
+///         - build the geometries and filter by the priority area
+///         - collect statistics, raw data and validation queries
+///         - apply the queries to the database, strictly in sequence
+/// This way the network, the CPU and the database are kept busy at
+/// the same time, and a slow file only delays itself.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "osm/nodelocations.hh"
+#include "replicator/threads.hh"
+#include "replicator/downloader.hh"
+#include "replicator/statepoller.hh"
+#include "utils/boundedqueue.hh"
+#include "utils/reorderbuffer.hh"
+
+namespace replicatorthreads {
+
+/// \struct PipelineItem
+/// \brief The data for a replication file as it moves along
+struct PipelineItem {
+    std::shared_ptr<replication::RemoteURL> remote;
+    replication::RequestedFile file;
+    std::shared_ptr<osmchange::OsmChangeFile> osmchanges;
+    ReplicationTask task;
+    /// The number of files merged into this one, the sequence of
+    /// the task is the one of the last file
+    long count = 1;
+    /// The nodes of the file, kept for updating the node
+    /// locations once it is committed. A removed node has no
+    /// location.
+    std::vector<std::pair<long, std::optional<point_t>>> nodes;
+};
+
+/// True if \a timestamp is within a few minutes of now
+bool isRecent(ptime timestamp);
+
+/// \class Coalescer
+/// \brief Merge consecutive replication files into groups
+///
+/// The files are parsed in parallel, so they arrive in any order.
+/// They are put back in sequence first, as only consecutive files
+/// can be merged.
+class Coalescer {
+  public:
+    /// \a next is the first sequence expected, and a group has at
+    /// most \a limit files. A group is also closed once it reaches
+    /// \a end_time, so no more than needed gets applied.
+    Coalescer(long next, long limit, ptime end_time = not_a_date_time)
+        : pending(next), limit(limit), end_time(end_time) {};
+
+    /// Add a parsed file. If \a hurry is set, the group is closed
+    /// right away, when caught up waiting for more files only adds
+    /// latency. Returns the groups that are complete, in sequence.
+    std::vector<std::shared_ptr<PipelineItem>> add(std::shared_ptr<PipelineItem> item, bool hurry = false);
+
+    /// Close the group still open once there are no more files,
+    /// returns nullptr if there is none
+    std::shared_ptr<PipelineItem> finish(void);
+
+    /// The number of files waiting for an earlier one
+    size_t waiting(void) const { return pending.size(); };
+    /// The sequence the files waiting are held up by
+    long missing(void) const { return pending.getNext(); };
+
+  private:
+    /// Merge the versions of the objects in the group
+    std::shared_ptr<PipelineItem> close(void);
+
+    ReorderBuffer<std::shared_ptr<PipelineItem>> pending;
+    std::shared_ptr<PipelineItem> group;
+    long limit;
+    ptime end_time;
+};
+
+/// \class OsmChangePipeline
+/// \brief Download and apply osmChange files continuously
+class OsmChangePipeline {
+  public:
+    OsmChangePipeline(std::shared_ptr<replication::RemoteURL> &remote,
+                      const geoutil::PreparedBoundary &poly,
+                      const geoutil::RegionSet &regions,
+                      std::shared_ptr<Validate> plugin,
+                      std::shared_ptr<Pq> db,
+                      std::shared_ptr<Pq> osmdb,
+                      const underpassconfig::UnderpassConfig &config);
+
+    /// Start all the stages, and block until the pipeline has
+    /// been stopped and drained
+    void run(void);
+
+    /// Stop downloading new files. Files already in the pipeline
+    /// are still processed and applied.
+    void stop(void);
+
+    /// True once the files being applied are close to the current time
+    bool caughtUp(void) const { return caught_up; };
+
+    /// The last sequence committed to the database
+    long lastApplied(void) const { return applied; };
+
+  private:
+    typedef BoundedQueue<std::shared_ptr<PipelineItem>> queue_t;
+
+    /// Start \a workers threads running \a stage. When the last one
+    /// exits the \a output queue gets closed, which shuts down the
+    /// next stage once it has drained it.
+    void startStage(int workers, std::function<void()> stage,
+                    std::shared_ptr<queue_t> output);
+    /// Run \a process on each file from \a input as a task of the
+    /// executor, with up to \a workers at once, and pass the files on
+    /// to \a output in the order they came in. The stages doing the
+    /// work this way share the cores with the rest of the process,
+    /// rather than each having its own threads.
+    void startTaskStage(int workers, std::function<void(PipelineItem &)> process,
+                        std::shared_ptr<queue_t> input, std::shared_ptr<queue_t> output,
+                        const std::string &subsystem);
+
+    /// Get the URL of the next replication file to download
+    std::shared_ptr<replication::RemoteURL> nextRemote(void);
+
+    /// Keep the downloader busy, and pass on the files as they arrive
+    void downloadStage(void);
+    void parseFile(PipelineItem &item);
+    /// Merge consecutive files, so an object edited many times is
+    /// only processed once
+    void coalesceStage(void);
+    void buildFile(PipelineItem &item);
+    void analyzeFile(PipelineItem &item);
+    void applyStage(void);
+
+    std::shared_ptr<replication::RemoteURL> remote;
+    std::mutex remote_mutex;
+    const geoutil::PreparedBoundary &poly;
+    const geoutil::RegionSet &regions;
+    std::shared_ptr<Validate> plugin;
+    std::shared_ptr<Pq> db;
+    std::shared_ptr<Pq> osmdb;
+    std::shared_ptr<QueryStats> querystats;
+    std::shared_ptr<QueryValidate> queryvalidate;
+    std::shared_ptr<QueryRaw> queryraw;
+    /// The node locations kept across files, if enabled
+    std::shared_ptr<nodelocations::NodeLocationStore> locations;
+    const underpassconfig::UnderpassConfig &config;
+    std::shared_ptr<replication::ServerSelector> selector;
+    std::shared_ptr<replication::AsyncDownloader> downloader;
+    /// Tells when the next file has been published
+    std::shared_ptr<replication::StatePoller> poller;
+
+    std::shared_ptr<queue_t> downloaded;
+    std::shared_ptr<queue_t> parsed;
+    /// The input of the geometry stage, the same as parsed unless
+    /// the files get coalesced
+    std::shared_ptr<queue_t> merged;
+    std::shared_ptr<queue_t> built;
+    std::shared_ptr<queue_t> analyzed;
+
+    std::vector<std::thread> threads;
+    // The downloads completed by the I/O thread
+    std::mutex done_mutex;
+    std::condition_variable done_cond;
+    std::deque<std::shared_ptr<PipelineItem>> done;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> caught_up{false};
+    /// The last sequence committed to the database
+    std::atomic<long> applied{-1};
+    /// The last sequence committed to each database, only used by the
+    /// apply stage
+    HighWaterMarks marks;
+    /// How many sequences the downloads can get ahead of the commits
+    long max_ahead = 0;
+
+    /// How long to wait before retrying after a failed download
+    std::chrono::seconds retry_interval{5};
+};
+
+} // namespace replicatorthreads
+
+#endif // EOF __PIPELINE_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
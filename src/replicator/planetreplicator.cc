@@ -38,6 +38,7 @@
 #include <vector>
 
 #include "replicator/planetreplicator.hh"
+#include "replicator/stateresolver.hh"
 #include "boost/date_time/posix_time/posix_time.hpp"
 #include <boost/date_time.hpp>
 using namespace boost::posix_time;
@@ -100,89 +101,28 @@ operator<<(std::ostream &os, const std::vector<T> &v)
 PlanetReplicator::PlanetReplicator(void) {};
 
 std::shared_ptr<RemoteURL> PlanetReplicator::findRemotePath(const underpassconfig::UnderpassConfig &config, ptime time) {
-    yaml::Yaml yaml;
-
-    std::string rep_file = ETCDIR;
-    rep_file += "/replicator/planetreplicator.yaml";
-    yaml.read(rep_file);
-    std::map<int, ptime> hashes;
-
-    yaml::Node hashes_config;
-
-    if (config.frequency == replication::minutely) {
-        hashes_config = yaml.get("minute");
-    } else {
-        hashes_config = yaml.get("changeset");
-    }
-    for (auto it = hashes_config.children.begin(); it != hashes_config.children.end(); ++it) {
-        hashes.insert(
-            std::make_pair(
-                    stoi(it->value),
-                    time_from_string(it->children[0].value)
-            )
-        );
-    }
-
-    boost::posix_time::time_duration delta;
-    std::pair<int, ptime> closest_prev;
-    std::pair<int, ptime> closest_next;
-    auto it = hashes.begin();
-    for (; it != hashes.end(); ++it) {
-        delta = config.start_time - it->second;
-        if (delta.total_seconds() < 0) {
-            break;
-        }
-    }
-
-    closest_next = *it;
-    closest_prev = *(--it);
-    delta = closest_next.second - closest_prev.second;
-
-    if (delta.total_seconds() < 0) {
-        closest_next = closest_prev;
-        closest_prev = *(std::prev(hashes.end(), 2));
-        delta = closest_next.second - closest_prev.second;
+    std::string cached = config.datadir + StateFile::freq_to_string(config.frequency);
+    std::string baseurl = "https://" + config.planet_server + "/" + cached;
+
+    // Search the state files on the server for the exact sequence
+    replication::StateResolver resolver(baseurl, config.destdir_base);
+    long sequence = resolver.resolve(time);
+    if (sequence < 0) {
+        log_error("Couldn't find the replication file for %1%", to_simple_string(time));
+        return nullptr;
     }
 
-    double ratio = (delta.total_seconds() / 60.0) / (closest_next.first - closest_prev.first);
-
-    boost::posix_time::time_duration delta_target = config.start_time - closest_prev.second;
-    int target_int = closest_prev.first + (delta_target.total_seconds() / 60.0 / ratio);
-
-    double n = target_int/1000000.0;
-    double major = floor(n);
-    double decimal = n - major;
-
-    double n2 = decimal * 1000;
-    double minor = floor(n2);
-    double index = (n2 - minor) * 1000;
-
-    boost::format majorfmt("%03d");
-    boost::format minorfmt("%03d");
-    boost::format indexfmt("%03d");
-
-    majorfmt % (major);
-    minorfmt % (minor);
-    indexfmt % (index);
-
-    std::string path = majorfmt.str() + "/" + minorfmt.str() + "/" + indexfmt.str();
-
     std::string suffix;
-    std::string fullurl;
-    std::string cached = config.datadir + StateFile::freq_to_string(config.frequency);
-
-    if (config.frequency == replication::minutely) {
-        suffix = ".osc.gz";
-    } else {
+    if (config.frequency == replication::changeset) {
         suffix = ".osm.gz";
+    } else {
+        suffix = ".osc.gz";
     }
 
     connectServer("https://" + config.planet_server);
     auto remote = std::make_shared<RemoteURL>();
-    cached += "/" + path + suffix;
-    fullurl = "https://" + config.planet_server + "/" + cached;
-    remote->parse(fullurl);
-    remote->updatePath(major, minor, index);
+    remote->parse(baseurl + "/" + replication::StateResolver::sequenceToPath(sequence) + suffix);
+    remote->updatePath(sequence / 1000000, (sequence / 1000) % 1000, sequence % 1000);
     return remote;
 };
 
@@ -78,6 +78,7 @@ using tcp = net::ip::tcp;         // from <boost/asio/ip/tcp.hpp>
 
 #include "osm/changeset.hh"
 #include "replicator/replication.hh"
+#include "replicator/connectionpool.hh"
 
 /// Control access to the database connection
 std::mutex db_mutex;
@@ -263,7 +264,7 @@ Planet::getLinks(GumboNode *node, std::shared_ptr<std::vector<std::string>> &lin
 }
 
 std::istringstream
-Planet::processData(const std::string &dest, std::vector<unsigned char> &data)
+Planet::processData(const std::string &dest, const FileData &data)
 {
     std::istringstream xml;
     try {
@@ -301,96 +302,40 @@ Planet::downloadFile(const std::string &url, const std::string &destdir_base)
         return file;
     }
 
-    file.data = std::make_shared<std::vector<unsigned char>>();
+    file.data = std::make_shared<FileData>();
 
-    // The io_context is required for all I/O
-    boost::asio::io_context ioc;
-
-    // The SSL context is required, and holds certificates
-    ssl::context ctx{ssl::context::sslv23_client};
-
-    // Verify the remote server's certificate
-    ctx.set_verify_mode(ssl::verify_none);
-
-    // These objects perform our I/O
-    tcp::resolver resolver{ioc};
-    ssl::stream<tcp::socket> stream{ioc, ctx};
-
-    // Look up the domain name
-    auto const results = resolver.resolve(remote.domain, std::to_string(port));
-    try {
-        // Make the connection on the IP address we get from a lookup
-        boost::asio::connect(stream.next_layer(), results.begin(), results.end());
-        // Perform the SSL handshake
-        stream.handshake(ssl::stream_base::client);
-    } catch (boost::system::system_error ex) {
-        log_error("stream write failed: %1%", ex.what());
+    // Reuse a connection to the server if there is one
+    auto pool = ConnectionPool::getPool(remote.domain, port);
+    std::string target = url;
+    auto pos = target.find(pool->getDomain());
+    if (pos != std::string::npos) {
+        target = target.substr(pos + pool->getDomain().size());
+    }
+    ConnectionPool::response_t response;
+    if (!pool->get(target, response)) {
         file.status = reqfile_t::systemError;
         return file;
     }
 
-    // Set up an HTTP GET request message
-    http::request<http::string_body> req{http::verb::get, url, version};
-
-    req.keep_alive();
-
-    // We want the host only: strip the rest
-    static const std::regex re(R"raw(^(?:https?://)?([^/]+).*)raw");
-    std::string host{remote.domain};
-    host = std::regex_replace(host, re, "$1");
-
-    req.set(http::field::host, host);
-    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
-    // Send the HTTP request to the remote host
-    try {
-        http::write(stream, req);
-        // log_debug("Downloading %1% ... ", url);
-    } catch (boost::system::system_error ex) {
-        log_error("stream write failed: %1%", ex.what());
-        file.status = reqfile_t::systemError;
+    if (response.result() == boost::beast::http::status::not_found ||
+        response.result() == boost::beast::http::status::gateway_timeout) {
+        log_error("Remote file not found: %1%", url);
+        file.status = reqfile_t::remoteNotFound;
         return file;
     }
 
-    // This buffer is used for reading and must be persistant
-    boost::beast::flat_buffer buffer;
+    auto &body = response.body();
+    if (body.size() > 0) {
+        // Check the magic number of the file
+        const auto is_gzipped{body[0] == 0x1f};
 
-    // Receive the HTTP response
-    http::response_parser<http::string_body> parser;
-
-    try {
-        read(stream, buffer, parser);
-
-        if (parser.get().result() == boost::beast::http::status::not_found ||
-            parser.get().result() == boost::beast::http::status::gateway_timeout) {
-            log_error("Remote file not found: %1%", url);
-            file.status = reqfile_t::remoteNotFound;
-            return file;
-        } else {
-            // Check the magic number of the file
-            const auto is_gzipped{parser.get().body()[0] == 0x1f};
-            std::shared_ptr<std::vector<unsigned char>> data;
-            for (auto body = std::begin(parser.get().body()); body != std::end(parser.get().body()); ++body) {
-                file.data->push_back(static_cast<unsigned char>(*body));
-            }
-
-            // Add the last newline back if not gzipped (or we'll get decompression error: unexpected end of file)
-            if (!is_gzipped) {
-                file.data->push_back('\n');
-            }
+        // Add the last newline back if not gzipped (or we'll get decompression error: unexpected end of file)
+        if (!is_gzipped) {
+            body.push_back('\n');
         }
-
-    } catch (boost::system::system_error ex) {
-        log_error("stream read failed: %1%", ex.what());
-    }
-
-    // Gracefully close the stream
-    beast::error_code ec;
-    stream.shutdown(ec);
-    if (ec == net::error::eof) {
-        // Rationale:
-        // http://stackoverflow.com/questions/25587403/boost-asio-ssl-async-shutdown-always-finishes-with-an-error
-        ec = {};
     }
+    // The body is moved, not copied
+    file.data = std::make_shared<FileData>(std::move(body));
 
 #ifdef USE_CACHE
     if (file.data->size() > 0) {
@@ -407,34 +352,20 @@ RequestedFile
 Planet::readFile(std::string &filespec) {
     log_debug("Reading cached file: %1%", filespec);
     // Since we want to read in the entire file so it can be
-    // decompressed, blow off C++ streaming and just load the
-    // entire thing.
-    int size = 0;
+    // decompressed, map it into memory, which doesn't need a copy.
     RequestedFile file;
-    file.data = std::make_shared<std::vector<unsigned char>>();
-    try {
-        size = boost::filesystem::file_size(filespec);
-    } catch (const std::exception &ex) {
-        log_error("File %1% doesn't exist but should!: %2%", filespec, ex.what());
+    file.data = FileData::mapFile(filespec);
+    if (!file.data) {
+        log_error("File %1% doesn't exist but should!", filespec);
+        file.data = std::make_shared<FileData>();
         file.status = reqfile_t::localError;
         return file;
     }
-
-    file.data->reserve(size);
-    file.data->resize(size);
-    int fd = open(filespec.c_str(), O_RDONLY);
-    char *buf = new char[size];
-    //memset(buf, 0, size);
-    read(fd, buf, size);
-    // FIXME: it would be nice to avoid this copy
-    std::copy(buf, buf + size, file.data->begin());
-    delete buf;
-    close(fd);
     file.status = reqfile_t::success;
     return file;
 }
 
-void Planet::writeFile(RemoteURL &remote, std::shared_ptr<std::vector<unsigned char>> data) {
+void Planet::writeFile(RemoteURL &remote, std::shared_ptr<FileData> data) {
     std::string local_file_path = remote.destdir_base + remote.destdir;
     try {
         if (!boost::filesystem::exists(local_file_path)) {
@@ -445,7 +376,7 @@ void Planet::writeFile(RemoteURL &remote, std::shared_ptr<std::vector<unsigned c
     }
     std::ofstream myfile;
     myfile.open(remote.destdir_base + remote.filespec, std::ofstream::out | std::ios::binary);
-    myfile.write(reinterpret_cast<char *>(data.get()->data()), data.get()->size());
+    myfile.write(reinterpret_cast<const char *>(data->data()), data->size());
     myfile.flush();
     myfile.close();
     log_debug("Wrote downloaded file %1% to disk from %2%", remote.destdir_base + remote.filespec, remote.domain);
@@ -453,8 +384,6 @@ void Planet::writeFile(RemoteURL &remote, std::shared_ptr<std::vector<unsigned c
 
 Planet::~Planet(void)
 {
-    ioc.reset(); // reset the I/O conhtext
-    // stream.shutdown();          // shutdown the socket used by the stream
 }
 
 Planet::Planet(void){
@@ -491,42 +420,11 @@ Planet::dump(void)
 bool
 Planet::connectServer(const std::string &planet)
 {
-    // Gracefully close the socket
-    boost::system::error_code ec;
-    ioc.reset();
-    ctx.set_verify_mode(ssl::verify_none);
-    // Strip off the https part
-    std::string tmp;
-    auto pos = planet.find(":");
-    if (pos != std::string::npos) {
-        tmp = planet.substr(pos + 3);
-    } else {
-        tmp = planet;
-    }
-    ssl::context ctx{ssl::context::sslv23_client};
-    boost::asio::io_context ioc;
-
-    try {
-        tcp::resolver resolver{ioc};
-        auto const dns = resolver.resolve(tmp, std::to_string(port));
-        boost::asio::connect(stream.next_layer(), dns.begin(), dns.end(), ec);
-        if (ec) {
-            log_error("stream connect failed %1%", ec.message());
-            return false;
-        }
-        stream.handshake(ssl::stream_base::client, ec);
-        if (ec) {
-            log_error("stream handshake failed %1%", ec.message());
-            return false;
-        }
-    } catch (const std::exception &ex) {
-        log_error("Connection to %1% failed: %2%", tmp, ex.what());
+    // The connection is kept in the pool for the next download
+    pool = ConnectionPool::getPool(planet, port);
+    if (!pool->connect()) {
         return false;
     }
-
-    // Verify the remote server's certificate
-    ctx.set_verify_mode(ssl::verify_none);
-
     domain = planet;
     return true;
 }
@@ -539,63 +437,23 @@ Planet::scanDirectory(const std::string &dir)
     RemoteURL remote(dir);
     log_debug("Scanning remote Directory: %1%", dir);
 
-    // The io_context is required for all I/O
-    boost::asio::io_context ioc;
-
-    // The SSL context is required, and holds certificates
-    ssl::context ctx{ssl::context::sslv23_client};
-
-    // Verify the remote server's certificate
-    ctx.set_verify_mode(ssl::verify_none);
-
-    // These objects perform our I/O
-    tcp::resolver resolver{ioc};
-    ssl::stream<tcp::socket> stream{ioc, ctx};
-
-    // Look up the domain name
-    auto const results = resolver.resolve(remote.domain, std::to_string(port));
-
-    // Make the connection on the IP address we get from a lookup
-    boost::asio::connect(stream.next_layer(), results.begin(), results.end());
-
-    // Perform the SSL handshake
-    stream.handshake(ssl::stream_base::client);
-
     auto links = std::make_shared<std::vector<std::string>>();
-
-    // Set up an HTTP GET request message
-    http::request<http::string_body> req{http::verb::get, dir, version};
-    req.set(http::field::host, remote.domain);
-    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
-
-    // Send the HTTP request to the remote host
-    http::write(stream, req);
-
-    // This buffer is used for reading and must be persistant
-    boost::beast::flat_buffer buffer;
-
-    // Receive the HTTP response
-    http::response_parser<http::string_body> parser;
-    // read_header(stream, buffer, parser);
-    http::read(stream, buffer, parser);
-    if (parser.get().result() == boost::beast::http::status::not_found) {
+    auto dirpool = ConnectionPool::getPool(remote.domain, port);
+    std::string target = dir;
+    auto pos = target.find(dirpool->getDomain());
+    if (pos != std::string::npos) {
+        target = target.substr(pos + dirpool->getDomain().size());
+    }
+    ConnectionPool::response_t response;
+    if (!dirpool->get(target, response)) {
+        return links;
+    }
+    if (response.result() == boost::beast::http::status::not_found) {
         return links;
     }
-    GumboOutput *output = gumbo_parse(parser.get().body().c_str());
+    GumboOutput *output = gumbo_parse(response.body().c_str());
     getLinks(output->root, links);
     gumbo_destroy_output(&kGumboDefaultOptions, output);
-
-    // Gracefully close the stream
-    boost::beast::error_code ec;
-    stream.shutdown(ec);
-    if (ec == net::error::eof) {
-        // Rationale:
-        // http://stackoverflow.com/questions/25587403/boost-asio-ssl-async-shutdown-always-finishes-with-an-error
-        ec = {};
-    }
-    if (ec) {
-        log_debug("stream shutdown failed: %1%", ec.message());
-    }
     return links;
 }
 
@@ -62,6 +62,8 @@ namespace ssl = boost::asio::ssl; // from <boost/asio/ssl.hpp>
 using boost::format;
 
 #include "osm/changeset.hh"
+#include "replicator/connectionpool.hh"
+#include "replicator/filedata.hh"
 
 namespace net = boost::asio;      // from <boost/asio.hpp>
 namespace ssl = boost::asio::ssl; // from <boost/asio/ssl.hpp>
@@ -118,6 +120,8 @@ class StateFile {
     StateFile(const std::string &file, bool memory);
     StateFile(const std::vector<unsigned char> &data)
         : StateFile(reinterpret_cast<const char *>(data.data()), true){};
+    StateFile(const FileData &data)
+        : StateFile(std::string(reinterpret_cast<const char *>(data.data()), data.size()), true){};
 
     inline bool operator==(const StateFile &other) const
     {
@@ -250,7 +254,7 @@ typedef enum {
 /// \class RequestedFile
 /// \brief Represents a requested file that could be downloaded or read from cache
 struct RequestedFile {
-    std::shared_ptr<std::vector<unsigned char>> data;
+    std::shared_ptr<FileData> data;
     reqfile_t status = reqfile_t::none;
 };
 
@@ -269,16 +273,18 @@ class Planet {
     /// Disconnect from the planet server
     bool disconnectServer(void)
     {
-        // db->disconnect();           // close the database connection
-        // db->close();                // close the database connection
-        ioc.reset();       // reset the I/O conhtext
-        stream.shutdown(); // shutdown the socket used by the stream
-        // FIXME: this should return a real value
-        return false;
+        // The pool is shared with the other Planets using the same
+        // server, so only drop the idle connections
+        if (pool) {
+            pool->closeIdle();
+        }
+        return true;
     }
 
-    /// Process the downloaded file, which require decompressing it
-    std::istringstream processData(const std::string &dest, std::vector<unsigned char> &data);
+    /// Process the downloaded file, which require decompressing it.
+    /// This holds the whole uncompressed file in memory, the readXML()
+    /// methods that take a buffer parse it a chunk at a time instead.
+    std::istringstream processData(const std::string &dest, const FileData &data);
 
     /// \brief downloadFile downloads a file from planet
     /// \param file the full URL or the path part of the URL (such as:
@@ -299,7 +305,7 @@ class Planet {
     /// \param remote RemoteURL object, which has destination directory and filename
     /// \param data File data
     /// \return void
-    void writeFile(RemoteURL &remote, std::shared_ptr<std::vector<unsigned char>> data);
+    void writeFile(RemoteURL &remote, std::shared_ptr<FileData> data);
 
     /// Dump internal data to the terminal, used only for debugging
     void dump(void);
@@ -316,11 +322,9 @@ class Planet {
     int version = 11; ///< HTTP version
     std::string domain; ///< The domain used for this network connection
 
-    // These are for the boost::asio data stream
-    boost::asio::io_context ioc;
-    // boost::asio::ip::basic_resolver_results<boost::asio::ip::tcp> dns;
-    ssl::context ctx{ssl::context::sslv23_client};
-    boost::asio::ssl::stream<tcp::socket> stream{ioc, ctx};
+    /// The keep-alive connections to the server, shared by all the
+    /// Planets using the same server
+    std::shared_ptr<ConnectionPool> pool;
 };
 
 /// \class Replication
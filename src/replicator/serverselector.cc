@@ -0,0 +1,228 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+#include "replicator/serverselector.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace replication {
+
+ServerSelector::ServerSelector(const RemoteURL &remote)
+    : remote(remote)
+{
+    addServer(remote.domain, remote.datadir);
+}
+
+void
+ServerSelector::addServer(const std::string &domain, const std::string &datadir)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = servers.begin(); it != servers.end(); ++it) {
+        if (it->domain == domain) {
+            return;
+        }
+    }
+    Server server;
+    server.domain = domain;
+    server.datadir = datadir;
+    RemoteURL mirror(remote);
+    mirror.domain = domain;
+    mirror.datadir = datadir;
+    server.poller = std::make_shared<StatePoller>(mirror);
+    servers.push_back(server);
+}
+
+ServerSelector::Server *
+ServerSelector::find(const std::string &domain)
+{
+    for (auto it = servers.begin(); it != servers.end(); ++it) {
+        if (it->domain == domain) {
+            return &(*it);
+        }
+    }
+    return nullptr;
+}
+
+std::vector<std::string>
+ServerSelector::select(long sequence, size_t count)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+    long freshest = -1;
+    for (auto it = servers.begin(); it != servers.end(); ++it) {
+        freshest = std::max(freshest, it->latest);
+    }
+
+    // A server not used yet gets tried first, so its latency is known.
+    // One that never worked has no latency, so it goes after the ones
+    // that do, by its error rate.
+    typedef std::pair<int, double> rank_t;
+    auto rank = [](const Server &server) {
+        if (server.latency > 0) {
+            return rank_t(1, server.latency * (1 + 10 * server.error_rate));
+        }
+        return rank_t(server.error_rate > 0 ? 2 : 0, server.error_rate);
+    };
+    std::vector<std::pair<rank_t, std::string>> ranked;
+    for (auto it = servers.begin(); it != servers.end(); ++it) {
+        if (now < it->retry_after) {
+            continue;
+        }
+        if (it->latest >= 0 && (sequence > it->latest || freshest - it->latest > max_lag)) {
+            continue;
+        }
+        ranked.emplace_back(rank(*it), it->domain);
+    }
+    // Better a bad server than none at all
+    if (ranked.empty()) {
+        for (auto it = servers.begin(); it != servers.end(); ++it) {
+            ranked.emplace_back(rank(*it), it->domain);
+        }
+    }
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [](const std::pair<rank_t, std::string> &a, const std::pair<rank_t, std::string> &b) {
+                         return a.first < b.first;
+                     });
+
+    std::vector<std::string> result;
+    for (auto it = ranked.begin(); it != ranked.end() && result.size() < count; ++it) {
+        result.push_back(it->second);
+    }
+    return result;
+}
+
+std::string
+ServerSelector::getTarget(const std::string &domain, const RemoteURL &file)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto server = find(domain);
+    // The filespec starts with the data directory of the original server
+    std::string path = file.filespec;
+    if (server && path.compare(0, file.datadir.size(), file.datadir) == 0) {
+        path = server->datadir + path.substr(file.datadir.size());
+    }
+    return "/" + path;
+}
+
+void
+ServerSelector::report(const std::string &domain, long sequence, reqfile_t status,
+                       std::chrono::milliseconds latency)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto server = find(domain);
+    if (!server) {
+        return;
+    }
+    switch (status) {
+      case reqfile_t::success:
+          if (server->latency == 0) {
+              server->latency = latency.count();
+          } else {
+              server->latency = alpha * latency.count() + (1 - alpha) * server->latency;
+          }
+          server->error_rate *= 1 - alpha;
+          server->failures = 0;
+          server->latest = std::max(server->latest, sequence);
+          break;
+      case reqfile_t::remoteNotFound:
+          // Not an error, the server doesn't have it yet
+          if (server->latest < 0 || server->latest >= sequence) {
+              server->latest = sequence - 1;
+          }
+          break;
+      default:
+          server->error_rate = alpha + (1 - alpha) * server->error_rate;
+          server->failures++;
+          // Back off longer each time, up to 5 minutes
+          server->retry_after = std::chrono::steady_clock::now() +
+              std::chrono::seconds(std::min(300, 5 << std::min(server->failures, 6)));
+          log_debug("%1% failed %2% times in a row", domain, server->failures);
+          break;
+    }
+}
+
+std::chrono::milliseconds
+ServerSelector::hedgeDelay(const std::string &domain)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto server = find(domain);
+    if (!server || server->latency == 0) {
+        return std::chrono::milliseconds(2000);
+    }
+    // Most requests finish well within this, so only the slow ones
+    // get a second request
+    long delay = server->latency * 3;
+    return std::chrono::milliseconds(std::min(10000L, std::max(250L, delay)));
+}
+
+void
+ServerSelector::refresh(void)
+{
+    std::vector<std::pair<std::string, std::shared_ptr<StatePoller>>> pollers;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (servers.size() < 2) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_refresh < refresh_interval) {
+            return;
+        }
+        last_refresh = now;
+        for (auto it = servers.begin(); it != servers.end(); ++it) {
+            pollers.emplace_back(it->domain, it->poller);
+        }
+    }
+    // The requests are done without holding the lock
+    for (auto it = pollers.begin(); it != pollers.end(); ++it) {
+        it->second->poll();
+        std::lock_guard<std::mutex> lock(mutex);
+        auto server = find(it->first);
+        if (server) {
+            server->latest = std::max(server->latest, it->second->latestSequence());
+        }
+    }
+}
+
+void
+ServerSelector::dump(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = servers.begin(); it != servers.end(); ++it) {
+        std::cerr << "\t" << it->domain << ": latency " << it->latency << "ms, errors "
+                  << it->error_rate << ", latest " << it->latest << std::endl;
+    }
+}
+
+} // namespace replication
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
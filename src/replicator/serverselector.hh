@@ -0,0 +1,122 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __SERVERSELECTOR_HH__
+#define __SERVERSELECTOR_HH__
+
+/// \file serverselector.hh
+/// \brief Pick the best planet mirror for each download
+///
+/// The same replication files are on several mirrors, which differ a
+/// lot in speed, and some lag behind the main server. This keeps track
+/// of the latency, the error rate and the latest sequence of each
+/// mirror, so the downloads go to the fastest one that has the file.
+/// The downloader uses the second best one for hedged requests.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "replicator/replication.hh"
+#include "replicator/statepoller.hh"
+
+/// \namespace replication
+namespace replication {
+
+/// \class ServerSelector
+/// \brief Rank the mirrors by latency, errors and freshness
+///
+/// This is used from the I/O thread of the downloader and from the
+/// monitor threads, so all the methods lock.
+class ServerSelector {
+  public:
+    /// The server of \a remote is always one of the mirrors
+    ServerSelector(const RemoteURL &remote);
+
+    /// Add a mirror, \a datadir is the directory with the frequency
+    /// directories in it
+    void addServer(const std::string &domain, const std::string &datadir);
+
+    /// The best servers to get \a sequence from, at most \a count.
+    /// Servers known not to have it yet, lagging behind the others,
+    /// or that failed recently, are skipped.
+    std::vector<std::string> select(long sequence, size_t count = 2);
+
+    /// The path of \a remote on the server \a domain
+    std::string getTarget(const std::string &domain, const RemoteURL &remote);
+
+    /// Record the result of a download from \a domain. The \a latency
+    /// is the time until the server started answering, so it is the
+    /// same for small and big files.
+    void report(const std::string &domain, long sequence, reqfile_t status,
+                std::chrono::milliseconds latency);
+
+    /// How long to wait for \a domain to start answering before
+    /// sending the same request to another server
+    std::chrono::milliseconds hedgeDelay(const std::string &domain);
+
+    /// Ask all the servers for their latest state, at most once in a while
+    void refresh(void);
+
+    /// Dump internal data to the terminal, used only for debugging
+    void dump(void);
+
+  private:
+    /// \struct Server
+    /// \brief What is known about a mirror
+    struct Server {
+        std::string domain;
+        std::string datadir;
+        double latency = 0;             ///< Moving average in milliseconds, 0 if unknown
+        double error_rate = 0;          ///< Moving average of the failures
+        long latest = -1;               ///< The latest sequence it has
+        int failures = 0;               ///< Failures in a row
+        std::chrono::steady_clock::time_point retry_after;
+        std::shared_ptr<StatePoller> poller;
+    };
+
+    Server *find(const std::string &domain);
+
+    std::mutex mutex;
+    RemoteURL remote;
+    std::vector<Server> servers;
+    std::chrono::steady_clock::time_point last_refresh;
+    /// Weight of the latest sample in the moving averages
+    double alpha = 0.2;
+    /// Mirrors this many sequences behind the freshest are not used
+    long max_lag = 5;
+    /// How often the state of all the mirrors gets checked
+    std::chrono::seconds refresh_interval{60};
+};
+
+} // namespace replication
+
+#endif // EOF __SERVERSELECTOR_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,211 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "replicator/statepoller.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace http = boost::beast::http;
+
+namespace replication {
+
+StatePoller::StatePoller(const RemoteURL &remote)
+{
+    frequency = remote.frequency;
+    pool = ConnectionPool::getPool(remote.domain);
+    target = "/" + remote.datadir + "/" + StateFile::freq_to_string(frequency);
+    // The changesets directory has a YAML file instead
+    if (frequency == changeset) {
+        target += "/state.yaml";
+    } else {
+        target += "/state.txt";
+    }
+}
+
+bool
+StatePoller::poll(void)
+{
+    ConnectionPool::headers_t headers;
+    if (!etag.empty()) {
+        headers.push_back({http::field::if_none_match, etag});
+    }
+    if (!last_modified.empty()) {
+        headers.push_back({http::field::if_modified_since, last_modified});
+    }
+
+    ConnectionPool::response_t response;
+    ptime now = microsec_clock::universal_time();
+    // Only a file seen while polling fast tells when it was published,
+    // otherwise it may have been there for a while
+    ptime seen = now;
+    if (last_poll == not_a_date_time || now - last_poll > fast_interval * 2) {
+        seen = not_a_date_time;
+    }
+    last_poll = now;
+    if (!pool->get(target, response, headers)) {
+        return false;
+    }
+    if (response.result() == http::status::not_modified) {
+        return false;
+    }
+    if (response.result() != http::status::ok) {
+        log_error("Couldn't get %1%: %2%", target, response.result_int());
+        return false;
+    }
+    etag = std::string(response[http::field::etag]);
+    last_modified = std::string(response[http::field::last_modified]);
+
+    StateFile state;
+    try {
+        state = StateFile(response.body(), true);
+    } catch (const std::exception &e) {
+        log_error("Couldn't parse %1%: %2%", target, e.what());
+        return false;
+    }
+    return update(state, seen);
+}
+
+bool
+StatePoller::update(const StateFile &state, ptime seen)
+{
+    if (state.sequence <= latest.sequence || state.timestamp == not_a_date_time) {
+        return false;
+    }
+
+    history.push_back({state.sequence, state.timestamp, seen});
+    if (history.size() > max_history) {
+        history.pop_front();
+    }
+    latest = state;
+    log_debug("Sequence %1% published, timestamp %2%", latest.sequence, to_simple_string(latest.timestamp));
+    return true;
+}
+
+ptime
+StatePoller::predict(long sequence) const
+{
+    if (latest.sequence < 0) {
+        return not_a_date_time;
+    }
+
+    // The median of the intervals, so an outage doesn't throw it off
+    std::vector<time_duration> intervals;
+    for (size_t i = 1; i < history.size(); i++) {
+        long steps = history[i].sequence - history[i - 1].sequence;
+        if (steps > 0) {
+            intervals.push_back((history[i].timestamp - history[i - 1].timestamp) / steps);
+        }
+    }
+    time_duration interval;
+    if (intervals.empty()) {
+        switch (frequency) {
+          case hourly:
+              interval = hours(1);
+              break;
+          case daily:
+              interval = hours(24);
+              break;
+          default:
+              interval = minutes(1);
+              break;
+        }
+    } else {
+        std::nth_element(intervals.begin(), intervals.begin() + intervals.size() / 2, intervals.end());
+        interval = intervals[intervals.size() / 2];
+    }
+
+    // The files appear on the server a little after their timestamp,
+    // use the shortest lag seen so the polling starts early enough
+    time_duration lag = seconds(0);
+    bool found = false;
+    for (auto it = history.begin(); it != history.end(); ++it) {
+        if (it->seen != not_a_date_time && (!found || it->seen - it->timestamp < lag)) {
+            lag = it->seen - it->timestamp;
+            found = true;
+        }
+    }
+    if (lag.is_negative()) {
+        lag = seconds(0);
+    }
+
+    return latest.timestamp + interval * (sequence - latest.sequence) + lag;
+}
+
+std::chrono::milliseconds
+StatePoller::nextPoll(long sequence) const
+{
+    return nextPoll(sequence, microsec_clock::universal_time());
+}
+
+std::chrono::milliseconds
+StatePoller::nextPoll(long sequence, ptime now) const
+{
+    ptime expected = predict(sequence);
+    if (expected == not_a_date_time) {
+        return std::chrono::milliseconds(fast_interval.total_milliseconds());
+    }
+    time_duration wait;
+    if (now < expected - lead) {
+        wait = std::max(expected - lead - now, fast_interval);
+    } else if (now < expected + late_window) {
+        wait = fast_interval;
+    } else {
+        wait = slow_interval;
+    }
+    return std::chrono::milliseconds(wait.total_milliseconds());
+}
+
+bool
+StatePoller::waitFor(long sequence, sleep_t sleep)
+{
+    while (!isPublished(sequence)) {
+        poll();
+        if (isPublished(sequence)) {
+            break;
+        }
+        auto wait = nextPoll(sequence);
+        if (sleep) {
+            if (!sleep(wait)) {
+                return false;
+            }
+        } else {
+            std::this_thread::sleep_for(wait);
+        }
+    }
+    return true;
+}
+
+} // namespace replication
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
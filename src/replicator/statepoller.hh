@@ -0,0 +1,130 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __STATEPOLLER_HH__
+#define __STATEPOLLER_HH__
+
+/// \file statepoller.hh
+/// \brief Find out when new replication files get published
+///
+/// Once caught up, asking blindly for the next file every 45 seconds
+/// means the data is on average half a minute late, and most requests
+/// get a 404. Instead this watches the top level state.txt with
+/// conditional requests, which are cheap for the server, and predicts
+/// when the next file is due from the recent sequence timestamps, so
+/// the file can be fetched within a second or two of being published.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+using namespace boost::posix_time;
+
+#include "replicator/replication.hh"
+#include "replicator/connectionpool.hh"
+
+/// \namespace replication
+namespace replication {
+
+/// \class StatePoller
+/// \brief Poll the latest state of a replication directory
+class StatePoller {
+  public:
+    /// Sleep for the duration, returns false if the caller should give up
+    typedef std::function<bool(std::chrono::milliseconds)> sleep_t;
+
+    /// \a remote is any file in the replication directory, it is only
+    /// used for the server, the data directory and the frequency.
+    StatePoller(const RemoteURL &remote);
+
+    /// Ask the server for the latest state. This is a conditional
+    /// request, so it's cheap when nothing has changed. Returns true
+    /// if a newer sequence has been published.
+    bool poll(void);
+
+    /// Record a \a state that has been downloaded. \a seen is when it
+    /// showed up, or not_a_date_time if it may have been there for a
+    /// while. Returns true if it is newer than the latest one.
+    bool update(const StateFile &state, ptime seen);
+
+    /// The latest sequence published, or -1 if not known yet
+    long latestSequence(void) const { return latest.sequence; };
+    /// True if \a sequence is known to have been published
+    bool isPublished(long sequence) const { return latest.sequence >= 0 && sequence <= latest.sequence; };
+
+    /// The time \a sequence is expected to be published, based on
+    /// the interval between the recent sequences
+    ptime predict(long sequence) const;
+
+    /// How long to wait before polling again when waiting for \a sequence.
+    /// This is a long sleep until shortly before the file is due, then
+    /// fast polling, backing off if the server is late.
+    std::chrono::milliseconds nextPoll(long sequence) const;
+    /// The same, as if the current time was \a now
+    std::chrono::milliseconds nextPoll(long sequence, ptime now) const;
+
+    /// Block until \a sequence has been published. Returns false if
+    /// \a sleep returned false.
+    bool waitFor(long sequence, sleep_t sleep = sleep_t());
+
+  private:
+    /// \struct Published
+    /// \brief When a sequence was seen
+    struct Published {
+        long sequence;
+        ptime timestamp;    ///< The timestamp in the state file
+        ptime seen;         ///< When the state file was downloaded
+    };
+
+    std::shared_ptr<ConnectionPool> pool;
+    std::string target;             ///< The path to the state file
+    frequency_t frequency;
+    StateFile latest;               ///< The latest state downloaded
+    std::string etag;               ///< For If-None-Match
+    std::string last_modified;      ///< For If-Modified-Since
+    std::deque<Published> history;  ///< The recent sequences, oldest first
+    ptime last_poll = not_a_date_time; ///< When the state file was last asked for
+    /// Don't keep more history than this, the interval drifts a bit
+    size_t max_history = 16;
+    /// Start fast polling this long before a file is due
+    time_duration lead = seconds(2);
+    /// How often to poll when the file is due
+    time_duration fast_interval = seconds(1);
+    /// If the file is this late, poll less often
+    time_duration late_window = seconds(30);
+    /// How often to poll once the file is late
+    time_duration slow_interval = seconds(5);
+};
+
+} // namespace replication
+
+#endif // EOF __STATEPOLLER_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
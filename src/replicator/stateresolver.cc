@@ -0,0 +1,197 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <fstream>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+#include "replicator/stateresolver.hh"
+#include "replicator/filedata.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace http = boost::beast::http;
+
+namespace replication {
+
+StateResolver::StateResolver(const std::string &url, const std::string &cachedir)
+    : cachedir(cachedir)
+{
+    // Split https://<server>/<path> into the server and the path
+    std::string host = url;
+    auto pos = host.find("://");
+    if (pos != std::string::npos) {
+        host = host.substr(pos + 3);
+    }
+    pos = host.find('/');
+    if (pos != std::string::npos) {
+        path = host.substr(pos + 1);
+        host = host.substr(0, pos);
+    }
+    while (!path.empty() && path.back() == '/') {
+        path.pop_back();
+    }
+    pool = ConnectionPool::getPool(host);
+
+    auto slash = path.rfind('/');
+    frequency = StateFile::freq_from_string(path.substr(slash == std::string::npos ? 0 : slash + 1));
+}
+
+std::string
+StateResolver::sequenceToPath(long sequence)
+{
+    boost::format fmt("%03d/%03d/%03d");
+    fmt % (sequence / 1000000) % ((sequence / 1000) % 1000) % (sequence % 1000);
+    return fmt.str();
+}
+
+StateFile
+StateResolver::download(const std::string &target, std::string &body)
+{
+    StateFile state;
+    ConnectionPool::response_t response;
+    requests++;
+    if (!pool->get(target, response)) {
+        failed = true;
+        return state;
+    }
+    if (response.result() != http::status::ok) {
+        log_debug("State file %1% not found: %2%", target, response.result_int());
+        return state;
+    }
+    body = std::move(response.body());
+    try {
+        state = StateFile(body, true);
+    } catch (const std::exception &e) {
+        log_error("Couldn't parse %1%: %2%", target, e.what());
+        return StateFile();
+    }
+    return state;
+}
+
+StateFile
+StateResolver::getState(long sequence)
+{
+    std::string subpath = sequenceToPath(sequence);
+    std::string filespec = path + "/" + subpath + ".state.txt";
+    std::string cached = cachedir + filespec;
+
+    StateFile state;
+    if (boost::filesystem::exists(cached)) {
+        auto data = FileData::mapFile(cached);
+        if (data) {
+            try {
+                state = StateFile(*data);
+            } catch (const std::exception &e) {
+                log_error("Removing corrupted %1%: %2%", cached, e.what());
+                boost::filesystem::remove(cached);
+            }
+        }
+    }
+    if (state.timestamp == not_a_date_time) {
+        std::string body;
+        state = download("/" + filespec, body);
+        if (state.timestamp != not_a_date_time && state.sequence == sequence) {
+            // The state of a past sequence never changes
+            try {
+                boost::filesystem::create_directories(boost::filesystem::path(cached).parent_path());
+                std::ofstream file(cached, std::ofstream::out | std::ios::binary);
+                file.write(body.data(), body.size());
+            } catch (const std::exception &e) {
+                log_error("Couldn't cache %1%: %2%", cached, e.what());
+            }
+        }
+    }
+    state.path = subpath;
+    state.frequency = frequency;
+    return state;
+}
+
+StateFile
+StateResolver::getLatest(void)
+{
+    std::string body;
+    // The changesets directory has a YAML file instead
+    auto state = download("/" + path + (frequency == changeset ? "/state.yaml" : "/state.txt"), body);
+    if (state.sequence >= 0) {
+        state.path = sequenceToPath(state.sequence);
+    }
+    state.frequency = frequency;
+    return state;
+}
+
+long
+StateResolver::resolve(ptime time)
+{
+    auto latest = getLatest();
+    if (latest.timestamp == not_a_date_time) {
+        log_error("Couldn't get the latest state from %1%/%2%", pool->getDomain(), path);
+        return -1;
+    }
+    if (time >= latest.timestamp) {
+        return latest.sequence;
+    }
+
+    // The timestamp of lo is never after time, the one of hi always is
+    long lo = 0;
+    long hi = latest.sequence;
+    failed = false;
+    while (hi - lo > 1 && !failed) {
+        long mid = lo + (hi - lo) / 2;
+        // Some early state files are missing, so use the next one
+        StateFile state;
+        long probe = mid;
+        for (; probe < hi && probe < mid + max_missing; probe++) {
+            state = getState(probe);
+            if (state.timestamp != not_a_date_time) {
+                break;
+            }
+        }
+        if (state.timestamp == not_a_date_time) {
+            log_debug("No state files from %1% to %2%", mid, probe);
+            lo = mid;
+        } else if (state.timestamp <= time) {
+            lo = probe;
+        } else {
+            hi = mid;
+        }
+    }
+    if (failed) {
+        log_error("Couldn't download the state files from %1%", pool->getDomain());
+        return -1;
+    }
+    log_debug("Timestamp %1% is after sequence %2%, using %3% requests",
+              to_simple_string(time), lo, requests);
+    return lo;
+}
+
+} // namespace replication
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,97 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __STATERESOLVER_HH__
+#define __STATERESOLVER_HH__
+
+/// \file stateresolver.hh
+/// \brief Find the replication file for a timestamp
+///
+/// Every replication file has a small state file next to it with its
+/// timestamp, and the timestamps only go up with the sequence number.
+/// So a binary search over the state files finds the exact sequence
+/// for a timestamp in about 23 requests for the minutely diffs. The
+/// state files of past sequences never change, so they are cached on
+/// disk, which makes the next lookup for a nearby time almost free.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <memory>
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+using namespace boost::posix_time;
+
+#include "replicator/replication.hh"
+#include "replicator/connectionpool.hh"
+
+/// \namespace replication
+namespace replication {
+
+/// \class StateResolver
+/// \brief Binary search the remote state files
+class StateResolver {
+  public:
+    /// \a url is the replication directory for one frequency, like
+    /// https://planet.openstreetmap.org/replication/minute. The state
+    /// files get cached under \a cachedir.
+    StateResolver(const std::string &url, const std::string &cachedir);
+
+    /// Find the last sequence with a timestamp not after \a time, so
+    /// the file after it is the first one with changes after \a time.
+    /// Returns -1 if the server can't be reached.
+    long resolve(ptime time);
+
+    /// Get the state file for \a sequence. It is invalid if the
+    /// file doesn't exist.
+    StateFile getState(long sequence);
+    /// Get the latest state, this is never cached
+    StateFile getLatest(void);
+
+    /// Convert a sequence to the NNN/NNN/NNN path
+    static std::string sequenceToPath(long sequence);
+
+    /// The number of state files downloaded, not counting the cached ones
+    int getRequests(void) const { return requests; };
+
+  private:
+    /// Download a state file, returns an invalid one if not found
+    StateFile download(const std::string &target, std::string &body);
+
+    std::shared_ptr<ConnectionPool> pool;
+    std::string path;               ///< The directory on the server
+    std::string cachedir;           ///< The local directory for the cache
+    frequency_t frequency;
+    int requests = 0;
+    bool failed = false;            ///< Set on network errors
+    /// Missing state files are skipped, but only this many in a row
+    int max_missing = 10;
+};
+
+} // namespace replication
+
+#endif // EOF __STATERESOLVER_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
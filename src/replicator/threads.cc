@@ -24,6 +24,7 @@
 
 #include <algorithm>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <iterator>
 #include <mutex>
@@ -40,7 +41,6 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/asio.hpp>
 #include <boost/thread/thread.hpp>
-#include <boost/asio/thread_pool.hpp>
 #include <boost/asio/ssl/error.hpp>
 #include <boost/asio/ssl/stream.hpp>
 #include <boost/beast/core.hpp>
@@ -73,9 +73,19 @@ using tcp = net::ip::tcp;         // from <boost/asio/ip/tcp.hpp>
 
 #include "osm/osmobjects.hh"
 #include "replicator/threads.hh"
+#include "replicator/pipeline.hh"
+#include "replicator/downloader.hh"
+#include "replicator/filedata.hh"
+#include "replicator/statepoller.hh"
+#include "replicator/stateresolver.hh"
+#include "replicator/planetreplicator.hh"
 #include "utils/log.hh"
+#include "utils/executor.hh"
 #include "osm/changeset.hh"
 #include "osm/osmchange.hh"
+#include "osm/oscparser.hh"
+#include "osm/changecache.hh"
+#include "osm/osmiumreader.hh"
 #include "stats/querystats.hh"
 #include "validate/queryvalidate.hh"
 #include "validate/validate.hh"
@@ -98,6 +108,19 @@ using namespace underpassconfig;
 
 namespace replicatorthreads {
 
+// The number of objects importChangeFile() reads from a file at a
+// time, which keeps the memory use of a country extract reasonable
+static const size_t import_batch = 500000;
+
+// The raw data tables are in the OSM database, everything else in
+// the Underpass database
+static bool
+isRawQuery(const std::string &query)
+{
+    return query.find(" nodes ") != std::string::npos || query.find(" ways_poly ") != std::string::npos ||
+        query.find(" ways_line ") != std::string::npos || query.find(" relations ") != std::string::npos;
+}
+
 std::shared_ptr<std::vector<std::string>>
 allTasksQueries(std::shared_ptr<std::vector<ReplicationTask>> tasks) {
     auto queries = std::make_shared<std::vector<std::string>>();
@@ -109,7 +132,7 @@ allTasksQueries(std::shared_ptr<std::vector<ReplicationTask>> tasks) {
                 log_debug("HAS SEMI-COLON: %1%", *itt);
                 log_debug("HAS SEMI-COLON: %1% %2%", itt->size() - 1, itt->rfind(';'));
             }
-            if (itt->find(" nodes ") != std::string::npos || itt->find(" ways_poly ") != std::string::npos || itt->find(" ways_line ") != std::string::npos ||  itt->find(" relations ") != std::string::npos) {
+            if (isRawQuery(*itt)) {
                 unsql.append(*itt);
             } else {
                 osmsql.append(*itt);
@@ -143,7 +166,8 @@ getClosest(std::shared_ptr<std::vector<ReplicationTask>> tasks, ptime now) {
 // Starting with this URL, download the file, incrementing
 void
 startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
-               const multipolygon_t &poly,
+               const geoutil::PreparedBoundary &poly,
+               const geoutil::RegionSet &regions,
                const UnderpassConfig config)
 {
 #ifdef TIMING_DEBUG
@@ -168,38 +192,36 @@ startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
     } else {
         log_debug("Connected to database: %1%", config.underpass_osm_db_url);
     }
+    prepareReplicationState(db);
+    prepareReplicationState(osmdb);
+    auto marks = readHighWaterMarks(db, osmdb, StateFile::freq_to_string(remote->frequency));
 
     int cores = config.concurrency;
-
-    // Support multiple OSM planet servers
-    std::vector<std::shared_ptr<replication::Planet>> planets;
-    std::vector<std::string> servers;
-    for (auto it = std::begin(config.planet_servers); it != std::end(config.planet_servers); ++it) {
-        servers.push_back(it->domain);
-    }
-
-    // Rotate OSM Planet servers
     int i = 0;
-    while (i <= cores/4) {
-        std::rotate(servers.begin(), servers.begin()+1, servers.end());
-        auto replicationPlanet = std::make_shared<replication::Planet>(*remote);
-        planets.push_back(replicationPlanet);
-        i++;
-    }
+
+    // The files are all downloaded at once by the I/O thread, the
+    // threads in the pool only wait for their own file
+    auto selector = makeSelector(*remote, config);
+    replication::AsyncDownloader downloader(config.downloads, selector);
+    // Once caught up, this tells when the next file is there
+    replication::StatePoller poller(*remote);
 
     // Process Changesets replication files
     ReplicationTask closest;
-    auto delay = std::chrono::seconds{0};
     auto last_task = std::make_shared<ReplicationTask>();
     bool caughtUpWithNow = false;
     bool monitoring = true;
+    // The downloads of the current batch still in flight
+    std::mutex download_mutex;
+    std::condition_variable download_cond;
+    int downloading = 0;
 
     while (monitoring) {
         auto tasks = std::make_shared<std::vector<ReplicationTask>>();
         i = cores*2;
-        boost::asio::thread_pool pool(i);
+        // The threads are shared with the osmChange pipeline
+        executor::TaskGroup group("changesets", executor::high);
         while (--i) {
-            std::this_thread::sleep_for(delay);
             if (last_task->status == reqfile_t::success ||
                 (last_task->status == reqfile_t::remoteNotFound && !caughtUpWithNow)) {
                 remote->increment();
@@ -207,27 +229,69 @@ startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
                     remote->dump();
                 }
             }
+            if (caughtUpWithNow) {
+                if (last_task->status == reqfile_t::remoteNotFound &&
+                    poller.isPublished(remote->sequence())) {
+                    // Published but not there yet, probably a mirror lagging
+                    std::this_thread::sleep_for(std::chrono::seconds{5});
+                }
+                selector->refresh();
+                poller.waitFor(remote->sequence());
+            }
             auto new_remote = std::make_shared<replication::RemoteURL>(remote->getURL());
             new_remote->destdir_base = remote->destdir_base;
-            auto task = boost::bind(threadChangeSet,
-                new_remote,
-                std::ref(planets.front()),
-                std::ref(poly),
-                std::ref(tasks),
-                std::ref(querystats)
-            );
-
-            boost::asio::post(pool, task);
-            std::rotate(planets.begin(), planets.begin()+1, planets.end());
-            remote->updateDomain(planets.front()->domain);
+            // The file is only handed to a thread once it has arrived,
+            // so no thread is tied up waiting on the network
+            {
+                std::lock_guard<std::mutex> lock(download_mutex);
+                downloading++;
+            }
+            downloader.fetch(*new_remote, [&, new_remote](replication::RequestedFile file) {
+                group.post([new_remote, file, tasks, &poly, &regions, &querystats]() mutable {
+                    threadChangeSet(new_remote, file, poly, regions, tasks, querystats);
+                });
+                std::lock_guard<std::mutex> lock(download_mutex);
+                if (--downloading == 0) {
+                    download_cond.notify_all();
+                }
+            });
         }
-        pool.join();
-        auto result = allTasksQueries(tasks);
-        if (result->at(0).size() > 0) {
-            db->query(result->at(0));
+        {
+            std::unique_lock<std::mutex> lock(download_mutex);
+            download_cond.wait(lock, [&downloading] { return downloading == 0; });
         }
-        if (result->at(1).size() > 0) {
-            osmdb->query(result->at(1));
+        group.wait();
+        // The threads finish in any order, but the files are committed
+        // in sequence, each in its own transaction
+        std::sort(tasks->begin(), tasks->end(), [](const ReplicationTask &a, const ReplicationTask &b) {
+            return a.sequence < b.sequence;
+        });
+        for (auto it = tasks->begin(); it != tasks->end(); ++it) {
+            // Skipping a file would leave a gap, so one that failed is
+            // downloaded again before any later one is committed
+            while (it->status != reqfile_t::success) {
+                log_error("Sequence %1% failed, getting it again", it->sequence);
+                if (it->status == reqfile_t::remoteNotFound) {
+                    poller.waitFor(it->sequence);
+                }
+                std::this_thread::sleep_for(std::chrono::seconds{5});
+                selector->refresh();
+                auto retry = std::make_shared<replication::RemoteURL>(*remote);
+                retry->updatePath(std::stoi(it->url.substr(0, 3)),
+                                  std::stoi(it->url.substr(4, 3)),
+                                  std::stoi(it->url.substr(8, 3)));
+                std::promise<replication::RequestedFile> fetched;
+                downloader.fetch(*retry, [&fetched](replication::RequestedFile file) {
+                    fetched.set_value(file);
+                });
+                auto retried = std::make_shared<std::vector<ReplicationTask>>();
+                threadChangeSet(retry, fetched.get_future().get(), poly, regions, retried, querystats);
+                *it = retried->front();
+            }
+            while (!applyTask(*it, StateFile::freq_to_string(remote->frequency), db, osmdb, marks)) {
+                log_error("Retrying sequence %1% in 5 seconds", it->sequence);
+                std::this_thread::sleep_for(std::chrono::seconds{5});
+            }
         }
 
         ptime now  = boost::posix_time::second_clock::universal_time();
@@ -245,6 +309,7 @@ startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
             if (delta_closest.hours() * 60 + delta_closest.minutes() <= 2) {
                 caughtUpWithNow = true;
                 log_debug("Caught up with: %1%", closest.url);
+                executor::Executor::getDefault().dumpMetrics();
                 remote->updatePath(
                     std::stoi(closest.url.substr(0, 3)),
                     std::stoi(closest.url.substr(4, 3)),
@@ -254,26 +319,15 @@ startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
                     remote->dump();
                 }
                 cores = 1;
-                delay = std::chrono::seconds{45};
             }
         }
     }
 }
 
-// Starting with this URL, download the file, incrementing
-void
-startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
-            const multipolygon_t &poly,
-            const UnderpassConfig &config)
+// Load the validation plugin, from the build tree if this is run there
+static std::shared_ptr<Validate>
+loadValidator(void)
 {
-#ifdef TIMING_DEBUG
-    boost::timer::auto_cpu_timer timer("startMonitorChanges: took %w seconds\n");
-#endif
-    if (remote->frequency == frequency_t::changeset) {
-        log_error("Could not start monitoring thread for OSM changes: URL %1% does not appear to be a valid URL for changes!", remote->filespec);
-        return;
-    }
-
     std::string plugins;
     if (boost::filesystem::exists("src/validate/.libs")) {
         plugins = "src/validate/.libs";
@@ -287,9 +341,30 @@ startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
         log_debug("Loaded plugin!");
     } catch (std::exception &e) {
         log_debug("Couldn't load plugin! %1%", e.what());
+        return nullptr;
+    }
+    return creator();
+}
+
+// Starting with this URL, download the file, incrementing
+void
+startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
+            const geoutil::PreparedBoundary &poly,
+            const geoutil::RegionSet &regions,
+            const UnderpassConfig &config)
+{
+#ifdef TIMING_DEBUG
+    boost::timer::auto_cpu_timer timer("startMonitorChanges: took %w seconds\n");
+#endif
+    if (remote->frequency == frequency_t::changeset) {
+        log_error("Could not start monitoring thread for OSM changes: URL %1% does not appear to be a valid URL for changes!", remote->filespec);
+        return;
+    }
+
+    auto validator = loadValidator();
+    if (!validator) {
         exit(0);
     }
-    auto validator = creator();
 
 #ifdef MEMORY_DEBUG
     size_t sz, active1, active2;
@@ -301,8 +376,6 @@ startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
     } else {
         log_debug("Connected to database: %1%", config.underpass_db_url);
     }
-    auto querystats = std::make_shared<QueryStats>(db);
-    auto queryvalidate = std::make_shared<QueryValidate>(db);
 
     // Connect to the raw OSM database, which is separate
     auto osmdb = std::make_shared<Pq>();
@@ -312,113 +385,111 @@ startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
     } else {
         log_debug("Connected to database: %1%", config.underpass_osm_db_url);
     }
-    auto queryraw = std::make_shared<QueryRaw>(osmdb);
-
-    int cores = config.concurrency;
-
-    // Support multiple OSM planet servers
-    std::vector<std::shared_ptr<replication::Planet>> planets;
-    std::vector<std::string> servers;
-    for (auto it = std::begin(config.planet_servers); it != std::end(config.planet_servers); ++it) {
-        servers.push_back(it->domain);
-    }
 
-    // Rotate OSM Planet servers
-    int i = 0;
-    while (i <= cores/4) {
-        std::rotate(servers.begin(), servers.begin()+1, servers.end());
-        auto replicationPlanet = std::make_shared<replication::Planet>(*remote);
-        planets.push_back(replicationPlanet);
-        i++;
+    // Process OSM changes, this runs until the end time is reached
+    if (!config.auto_frequency) {
+        OsmChangePipeline pipeline(remote, poly, regions, validator, db, osmdb, config);
+        pipeline.run();
+        return;
     }
 
-    // Process OSM changes
-    auto delay = std::chrono::seconds{0};
-    ReplicationTask closest;
-    auto last_task = std::make_shared<ReplicationTask>();
-    last_task->status = reqfile_t::success;
-    bool caughtUpWithNow = false;
-    bool monitoring = true;
-    auto underpassConfig = std::make_shared<UnderpassConfig>(config);
-    int concurrentTasks = cores*2;
+    // A daily file replaces over a thousand minutely ones, so a large
+    // backlog is worked through with the coarsest files first. Each
+    // pass stops once the backlog is small enough for the next finer
+    // frequency, which then starts right after the last file applied.
+    auto current = remote;
+    bool coarse = true;
+    while (true) {
+        std::string baseurl = "https://" + current->domain + "/" + current->datadir + "/" +
+            StateFile::freq_to_string(current->frequency);
+        replication::StateResolver resolver(baseurl, config.destdir_base);
+        ptime applied = resolver.getState(current->sequence()).timestamp;
+        if (applied == not_a_date_time) {
+            log_error("No state file for %1%, not changing the frequency", current->subpath);
+            applied = boost::posix_time::second_clock::universal_time();
+        }
+        if (config.end_time != not_a_date_time && applied >= config.end_time) {
+            break;
+        }
 
-    while (monitoring) {
-        auto tasks = std::make_shared<std::vector<ReplicationTask>>(concurrentTasks);
-        boost::asio::thread_pool pool(concurrentTasks);
-        i = concurrentTasks;
-        do {
-            std::this_thread::sleep_for(delay);
-            if (last_task->status == reqfile_t::success ||
-                (last_task->status == reqfile_t::remoteNotFound && !caughtUpWithNow)) {
-                remote->increment();
-                if (!config.silent) {
-                    remote->dump();
-                }
+        ptime now = boost::posix_time::second_clock::universal_time();
+        frequency_t frequency = coarse ? catchUpFrequency(now - applied) : frequency_t::minutely;
+        if (frequency != current->frequency) {
+            // The files of all the frequencies end on the same minute
+            // boundaries, so this is the file ending where the last
+            // one applied ended
+            UnderpassConfig handover(config);
+            handover.frequency = frequency;
+            planetreplicator::PlanetReplicator replicator;
+            auto next = replicator.findRemotePath(handover, applied);
+            if (next) {
+                log_info("Switching to %1% files at %2%", StateFile::freq_to_string(frequency),
+                         to_simple_string(applied));
+                next->destdir_base = config.destdir_base;
+                current = next;
+            } else {
+                frequency = current->frequency;
             }
-            auto new_remote = std::make_shared<replication::RemoteURL>(remote->getURL());
-            new_remote->destdir_base = remote->destdir_base;
-            OsmChangeTask osmChangeTask {
-                new_remote,
-                std::ref(planets.front()),
-                std::ref(poly),
-                std::ref(validator),
-                std::ref(tasks),
-                std::ref(querystats),
-                std::ref(queryvalidate),
-                std::ref(queryraw),
-                underpassConfig,
-                concurrentTasks - i
-            };
-
-            auto task = boost::bind(threadOsmChange, osmChangeTask);
-            std::rotate(planets.begin(), planets.begin()+1, planets.end());
-
-            boost::asio::post(pool, task);
-        } while (--i);
-        pool.join();
-        auto result = allTasksQueries(tasks);
-        if (result->at(0).size() > 0) {
-            db->query(result->at(0));
-        }
-        if (result->at(1).size() > 0) {
-            osmdb->query(result->at(1));
         }
 
-        ptime now  = boost::posix_time::second_clock::universal_time();
-        last_task = getClosest(tasks, now);
-        if (last_task->timestamp != not_a_date_time) {
-            closest.url = std::string(last_task->url);
-            closest.timestamp = ptime(last_task->timestamp);
-            if (last_task->timestamp >= config.end_time) {
-                monitoring = false;
+        UnderpassConfig pass(config);
+        pass.frequency = current->frequency;
+        if (current->frequency != frequency_t::minutely) {
+            ptime end = now - minimumBacklog(current->frequency);
+            if (config.end_time == not_a_date_time || end < config.end_time) {
+                pass.end_time = end;
             }
         }
-        // Check if caught up with now
-        if (!caughtUpWithNow) {
-            boost::posix_time::time_duration delta_closest = now - closest.timestamp;
-            if (delta_closest.hours() * 60 + delta_closest.minutes() <= 2) {
-                caughtUpWithNow = true;
-                log_debug("Caught up with: %1%", closest.url);
-                remote->updatePath(
-                    std::stoi(closest.url.substr(0, 3)),
-                    std::stoi(closest.url.substr(4, 3)),
-                    std::stoi(closest.url.substr(8, 3))
-                );
-                if (!config.silent) {
-                    remote->dump();
-                }
-                concurrentTasks = 1;
-                delay = std::chrono::seconds{45};
-            }
+        long start = current->sequence();
+        OsmChangePipeline pipeline(current, poly, regions, validator, db, osmdb, pass);
+        pipeline.run();
+        if (current->frequency == frequency_t::minutely) {
+            break;
+        }
+        long last = pipeline.lastApplied();
+        if (last == start) {
+            // Nothing was applied, so finish with the minutely files
+            log_error("No progress with %1% files", StateFile::freq_to_string(current->frequency));
+            coarse = false;
+            continue;
         }
+        current->updatePath(last / 1000000, (last / 1000) % 1000, last % 1000);
+    }
+}
+
+// Coarser files are only used for a backlog at least this large
+boost::posix_time::time_duration
+minimumBacklog(frequency_t frequency)
+{
+    switch (frequency) {
+      case frequency_t::daily:
+          return boost::posix_time::hours(48);
+      case frequency_t::hourly:
+          return boost::posix_time::hours(3);
+      default:
+          return boost::posix_time::hours(0);
+    }
+}
+
+// The coarsest frequency worth using for a backlog of \a lag
+frequency_t
+catchUpFrequency(boost::posix_time::time_duration lag)
+{
+    if (lag >= minimumBacklog(frequency_t::daily)) {
+        return frequency_t::daily;
+    }
+    if (lag >= minimumBacklog(frequency_t::hourly)) {
+        return frequency_t::hourly;
     }
+    return frequency_t::minutely;
 }
 
 // This parses the changeset file into changesets
 void
 threadChangeSet(std::shared_ptr<replication::RemoteURL> &remote,
-        std::shared_ptr<replication::Planet> &planet,
-        const multipolygon_t &poly,
+        replication::RequestedFile file,
+        const geoutil::PreparedBoundary &poly,
+        const geoutil::RegionSet &regions,
         std::shared_ptr<std::vector<ReplicationTask>> tasks,
         std::shared_ptr<QueryStats> &querystats)
 {
@@ -427,15 +498,18 @@ threadChangeSet(std::shared_ptr<replication::RemoteURL> &remote,
 #endif
     ReplicationTask task;
     task.url = remote->subpath;
-    auto file = planet->downloadFile(*remote.get());
+    task.sequence = remote->sequence();
     task.status = file.status;
 
     if (file.status == reqfile_t::success) {
         auto changeset = std::make_unique<changesets::ChangeSetFile>();
         log_debug("Processing ChangeSet: %1%", remote->filespec);
-        auto xml = planet->processData(remote->filespec, *file.data);
-        std::istream& input(xml);
-        changeset->readXML(input);
+        try {
+            changeset->readXML(file.data->data(), file.data->size());
+        } catch (std::exception &e) {
+            log_error("%1% is corrupted!", remote->filespec);
+            std::cerr << e.what() << std::endl;
+        }
         if (changeset->last_closed_at != not_a_date_time) {
             task.timestamp = changeset->last_closed_at;
         } else if (changeset->changes.size() && changeset->changes.back()->created_at != not_a_date_time) {
@@ -443,6 +517,9 @@ threadChangeSet(std::shared_ptr<replication::RemoteURL> &remote,
         }
         log_debug("ChangeSet last_closed_at: %1%", task.timestamp);
         changeset->areaFilter(poly);
+        if (!regions.empty()) {
+            changeset->regionFilter(regions);
+        }
         for (auto cit = std::begin(changeset->changes); cit != std::end(changeset->changes); ++cit) {
             task.query.push_back(querystats->applyChange(*cit->get()));
         }
@@ -451,81 +528,112 @@ threadChangeSet(std::shared_ptr<replication::RemoteURL> &remote,
     tasks->push_back(task);
 }
 
-// This thread get started for every osmChange file
-void
-threadOsmChange(OsmChangeTask osmChangeTask)
+// Decompress and parse a downloaded osmChange file
+std::shared_ptr<osmchange::OsmChangeFile>
+parseOsmChange(replication::RemoteURL &remote,
+               replication::RequestedFile &file,
+               ReplicationTask &task,
+               const UnderpassConfig &config)
 {
 #ifdef TIMING_DEBUG
-    boost::timer::auto_cpu_timer timer("threadOsmChange: took %w seconds\n");
+    boost::timer::auto_cpu_timer timer("parseOsmChange: took %w seconds\n");
 #endif
-    auto remote = osmChangeTask.remote;
-    auto planet = osmChangeTask.planet;
-    auto poly = osmChangeTask.poly;
-    auto plugin = osmChangeTask.plugin;
-    auto tasks = osmChangeTask.tasks;
-    auto querystats = osmChangeTask.querystats;
-    auto queryvalidate = osmChangeTask.queryvalidate;
-    auto queryraw = osmChangeTask.queryraw;
-    auto config = osmChangeTask.config;
-    auto taskIndex = osmChangeTask.taskIndex;
-
     auto osmchanges = std::make_shared<osmchange::OsmChangeFile>();
-    log_debug("Processing OsmChange: %1%", remote->filespec);
-    ReplicationTask task;
-    task.url = remote->subpath;
-    auto file = planet->downloadFile(*remote.get());
-    task.status = file.status;
-
-    // Read OsmChange
-    if (file.status == replication::success) {
-        try {
-            std::istringstream changes_xml;
-            // Scope to deallocate buffers
-            {
-                boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
-                inbuf.push(boost::iostreams::gzip_decompressor());
-                boost::iostreams::array_source arrs{reinterpret_cast<char const *>(file.data->data()), file.data->size()};
-                inbuf.push(arrs);
-                std::istream instream(&inbuf);
-                changes_xml.str(std::string{std::istreambuf_iterator<char>(instream), {}});
-            }
-
-            try {
-                osmchanges->nodecache.clear();
-                osmchanges->waycache.clear();
-                osmchanges->readXML(changes_xml);
+    if (file.status != replication::success) {
+        return osmchanges;
+    }
+    // A file processed before may have been kept parsed
+    std::string parsed;
+    if (config.parsed_cache) {
+        parsed = changecache::cachePath(remote.destdir_base + remote.filespec);
+        if (boost::filesystem::exists(parsed)) {
+            auto data = replication::FileData::mapFile(parsed);
+            if (data && changecache::readData(*osmchanges, data->data(), data->size())) {
+                log_debug("Using parsed OsmChange: %1%", parsed);
                 if (osmchanges->changes.size() > 0) {
                     task.timestamp = osmchanges->changes.back()->final_entry;
-                    // log_debug("OsmChange final_entry: %1%", task.timestamp);
                 }
-            } catch (std::exception &e) {
-                log_error("Couldn't parse: %1%", remote->filespec);
-                boost::filesystem::remove(remote->filespec);
-                std::cerr << e.what() << std::endl;
+                return osmchanges;
             }
-
-        } catch (std::exception &e) {
-            log_error("%1% is corrupted!", remote->filespec);
-            boost::filesystem::remove(remote->filespec);
-            std::cerr << e.what() << std::endl;
+            // It gets replaced once the XML is parsed
+            osmchanges = std::make_shared<osmchange::OsmChangeFile>();
         }
     }
+    log_debug("Processing OsmChange: %1%", remote.filespec);
+    // The file is decompressed a chunk at a time straight into the
+    // parser, so the uncompressed XML is never all in memory
+    try {
+        bool valid = true;
+        if (config.parser == "fast") {
+            // Except for large files, like the daily ones, which are
+            // inflated first so all the cores can parse them
+            if (!oscparser::parseParallel(*osmchanges, file.data->data(), file.data->size())) {
+                log_error("%1% is not a valid osmChange file", remote.filespec);
+                valid = false;
+            }
+        } else if (!osmchanges->readXML(file.data->data(), file.data->size())) {
+            log_error("%1% is not a valid osmChange file", remote.filespec);
+            valid = false;
+        }
+        if (osmchanges->changes.size() > 0) {
+            task.timestamp = osmchanges->changes.back()->final_entry;
+            // log_debug("OsmChange final_entry: %1%", task.timestamp);
+        }
+        if (valid && !parsed.empty()) {
+            changecache::writeFile(*osmchanges, parsed);
+        }
+    } catch (std::exception &e) {
+        log_error("%1% is corrupted!", remote.filespec);
+        boost::filesystem::remove(remote.filespec);
+        std::cerr << e.what() << std::endl;
+    }
+    return osmchanges;
+}
 
+// Build the geometries and filter the data by the priority polygon
+void
+buildOsmChangeGeometries(std::shared_ptr<osmchange::OsmChangeFile> osmchanges,
+                         const geoutil::PreparedBoundary &poly,
+                         const geoutil::RegionSet &regions,
+                         std::shared_ptr<QueryRaw> queryraw,
+                         const UnderpassConfig &config)
+{
+#ifdef TIMING_DEBUG
+    boost::timer::auto_cpu_timer timer("buildOsmChangeGeometries: took %w seconds\n");
+#endif
     // - Fill node cache with nodes referenced in modified
     //   or created ways and also ways indirectly modified by modified nodes
     // - Add indirectly modified ways to osmchanges
     // - Build ways polygon/linestring geometries using nodecache
     // - Build relation multipolyon/multilinestring geometries using waycache
-    if (!config->disable_raw) {
+    if (!config.disable_raw) {
         queryraw->buildGeometries(osmchanges, poly);
     }
 
     // Filter data by priority polygon
     osmchanges->areaFilter(poly);
+    if (!regions.empty()) {
+        osmchanges->regionFilter(regions);
+    }
+}
 
+// Generate the stats, raw data and validation queries for an osmChange file
+void
+analyzeOsmChange(std::shared_ptr<osmchange::OsmChangeFile> osmchanges,
+                 const geoutil::PreparedBoundary &poly,
+                 std::shared_ptr<Validate> plugin,
+                 std::shared_ptr<QueryStats> querystats,
+                 std::shared_ptr<QueryValidate> queryvalidate,
+                 std::shared_ptr<QueryRaw> queryraw,
+                 const UnderpassConfig &config,
+                 ReplicationTask &task)
+{
+#ifdef TIMING_DEBUG
+    boost::timer::auto_cpu_timer timer("analyzeOsmChange: took %w seconds\n");
+#endif
     // Collect stats
-    if (!config->disable_stats) {
-        auto stats = osmchanges->collectStats(poly);
+    if (!config.disable_stats) {
+        auto stats = osmchanges->collectStats();
         for (auto it = std::begin(*stats); it != std::end(*stats); ++it) {
             if (it->second->added.size() == 0 && it->second->modified.size() == 0) {
                 continue;
@@ -540,25 +648,25 @@ threadOsmChange(OsmChangeTask osmChangeTask)
     auto validation_removals = std::make_shared<std::vector<long>>();
 
     // Raw data and validation
-    if (!config->disable_validation || !config->disable_raw) {
+    if (!config.disable_validation || !config.disable_raw) {
         for (auto it = std::begin(osmchanges->changes); it != std::end(osmchanges->changes); ++it) {
             osmchange::OsmChange *change = it->get();
 
             // Nodes
             for (auto nit = std::begin(change->nodes); nit != std::end(change->nodes); ++nit) {
-                osmobjects::OsmNode *node = nit->get();
+                osmobjects::OsmNode *node = &*nit;
 
                 if (!node->priority) {
                     continue;
                 }
 
                 // Remove deleted nodes from validation table
-                if (!config->disable_validation && node->action == osmobjects::remove) {
+                if (!config.disable_validation && node->action == osmobjects::remove) {
                     removed_nodes->push_back(node->id);
                 }
 
                 //  Update nodes, ignore new ones outside priority area
-                if (!config->disable_raw) {
+                if (!config.disable_raw) {
                     auto changes = queryraw->applyChange(*node);
                     for (auto it = changes->begin(); it != changes->end(); ++it) {
                          task.query.push_back(*it);
@@ -568,19 +676,19 @@ threadOsmChange(OsmChangeTask osmChangeTask)
 
             // Ways
             for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
-                osmobjects::OsmWay *way = wit->get();
+                osmobjects::OsmWay *way = &*wit;
 
                 if (way->action != osmobjects::remove && !way->priority) {
                     continue;
                 }
 
                 // Remove deleted ways from validation table
-                if (!config->disable_validation && way->action == osmobjects::remove) {
+                if (!config.disable_validation && way->action == osmobjects::remove) {
                     removed_ways->push_back(way->id);
                 }
 
                 //  Update ways, ignore new ones outside priority area
-                if (!config->disable_raw) {
+                if (!config.disable_raw) {
                     auto changes = queryraw->applyChange(*way);
                     for (auto it = changes->begin(); it != changes->end(); ++it) {
                         task.query.push_back(*it);
@@ -590,7 +698,7 @@ threadOsmChange(OsmChangeTask osmChangeTask)
 
             // Relations
             for (auto rit = std::begin(change->relations); rit != std::end(change->relations); ++rit) {
-                osmobjects::OsmRelation *relation = rit->get();
+                osmobjects::OsmRelation *relation = &*rit;
 
                 if (relation->action != osmobjects::remove && !relation->priority) {
                     // if (!relation->priority) {
@@ -599,12 +707,12 @@ threadOsmChange(OsmChangeTask osmChangeTask)
                     continue;
                 }
                 // Remove deleted relations from validation table
-                // if (!config->disable_validation && relation->action == osmobjects::remove) {
+                // if (!config.disable_validation && relation->action == osmobjects::remove) {
                 //     removed_relations->push_back(relation->id);
                 // }
 
                 //  Update relations, ignore new ones outside priority area
-                if (!config->disable_raw) {
+                if (!config.disable_raw) {
                     auto changes = queryraw->applyChange(*relation);
                     for (auto it = changes->begin(); it != changes->end(); ++it) {
                         task.query.push_back(*it);
@@ -615,17 +723,17 @@ threadOsmChange(OsmChangeTask osmChangeTask)
     }
 
     // Update validation table
-    if (!config->disable_validation) {
+    if (!config.disable_validation) {
 
         // Validate ways
-        auto wayval = osmchanges->validateWays(poly, plugin);
+        auto wayval = osmchanges->validateWays(plugin);
         auto wayval_queries = queryvalidate->ways(wayval, validation_removals);
         for (auto itt = wayval_queries->begin(); itt != wayval_queries->end(); ++itt) {
             task.query.push_back(*itt);
         }
 
         // Validate nodes
-        auto nodeval = osmchanges->validateNodes(poly, plugin);
+        auto nodeval = osmchanges->validateNodes(plugin);
         auto nodeval_queries = queryvalidate->nodes(nodeval, validation_removals);
         for (auto itt = nodeval_queries->begin(); itt != nodeval_queries->end(); ++itt) {
             task.query.push_back(*itt);
@@ -645,9 +753,257 @@ threadOsmChange(OsmChangeTask osmChangeTask)
         // task.query += queryvalidate->updateValidation(removed_relations);
 
     }
-    const std::lock_guard<std::mutex> lock(tasks_change_mutex);
-    (*tasks)[taskIndex] = task;
+}
+
+// Apply the queries of a set of tasks, the raw data tables go to
+// the OSM database, the rest to the Underpass database
+void
+applyTasks(std::shared_ptr<std::vector<ReplicationTask>> tasks,
+           std::shared_ptr<Pq> db,
+           std::shared_ptr<Pq> osmdb)
+{
+    auto result = allTasksQueries(tasks);
+    if (result->at(0).size() > 0) {
+        db->query(result->at(0));
+    }
+    if (result->at(1).size() > 0) {
+        osmdb->query(result->at(1));
+    }
+}
+
+std::shared_ptr<replication::ServerSelector>
+makeSelector(const replication::RemoteURL &remote, const UnderpassConfig &config)
+{
+    auto selector = std::make_shared<replication::ServerSelector>(remote);
+    auto servers = config.getPlanetServers(remote.frequency);
+    for (auto it = servers.begin(); it != servers.end(); ++it) {
+        selector->addServer(it->domain, it->datadir);
+    }
+    return selector;
+}
+
+std::string
+highWaterMark(const ReplicationTask &task, const std::string &frequency)
+{
+    std::string sql = "INSERT INTO replication_state(frequency, sequence, timestamp, updated_at) VALUES('";
+    sql += frequency + "', " + std::to_string(task.sequence) + ", ";
+    if (task.timestamp != not_a_date_time) {
+        sql += "'" + to_iso_extended_string(task.timestamp) + "'";
+    } else {
+        sql += "NULL";
+    }
+    sql += ", now()) ON CONFLICT (frequency) DO UPDATE SET sequence = EXCLUDED.sequence,";
+    sql += " timestamp = COALESCE(EXCLUDED.timestamp, replication_state.timestamp), updated_at = EXCLUDED.updated_at";
+    sql += " WHERE replication_state.sequence < EXCLUDED.sequence;";
+    return sql;
+}
+
+bool
+prepareReplicationState(std::shared_ptr<Pq> db)
+{
+    // A database set up before the table existed doesn't have it
+    return db->transaction("CREATE TABLE IF NOT EXISTS replication_state ("
+                           "frequency text PRIMARY KEY, sequence int8 NOT NULL,"
+                           " timestamp timestamp with time zone, updated_at timestamp with time zone);");
+}
+
+ReplicationTask
+readHighWaterMark(std::shared_ptr<Pq> db, const std::string &frequency)
+{
+    ReplicationTask mark;
+    auto result = db->query("SELECT sequence, to_char(timestamp AT TIME ZONE 'UTC', 'YYYY-MM-DD HH24:MI:SS')"
+                            " FROM replication_state WHERE frequency = '" + frequency + "';");
+    if (result.size() == 0) {
+        return mark;
+    }
+    mark.sequence = result[0][0].as<long>();
+    if (!result[0][1].is_null()) {
+        mark.timestamp = time_from_string(result[0][1].as<std::string>());
+    }
+    return mark;
+}
+
+HighWaterMarks
+readHighWaterMarks(std::shared_ptr<Pq> db, std::shared_ptr<Pq> osmdb, const std::string &frequency)
+{
+    HighWaterMarks marks;
+    marks.db = readHighWaterMark(db, frequency).sequence;
+    marks.osmdb = readHighWaterMark(osmdb, frequency).sequence;
+    return marks;
+}
+
+ReplicationTask
+lastCommitted(const UnderpassConfig &config, frequency_t frequency)
+{
+    ReplicationTask none;
+    auto db = std::make_shared<Pq>();
+    auto osmdb = std::make_shared<Pq>();
+    if (!db->connect(config.underpass_db_url) || !osmdb->connect(config.underpass_osm_db_url)) {
+        log_error("Could not connect to the databases to read the last sequence!");
+        return none;
+    }
+    if (!prepareReplicationState(db) || !prepareReplicationState(osmdb)) {
+        return none;
+    }
+    std::string name = StateFile::freq_to_string(frequency);
+    auto mark = readHighWaterMark(db, name);
+    auto osmmark = readHighWaterMark(osmdb, name);
+    if (mark.sequence < 0 || osmmark.sequence < 0) {
+        return none;
+    }
+    // Only one of them may have the last one
+    return osmmark.sequence < mark.sequence ? osmmark : mark;
+}
 
+bool
+applyTask(const ReplicationTask &task, const std::string &frequency,
+          std::shared_ptr<Pq> db,
+          std::shared_ptr<Pq> osmdb,
+          HighWaterMarks &marks)
+{
+    std::string osmsql;
+    std::string unsql;
+    for (auto it = task.query.begin(); it != task.query.end(); ++it) {
+        if (isRawQuery(*it)) {
+            unsql.append(*it);
+        } else {
+            osmsql.append(*it);
+        }
+    }
+    // The high-water mark is in the same transaction as the data, so
+    // it only moves if the data got committed. Both databases have
+    // one, as they may be different servers. If only one of them got
+    // the sequence last time, it is only applied to the other one.
+    auto mark = highWaterMark(task, frequency);
+    auto apply = [&task, &frequency, &mark](std::shared_ptr<Pq> pq, const std::string &sql, long &last) {
+        if (last >= task.sequence) {
+            return true;
+        }
+        if (pq->transaction(sql + mark)) {
+            last = task.sequence;
+            return true;
+        }
+        // The connection may have dropped after the commit, so only
+        // the database knows for sure
+        last = std::max(last, readHighWaterMark(pq, frequency).sequence);
+        return last >= task.sequence;
+    };
+    bool ok = apply(db, osmsql, marks.db);
+    ok = apply(osmdb, unsql, marks.osmdb) && ok;
+    if (!ok) {
+        log_error("Sequence %1% (%2%) was not fully committed!", task.sequence, task.url);
+    }
+    return ok;
+}
+
+// Import a file that isn't part of the replication sequence, a batch
+// of objects at a time
+void
+importChangeFile(const std::string &filespec,
+                 const geoutil::PreparedBoundary &poly,
+                 const geoutil::RegionSet &regions,
+                 const UnderpassConfig &config)
+{
+#ifdef TIMING_DEBUG
+    boost::timer::auto_cpu_timer timer("importChangeFile: took %w seconds\n");
+#endif
+    auto validator = loadValidator();
+    if (!validator) {
+        return;
+    }
+    auto db = std::make_shared<Pq>();
+    if (!db->connect(config.underpass_db_url)) {
+        log_error("Could not connect to Underpass DB, aborting import!");
+        return;
+    }
+    auto osmdb = std::make_shared<Pq>();
+    if (!osmdb->connect(config.underpass_osm_db_url)) {
+        log_error("Could not connect to raw OSM DB, aborting import!");
+        return;
+    }
+    auto querystats = std::make_shared<QueryStats>(db);
+    auto queryvalidate = std::make_shared<QueryValidate>(db);
+    auto queryraw = std::make_shared<QueryRaw>(osmdb);
+    std::shared_ptr<nodelocations::NodeLocationStore> locations;
+    if (!config.node_locations.empty()) {
+        auto store = std::make_shared<nodelocations::MmapLocations>();
+        if (store->open(config.node_locations)) {
+            locations = store;
+        }
+    }
+
+    // Each batch is applied before the next one is read, so the ways
+    // of a later batch find their nodes in the database, or the node
+    // locations if there are any
+    auto import = [&](std::shared_ptr<osmchange::OsmChangeFile> osmchanges) {
+        osmchanges->locations = locations;
+        buildOsmChangeGeometries(osmchanges, poly, regions, queryraw, config);
+        auto tasks = std::make_shared<std::vector<ReplicationTask>>(1);
+        ReplicationTask &task = tasks->front();
+        task.url = filespec;
+        analyzeOsmChange(osmchanges, poly, validator, querystats,
+                         queryvalidate, queryraw, config, task);
+        applyTasks(tasks, db, osmdb);
+        if (locations) {
+            for (auto it = std::begin(osmchanges->changes); it != std::end(osmchanges->changes); ++it) {
+                auto &nodes = it->get()->nodes;
+                for (auto nit = std::begin(nodes); nit != std::end(nodes); ++nit) {
+                    osmobjects::OsmNode *node = &*nit;
+                    if (node->action == osmobjects::remove) {
+                        locations->remove(node->id);
+                    } else {
+                        locations->set(node->id, node->point);
+                    }
+                }
+            }
+        }
+    };
+
+    if (!osmiumreader::isOsmiumFile(filespec)) {
+        // osmChange XML, which may be gzipped
+        std::ifstream file(filespec, std::ios::binary);
+        if (!file) {
+            log_error("Couldn't open %1%", filespec);
+            return;
+        }
+        std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)),
+                                        std::istreambuf_iterator<char>());
+        auto osmchanges = std::make_shared<osmchange::OsmChangeFile>();
+        try {
+            if (config.parser == "fast") {
+                if (!oscparser::parseParallel(*osmchanges, data.data(), data.size())) {
+                    log_error("%1% is not a valid osmChange file", filespec);
+                    return;
+                }
+            } else {
+                osmchanges->readXML(data.data(), data.size());
+            }
+        } catch (std::exception &e) {
+            log_error("%1% is corrupted! %2%", filespec, e.what());
+            return;
+        }
+        import(osmchanges);
+        return;
+    }
+
+    osmiumreader::OsmiumReader reader(filespec);
+    if (!reader.open()) {
+        return;
+    }
+    long objects = 0;
+    bool more = true;
+    while (more) {
+        auto osmchanges = std::make_shared<osmchange::OsmChangeFile>();
+        more = reader.read(*osmchanges, import_batch);
+        if (!reader.good()) {
+            break;
+        }
+        for (auto it = std::begin(osmchanges->changes); it != std::end(osmchanges->changes); ++it) {
+            objects += it->get()->nodes.size() + it->get()->ways.size() + it->get()->relations.size();
+        }
+        import(osmchanges);
+        log_info("Imported %1% objects from %2%", objects, filespec);
+    }
 }
 
 } // namespace replicatorthreads
@@ -68,11 +68,14 @@ namespace http = beast::http;
 using tcp = net::ip::tcp;
 
 #include "replicator/replication.hh"
+#include "replicator/serverselector.hh"
 #include "underpassconfig.hh"
 #include "stats/querystats.hh"
 #include "validate/queryvalidate.hh"
 #include "raw/queryraw.hh"
 #include "validate/validate.hh"
+#include "utils/boundary.hh"
+#include "utils/regions.hh"
 #include <ogr_geometry.h>
 
 using namespace queryvalidate;
@@ -94,17 +97,29 @@ namespace replicatorthreads {
 /// \brief Represents a replication task
 struct ReplicationTask {
     std::string url;
+    long sequence = -1;     ///< The sequence number of the replication file
     ptime timestamp = not_a_date_time;
     replication::reqfile_t status = replication::reqfile_t::none;
     std::vector<std::string> query;
 };
 
+/// \struct HighWaterMarks
+/// \brief The last sequence committed to each database
+///
+/// These are read once at startup and then kept up to date as the
+/// files are committed, rather than read again for every file.
+struct HighWaterMarks {
+    long db = -1;
+    long osmdb = -1;
+};
+
 /// This monitors the planet server for new changesets files.
 /// It does a bulk download to catch up the database, then checks for the
 /// minutely change files and processes them.
 extern void
 startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
-    const multipolygon_t &poly,
+    const geoutil::PreparedBoundary &poly,
+    const geoutil::RegionSet &regions,
     const underpassconfig::UnderpassConfig config
 );
 
@@ -112,8 +127,9 @@ startMonitorChangesets(std::shared_ptr<replication::RemoteURL> &remote,
 /// the changeset file, and don't need to be calculated.
 void
 threadChangeSet(std::shared_ptr<replication::RemoteURL> &remote,
-    std::shared_ptr<replication::Planet> &planet,
-    const multipolygon_t &poly,
+    replication::RequestedFile file,
+    const geoutil::PreparedBoundary &poly,
+    const geoutil::RegionSet &regions,
     std::shared_ptr<std::vector<ReplicationTask>> tasks,
     std::shared_ptr<QueryStats> &querystats
 );
@@ -123,27 +139,112 @@ threadChangeSet(std::shared_ptr<replication::RemoteURL> &remote,
 /// minutely change files and processes them.
 extern void
 startMonitorChanges(std::shared_ptr<replication::RemoteURL> &remote,
-    const multipolygon_t &poly,
+    const geoutil::PreparedBoundary &poly,
+    const geoutil::RegionSet &regions,
     const underpassconfig::UnderpassConfig &config
 );
 
-struct OsmChangeTask {
-        std::shared_ptr<replication::RemoteURL> remote;
-        std::shared_ptr<replication::Planet> planet;
-        const multipolygon_t poly;
-        std::shared_ptr<Validate> plugin;
-        std::shared_ptr<std::vector<ReplicationTask>> tasks;
-        std::shared_ptr<QueryStats> querystats;
-        std::shared_ptr<QueryValidate> queryvalidate;
-        std::shared_ptr<QueryRaw> queryraw;
-        std::shared_ptr<UnderpassConfig> config;
-        const int taskIndex;
-};
+/// Decompress and parse a downloaded osmChange file, with the parser
+/// chosen in the config. The timestamp of the last entry is stored in
+/// the task.
+std::shared_ptr<osmchange::OsmChangeFile>
+parseOsmChange(replication::RemoteURL &remote,
+    replication::RequestedFile &file,
+    ReplicationTask &task,
+    const underpassconfig::UnderpassConfig &config
+);
+
+/// Build the way and relation geometries, flag the objects that are
+/// in the priority area, and set the regions they are in
+void
+buildOsmChangeGeometries(std::shared_ptr<osmchange::OsmChangeFile> osmchanges,
+    const geoutil::PreparedBoundary &poly,
+    const geoutil::RegionSet &regions,
+    std::shared_ptr<QueryRaw> queryraw,
+    const underpassconfig::UnderpassConfig &config
+);
+
+/// Collect the statistics, raw data and validation queries for
+/// an osmChange file into the task
+void
+analyzeOsmChange(std::shared_ptr<osmchange::OsmChangeFile> osmchanges,
+    const geoutil::PreparedBoundary &poly,
+    std::shared_ptr<Validate> plugin,
+    std::shared_ptr<QueryStats> querystats,
+    std::shared_ptr<QueryValidate> queryvalidate,
+    std::shared_ptr<QueryRaw> queryraw,
+    const underpassconfig::UnderpassConfig &config,
+    ReplicationTask &task
+);
+
+/// Import a PBF, OPL, o5m or osmChange file, which isn't part of the
+/// replication sequence, like the initial load of a country. Large
+/// files are processed a batch of objects at a time.
+void
+importChangeFile(const std::string &filespec,
+    const geoutil::PreparedBoundary &poly,
+    const geoutil::RegionSet &regions,
+    const underpassconfig::UnderpassConfig &config
+);
+
+/// Apply the queries of the tasks to the databases
+void
+applyTasks(std::shared_ptr<std::vector<ReplicationTask>> tasks,
+    std::shared_ptr<Pq> db,
+    std::shared_ptr<Pq> osmdb
+);
+
+/// Apply the queries of a single task, each database in its own
+/// transaction, along with the high-water mark for \a frequency.
+/// A database that already has the sequence in \a marks is skipped,
+/// so a task that failed can be applied again, and \a marks is
+/// updated. Returns false if anything failed.
+bool
+applyTask(const ReplicationTask &task, const std::string &frequency,
+    std::shared_ptr<Pq> db,
+    std::shared_ptr<Pq> osmdb,
+    HighWaterMarks &marks
+);
+
+/// The query recording \a task as the last sequence committed
+std::string
+highWaterMark(const ReplicationTask &task, const std::string &frequency);
+
+/// Create the table for the high-water mark in \a db, if it isn't
+/// there yet
+bool prepareReplicationState(std::shared_ptr<Pq> db);
+
+/// The last sequence for \a frequency committed to \a db, and its
+/// timestamp. The sequence is -1 if there is none.
+ReplicationTask
+readHighWaterMark(std::shared_ptr<Pq> db, const std::string &frequency);
+
+/// The last sequences for \a frequency committed to \a db and \a osmdb
+HighWaterMarks
+readHighWaterMarks(std::shared_ptr<Pq> db, std::shared_ptr<Pq> osmdb, const std::string &frequency);
+
+/// The last file of \a frequency committed to both databases, so
+/// replication can resume after it. The sequence is -1 if there is none.
+ReplicationTask
+lastCommitted(const underpassconfig::UnderpassConfig &config, frequency_t frequency);
+
+/// Make a selector for all the planet servers that have the
+/// frequency of \a remote
+std::shared_ptr<replication::ServerSelector>
+makeSelector(const replication::RemoteURL &remote,
+    const underpassconfig::UnderpassConfig &config
+);
+
+/// The smallest backlog worth catching up with files of \a frequency
+boost::posix_time::time_duration minimumBacklog(frequency_t frequency);
+
+/// The coarsest frequency worth using to catch up with a backlog of \a lag
+frequency_t catchUpFrequency(boost::posix_time::time_duration lag);
 
-/// Updates the tables from a changeset file
-void threadOsmChange(OsmChangeTask osmChangeTask);
+/// Get the task with the timestamp closest to \a now
+std::shared_ptr<ReplicationTask>
+getClosest(std::shared_ptr<std::vector<ReplicationTask>> tasks, ptime now);
 
-static std::mutex tasks_change_mutex;
 static std::mutex tasks_changeset_mutex;
 
 } // namespace replicatorthreads
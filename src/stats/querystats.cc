@@ -53,12 +53,21 @@ using namespace boost::gregorian;
 #include "osm/changeset.hh"
 #include "stats/querystats.hh"
 #include "data/pq.hh"
+#include "utils/regions.hh"
 using namespace pq;
 using namespace logger;
 
 /// \namespace querystats
 namespace querystats {
 
+// A changeset can be in several files, so the regions already stored
+// are kept
+static std::string
+mergeRegions(const std::string &array)
+{
+    return "ARRAY(SELECT DISTINCT unnest(array_cat(changesets.regions, " + array + ")))";
+}
+
 QueryStats::QueryStats(void) {}
 
 QueryStats::QueryStats(std::shared_ptr<Pq> db) {
@@ -101,6 +110,11 @@ QueryStats::applyChange(const osmchange::ChangeStats &change) const
             mhstore += "])";
         }
 
+        std::string regions;
+        if (change.regions.size() > 0) {
+            regions = geoutil::regionArray(change.regions, *dbconn);
+        }
+
         // Some of the data field in the changset come from a different file,
         // which may not be downloaded yet.
         ptime now = boost::posix_time::microsec_clock::universal_time();
@@ -112,6 +126,9 @@ QueryStats::applyChange(const osmchange::ChangeStats &change) const
         if (change.modified.size() > 0) {
             aquery += "modified, ";
         }
+        if (change.regions.size() > 0) {
+            aquery += "regions, ";
+        }
         aquery.erase(aquery.size() - 2);
         aquery += ")";
 
@@ -126,6 +143,9 @@ QueryStats::applyChange(const osmchange::ChangeStats &change) const
         if (change.modified.size() > 0) {
             aquery += mhstore + ", ";
         }
+        if (change.regions.size() > 0) {
+            aquery += regions + ", ";
+        }
 
         aquery.erase(aquery.size() - 2);
         aquery += ") ON CONFLICT (id) DO UPDATE SET";
@@ -142,6 +162,9 @@ QueryStats::applyChange(const osmchange::ChangeStats &change) const
         } else {
             aquery += "modified = null, ";
         }
+        if (change.regions.size() > 0) {
+            aquery += "regions = " + mergeRegions(regions) + ", ";
+        }
         aquery.erase(aquery.size() - 2);
 
         return aquery + ";";
@@ -167,6 +190,10 @@ QueryStats::applyChange(const changesets::ChangeSet &change) const
         query += ", source ";
     }
 
+    if (change.regions.size() > 0) {
+        query += ", regions ";
+    }
+
     query += ", bbox) VALUES(";
     query += std::to_string(change.id) + ",'" + dbconn->escapedString(change.editor) + "',\'";
 
@@ -198,6 +225,12 @@ QueryStats::applyChange(const changesets::ChangeSet &change) const
         query += ",\'" + change.source += "\'";
     }
 
+    std::string regions;
+    if (change.regions.size() > 0) {
+        regions = geoutil::regionArray(change.regions, *dbconn);
+        query += ", " + regions;
+    }
+
     // Store the current values as they can get changed to expand very short
     // lines or POIs so they have a bounding box big enough for Postgis to use.
     double min_lat = change.min_lat;
@@ -270,6 +303,10 @@ QueryStats::applyChange(const changesets::ChangeSet &change) const
         query += ", hashtags=null";
     }
 
+    if (change.regions.size() > 0) {
+        query += ", regions=" + mergeRegions(regions);
+    }
+
     query += ", bbox=" + bbox.substr(2) + ")'));";
 
     return query;
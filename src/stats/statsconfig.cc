@@ -25,12 +25,15 @@
 #include "utils/yaml.hh"
 #include "statsconfig.hh"
 #include "osm/osmchange.hh"
+#include <algorithm>
 #include <memory>
 
 /// \namespace statsconfig
 namespace statsconfig {
 
-    std::map<std::string, std::shared_ptr<std::vector<StatsConfigCategory>>> StatsConfig::cache;
+    std::shared_ptr<const StatsClassifier> StatsConfig::compiled;
+    std::string StatsConfig::compiled_path;
+    std::mutex StatsConfig::compiled_mutex;
     std::string StatsConfig::path;
 
     StatsConfigCategory::StatsConfigCategory(std::string name) {
@@ -49,110 +52,158 @@ namespace statsconfig {
     };
 
 
-    StatsConfig::StatsConfig() {
-        if (path.empty()) {
-            path = ETCDIR;
-            path += "/stats/statistics.yaml";
-            if (!boost::filesystem::exists(path)) {
-                throw std::runtime_error("Statistics file not found: " + path);
+    StatsClassifier::StatsClassifier(const std::vector<StatsConfigCategory> &categories) {
+        // The categories are compiled in order, so the first one found
+        // for a wildcard, key or value is kept
+        auto compile = [this](TypeRules &rules, category_t id, const std::map<std::string, std::set<std::string>> &tags) {
+            for (auto tag_it = std::begin(tags); tag_it != std::end(tags); ++tag_it) {
+                if (tag_it->first == "*") {
+                    if (rules.any == none) {
+                        rules.any = id;
+                    }
+                    continue;
+                }
+                KeyRule &key = rules.keys[*strings.insert(tag_it->first).first];
+                if (!tag_it->second.empty() && *(tag_it->second.begin()) == "*") {
+                    if (key.any == none) {
+                        key.any = id;
+                    }
+                    continue;
+                }
+                for (auto value_it = std::begin(tag_it->second); value_it != std::end(tag_it->second); ++value_it) {
+                    key.values.emplace(*strings.insert(*value_it).first, id);
+                }
+            }
+        };
+        for (size_t i = 0; i < categories.size() && i < none; ++i) {
+            const StatsConfigCategory &category = categories[i];
+            if (category.name == "\"[key]\"") {
+                names.emplace_back(category.name, key_name);
+            } else if (category.name == "\"[key:value]\"") {
+                names.emplace_back(category.name, key_value_name);
+            } else {
+                names.emplace_back(category.name, fixed_name);
             }
+            compile(nodes, i, category.node);
+            compile(ways, i, category.way);
+            compile(relations, i, category.relation);
         }
-        read_yaml(path);
+    }
+
+    const StatsClassifier::TypeRules *StatsClassifier::rules(osmchange::osmtype_t type) const {
+        if (type == osmchange::node) {
+            return &nodes;
+        } else if (type == osmchange::way) {
+            return &ways;
+        } else if (type == osmchange::relation) {
+            return &relations;
+        }
+        return nullptr;
+    }
+
+    category_t StatsClassifier::classify(osmchange::osmtype_t type, std::string_view key, std::string_view value) const {
+        const TypeRules *typerules = rules(type);
+        if (!typerules) {
+            return none;
+        }
+        category_t category = typerules->any;
+        auto key_it = typerules->keys.find(key);
+        if (key_it != typerules->keys.end()) {
+            category = std::min(category, key_it->second.any);
+            auto value_it = key_it->second.values.find(value);
+            if (value_it != key_it->second.values.end()) {
+                category = std::min(category, value_it->second);
+            }
+        }
+        return category;
+    }
+
+    std::string StatsClassifier::name(category_t category, std::string_view key, std::string_view value) const {
+        if (category >= names.size()) {
+            return "";
+        }
+        if (names[category].second == key_name) {
+            return std::string(key);
+        } else if (names[category].second == key_value_name) {
+            std::string name(key);
+            name += ":";
+            name += value;
+            return name;
+        }
+        return names[category].first;
+    }
+
+    StatsConfig::StatsConfig() {
+        rules = classifier();
     }
 
     void StatsConfig::setConfigurationFile(std::string statsConfigFilename) {
         if (!boost::filesystem::exists(statsConfigFilename)) {
             throw std::runtime_error("Statistics configuration file not found: " + statsConfigFilename);
         }
+        const std::lock_guard<std::mutex> lock(compiled_mutex);
         path = statsConfigFilename;
     }
 
-    std::shared_ptr<std::vector<StatsConfigCategory>> StatsConfig::read_yaml(std::string filename) {
-        if (!cache.count(filename)) {
-            yaml::Yaml yaml;
-            yaml.read(filename);
-
-            auto statscategories = std::make_shared<std::vector<StatsConfigCategory>>();
-            for (auto it = std::begin(yaml.root.children); it != std::end(yaml.root.children); ++it) {
-                std::map<std::string, std::set<std::string>> way_tags;
-                std::map<std::string, std::set<std::string>> node_tags;
-                std::map<std::string, std::set<std::string>> relation_tags;
-                for (auto type_it = std::begin(it->children); type_it != std::end(it->children); ++type_it) {
-                    for (auto value_it = std::begin(type_it->children); value_it != std::end(type_it->children); ++value_it) {
-                        if (value_it->value != "*") {
-                            for (auto tag_it = std::begin(value_it->children); tag_it != std::end(value_it->children); ++tag_it) {
-                                if (type_it->value == "way") {
-                                    way_tags[value_it->value].insert(tag_it->value);
-                                } else if (type_it->value == "node") {
-                                    node_tags[value_it->value].insert(tag_it->value);
-                                } else if (type_it->value == "relation") {
-                                    relation_tags[value_it->value].insert(tag_it->value);
-                                }
-                            }
-                        } else {
+    std::shared_ptr<const StatsClassifier> StatsConfig::classifier(void) {
+        const std::lock_guard<std::mutex> lock(compiled_mutex);
+        if (path.empty()) {
+            path = ETCDIR;
+            path += "/stats/statistics.yaml";
+            if (!boost::filesystem::exists(path)) {
+                throw std::runtime_error("Statistics file not found: " + path);
+            }
+        }
+        if (!compiled || compiled_path != path) {
+            compiled = std::make_shared<const StatsClassifier>(read_yaml(path));
+            compiled_path = path;
+        }
+        return compiled;
+    }
+
+    std::vector<StatsConfigCategory> StatsConfig::read_yaml(const std::string &filename) {
+        yaml::Yaml yaml;
+        yaml.read(filename);
+
+        std::vector<StatsConfigCategory> statscategories;
+        for (auto it = std::begin(yaml.root.children); it != std::end(yaml.root.children); ++it) {
+            std::map<std::string, std::set<std::string>> way_tags;
+            std::map<std::string, std::set<std::string>> node_tags;
+            std::map<std::string, std::set<std::string>> relation_tags;
+            for (auto type_it = std::begin(it->children); type_it != std::end(it->children); ++type_it) {
+                for (auto value_it = std::begin(type_it->children); value_it != std::end(type_it->children); ++value_it) {
+                    if (value_it->value != "*") {
+                        for (auto tag_it = std::begin(value_it->children); tag_it != std::end(value_it->children); ++tag_it) {
                             if (type_it->value == "way") {
-                                way_tags["*"].insert("*");
+                                way_tags[value_it->value].insert(tag_it->value);
                             } else if (type_it->value == "node") {
-                                node_tags["*"].insert("*");
+                                node_tags[value_it->value].insert(tag_it->value);
                             } else if (type_it->value == "relation") {
-                                relation_tags["*"].insert("*");
+                                relation_tags[value_it->value].insert(tag_it->value);
                             }
                         }
+                    } else {
+                        if (type_it->value == "way") {
+                            way_tags["*"].insert("*");
+                        } else if (type_it->value == "node") {
+                            node_tags["*"].insert("*");
+                        } else if (type_it->value == "relation") {
+                            relation_tags["*"].insert("*");
+                        }
                     }
                 }
-                statscategories->push_back(
-                    StatsConfigCategory(it->value, way_tags, node_tags, relation_tags)
-                );
             }
-            cache.insert(
-                std::pair<std::string, std::shared_ptr<std::vector<StatsConfigCategory>>>(
-                    filename, statscategories
-                )
+            statscategories.push_back(
+                StatsConfigCategory(it->value, way_tags, node_tags, relation_tags)
             );
         }
-        return cache.at(filename);
+        return statscategories;
     }
 
-    bool StatsConfig::searchCategory(std::string tag, std::string value, std::map<std::string, std::set<std::string>> tags) {
-        for (auto tag_it = std::begin(tags); tag_it != std::end(tags); ++tag_it) {
-            if (tag_it->first == "*" || (
-                    tag == tag_it->first && (
-                        *(tag_it->second.begin()) == "*" ||
-                        tag_it->second.find(value) != tag_it->second.end()
-                    )
-                )
-            ) {
-                return true;
-            }
-        }
-        return false;
-    };
-
-    std::string StatsConfig::search(std::string tag, std::string value, osmchange::osmtype_t type) {
-        bool category = false;
-        std::vector<StatsConfigCategory> statscategories = *cache.begin()->second.get();
-        for (auto it = std::begin(statscategories); it != std::end(statscategories); ++it) {
-            if (type == osmchange::node) {
-                category = searchCategory(tag, value, it->node);
-            } else if (type == osmchange::way) {
-                category = searchCategory(tag, value, it->way);
-            } else if (type == osmchange::relation) {
-                category = searchCategory(tag, value, it->relation);
-            }
-            if (category) {
-                if (it->name == "\"[key]\"") {
-                    return tag;
-                } else if (it->name == "\"[key:value]\"") {
-                    return tag + ":" + value;
-                }
-                return it->name;
-            }
-        }
-        return "";
+    std::string StatsConfig::search(const std::string &tag, const std::string &value, osmchange::osmtype_t type) {
+        return rules->name(rules->classify(type, tag, value), tag, value);
     }
 
-
-
 } // EOF statsconfig namespace
 
 // Local Variables:
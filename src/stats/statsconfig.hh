@@ -30,8 +30,13 @@
 # include "unconfig.h"
 #endif
 
+#include <cstdint>
 #include <map>
+#include <mutex>
+#include <set>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <memory>
 #include "osm/osmchange.hh"
@@ -57,18 +62,71 @@ namespace statsconfig {
             );
     };
 
+    /// The ID of a category, its position in the configuration file
+    typedef uint16_t category_t;
+
+    /// \class StatsClassifier
+    /// \brief The stats configuration compiled for fast lookups
+    ///
+    /// Instead of walking every category for every tag, the key and
+    /// value of a tag are looked up in hash tables, which have the first
+    /// category they are in for each OSM type, with the wildcards
+    /// already resolved. It doesn't change once compiled, so it's shared
+    /// by all the threads collecting statistics.
+    class StatsClassifier {
+        public:
+            /// The category of a tag that isn't in any
+            static const category_t none = UINT16_MAX;
+            StatsClassifier(const std::vector<StatsConfigCategory> &categories);
+            /// The tables point to the strings it owns
+            StatsClassifier(const StatsClassifier &other) = delete;
+            StatsClassifier &operator=(const StatsClassifier &other) = delete;
+            /// The first category with this tag for the OSM type
+            category_t classify(osmchange::osmtype_t type, std::string_view key, std::string_view value) const;
+            /// The name the statistics of a tag in a category are kept
+            /// under, the category can be named after the tag
+            std::string name(category_t category, std::string_view key, std::string_view value) const;
+        private:
+            /// The keys and values of the tables, which are looked up
+            /// with the tags of the objects without copying them
+            std::set<std::string> strings;
+            /// \struct KeyRule
+            /// \brief The first categories with any value of a key, or a value
+            struct KeyRule {
+                category_t any = none;
+                std::unordered_map<std::string_view, category_t> values;
+            };
+            /// \struct TypeRules
+            /// \brief The first categories with any tag, or a key, for an OSM type
+            struct TypeRules {
+                category_t any = none;
+                std::unordered_map<std::string_view, KeyRule> keys;
+            };
+            typedef enum { fixed_name, key_name, key_value_name } naming_t;
+            TypeRules nodes;
+            TypeRules ways;
+            TypeRules relations;
+            std::vector<std::pair<std::string, naming_t>> names;
+            const TypeRules *rules(osmchange::osmtype_t type) const;
+    };
+
    /// \class StatsConfig
    /// \brief Stats configuration manager
    class StatsConfig {
         public:
             StatsConfig();
-            std::string search(std::string tag, std::string value, osmchange::osmtype_t type);
+            std::string search(const std::string &tag, const std::string &value, osmchange::osmtype_t type);
             static void setConfigurationFile(std::string statsConfigFilename);
+            /// The compiled configuration file, which is only read again
+            /// if another file is set
+            static std::shared_ptr<const StatsClassifier> classifier(void);
         private:
-            static std::map<std::string, std::shared_ptr<std::vector<StatsConfigCategory>>> cache;
+            static std::shared_ptr<const StatsClassifier> compiled;
+            static std::string compiled_path;
+            static std::mutex compiled_mutex;
             static std::string path;
-            bool searchCategory(std::string tag, std::string value, std::map<std::string, std::set<std::string>> tags);
-            std::shared_ptr<std::vector<statsconfig::StatsConfigCategory>> read_yaml(std::string filename);
+            std::shared_ptr<const StatsClassifier> rules;
+            static std::vector<statsconfig::StatsConfigCategory> read_yaml(const std::string &filename);
 
     };
 
@@ -39,19 +39,19 @@ countFeatures(TestOsmChange &osmchange) {
     for (auto cit = std::begin(osmchange.changes); cit != std::end(osmchange.changes); ++cit) {
         osmchange::OsmChange *testOsmChange = cit->get();
         for (auto nit = std::begin(testOsmChange->nodes); nit != std::end(testOsmChange->nodes); ++nit) {
-            osmobjects::OsmNode *node = nit->get();
+            osmobjects::OsmNode *node = &*nit;
             if (node->priority) {
                 nodeCount++;
             }
         }
         for (auto wit = std::begin(testOsmChange->ways); wit != std::end(testOsmChange->ways); ++wit) {
-            osmobjects::OsmWay *way = wit->get();
+            osmobjects::OsmWay *way = &*wit;
             if (way->priority) {
                 wayCount++;
             }
         }
         for (auto rit = std::begin(testOsmChange->relations); rit != std::end(testOsmChange->relations); ++rit) {
-            osmobjects::OsmRelation *relation = rit->get();
+            osmobjects::OsmRelation *relation = &*rit;
             if (relation->priority) {
                 relCount++;
             }
@@ -71,13 +71,13 @@ getPriority(TestOsmChange &osmchange, bool debug = false) {
     for (auto cit = std::begin(osmchange.changes); cit != std::end(osmchange.changes); ++cit) {
         osmchange::OsmChange *testOsmChange = cit->get();
         for (auto nit = std::begin(testOsmChange->nodes); nit != std::end(testOsmChange->nodes); ++nit) {
-            osmobjects::OsmNode *node = nit->get();
+            osmobjects::OsmNode *node = &*nit;
             if (!node->priority) {
                 result = false;
             }
         }
         for (auto wit = std::begin(testOsmChange->ways); wit != std::end(testOsmChange->ways); ++wit) {
-            osmobjects::OsmWay *way = wit->get();
+            osmobjects::OsmWay *way = &*wit;
             if (!way->priority) {
                 result = false;
             }
@@ -98,6 +98,12 @@ main(int argc, char *argv[])
     multipolygon_t polyHalfSmall;
     boost::geometry::read_wkt("MULTIPOLYGON(((91.08695983886719 25.195485830324174,91.08697056770325 25.192155906163805,91.08929872512817 25.192126781061106,91.08922362327574 25.195505246524604,91.08695983886719 25.195485830324174)))", polyHalfSmall);
     multipolygon_t polyEmpty;
+    // The filters take the prepared boundaries
+    geoutil::PreparedBoundary boundaryWholeWorld(polyWholeWorld);
+    geoutil::PreparedBoundary boundarySmallArea(polySmallArea);
+    geoutil::PreparedBoundary boundaryHalf(polyHalf);
+    geoutil::PreparedBoundary boundaryHalfSmall(polyHalfSmall);
+    geoutil::PreparedBoundary boundaryEmpty(polyEmpty);
 
     // -- ChangeSets
 
@@ -112,7 +118,7 @@ main(int argc, char *argv[])
 
     // ChangeSet - Whole world
     changeset.readChanges(changesetFile);
-    changeset.areaFilter(polyWholeWorld);
+    changeset.areaFilter(boundaryWholeWorld);
     testChangeset = changeset.changes.front().get();
     if (testChangeset && testChangeset->priority) {
         runtest.pass("ChangeSet areaFilter - true (whole world)");
@@ -124,7 +130,7 @@ main(int argc, char *argv[])
     // ChangeSet - Small area in North Africa
     // outside, not in priority area
     changeset.readChanges(changesetFile);
-    changeset.areaFilter(polySmallArea);
+    changeset.areaFilter(boundarySmallArea);
     testChangeset = changeset.changes.front().get();
     if (testChangeset && testChangeset->priority) {
         runtest.fail("ChangeSet areaFilter - false (small area)");
@@ -135,7 +141,7 @@ main(int argc, char *argv[])
     // ChangeSet - Empty polygon
     // inside, in priority area
     changeset.readChanges(changesetFile);
-    changeset.areaFilter(polyEmpty);
+    changeset.areaFilter(boundaryEmpty);
     testChangeset = changeset.changes.front().get();
     if (testChangeset && testChangeset->priority) {
         runtest.pass("ChangeSet areaFilter - true (empty)");
@@ -146,7 +152,7 @@ main(int argc, char *argv[])
 
     // ChangeSet - Half area
     changeset.readChanges(changesetFile);
-    changeset.areaFilter(polyHalf);
+    changeset.areaFilter(boundaryHalf);
     // inside, in priority area
     testChangeset = changeset.changes.front().get();
     if (testChangeset && testChangeset->priority) {
@@ -162,7 +168,7 @@ main(int argc, char *argv[])
     osmchange.readChanges(osmchangeFile);
     osmchange.buildGeometriesFromNodeCache();
 
-    osmchange.areaFilter(polyEmpty);
+    osmchange.areaFilter(boundaryEmpty);
     if (getPriority(osmchange) && countFeatures(osmchange) == 54) {
         runtest.pass("OsmChange areaFilter - 54 (empty poly)");
     } else {
@@ -171,7 +177,7 @@ main(int argc, char *argv[])
     }
 
     // OsmChange - Whole world
-    osmchange.areaFilter(polyWholeWorld);
+    osmchange.areaFilter(boundaryWholeWorld);
     if (getPriority(osmchange) && countFeatures(osmchange) == 54) {
         runtest.pass("OsmChange areaFilter - 54 (whole world)");
     } else {
@@ -181,7 +187,7 @@ main(int argc, char *argv[])
 
     // OsmChange - Small area in North Africa
     // Outside priority area, count should be 0
-    osmchange.areaFilter(polySmallArea);
+    osmchange.areaFilter(boundarySmallArea);
     if (countFeatures(osmchange) == 0) {
         runtest.pass("OsmChange areaFilter - 0 (Small area)");
     } else {
@@ -191,7 +197,7 @@ main(int argc, char *argv[])
 
     // OsmChange - Small area in Bangladesh
     // 28 nodes / 5 ways / 1 relation inside priority area, count should be 34
-    osmchange.areaFilter(polyHalf);
+    osmchange.areaFilter(boundaryHalf);
     if (countFeatures(osmchange) == 34) {
         runtest.pass("OsmChange areaFilter - 34 (small area)");
     } else {
@@ -201,7 +207,7 @@ main(int argc, char *argv[])
 
     // OsmChange - Smaller area in Bangladesh
     // 12 nodes / 3 ways / 1 relation inside priority area, count should be 16
-    osmchange.areaFilter(polyHalfSmall);
+    osmchange.areaFilter(boundaryHalfSmall);
     if (countFeatures(osmchange) == 16) {
         runtest.pass("OsmChange areaFilter - 16 (smaller area)");
     } else {
@@ -0,0 +1,366 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <dejagnu.h>
+#include <boost/geometry.hpp>
+#include "osm/changeset.hh"
+#include "osm/osmchange.hh"
+#include "utils/boundary.hh"
+#include "utils/geoutil.hh"
+#include "utils/regions.hh"
+
+TestState runtest;
+
+using namespace logger;
+namespace bg = boost::geometry;
+
+class TestOsmChange : public osmchange::OsmChangeFile {};
+
+// Points all over the boundary, and on and next to its edges, where the
+// grid and the edge bands have to get it right
+std::vector<point_t>
+testPoints(const multipolygon_t &poly)
+{
+    std::vector<point_t> points;
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> offset(-1, 1);
+    auto envelope = bg::return_envelope<bg::model::box<point_t>>(poly);
+    double width = envelope.max_corner().x() - envelope.min_corner().x();
+    double height = envelope.max_corner().y() - envelope.min_corner().y();
+    for (int y = -10; y < 510; y++) {
+        for (int x = -10; x < 510; x++) {
+            points.emplace_back(envelope.min_corner().x() + width * x / 500,
+                                envelope.min_corner().y() + height * y / 500);
+        }
+    }
+    auto addRing = [&](const polygon_t::ring_type &ring) {
+        for (size_t i = 0; i < ring.size(); i++) {
+            const point_t &vertex = ring[i];
+            points.push_back(vertex);
+            for (double distance: {1e-13, 1e-11, 1e-9, 1e-7, 1e-5}) {
+                points.emplace_back(vertex.x() + distance * offset(random), vertex.y() + distance * offset(random));
+            }
+            if (i > 0) {
+                double t = (offset(random) + 1) / 2;
+                point_t middle(ring[i - 1].x() + t * (vertex.x() - ring[i - 1].x()),
+                               ring[i - 1].y() + t * (vertex.y() - ring[i - 1].y()));
+                points.push_back(middle);
+                for (double distance: {1e-15, 1e-12, 1e-9}) {
+                    points.emplace_back(middle.x() + distance * offset(random), middle.y() + distance * offset(random));
+                }
+            }
+        }
+    };
+    for (auto it = poly.begin(); it != poly.end(); ++it) {
+        addRing(it->outer());
+        for (auto iit = it->inners().begin(); iit != it->inners().end(); ++iit) {
+            addRing(*iit);
+        }
+    }
+    return points;
+}
+
+// Compare the prepared boundary with boost::geometry for the points
+bool
+samePoints(const std::string &name, const multipolygon_t &poly, const std::vector<point_t> &points)
+{
+    geoutil::PreparedBoundary prepared(poly);
+    int errors = 0;
+    for (auto it = points.begin(); it != points.end(); ++it) {
+        if (prepared.within(*it) != bg::within(*it, poly)) {
+            if (errors++ < 5) {
+                std::cerr.precision(17);
+                std::cerr << name << ": " << bg::wkt(*it) << " should be " << bg::within(*it, poly) << std::endl;
+            }
+        }
+    }
+    if (errors == 0) {
+        runtest.pass("PreparedBoundary::within(point) - " + name);
+        return true;
+    }
+    runtest.fail("PreparedBoundary::within(point) - " + name);
+    return false;
+}
+
+// Compare testing the points all at once, with and without SIMD, with
+// testing them one at a time
+bool
+sameBatch(const std::string &name, const multipolygon_t &poly, const std::vector<point_t> &points)
+{
+    geoutil::PreparedBoundary prepared(poly);
+    std::vector<double> x;
+    std::vector<double> y;
+    for (auto it = points.begin(); it != points.end(); ++it) {
+        x.push_back(it->x());
+        y.push_back(it->y());
+    }
+    int errors = 0;
+    for (bool simd: {true, false}) {
+        geoutil::PreparedBoundary::useSimd(simd);
+        // An odd count, so the last points don't fill a vector
+        std::vector<uint8_t> inside(points.size());
+        prepared.within(x.data(), y.data(), points.size() - 1, inside.data());
+        for (size_t i = 0; i + 1 < points.size(); i++) {
+            if (inside[i] != prepared.within(points[i])) {
+                if (errors++ < 5) {
+                    std::cerr.precision(17);
+                    std::cerr << name << ": " << bg::wkt(points[i]) << " should be " << !inside[i] << std::endl;
+                }
+            }
+        }
+    }
+    geoutil::PreparedBoundary::useSimd(true);
+    if (errors == 0) {
+        runtest.pass("PreparedBoundary::within(x, y) - " + name);
+        return true;
+    }
+    runtest.fail("PreparedBoundary::within(x, y) - " + name);
+    return false;
+}
+
+// Compare the prepared boundary with boost::geometry for the nodes and
+// ways of a data file
+bool
+sameObjects(const std::string &name, const multipolygon_t &poly, const std::string &file)
+{
+    geoutil::PreparedBoundary prepared(poly);
+    TestOsmChange osmchange;
+    osmchange.readChanges(file);
+    osmchange.buildGeometriesFromNodeCache();
+    int errors = 0;
+    int count = 0;
+    for (auto it = osmchange.changes.begin(); it != osmchange.changes.end(); ++it) {
+        for (auto nit = (*it)->nodes.begin(); nit != (*it)->nodes.end(); ++nit) {
+            count++;
+            if (prepared.within(nit->point) != bg::within(nit->point, poly)) {
+                errors++;
+            }
+        }
+        for (auto wit = (*it)->ways.begin(); wit != (*it)->ways.end(); ++wit) {
+            if (wit->linestring.size() < 2) {
+                continue;
+            }
+            count++;
+            if (prepared.within(wit->linestring) != bg::within(wit->linestring, poly)) {
+                errors++;
+            }
+        }
+    }
+    if (errors == 0 && count > 0) {
+        runtest.pass("PreparedBoundary::within(node, way) - " + name);
+        return true;
+    }
+    runtest.fail("PreparedBoundary::within(node, way) - " + name);
+    return false;
+}
+
+// Compare the prepared boundary with boost::geometry for changeset
+// bounding boxes of all sizes
+bool
+sameBoxes(const std::string &name, const multipolygon_t &poly)
+{
+    geoutil::PreparedBoundary prepared(poly);
+    std::mt19937 random(2);
+    std::uniform_real_distribution<double> unit(0, 1);
+    auto envelope = bg::return_envelope<bg::model::box<point_t>>(poly);
+    double width = envelope.max_corner().x() - envelope.min_corner().x();
+    double height = envelope.max_corner().y() - envelope.min_corner().y();
+    int errors = 0;
+    for (int i = 0; i < 5000; i++) {
+        double x = envelope.min_corner().x() - width / 10 + unit(random) * width * 1.2;
+        double y = envelope.min_corner().y() - height / 10 + unit(random) * height * 1.2;
+        double size = std::pow(10, -4 * unit(random));
+        double w = width * size * unit(random);
+        double h = height * size * unit(random);
+        polygon_t bbox;
+        bg::append(bbox, point_t(x + w, y + h));
+        bg::append(bbox, point_t(x + w, y));
+        bg::append(bbox, point_t(x, y));
+        bg::append(bbox, point_t(x, y + h));
+        bg::append(bbox, point_t(x + w, y + h));
+        if (prepared.intersects(bbox) != bg::intersects(bbox, poly)) {
+            errors++;
+        }
+    }
+    if (errors == 0) {
+        runtest.pass("PreparedBoundary::intersects(bbox) - " + name);
+        return true;
+    }
+    runtest.fail("PreparedBoundary::intersects(bbox) - " + name);
+    return false;
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("boundary-test.log");
+    dbglogfile.setVerbosity(3);
+
+    std::string testdata(DATADIR);
+    testdata += "/testsuite/testdata/";
+
+    // The default priority boundary
+    geoutil::GeoUtil geou;
+    std::string priority(DATADIR);
+    priority += "/../config/priority.geojson";
+    if (geou.readFile(priority)) {
+        runtest.pass("GeoUtil::readFile(priority.geojson)");
+    } else {
+        runtest.fail("GeoUtil::readFile(priority.geojson)");
+        return 1;
+    }
+    samePoints("priority.geojson", geou.boundary, testPoints(geou.boundary));
+    sameBatch("priority.geojson", geou.boundary, testPoints(geou.boundary));
+    sameBoxes("priority.geojson", geou.boundary);
+
+    // A boundary with a hole, around the data in areafilter-test.osm
+    multipolygon_t bangladesh;
+    bg::read_wkt("MULTIPOLYGON(((91.08473230447439 25.195528629552243,91.08475247411987 25.192143075605387,"
+                 "91.08932089882008 25.192152201214213,91.08927047470638 25.195501253482632,"
+                 "91.08473230447439 25.195528629552243),(91.0860 25.1930,91.0880 25.1930,91.0880 25.1945,"
+                 "91.0860 25.1945,91.0860 25.1930)),((91.09 25.19,91.095 25.185,91.09 25.185,91.09 25.19)))",
+                 bangladesh);
+    bg::correct(bangladesh);
+    samePoints("hole", bangladesh, testPoints(bangladesh));
+    sameBatch("hole", bangladesh, testPoints(bangladesh));
+    sameBoxes("hole", bangladesh);
+    sameObjects("hole", bangladesh, testdata + "areafilter-test.osm");
+    sameObjects("priority.geojson", geou.boundary, testdata + "test_change.osc");
+    sameObjects("priority.geojson", geou.boundary, testdata + "test_stats.osc");
+
+    // An empty boundary has nothing in it
+    multipolygon_t empty;
+    geoutil::PreparedBoundary none(empty);
+    if (!none.within(point_t(0, 0)) && none.empty()) {
+        runtest.pass("PreparedBoundary::within(point) - empty");
+    } else {
+        runtest.fail("PreparedBoundary::within(point) - empty");
+    }
+
+    // Regions, which can overlap, and be in several pieces
+    geoutil::RegionSet regions;
+    multipolygon_t west, east, island;
+    bg::read_wkt("MULTIPOLYGON(((0 0,0 10,10 10,10 0,0 0)))", west);
+    bg::read_wkt("MULTIPOLYGON(((5 0,5 10,15 10,15 0,5 0)))", east);
+    bg::read_wkt("MULTIPOLYGON(((20 20,20 21,21 21,21 20,20 20)))", island);
+    regions.add("West", west);
+    regions.add("East", east);
+    regions.add("West", island);
+    auto names = [](const std::vector<geoutil::region_t> &found) {
+        std::string result;
+        for (auto it = found.begin(); it != found.end(); ++it) {
+            result += geoutil::RegionSet::name(*it) + ";";
+        }
+        return result;
+    };
+    auto both = names(regions.find(point_t(7, 5)));
+    if (regions.size() == 2 && names(regions.find(point_t(2, 5))) == "West;" &&
+        names(regions.find(point_t(12, 5))) == "East;" && (both == "West;East;" || both == "East;West;") &&
+        names(regions.find(point_t(20.5, 20.5))) == "West;" && regions.find(point_t(30, 30)).empty()) {
+        runtest.pass("RegionSet::find(point)");
+    } else {
+        runtest.fail("RegionSet::find(point)");
+    }
+    polygon_t bbox;
+    bg::read_wkt("POLYGON((9 9,9 25,25 25,25 9,9 9))", bbox);
+    if (regions.find(bbox).size() == 2) {
+        runtest.pass("RegionSet::find(bbox)");
+    } else {
+        runtest.fail("RegionSet::find(bbox)");
+    }
+
+    // Tag a changeset and its data with the region they're in
+    geoutil::RegionSet bangladeshRegions;
+    bangladeshRegions.add("Bangladesh", bangladesh);
+    changesets::ChangeSetFile changeset;
+    changeset.readChanges(testdata + "areafilter-test.osc");
+    changeset.regionFilter(bangladeshRegions);
+    if (changeset.changes.size() > 0 && names(changeset.changes.front()->regions) == "Bangladesh;") {
+        runtest.pass("ChangeSetFile::regionFilter()");
+    } else {
+        runtest.fail("ChangeSetFile::regionFilter()");
+    }
+    TestOsmChange osmchange;
+    osmchange.readChanges(testdata + "areafilter-test.osm");
+    osmchange.buildGeometriesFromNodeCache();
+    osmchange.regionFilter(bangladeshRegions);
+    int tagged = 0;
+    int wrong = 0;
+    for (auto it = osmchange.changes.begin(); it != osmchange.changes.end(); ++it) {
+        for (auto nit = (*it)->nodes.begin(); nit != (*it)->nodes.end(); ++nit) {
+            bool in = bg::within(nit->point, bangladesh);
+            tagged += in;
+            wrong += in != (nit->regions.size() == 1);
+        }
+    }
+    if (tagged > 0 && wrong == 0) {
+        runtest.pass("OsmChangeFile::regionFilter()");
+    } else {
+        runtest.fail("OsmChangeFile::regionFilter()");
+    }
+
+    // Most points are a lookup in the grid
+    std::vector<point_t> points = testPoints(geou.boundary);
+    auto start = std::chrono::steady_clock::now();
+    int slow = 0;
+    for (auto it = points.begin(); it != points.end(); ++it) {
+        slow += bg::within(*it, geou.boundary);
+    }
+    auto middle = std::chrono::steady_clock::now();
+    int fast = 0;
+    for (auto it = points.begin(); it != points.end(); ++it) {
+        fast += geou.prepared.within(*it);
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << points.size() << " points, " << slow << " inside, boost::geometry: "
+              << std::chrono::duration<double>(middle - start).count() << "s, " << fast
+              << " inside, prepared: " << std::chrono::duration<double>(end - middle).count() << "s"
+              << std::endl;
+
+    // And a whole array at a time
+    std::vector<double> x;
+    std::vector<double> y;
+    for (auto it = points.begin(); it != points.end(); ++it) {
+        x.push_back(it->x());
+        y.push_back(it->y());
+    }
+    std::vector<uint8_t> inside(points.size());
+    for (bool simd: {false, true}) {
+        geoutil::PreparedBoundary::useSimd(simd);
+        start = std::chrono::steady_clock::now();
+        geou.prepared.within(x.data(), y.data(), points.size(), inside.data());
+        end = std::chrono::steady_clock::now();
+        std::cout << std::count(inside.begin(), inside.end(), 1) << " inside, "
+                  << (simd ? "batch with SIMD: " : "batch: ")
+                  << std::chrono::duration<double>(end - start).count() << "s" << std::endl;
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -18,6 +18,7 @@
 //
 
 #include <cmath>
+#include <cstdio>
 #include <dejagnu.h>
 #include <iostream>
 #include <pqxx/pqxx>
@@ -27,7 +28,10 @@
 #include "utils/log.hh"
 #include "osm/changeset.hh"
 #include "osm/osmchange.hh"
+#include "osm/oscparser.hh"
+#include "osm/changecache.hh"
 #include "stats/querystats.hh"
+#include "stats/statsconfig.hh"
 #include "replicator/replication.hh"
 
 #include "boost/date_time/gregorian/gregorian.hpp"
@@ -35,6 +39,8 @@
 #include <boost/date_time.hpp>
 #include <boost/geometry.hpp>
 #include <boost/program_options.hpp>
+#include <fstream>
+#include <sstream>
 
 namespace opts = boost::program_options;
 
@@ -82,6 +88,60 @@ class TestStateFile : public replication::StateFile {
     long getSequence(void) { return sequence; };
 };
 
+// Compare the common fields of two objects
+static bool
+sameObject(const osmobjects::OsmObject &a, const osmobjects::OsmObject &b)
+{
+    return a.id == b.id && a.version == b.version && a.timestamp == b.timestamp &&
+        a.uid == b.uid && a.user == b.user && a.changeset == b.changeset &&
+        a.action == b.action && a.tags == b.tags;
+}
+
+// Check the fast parser gets the same data as libxml
+static bool
+sameChanges(const osmchange::OsmChangeFile &a, const osmchange::OsmChangeFile &b)
+{
+    if (a.changes.size() != b.changes.size() || a.nodecache.size() != b.nodecache.size()) {
+        return false;
+    }
+    point_t point;
+    for (auto ait = a.nodecache.begin(); ait != a.nodecache.end(); ++ait) {
+        if (!b.nodecache.get(ait->first, point) || !boost::geometry::equals(ait->second, point)) {
+            return false;
+        }
+    }
+    for (auto ait = a.changes.begin(), bit = b.changes.begin(); ait != a.changes.end(); ++ait, ++bit) {
+        auto &ac = **ait;
+        auto &bc = **bit;
+        if (ac.action != bc.action || ac.final_entry != bc.final_entry ||
+            ac.nodes.size() != bc.nodes.size() || ac.ways.size() != bc.ways.size() ||
+            ac.relations.size() != bc.relations.size()) {
+            return false;
+        }
+        for (auto an = ac.nodes.begin(), bn = bc.nodes.begin(); an != ac.nodes.end(); ++an, ++bn) {
+            if (!sameObject(*an, *bn) || !boost::geometry::equals(an->point, bn->point)) {
+                return false;
+            }
+        }
+        for (auto aw = ac.ways.begin(), bw = bc.ways.begin(); aw != ac.ways.end(); ++aw, ++bw) {
+            if (!sameObject(*aw, *bw) || aw->refs != bw->refs) {
+                return false;
+            }
+        }
+        for (auto ar = ac.relations.begin(), br = bc.relations.begin(); ar != ac.relations.end(); ++ar, ++br) {
+            if (!sameObject(*ar, *br) || ar->members.size() != br->members.size()) {
+                return false;
+            }
+            for (auto am = ar->members.begin(), bm = br->members.begin(); am != ar->members.end(); ++am, ++bm) {
+                if (am->ref != bm->ref || am->type != bm->type || am->role != bm->role) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -174,13 +234,13 @@ main(int argc, char *argv[])
     std::map<long, long> changeset_ids_found;
     for (const auto &change: testco.changes) {
         for (const auto &node: change->nodes) {
-            changeset_ids_found.insert(std::pair<long, long>(node->changeset, node->changeset));
+            changeset_ids_found.insert(std::pair<long, long>(node.changeset, node.changeset));
         }
         for (const auto &way: change->ways) {
-            changeset_ids_found.insert(std::pair<long, long>(way->changeset, way->changeset));
+            changeset_ids_found.insert(std::pair<long, long>(way.changeset, way.changeset));
         }
         for (const auto &relation: change->relations) {
-            changeset_ids_found.insert(std::pair<long, long>(relation->changeset, relation->changeset));
+            changeset_ids_found.insert(std::pair<long, long>(relation.changeset, relation.changeset));
         }
     }
     bool all_changesets_tracked = true;
@@ -197,13 +257,13 @@ main(int argc, char *argv[])
     }
 
     auto tf = testco.changes.front();
-    auto tnf = tf->nodes.front();
+    auto tnf = &tf->nodes.front();
     if (tnf->changeset == 99069702 && tnf->id == 5776216755) {
         runtest.pass("ChangeSetFile::readChanges(first change, first node)");
     } else {
         runtest.fail("ChangeSetFile::readChanges(first change, first node)");
     }
-    auto twf = tf->ways.front();
+    auto twf = &tf->ways.front();
     // twf->dump();
     if (twf->changeset == 99069879L && twf->id == 474556695L &&
         twf->uid == 1041828L) {
@@ -211,14 +271,14 @@ main(int argc, char *argv[])
     } else {
         runtest.fail("ChangeSetFile::readChanges(first change, first way)");
     }
-    auto tnb = tf->nodes.back();
+    auto tnb = &tf->nodes.back();
     // tnb->dump();
     if (tnb->changeset == 94802322L && tnb->id == 289112823L) {
         runtest.pass("ChangeSetFile::readChanges(first change, last node)");
     } else {
         runtest.fail("ChangeSetFile::readChanges(first change, last node)");
     }
-    auto twb = tf->ways.back();
+    auto twb = &tf->ways.back();
     // twb->dump();
     if (twb->changeset == 99063443L && twb->id == 67365141L &&
         twb->uid == 1137406L) {
@@ -255,13 +315,13 @@ main(int argc, char *argv[])
     boost::geometry::read_wkt(
         "MULTIPOLYGON(((0 0, 0 0.1, 0.1 0.1, 0.1 0, 0 0)))", null_island_poly);
 
-    testco.areaFilter(null_island_poly);
+    testco.areaFilter(geoutil::PreparedBoundary(null_island_poly));
 
-    std::list<std::shared_ptr<osmobjects::OsmNode>> priority_nodes;
+    std::list<const osmobjects::OsmNode *> priority_nodes;
     for (const auto &change: testco.changes) {
         for (const auto &node: change->nodes) {
-            if (node->priority) {
-                priority_nodes.push_back(node);
+            if (node.priority) {
+                priority_nodes.push_back(&node);
             }
         }
     }
@@ -276,13 +336,13 @@ main(int argc, char *argv[])
     testco.changes.clear();
     testco.nodecache.clear();
     testco.readChanges(test_data_dir + "/123.osc");
-    testco.areaFilter(single_node_poly);
+    testco.areaFilter(geoutil::PreparedBoundary(single_node_poly));
 
     priority_nodes.clear();
     for (const auto &change: testco.changes) {
         for (const auto &node: change->nodes) {
-            if (node->priority) {
-                priority_nodes.push_back(node);
+            if (node.priority) {
+                priority_nodes.push_back(&node);
             }
         }
     }
@@ -325,7 +385,7 @@ main(int argc, char *argv[])
                testco.changes.front()->ways.size() == 1,
            "ChangeSetFile::readXML(xml) - relations");
 
-    const auto relation{testco.changes.front()->relations.front()};
+    const auto *relation = &testco.changes.front()->relations.front();
     COMPARE(relation->action, osmobjects::create,
             "ChangeSetFile::readXML(xml) - relation.action");
     COMPARE(relation->type, osmobjects::relation,
@@ -340,6 +400,179 @@ main(int argc, char *argv[])
             "ChangeSetFile::readXML(xml) - relation member role");
     COMPARE(member.type, osmobjects::osmtype_t::way,
             "ChangeSetFile::readXML(xml) - relation member type");
+
+    // The fast parser has to get exactly the same data as libxml
+    std::vector<std::string> oscfiles = {"123.osc", "54321.osc", "test_change.osc",
+                                         "test_change_node.osc", "test_multipolygon.osc",
+                                         "test_stats.osc"};
+    for (auto it = oscfiles.begin(); it != oscfiles.end(); ++it) {
+        std::ifstream file(test_data_dir + *it);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        std::string data = contents.str();
+        auto bytes = reinterpret_cast<const unsigned char *>(data.data());
+
+        osmchange::OsmChangeFile expected;
+        expected.readXML(bytes, data.size());
+        osmchange::OsmChangeFile fast;
+        oscparser::OscParser parser(fast);
+        VERIFY(parser.parse(bytes, data.size()), "OscParser::parse(" + *it + ")");
+        VERIFY(expected.changes.size() > 0 && sameChanges(expected, fast),
+               "OscParser::parse(" + *it + ") - same as libxml");
+
+        // Tiny chunks, so even these files get split many times
+        osmchange::OsmChangeFile parallel;
+        VERIFY(oscparser::parseParallel(parallel, bytes, data.size(), 256) &&
+               sameChanges(expected, parallel),
+               "oscparser::parseParallel(" + *it + ") - same as libxml");
+
+        // The parsed file kept in the cache has to load the same
+        std::string binfile = changecache::cachePath(*it);
+        VERIFY(changecache::writeFile(fast, binfile), "changecache::writeFile(" + *it + ")");
+        std::ifstream bin(binfile, std::ios::binary);
+        std::stringstream bincontents;
+        bincontents << bin.rdbuf();
+        std::string bindata = bincontents.str();
+        auto binbytes = reinterpret_cast<const unsigned char *>(bindata.data());
+        osmchange::OsmChangeFile cached;
+        VERIFY(changecache::readData(cached, binbytes, bindata.size()) &&
+               sameChanges(expected, cached),
+               "changecache::readData(" + *it + ") - same as libxml");
+        // Any change to the data is caught by the checksum
+        bindata[bindata.size() / 2] ^= 0x40;
+        osmchange::OsmChangeFile corrupted;
+        VERIFY(!changecache::readData(corrupted, binbytes, bindata.size()),
+               "changecache::readData(" + *it + ") - corrupted");
+        std::remove(binfile.c_str());
+    }
+
+    // Two files editing the same objects, the node moves out of the
+    // area in the second one
+    const std::string earlier{R"xml(<osmChange version="0.6">
+      <modify>
+        <node id="1" version="2" timestamp="2021-02-11T01:49:51Z" uid="1" user="first" changeset="10" lat="22.1" lon="114.1">
+          <tag k="amenity" v="cafe"/>
+        </node>
+      </modify>
+      <create>
+        <node id="2" version="1" timestamp="2021-02-11T01:49:51Z" uid="1" user="first" changeset="10" lat="22.2" lon="114.2"/>
+        <way id="5" version="1" timestamp="2021-02-11T01:49:51Z" uid="1" user="first" changeset="10">
+          <nd ref="1"/>
+          <nd ref="2"/>
+          <tag k="highway" v="residential"/>
+        </way>
+      </create></osmChange>)xml"};
+    const std::string later{R"xml(<osmChange version="0.6">
+      <modify>
+        <node id="1" version="3" timestamp="2021-02-11T01:50:51Z" uid="2" user="second" changeset="11" lat="30.5" lon="120.5">
+          <tag k="amenity" v="restaurant"/>
+        </node>
+        <way id="5" version="2" timestamp="2021-02-11T01:50:51Z" uid="2" user="second" changeset="11">
+          <nd ref="1"/>
+          <nd ref="2"/>
+          <tag k="highway" v="primary"/>
+        </way>
+      </modify></osmChange>)xml"};
+    osmchange::OsmChangeFile merged;
+    osmchange::OsmChangeFile next;
+    merged.readXML(reinterpret_cast<const unsigned char *>(earlier.data()), earlier.size());
+    next.readXML(reinterpret_cast<const unsigned char *>(later.data()), later.size());
+    merged.append(next);
+    merged.coalesce();
+
+    // Only the latest version of each object is left to apply
+    long node_version = 0;
+    long way_version = 0;
+    size_t objects = 0;
+    for (const auto &change: merged.changes) {
+        for (const auto &node: change->nodes) {
+            objects++;
+            if (node.id == 1) {
+                node_version = node.version;
+            }
+        }
+        for (const auto &way: change->ways) {
+            objects++;
+            way_version = way.version;
+        }
+    }
+    VERIFY(objects == 3 && node_version == 3 && way_version == 2 && merged.superseded.size() == 1 &&
+           merged.superseded.front()->nodes.size() == 1 && merged.superseded.front()->ways.size() == 1,
+           "OsmChangeFile::coalesce() - latest version");
+
+    // The old version inside the area doesn't bring back the old location
+    multipolygon_t area;
+    boost::geometry::read_wkt("MULTIPOLYGON(((114 22, 114 23, 115 23, 115 22, 114 22)))", area);
+    merged.areaFilter(geoutil::PreparedBoundary(area));
+    point_t location;
+    VERIFY(merged.getLocation(1, location) && location.get<0>() == 120.5 && location.get<1>() == 30.5,
+           "OsmChangeFile::areaFilter() - latest location");
+
+    // The superseded edits still count for their own changeset
+    statsconfig::StatsConfig::setConfigurationFile(std::string(DATADIR) + "/../config/stats/statistics.yaml");
+    auto stats = merged.collectStats();
+    VERIFY(stats->size() == 2 && stats->count(10) && stats->count(11),
+           "OsmChangeFile::collectStats() - coalesced changesets");
+    auto &first_stats = stats->at(10);
+    auto &second_stats = stats->at(11);
+    COMPARE(first_stats->added["highway"], 1, "OsmChangeFile::collectStats() - superseded way");
+    COMPARE(first_stats->modified["amenity"], 1, "OsmChangeFile::collectStats() - superseded node");
+    COMPARE(second_stats->modified["highway"], 1, "OsmChangeFile::collectStats() - latest way");
+    COMPARE(second_stats->modified.count("amenity"), 0, "OsmChangeFile::collectStats() - node moved out");
+
+    // Elements split between two buffers
+    const std::string split{R"xml(<osmChange version="0.6"><modify>
+      <node id="5" version="3" timestamp="2021-02-11T01:49:51Z" uid="7" user="Tom &amp; Jerry" changeset="9" lat="22.5" lon="114.25">
+        <tag k="name" v="&lt;caf&#233;&gt;"/>
+      </node></modify></osmChange>)xml"};
+    osmchange::OsmChangeFile pieces;
+    oscparser::OscParser splitter(pieces);
+    bool fed = true;
+    for (size_t i = 0; i < split.size(); i += 5) {
+        fed &= splitter.feed(split.data() + i, std::min<size_t>(5, split.size() - i));
+    }
+    VERIFY(fed && splitter.finish() && pieces.changes.size() == 1 &&
+           pieces.changes.front()->nodes.size() == 1,
+           "OscParser::feed(split elements)");
+    auto node = &pieces.changes.front()->nodes.front();
+    COMPARE(node->user, "Tom & Jerry", "OscParser::feed(split elements) - entities");
+    COMPARE(node->getTagValue("name"), "<caf\xc3\xa9>", "OscParser::feed(split elements) - numeric entities");
+    COMPARE(node->point.get<1>(), 22.5, "OscParser::feed(split elements) - latitude");
+    COMPARE(node->action, osmobjects::modify, "OscParser::feed(split elements) - action");
+
+    // A malformed timestamp is rejected, not converted to a wrong time
+    VERIFY(oscparser::parseTimestamp("2021-02-11T01:49:51Z") == time_from_string("2021-02-11 01:49:51") &&
+           oscparser::parseTimestamp("2021-02-1xT01:49:51Z").is_not_a_date_time() &&
+           oscparser::parseTimestamp("2021-02-11T01-49-51Z").is_not_a_date_time() &&
+           oscparser::parseTimestamp("2021-02-11 01:49:51Z").is_not_a_date_time() &&
+           oscparser::parseTimestamp("2021-13-11T01:49:51Z").is_not_a_date_time() &&
+           oscparser::parseTimestamp("2021-02-11T25:49:51Z").is_not_a_date_time() &&
+           oscparser::parseTimestamp("2021-02-11").is_not_a_date_time(),
+           "oscparser::parseTimestamp() - malformed");
+
+    // The tags are interned, except for long and free text values
+    osmobjects::OsmNode first;
+    osmobjects::OsmNode second;
+    std::string note(200, 'x');
+    first.addTag("amenity", "cafe");
+    first.addTag("note", note);
+    first.addTag("name", "Tom's");
+    first.addTag("amenity", "restaurant");
+    COMPARE(first.tags.size(), 3, "TagMap::set() - replace");
+    COMPARE(first.getTagValue("amenity"), "restaurant", "TagMap::get()");
+    COMPARE(first.getTagValue("note"), note, "TagMap::get() - not interned");
+    COMPARE(first.getTagValue("building"), "", "TagMap::get() - no tag");
+    auto &pool = stringpool::StringPool::getDefault();
+    VERIFY(first.containsKey(pool.lookup("amenity")) &&
+           first.tags.getId(pool.lookup("amenity")) == pool.lookup("restaurant"),
+           "TagMap::getId()");
+    second.addTag("name", "Tom's");
+    second.addTag("note", note);
+    second.addTag("amenity", "restaurant");
+    VERIFY(first.tags == second.tags, "TagMap::operator==()");
+    second.tags.erase("note");
+    VERIFY(first.tags != second.tags && second.tags.size() == 2 &&
+           second.getTagValue("name") == "Tom's", "TagMap::erase()");
 };
 
 // local Variables:
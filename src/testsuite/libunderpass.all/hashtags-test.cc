@@ -17,9 +17,11 @@
 //     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
 //
 
+#include <chrono>
 #include <iostream>
 #include <dejagnu.h>
 #include "osm/changeset.hh"
+#include "osm/hashtags.hh"
 #include <boost/algorithm/string.hpp>
 #include <boost/geometry.hpp>
 #include "utils/geoutil.hh"
@@ -40,7 +42,7 @@ main(int argc, char *argv[])
     TestChangeset changeset;
     changesets::ChangeSet *change;
     changeset.readChanges(changesetFile);
-    multipolygon_t polyEmpty;
+    geoutil::PreparedBoundary polyEmpty;
     changeset.areaFilter(polyEmpty);
     change = changeset.changes.front().get();
 
@@ -55,6 +57,44 @@ main(int argc, char *argv[])
         return 1;
     }
 
+    // Non ASCII hashtags, and punctuation that doesn't end one
+    auto found = hashtags::fromComment("Buildings #hotosm-project-123, #a&b+c_d #x\u2014yyy #\u65e5\u672c\u8a9e #ab\u00a0cdef");
+    if (found.size() == 3 && found[0] == "hotosm-project-123" && found[1] == "a&b+c_d" &&
+        found[2] == "\u65e5\u672c\u8a9e") {
+        runtest.pass("hashtags::fromComment()");
+    } else {
+        runtest.fail("hashtags::fromComment()");
+        return 1;
+    }
+    found = hashtags::fromTag("#hotosm-project-4892;#missingmaps");
+    if (found.size() == 2 && found[0] == "hotosm-project-4892" && found[1] == "missingmaps" &&
+        hashtags::fromTag("missingmaps").size() == 1) {
+        runtest.pass("hashtags::fromTag()");
+    } else {
+        runtest.fail("hashtags::fromTag()");
+        return 1;
+    }
+
+    // Reading changeset files used to spend most of its time compiling
+    // a regular expression for every comment
+    const int loops = 1000;
+    auto start = std::chrono::steady_clock::now();
+    size_t total = 0;
+    for (int i = 0; i < loops; i++) {
+        TestChangeset again;
+        again.readChanges(changesetFile);
+        total += again.changes.front()->hashtags.size();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Read " << changesetFile << " " << loops << " times in "
+              << elapsed.count() << " seconds" << std::endl;
+    if (total == 8 * loops) {
+        runtest.pass("ChangeSet hashtags - benchmark");
+    } else {
+        runtest.fail("ChangeSet hashtags - benchmark");
+        return 1;
+    }
+
 }
 
 // local Variables:
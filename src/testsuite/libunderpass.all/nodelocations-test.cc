@@ -0,0 +1,180 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <dejagnu.h>
+#include "osm/nodelocations.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace nodelocations;
+
+// The locations are kept with 7 decimals, like in the OSM database
+bool
+near(const point_t &point, double lon, double lat)
+{
+    return std::fabs(point.x() - lon) < 5e-8 && std::fabs(point.y() - lat) < 5e-8;
+}
+
+// Store \a lon, \a lat for node \a id and read it back
+bool
+roundTrip(NodeLocationStore &store, long id, double lon, double lat)
+{
+    point_t point;
+    store.set(id, point_t(lon, lat));
+    return store.get(id, point) && near(point, lon, lat);
+}
+
+void
+testStore(NodeLocationStore &store, const std::string &name)
+{
+    point_t point;
+    if (!store.get(1, point) && !store.contains(1) && roundTrip(store, 1, 114.4398219, 22.9890996) &&
+        store.contains(1)) {
+        runtest.pass(name + "::get()");
+    } else {
+        runtest.fail(name + "::get()");
+    }
+
+    // A node that moves gets its new location
+    if (roundTrip(store, 1, 114.5, 23.0)) {
+        runtest.pass(name + "::set() - replace");
+    } else {
+        runtest.fail(name + "::set() - replace");
+    }
+
+    // Locations from the database don't replace the ones from a file
+    store.setIfMissing(1, point_t(10, 10));
+    store.setIfMissing(2, point_t(-10, -10));
+    point_t other;
+    if (store.get(1, point) && near(point, 114.5, 23.0) && store.get(2, other) && near(other, -10, -10)) {
+        runtest.pass(name + "::setIfMissing()");
+    } else {
+        runtest.fail(name + "::setIfMissing()");
+    }
+
+    store.remove(1);
+    store.remove(3);
+    if (!store.get(1, point) && store.contains(2)) {
+        runtest.pass(name + "::remove()");
+    } else {
+        runtest.fail(name + "::remove()");
+    }
+
+    // Both signs, the corners of the map and null island
+    if (roundTrip(store, 4, -77.0365298, -12.0463731) && roundTrip(store, 5, -180, -90) &&
+        roundTrip(store, 6, 180, 90) && roundTrip(store, 7, -180, 90) && roundTrip(store, 8, 0, 0) &&
+        roundTrip(store, 9, 0.0000001, -0.0000001)) {
+        runtest.pass(name + "::set() - extreme coordinates");
+    } else {
+        runtest.fail(name + "::set() - extreme coordinates");
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("nodelocations-test.log");
+    dbglogfile.setVerbosity(3);
+
+    HashLocations hash;
+    testStore(hash, "HashLocations");
+
+    // The locations of the later file win
+    HashLocations later;
+    later.set(2, point_t(1, 2));
+    later.set(10, point_t(3, 4));
+    hash.merge(later);
+    point_t point;
+    if (later.empty() && hash.get(2, point) && near(point, 1, 2) && hash.contains(10) && hash.contains(4)) {
+        runtest.pass("HashLocations::merge()");
+    } else {
+        runtest.fail("HashLocations::merge()");
+    }
+
+    std::string filespec = "nodelocations-test.bin";
+    std::remove(filespec.c_str());
+    {
+        MmapLocations mmap(1000);
+        if (mmap.open(filespec)) {
+            runtest.pass("MmapLocations::open()");
+        } else {
+            runtest.fail("MmapLocations::open()");
+            return 1;
+        }
+        testStore(mmap, "MmapLocations");
+
+        // The coordinates are rounded to fixed point
+        mmap.set(20, point_t(12.345678949, -12.345678951));
+        if (mmap.get(20, point) && point.x() == 123456789 / 1e7 && point.y() == -123456790 / 1e7) {
+            runtest.pass("MmapLocations::set() - fixed point");
+        } else {
+            runtest.fail("MmapLocations::set() - fixed point");
+        }
+
+        // Nothing outside of the map or of the file gets stored
+        mmap.set(21, point_t(180.5, 0));
+        mmap.set(22, point_t(0, -91));
+        mmap.set(23, point_t(NAN, 0));
+        mmap.set(0, point_t(1, 1));
+        mmap.set(-1, point_t(1, 1));
+        mmap.set(1001, point_t(1, 1));
+        if (!mmap.contains(21) && !mmap.contains(22) && !mmap.contains(23) && !mmap.contains(0) &&
+            !mmap.contains(-1) && !mmap.contains(1001) && roundTrip(mmap, 1000, 1, 1)) {
+            runtest.pass("MmapLocations::set() - invalid");
+        } else {
+            runtest.fail("MmapLocations::set() - invalid");
+        }
+    }
+
+    // The locations are still there for the next run
+    MmapLocations reopened(1000);
+    if (reopened.open(filespec) && reopened.get(4, point) && near(point, -77.0365298, -12.0463731) &&
+        reopened.get(5, point) && near(point, -180, -90) && !reopened.contains(1) &&
+        reopened.contains(1000)) {
+        runtest.pass("MmapLocations::open() - persistent");
+    } else {
+        runtest.fail("MmapLocations::open() - persistent");
+    }
+    std::remove(filespec.c_str());
+
+    // The file is only as big as the largest node seen
+    {
+        MmapLocations grown;
+        if (grown.open(filespec) && roundTrip(grown, 20000000, 1, 2) && !grown.contains(30000000) &&
+            std::filesystem::file_size(filespec) < 1024L * 1024 * 1024) {
+            runtest.pass("MmapLocations::set() - grows");
+        } else {
+            runtest.fail("MmapLocations::set() - grows");
+        }
+    }
+    std::remove(filespec.c_str());
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
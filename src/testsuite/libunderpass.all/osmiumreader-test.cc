@@ -0,0 +1,144 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <memory>
+#include <string>
+#include <dejagnu.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "osm/osmchange.hh"
+#include "osm/osmiumreader.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+
+// Find a version of an object in all the changes of \a osc
+template <typename T>
+const T *
+find(osmchange::OsmChangeFile &osc, std::pmr::vector<T> osmchange::OsmChange::*objects,
+     long id, long version)
+{
+    for (auto it = osc.changes.begin(); it != osc.changes.end(); ++it) {
+        auto &list = it->get()->*objects;
+        for (auto oit = list.begin(); oit != list.end(); ++oit) {
+            if (oit->id == id && oit->version == version) {
+                return &*oit;
+            }
+        }
+    }
+    return nullptr;
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("osmiumreader-test.log");
+    dbglogfile.setVerbosity(3);
+
+    std::string testdata = DATADIR;
+    testdata += "/testsuite/testdata/";
+
+    if (osmiumreader::isOsmiumFile("country-latest.osm.pbf") && osmiumreader::isOsmiumFile("history.osc.opl.gz") &&
+        osmiumreader::isOsmiumFile("changes.o5c.bz2") && !osmiumreader::isOsmiumFile("123.osc.gz") &&
+        !osmiumreader::isOsmiumFile("test_initial.osm")) {
+        runtest.pass("osmiumreader::isOsmiumFile()");
+    } else {
+        runtest.fail("osmiumreader::isOsmiumFile()");
+    }
+
+    osmchange::OsmChangeFile missing;
+    if (!osmiumreader::readFile(missing, testdata + "nothere.osm.opl") && missing.changes.empty()) {
+        runtest.pass("osmiumreader::readFile() - missing file");
+    } else {
+        runtest.fail("osmiumreader::readFile() - missing file");
+    }
+
+    // In a file of changes, the action comes from the version and
+    // the visibility
+    osmchange::OsmChangeFile changes;
+    if (osmiumreader::readFile(changes, testdata + "osmium-test.osc.opl") && changes.changes.size() == 6) {
+        runtest.pass("osmiumreader::readFile() - changes");
+    } else {
+        runtest.fail("osmiumreader::readFile() - changes");
+    }
+    auto created = find(changes, &osmchange::OsmChange::nodes, 1, 1);
+    auto modified = find(changes, &osmchange::OsmChange::nodes, 1, 2);
+    auto deleted = find(changes, &osmchange::OsmChange::nodes, 3, 4);
+    auto way = find(changes, &osmchange::OsmChange::ways, 5, 1);
+    auto relation = find(changes, &osmchange::OsmChange::relations, 7, 3);
+    if (created && created->action == osmobjects::create && modified &&
+        modified->action == osmobjects::modify && deleted && deleted->action == osmobjects::remove &&
+        way && way->action == osmobjects::create && relation && relation->action == osmobjects::modify) {
+        runtest.pass("OsmiumReader::read() - actions");
+    } else {
+        runtest.fail("OsmiumReader::read() - actions");
+        return 1;
+    }
+
+    // The metadata, tags and location are all copied
+    point_t location;
+    if (modified->changeset == 11 && modified->uid == 2 && modified->user == "second" &&
+        modified->timestamp == boost::posix_time::time_from_string("2021-02-11 01:50:51") &&
+        modified->getTagValue("amenity") == "restaurant" && modified->point.x() == 114.15 &&
+        modified->point.y() == 22.15 && changes.getLocation(1, location) && location.y() == 22.15 &&
+        !changes.getLocation(3, location)) {
+        runtest.pass("OsmiumReader::node()");
+    } else {
+        runtest.fail("OsmiumReader::node()");
+    }
+
+    if (way->refs.size() == 2 && way->refs[0] == 1 && way->refs[1] == 2 &&
+        way->getTagValue("highway") == "residential") {
+        runtest.pass("OsmiumReader::way()");
+    } else {
+        runtest.fail("OsmiumReader::way()");
+    }
+
+    if (relation->members.size() == 2 && relation->members[0].ref == 5 &&
+        relation->members[0].type == osmobjects::osmtype_t::way && relation->members[0].role == "a_role" &&
+        relation->members[1].ref == 2 && relation->members[1].type == osmobjects::osmtype_t::node &&
+        relation->members[1].role == "stop") {
+        runtest.pass("OsmiumReader::relation()");
+    } else {
+        runtest.fail("OsmiumReader::relation()");
+    }
+
+    // Everything in a snapshot is created, whatever its version
+    osmchange::OsmChangeFile snapshot;
+    osmiumreader::OsmiumReader reader(testdata + "osmium-test.osm.opl");
+    bool opened = reader.open();
+    bool more = reader.read(snapshot);
+    auto node = find(snapshot, &osmchange::OsmChange::nodes, 1, 2);
+    way = find(snapshot, &osmchange::OsmChange::ways, 5, 3);
+    if (opened && !more && reader.good() && snapshot.changes.size() == 1 &&
+        snapshot.changes.front()->action == osmobjects::create && snapshot.changes.front()->nodes.size() == 2 &&
+        node && node->action == osmobjects::create && way && way->action == osmobjects::create) {
+        runtest.pass("OsmiumReader::read() - snapshot");
+    } else {
+        runtest.fail("OsmiumReader::read() - snapshot");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
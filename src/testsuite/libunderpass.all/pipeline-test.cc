@@ -0,0 +1,242 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dejagnu.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "osm/osmchange.hh"
+#include "replicator/pipeline.hh"
+#include "utils/boundedqueue.hh"
+#include "utils/reorderbuffer.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace boost::posix_time;
+using namespace replicatorthreads;
+
+void
+testBoundedQueue(void)
+{
+    // The items come out in the order they went in
+    BoundedQueue<int> queue(2);
+    queue.push(1);
+    queue.push(2);
+    int item = 0;
+    if (queue.pop(item) && item == 1 && queue.pop(item) && item == 2 && !queue.tryPop(item)) {
+        runtest.pass("BoundedQueue::pop() - in order");
+    } else {
+        runtest.fail("BoundedQueue::pop() - in order");
+    }
+
+    // A producer blocks while the queue is full
+    std::atomic<int> pushed{0};
+    std::thread producer([&] {
+        for (int i = 1; i <= 3; i++) {
+            queue.push(i);
+            pushed++;
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    bool blocked = pushed == 2 && queue.size() == 2;
+    queue.pop(item);
+    producer.join();
+    if (blocked && pushed == 3 && queue.size() == 2) {
+        runtest.pass("BoundedQueue::push() - blocks when full");
+    } else {
+        runtest.fail("BoundedQueue::push() - blocks when full");
+    }
+
+    // Once closed nothing more gets in, but what is left drains
+    queue.close();
+    bool rejected = !queue.push(4);
+    std::vector<int> drained;
+    while (queue.pop(item)) {
+        drained.push_back(item);
+    }
+    if (rejected && queue.isClosed() && drained == std::vector<int>{2, 3}) {
+        runtest.pass("BoundedQueue::close() - drains");
+    } else {
+        runtest.fail("BoundedQueue::close() - drains");
+    }
+
+    // A consumer waiting on an empty queue wakes up when it is closed
+    BoundedQueue<int> empty(1);
+    std::atomic<bool> done{false};
+    std::atomic<bool> popped{true};
+    std::thread consumer([&] {
+        int value;
+        popped = empty.pop(value);
+        done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    bool waiting = !done;
+    empty.close();
+    consumer.join();
+    if (waiting && done && !popped) {
+        runtest.pass("BoundedQueue::close() - wakes up consumers");
+    } else {
+        runtest.fail("BoundedQueue::close() - wakes up consumers");
+    }
+}
+
+void
+testReorderBuffer(void)
+{
+    // Items inserted out of order are released in sequence
+    ReorderBuffer<std::string> buffer(1);
+    std::vector<std::string> released;
+    std::string item;
+    buffer.insert(3, "three");
+    buffer.insert(2, "two");
+    bool held = !buffer.pop(item) && buffer.size() == 2;
+    buffer.insert(1, "one");
+    while (buffer.pop(item)) {
+        released.push_back(item);
+    }
+    if (held && released == std::vector<std::string>{"one", "two", "three"} &&
+        buffer.getNext() == 4 && buffer.empty()) {
+        runtest.pass("ReorderBuffer::pop() - in sequence");
+    } else {
+        runtest.fail("ReorderBuffer::pop() - in sequence");
+    }
+
+    // An item can stand for several sequences, the way a group of
+    // coalesced files does
+    released.clear();
+    buffer.insert(7, "seven");
+    buffer.insert(4, "four to six", 3);
+    while (buffer.pop(item)) {
+        released.push_back(item);
+    }
+    if (released == std::vector<std::string>{"four to six", "seven"} && buffer.getNext() == 8) {
+        runtest.pass("ReorderBuffer::insert() - count");
+    } else {
+        runtest.fail("ReorderBuffer::insert() - count");
+    }
+
+    // A sequence already released is ignored
+    buffer.insert(5, "five");
+    if (buffer.empty() && !buffer.pop(item)) {
+        runtest.pass("ReorderBuffer::insert() - already released");
+    } else {
+        runtest.fail("ReorderBuffer::insert() - already released");
+    }
+}
+
+// A parsed file with one version of the same node
+std::shared_ptr<PipelineItem>
+makeItem(long sequence)
+{
+    auto item = std::make_shared<PipelineItem>();
+    item->task.sequence = sequence;
+    item->task.url = std::to_string(sequence);
+    item->task.timestamp = time_from_string("2023-01-01 00:00:00") + minutes(sequence);
+    item->osmchanges = std::make_shared<osmchange::OsmChangeFile>();
+    auto change = item->osmchanges->newChange(osmobjects::modify);
+    auto node = &change->newNode();
+    node->id = 1;
+    node->version = sequence;
+    node->action = osmobjects::modify;
+    return item;
+}
+
+void
+testCoalescer(void)
+{
+    // The files are put back in sequence, and grouped up to the limit
+    Coalescer coalescer(1, 3);
+    auto groups = coalescer.add(makeItem(3));
+    bool held = groups.empty() && coalescer.waiting() == 1 && coalescer.missing() == 1;
+    groups = coalescer.add(makeItem(2));
+    held = held && groups.empty();
+    groups = coalescer.add(makeItem(1));
+    if (held && groups.size() == 1 && groups[0]->count == 3 && groups[0]->task.sequence == 3 &&
+        groups[0]->task.url == "3" && coalescer.waiting() == 0) {
+        runtest.pass("Coalescer::add() - out of order");
+    } else {
+        runtest.fail("Coalescer::add() - out of order");
+    }
+
+    // Only the latest version of the node is left
+    if (groups.size() == 1) {
+        auto &osmchanges = groups[0]->osmchanges;
+        if (osmchanges->changes.size() == 1 && osmchanges->changes.front()->nodes.size() == 1 &&
+            osmchanges->changes.front()->nodes.front().version == 3 &&
+            osmchanges->superseded.size() == 1 && osmchanges->superseded.front()->nodes.size() == 2) {
+            runtest.pass("Coalescer::add() - merged");
+        } else {
+            runtest.fail("Coalescer::add() - merged");
+        }
+    }
+
+    // What is left is flushed at the end
+    groups = coalescer.add(makeItem(4));
+    auto rest = coalescer.finish();
+    if (groups.empty() && rest && rest->count == 1 && rest->task.sequence == 4 && !coalescer.finish()) {
+        runtest.pass("Coalescer::finish()");
+    } else {
+        runtest.fail("Coalescer::finish()");
+    }
+
+    // A group is flushed as soon as it reaches the end time, even if
+    // it isn't full
+    Coalescer ending(1, 10, time_from_string("2023-01-01 00:02:00"));
+    groups = ending.add(makeItem(1));
+    held = groups.empty();
+    groups = ending.add(makeItem(2));
+    if (held && groups.size() == 1 && groups[0]->count == 2 && groups[0]->task.sequence == 2) {
+        runtest.pass("Coalescer::add() - end time");
+    } else {
+        runtest.fail("Coalescer::add() - end time");
+    }
+
+    // When caught up, a file isn't held back waiting for more
+    Coalescer hurry(1, 10);
+    groups = hurry.add(makeItem(1), true);
+    if (groups.size() == 1 && groups[0]->count == 1) {
+        runtest.pass("Coalescer::add() - hurry");
+    } else {
+        runtest.fail("Coalescer::add() - hurry");
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("pipeline-test.log");
+    dbglogfile.setVerbosity(3);
+
+    testBoundedQueue();
+    testReorderBuffer();
+    testCoalescer();
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
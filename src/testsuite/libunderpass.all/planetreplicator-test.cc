@@ -27,6 +27,7 @@
 #include "osm/osmchange.hh"
 #include "underpassconfig.hh"
 #include "replicator/planetreplicator.hh"
+#include "replicator/stateresolver.hh"
 #include "osm/changeset.hh"
 #include "replicator/replication.hh"
 #include <string>
@@ -52,6 +53,10 @@ TestState runtest;
 void testPath(underpassconfig::UnderpassConfig config) {
     planetreplicator::PlanetReplicator replicator;
     auto osmchange = replicator.findRemotePath(config, config.start_time);
+    if (!osmchange) {
+        runtest.fail("Find remote path from timestamp (" + to_simple_string(config.start_time) + ")");
+        return;
+    }
     TestCO change;
     if (boost::filesystem::exists(osmchange->filespec)) {
         change.readChanges(osmchange->filespec);
@@ -96,6 +101,13 @@ main(int argc, char *argv[]) {
     opts::store(opts::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
     opts::notify(vm);
 
+    if (StateResolver::sequenceToPath(5123456) == "005/123/456" &&
+        StateResolver::sequenceToPath(1) == "000/000/001") {
+        runtest.pass("StateResolver::sequenceToPath()");
+    } else {
+        runtest.fail("StateResolver::sequenceToPath()");
+    }
+
     if (vm.count("timestamp")) {
         auto timestamps = vm["timestamp"].as<std::vector<std::string>>();
         config.start_time = time_from_string(timestamps[0]);
@@ -79,7 +79,7 @@ bool processFile(const std::string &filename, std::shared_ptr<Pq> &db) {
     auto queryraw = std::make_shared<QueryRaw>(db);
     auto osmchanges = std::make_shared<osmchange::OsmChangeFile>();
     std::string destdir_base = DATADIR;
-    multipolygon_t poly;
+    geoutil::PreparedBoundary poly;
     osmchanges->readChanges(destdir_base + "/testsuite/testdata/raw/" + filename);
     queryraw->buildGeometries(osmchanges, poly);
     osmchanges->areaFilter(poly);
@@ -89,7 +89,7 @@ bool processFile(const std::string &filename, std::shared_ptr<Pq> &db) {
         osmchange::OsmChange *change = it->get();
         // Nodes
         for (auto nit = std::begin(change->nodes); nit != std::end(change->nodes); ++nit) {
-            osmobjects::OsmNode *node = nit->get();
+            osmobjects::OsmNode *node = &*nit;
             auto changes = *queryraw->applyChange(*node);
             for (auto it = changes.begin(); it != changes.end(); ++it) {
                 rawquery->push_back(*it);
@@ -97,7 +97,7 @@ bool processFile(const std::string &filename, std::shared_ptr<Pq> &db) {
         }
         // Ways
         for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
-            osmobjects::OsmWay *way = wit->get();
+            osmobjects::OsmWay *way = &*wit;
             auto changes = *queryraw->applyChange(*way);
             for (auto it = changes.begin(); it != changes.end(); ++it) {
                 rawquery->push_back(*it);
@@ -105,7 +105,7 @@ bool processFile(const std::string &filename, std::shared_ptr<Pq> &db) {
         }
         // Relations
         for (auto rit = std::begin(change->relations); rit != std::end(change->relations); ++rit) {
-            osmobjects::OsmRelation *relation = rit->get();
+            osmobjects::OsmRelation *relation = &*rit;
             auto changes = *queryraw->applyChange(*relation);
             for (auto it = changes.begin(); it != changes.end(); ++it) {
                 rawquery->push_back(*it);
@@ -0,0 +1,175 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <dejagnu.h>
+#include "replicator/replication.hh"
+#include "replicator/serverselector.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace replication;
+
+// Feed the recorded samples of a server, all for \a sequence
+void
+feed(ServerSelector &selector, const std::string &domain, long sequence,
+     const std::vector<long> &samples)
+{
+    for (auto it = samples.begin(); it != samples.end(); ++it) {
+        selector.report(domain, sequence, reqfile_t::success, std::chrono::milliseconds(*it));
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("serverselector-test.log");
+    dbglogfile.setVerbosity(3);
+
+    RemoteURL remote("https://planet.openstreetmap.org/replication/minute/000/000/100.osc.gz");
+    ServerSelector selector(remote);
+    selector.addServer("a.example.org", "replication");
+    selector.addServer("b.example.org", "pub/replication");
+    std::string main = "planet.openstreetmap.org";
+
+    // The path is the one of each mirror
+    if (selector.getTarget("b.example.org", remote) == "/pub/replication/minute/000/000/100.osc.gz" &&
+        selector.getTarget(main, remote) == "/replication/minute/000/000/100.osc.gz") {
+        runtest.pass("ServerSelector::getTarget()");
+    } else {
+        runtest.fail("ServerSelector::getTarget()");
+    }
+
+    // A server not used yet is tried first, so its latency gets known
+    feed(selector, main, 100, {120});
+    auto servers = selector.select(100, 3);
+    if (servers.size() == 3 && servers[0] == "a.example.org" && servers[1] == "b.example.org" &&
+        servers[2] == main && selector.select(100).size() == 2) {
+        runtest.pass("ServerSelector::select() - unknown first");
+    } else {
+        runtest.fail("ServerSelector::select() - unknown first");
+    }
+
+    // The moving average follows the recent samples, but one slow
+    // request doesn't change the ranking: main ends up at 120ms, a at
+    // 0.8 * 80 + 0.2 * 400 = 144ms and b goes from 300ms down to
+    // 0.8 * 0.8 * 300 + 0.2 * 0.8 * 100 + 0.2 * 100 = 228ms
+    feed(selector, main, 100, {120, 120});
+    feed(selector, "a.example.org", 100, {80, 400});
+    feed(selector, "b.example.org", 100, {300, 100, 100});
+    servers = selector.select(100, 3);
+    if (servers.size() == 3 && servers[0] == main && servers[1] == "a.example.org" &&
+        servers[2] == "b.example.org") {
+        runtest.pass("ServerSelector::select() - moving average");
+    } else {
+        runtest.fail("ServerSelector::select() - moving average");
+    }
+    feed(selector, "a.example.org", 100, {80, 80, 80});
+    servers = selector.select(100, 3);
+    if (servers.size() == 3 && servers[0] == "a.example.org" && servers[1] == main) {
+        runtest.pass("ServerSelector::select() - recovers");
+    } else {
+        runtest.fail("ServerSelector::select() - recovers");
+    }
+
+    // The hedge delay is three times the latency, within limits
+    ServerSelector hedge(remote);
+    hedge.addServer("fast.example.org", "replication");
+    hedge.addServer("slow.example.org", "replication");
+    hedge.addServer("mid.example.org", "replication");
+    feed(hedge, "fast.example.org", 100, {20});
+    feed(hedge, "slow.example.org", 100, {8000});
+    feed(hedge, "mid.example.org", 100, {700});
+    if (hedge.hedgeDelay(main) == std::chrono::milliseconds(2000) &&
+        hedge.hedgeDelay("unknown.example.org") == std::chrono::milliseconds(2000) &&
+        hedge.hedgeDelay("fast.example.org") == std::chrono::milliseconds(250) &&
+        hedge.hedgeDelay("mid.example.org") == std::chrono::milliseconds(2100) &&
+        hedge.hedgeDelay("slow.example.org") == std::chrono::milliseconds(10000)) {
+        runtest.pass("ServerSelector::hedgeDelay()");
+    } else {
+        runtest.fail("ServerSelector::hedgeDelay()");
+    }
+
+    // A mirror that doesn't have the file yet isn't asked for it, and
+    // one too far behind the others isn't used at all
+    ServerSelector lag(remote);
+    lag.addServer("behind.example.org", "replication");
+    lag.addServer("late.example.org", "replication");
+    feed(lag, main, 200, {100});
+    feed(lag, "behind.example.org", 194, {10});
+    lag.report("late.example.org", 200, reqfile_t::remoteNotFound, std::chrono::milliseconds(50));
+    servers = lag.select(194, 3);
+    bool behind = servers.size() == 2 && servers[0] == "late.example.org" && servers[1] == main;
+    servers = lag.select(200, 3);
+    if (behind && servers.size() == 1 && servers[0] == main) {
+        runtest.pass("ServerSelector::select() - lag");
+    } else {
+        runtest.fail("ServerSelector::select() - lag");
+    }
+    // Once it catches up, it is the fastest again
+    feed(lag, "behind.example.org", 200, {10});
+    servers = lag.select(200, 3);
+    if (servers.size() == 2 && servers[0] == "behind.example.org" && servers[1] == main) {
+        runtest.pass("ServerSelector::select() - caught up");
+    } else {
+        runtest.fail("ServerSelector::select() - caught up");
+    }
+
+    // A server that fails is left alone for a while, unless there is
+    // nothing else
+    ServerSelector failing(remote);
+    failing.addServer("broken.example.org", "replication");
+    feed(failing, main, 100, {200});
+    feed(failing, "broken.example.org", 100, {10});
+    failing.report("broken.example.org", 100, reqfile_t::systemError, std::chrono::milliseconds(10));
+    servers = failing.select(100, 3);
+    bool skipped = servers.size() == 1 && servers[0] == main;
+    // When they all failed, the ranking still applies
+    failing.report(main, 100, reqfile_t::systemError, std::chrono::milliseconds(10));
+    servers = failing.select(100, 3);
+    if (skipped && servers.size() == 2 && servers[0] == "broken.example.org") {
+        runtest.pass("ServerSelector::select() - failures");
+    } else {
+        runtest.fail("ServerSelector::select() - failures");
+    }
+
+    // A server that never worked goes after the ones that did
+    ServerSelector dead(remote);
+    dead.addServer("dead.example.org", "replication");
+    feed(dead, main, 100, {300});
+    dead.report("dead.example.org", 100, reqfile_t::systemError, std::chrono::milliseconds(10));
+    dead.report(main, 100, reqfile_t::systemError, std::chrono::milliseconds(10));
+    servers = dead.select(100, 3);
+    if (servers.size() == 2 && servers[0] == main && servers[1] == "dead.example.org") {
+        runtest.pass("ServerSelector::select() - never worked");
+    } else {
+        runtest.fail("ServerSelector::select() - never worked");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
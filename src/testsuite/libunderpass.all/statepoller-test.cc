@@ -0,0 +1,146 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <chrono>
+#include <string>
+#include <dejagnu.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "replicator/replication.hh"
+#include "replicator/statepoller.hh"
+#include "utils/log.hh"
+
+TestState runtest;
+
+using namespace logger;
+using namespace replication;
+using namespace boost::posix_time;
+
+// The timestamp of a minutely sequence, when they are all on time
+ptime
+atMinute(long sequence)
+{
+    return time_from_string("2024-01-01 00:00:00") + minutes(sequence - 100);
+}
+
+StateFile
+state(long sequence, ptime timestamp)
+{
+    return StateFile("", sequence, timestamp, replication::minutely);
+}
+
+int
+main(int argc, char *argv[])
+{
+    logger::LogFile &dbglogfile = logger::LogFile::getDefaultInstance();
+    dbglogfile.setWriteDisk(true);
+    dbglogfile.setLogFilename("statepoller-test.log");
+    dbglogfile.setVerbosity(3);
+
+    // Nothing is known before the first state file
+    RemoteURL remote("https://planet.openstreetmap.org/replication/minute/000/000/100.osc.gz");
+    StatePoller poller(remote);
+    if (poller.predict(101) == not_a_date_time && poller.latestSequence() == -1 &&
+        !poller.isPublished(100) && poller.nextPoll(101, atMinute(101)) == std::chrono::seconds(1)) {
+        runtest.pass("StatePoller::predict() - unknown");
+    } else {
+        runtest.fail("StatePoller::predict() - unknown");
+    }
+
+    // With a single state, the interval is the one of the frequency
+    poller.update(state(100, atMinute(100)), not_a_date_time);
+    if (poller.predict(101) == atMinute(101) && poller.predict(103) == atMinute(103) &&
+        poller.isPublished(100) && !poller.isPublished(101)) {
+        runtest.pass("StatePoller::predict() - default interval");
+    } else {
+        runtest.fail("StatePoller::predict() - default interval");
+    }
+
+    // Files seen while polling fast give the lag of the server, the
+    // shortest one is used so polling starts early enough
+    poller.update(state(101, atMinute(101)), atMinute(101) + seconds(7));
+    poller.update(state(102, atMinute(102)), atMinute(102) + seconds(4));
+    poller.update(state(103, atMinute(103)), atMinute(103) + seconds(9));
+    // An old or repeated state is ignored
+    bool ignored = !poller.update(state(103, atMinute(103)), atMinute(103) + seconds(1)) &&
+        !poller.update(state(90, atMinute(90)), atMinute(90));
+    if (ignored && poller.latestSequence() == 103 && poller.predict(104) == atMinute(104) + seconds(4)) {
+        runtest.pass("StatePoller::predict() - lag");
+    } else {
+        runtest.fail("StatePoller::predict() - lag");
+    }
+
+    // A late file and an outage don't throw off the interval, a
+    // missed sequence counts as several intervals
+    poller.update(state(104, atMinute(104) + seconds(50)), not_a_date_time);
+    poller.update(state(107, atMinute(107)), not_a_date_time);
+    poller.update(state(108, atMinute(108)), not_a_date_time);
+    if (poller.predict(109) == atMinute(109) + seconds(4)) {
+        runtest.pass("StatePoller::predict() - median interval");
+    } else {
+        runtest.fail("StatePoller::predict() - median interval");
+    }
+
+    // Sleep until shortly before the file is due
+    ptime expected = poller.predict(109);
+    if (poller.nextPoll(109, expected - seconds(40)) == std::chrono::seconds(38)) {
+        runtest.pass("StatePoller::nextPoll() - early");
+    } else {
+        runtest.fail("StatePoller::nextPoll() - early");
+    }
+
+    // Never less than the fast interval
+    if (poller.nextPoll(109, expected - milliseconds(2500)) == std::chrono::seconds(1)) {
+        runtest.pass("StatePoller::nextPoll() - minimum");
+    } else {
+        runtest.fail("StatePoller::nextPoll() - minimum");
+    }
+
+    // Then poll fast around the time it is due
+    if (poller.nextPoll(109, expected - seconds(1)) == std::chrono::seconds(1) &&
+        poller.nextPoll(109, expected + seconds(29)) == std::chrono::seconds(1)) {
+        runtest.pass("StatePoller::nextPoll() - due");
+    } else {
+        runtest.fail("StatePoller::nextPoll() - due");
+    }
+
+    // And back off if the server is late
+    if (poller.nextPoll(109, expected + seconds(31)) == std::chrono::seconds(5) &&
+        poller.nextPoll(109, expected + hours(1)) == std::chrono::seconds(5)) {
+        runtest.pass("StatePoller::nextPoll() - late");
+    } else {
+        runtest.fail("StatePoller::nextPoll() - late");
+    }
+
+    // Hourly files without any history
+    RemoteURL remote_hourly("https://planet.openstreetmap.org/replication/hour/000/000/100.osc.gz");
+    StatePoller slow(remote_hourly);
+    ptime start = time_from_string("2024-01-01 00:00:00");
+    slow.update(StateFile("", 100, start, replication::hourly), not_a_date_time);
+    if (slow.predict(102) == start + hours(2) &&
+        slow.nextPoll(101, start + minutes(30)) == std::chrono::milliseconds((minutes(30) - seconds(2)).total_milliseconds())) {
+        runtest.pass("StatePoller::predict() - hourly");
+    } else {
+        runtest.fail("StatePoller::predict() - hourly");
+    }
+}
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -58,7 +58,7 @@ class TestStats {
         ptime startTime = boost::posix_time::second_clock::universal_time();
         int increment = 2;
         bool verbose = false;
-        multipolygon_t boundary;
+        geoutil::PreparedBoundary boundary;
 
         std::string
         statsToJSON(std::shared_ptr<std::map<long, std::shared_ptr<osmchange::ChangeStats>>> stats, std::string filespec) {
@@ -122,7 +122,7 @@ class TestStats {
                 }
 
                 change.areaFilter(boundary);
-                auto stats = change.collectStats(boundary);
+                auto stats = change.collectStats();
                 jsonstr += statsToJSON(stats, osmchange->filespec);
 
                 osmchange->increment();
@@ -142,7 +142,7 @@ class TestStats {
             if (this->verbose) {
                 osmchanges.dump();
             }
-            auto stats = osmchanges.collectStats(boundary);
+            auto stats = osmchanges.collectStats();
             return stats;
         }
 
@@ -274,7 +274,7 @@ main(int argc, char *argv[]) {
         if (!geou.readFile(vm["boundary"].as<std::string>())) {
             return 0;
         }
-        testStats.boundary = geou.boundary;
+        testStats.boundary = geou.prepared;
     }
     if (vm.count("timestamp")) {
         testStats.startTime = from_iso_extended_string(vm["timestamp"].as<std::string>());
@@ -17,6 +17,8 @@
 //     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
 //
 
+#include <chrono>
+#include <iostream>
 #include <dejagnu.h>
 #include "utils/log.hh"
 
@@ -83,6 +85,79 @@ main(int argc, char *argv[])
         return 1;
     }
 
+    // The first category with the tag wins
+    auto classifier = statsconfig::StatsConfig::classifier();
+    if (classifier->name(classifier->classify(osmchange::node, "amenity", "emergency"), "amenity", "emergency") == "amenities" &&
+        classifier->name(classifier->classify(osmchange::way, "amenity", "emergency"), "amenity", "emergency") == "buildings" &&
+        classifier->classify(osmchange::node, "building", "yes") == statsconfig::StatsClassifier::none &&
+        classifier->classify(osmchange::relation, "building", "yes") == statsconfig::StatsClassifier::none) {
+        runtest.pass("StatsClassifier::classify() - first category");
+    } else {
+        runtest.fail("StatsClassifier::classify() - first category");
+        return 1;
+    }
+
+    // Categories named after the tag, for any key or any value
+    filespec = DATADIR;
+    filespec += "/testsuite/testdata/stats/statsconfig_dynamic_keyval.yaml";
+    statsconfig::StatsConfig::setConfigurationFile(filespec);
+    classifier = statsconfig::StatsConfig::classifier();
+    auto category = classifier->classify(osmchange::way, "building", "house");
+    if (classifier->name(category, "building", "house") == "building:house" &&
+        classifier->classify(osmchange::way, "highway", "primary") == statsconfig::StatsClassifier::none) {
+        runtest.pass("StatsClassifier::classify() - [key:value]");
+    } else {
+        runtest.fail("StatsClassifier::classify() - [key:value]");
+        return 1;
+    }
+    filespec = DATADIR;
+    filespec += "/testsuite/testdata/stats/statsconfig_dynamic_all_key.yaml";
+    statsconfig::StatsConfig::setConfigurationFile(filespec);
+    classifier = statsconfig::StatsConfig::classifier();
+    category = classifier->classify(osmchange::relation, "highway", "primary");
+    if (classifier->name(category, "highway", "primary") == "highway" &&
+        statsconfig::StatsConfig().search("natural", "water", osmchange::node) == "natural") {
+        runtest.pass("StatsClassifier::classify() - [key] for any tag");
+    } else {
+        runtest.fail("StatsClassifier::classify() - [key] for any tag");
+        return 1;
+    }
+
+    // Collecting the statistics only compiles the configuration once
+    filespec = DATADIR;
+    filespec += "/../config/stats/statistics.yaml";
+    statsconfig::StatsConfig::setConfigurationFile(filespec);
+    osmchange::OsmChangeFile osmchanges;
+    std::string osc = DATADIR;
+    osc += "/testsuite/testdata/stats/test_stats.osc";
+    osmchanges.readChanges(osc);
+    osmchanges.areaFilter(geoutil::PreparedBoundary());
+    auto start = std::chrono::steady_clock::now();
+    size_t changesets = 0;
+    for (int i = 0; i < 100; i++) {
+        changesets += osmchanges.collectStats()->size();
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "collectStats(test_stats.osc) 100 times, " << changesets / 100 << " changesets: "
+              << std::chrono::duration<double>(end - start).count() << "s" << std::endl;
+
+    // The same counts as in test_stats.yaml, every time
+    auto stats = osmchanges.collectStats();
+    if (changesets == 100 && stats->size() == 1 && stats->count(1)) {
+        runtest.pass("OsmChangeFile::collectStats() - changesets");
+    } else {
+        runtest.fail("OsmChangeFile::collectStats() - changesets");
+        return 1;
+    }
+    auto &change = stats->at(1);
+    if (change->modified["highway"] == 2 && change->added["highway"] == 3 &&
+        change->modified["building"] == 1 && change->added["building"] == 2 &&
+        change->modified["waterway"] == 1 && change->added["waterway"] == 1) {
+        runtest.pass("OsmChangeFile::collectStats() - categories");
+    } else {
+        runtest.fail("OsmChangeFile::collectStats() - categories");
+    }
+
 }
 
 // local Variables:
@@ -92,7 +92,7 @@ osmobjects::OsmWay readOsmWayFromFile(std::string filename) {
         log_debug("Couldn't load ! %1%", filespec);
     };
     osmchange.buildGeometriesFromNodeCache();
-    return *osmchange.changes.front().get()->ways.front().get();
+    return osmchange.changes.front().get()->ways.front();
 }
 
 int
@@ -305,7 +305,7 @@ test_geospatial(std::shared_ptr<Validate> &plugin)
     for (auto it = std::begin(ocf.changes); it != std::end(ocf.changes); ++it) {
         osmchange::OsmChange *change = it->get();
         for (auto wit = std::begin(change->ways); wit != std::end(change->ways); ++wit) {
-            osmobjects::OsmWay *way = wit->get();
+            osmobjects::OsmWay *way = &*wit;
 
             auto status = plugin->checkWay(*way, "building");
             // status->dump();
@@ -438,7 +438,6 @@ test_geospatial(std::shared_ptr<Validate> &plugin)
 
     // Overlapping, duplicate
     osmchange::OsmChangeFile osmfoverlapping;
-    const multipolygon_t poly;
     filespec = DATADIR;
     filespec += "/testdata/validation/rect-overlap-and-duplicate-building.osc";
     if (boost::filesystem::exists(filespec)) {
@@ -450,11 +449,11 @@ test_geospatial(std::shared_ptr<Validate> &plugin)
     for (auto it = std::begin(osmfoverlapping.changes); it != std::end(osmfoverlapping.changes); ++it) {
         osmchange::OsmChange *change = it->get();
         for (auto nit = std::begin(change->ways); nit != std::end(change->ways); ++nit) {
-            osmobjects::OsmWay *way = nit->get();
+            osmobjects::OsmWay *way = &*nit;
             way->priority = true;
         }
     }
-    auto wayval = osmfoverlapping.validateWays(poly, plugin);
+    auto wayval = osmfoverlapping.validateWays(plugin);
     for (auto sit = wayval->begin(); sit != wayval->end(); ++sit) {
         auto status = *sit->get();
         if (status.hasStatus(overlapping)) {
@@ -483,11 +482,11 @@ test_geospatial(std::shared_ptr<Validate> &plugin)
     for (auto it = std::begin(osmfnooverlapping.changes); it != std::end(osmfnooverlapping.changes); ++it) {
         osmchange::OsmChange *change = it->get();
         for (auto nit = std::begin(change->ways); nit != std::end(change->ways); ++nit) {
-            osmobjects::OsmWay *way = nit->get();
+            osmobjects::OsmWay *way = &*nit;
             way->priority = true;
         }
     }
-    wayval = osmfnooverlapping.validateWays(poly, plugin);
+    wayval = osmfnooverlapping.validateWays(plugin);
     for (auto sit = wayval->begin(); sit != wayval->end(); ++sit) {
         auto status = *sit->get();
         if (!status.hasStatus(overlapping)) {
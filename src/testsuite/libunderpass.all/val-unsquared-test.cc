@@ -42,7 +42,7 @@ osmobjects::OsmWay readOsmWayFromFile(std::string filename) {
         log_debug("Couldn't load ! %1%", filespec);
     };
     osmchange.buildGeometriesFromNodeCache();
-    return *osmchange.changes.front().get()->ways.front().get();
+    return osmchange.changes.front().get()->ways.front();
 }
 
 int
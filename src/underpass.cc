@@ -22,6 +22,7 @@
 #include "unconfig.h"
 #endif
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <chrono>
@@ -58,6 +59,7 @@ using namespace boost;
 namespace opts = boost::program_options;
 
 #include "utils/geoutil.hh"
+#include "utils/regions.hh"
 #include "utils/log.hh"
 #include "osm/changeset.hh"
 #include "osm/osmchange.hh"
@@ -104,17 +106,25 @@ main(int argc, char *argv[])
             ("url,u", opts::value<std::string>(), "Starting URL path (ex. 000/075/000), takes precedence over 'timestamp' option")
             ("changeseturl", opts::value<std::string>(), "Starting URL path for ChangeSet (ex. 000/075/000), takes precedence over 'timestamp' option")
             ("frequency,f", opts::value<std::string>(), "Update frequency (hourly, daily), default minutely)")
-            ("timestamp,t", opts::value<std::vector<std::string>>(), "Starting timestamp (can be used 2 times to set a range)")
+            ("auto-frequency", "Catch up with daily, then hourly files, and only use the frequency near the current time")
+            ("timestamp,t", opts::value<std::vector<std::string>>(), "Starting timestamp (can be used 2 times to set a range), 'now', or 'resume' to start after the last file committed")
             // ("import,i", opts::value<std::string>(), "Initialize OSM database with datafile")
             ("boundary,b", opts::value<std::string>(), "Boundary polygon file name")
             ("osmnoboundary", "Disable boundary polygon for OsmChanges")
             ("oscnoboundary", "Disable boundary polygon for Changesets")
+            ("regions", opts::value<std::string>(), "File of named regions, like countries, to tag the data with")
+            ("regions-field", opts::value<std::string>(), "The attribute with the name of each region (defaults to name)")
             ("datadir", opts::value<std::string>(), "Directory for remote and local cached files (with ending slash)")
             ("destdir_base", opts::value<std::string>(), "Base directory for local cached files (with ending slash)")
             ("verbose,v", "Enable verbosity")
             ("logstdout,l", "Enable logging to stdout, default is log to underpass.log")
-            ("changefile", opts::value<std::string>(), "Import change file")
+            ("changefile", opts::value<std::string>(), "Import a change or data file (osmChange, PBF, OPL or o5m)")
             ("concurrency,c", opts::value<std::string>(), "Concurrency")
+            ("downloads", opts::value<std::string>(), "Maximum number of simultaneous downloads (defaults to 16)")
+            ("parser", opts::value<std::string>(), "The osmChange parser, libxml or fast (defaults to libxml)")
+            ("coalesce", opts::value<std::string>(), "Merge this many OsmChange files into one when catching up (defaults to 1)")
+            ("node-locations", opts::value<std::string>(), "Keep the node locations in this file, to avoid database queries")
+            ("parsed-cache", "Also keep the parsed OsmChange files in the local cache, to skip parsing them again")
             ("changesets", "Changesets only")
             ("osmchanges", "OsmChanges only")
             ("debug,d", "Enable debug messages for developers")
@@ -187,6 +197,86 @@ main(int argc, char *argv[])
         config.concurrency = std::thread::hardware_concurrency();
     }
 
+    // Simultaneous downloads, these don't use a thread each
+    if (vm.count("downloads")) {
+        try {
+            config.downloads = std::stoi(vm["downloads"].as<std::string>());
+        } catch (const std::exception &) {
+            log_error("ERROR: error parsing \"downloads\"!");
+            exit(-1);
+        }
+    }
+
+    // The hand written parser is much faster than libxml
+    if (vm.count("parser")) {
+        config.parser = vm["parser"].as<std::string>();
+        if (config.parser != "libxml" && config.parser != "fast") {
+            log_error("ERROR: unknown parser \"%1%\"!", config.parser);
+            exit(-1);
+        }
+    }
+
+    // Apply only the net result of several files during catch-up
+    if (vm.count("coalesce")) {
+        try {
+            config.coalesce = std::max(1, std::stoi(vm["coalesce"].as<std::string>()));
+        } catch (const std::exception &) {
+            log_error("ERROR: error parsing \"coalesce\"!");
+            exit(-1);
+        }
+    }
+
+    if (vm.count("node-locations")) {
+        config.node_locations = vm["node-locations"].as<std::string>();
+    }
+    if (vm.count("parsed-cache")) {
+        config.parsed_cache = true;
+    }
+
+    // Features
+    if (vm.count("disable-validation")) {
+        config.disable_validation = true;
+    }
+    if (vm.count("disable-stats")) {
+        config.disable_stats = true;
+    }
+    if (vm.count("disable-raw")) {
+        config.disable_raw = true;
+    }
+
+    // Named regions, the data in one is tagged with its name
+    geoutil::RegionSet regions;
+    if (vm.count("regions")) {
+        std::string field = "name";
+        if (vm.count("regions-field")) {
+            field = vm["regions-field"].as<std::string>();
+        }
+        if (!regions.readFile(vm["regions"].as<std::string>(), field)) {
+            log_error("Could not read any regions from '%1%'!", vm["regions"].as<std::string>());
+            exit(-1);
+        }
+    }
+
+    // Import a single file, like the initial load of a country
+    if (vm.count("changefile")) {
+        if (vm.count("boundary")) {
+            boundary = vm["boundary"].as<std::string>();
+        }
+        geoutil::PreparedBoundary poly;
+        geoutil::GeoUtil geou;
+        // Without the boundary the whole file would be imported, so
+        // that has to be asked for with --osmnoboundary
+        if (!vm.count("osmnoboundary")) {
+            if (!geou.readFile(boundary)) {
+                log_error("Could not find '%1%' area file!", boundary);
+                exit(-1);
+            }
+            poly = geou.prepared;
+        }
+        replicatorthreads::importChangeFile(vm["changefile"].as<std::string>(), poly, regions, config);
+        exit(0);
+    }
+
     if (vm.count("timestamp") || vm.count("url") ||  vm.count("changeseturl")) {
 
         // Planet server
@@ -228,9 +318,13 @@ main(int argc, char *argv[])
                 exit(-1);
             }
         }
+        // Switch to the given frequency only once caught up
+        if (vm.count("auto-frequency")) {
+            config.auto_frequency = true;
+        }
         
         // Priority boundary
-        multipolygon_t poly;
+        geoutil::PreparedBoundary poly;
         if (vm.count("boundary")) {
             boundary = vm["boundary"].as<std::string>();
         }
@@ -238,20 +332,9 @@ main(int argc, char *argv[])
         if (!geou.readFile(boundary)) {
             log_debug("Could not find '%1%' area file!", boundary);
         }
-        multipolygon_t * oscboundary = &poly;
+        geoutil::PreparedBoundary * oscboundary = &poly;
         if (!vm.count("oscnoboundary")) {
-            oscboundary = &geou.boundary;
-        }
-
-        // Features
-        if (vm.count("disable-validation")) {
-            config.disable_validation = true;
-        }
-        if (vm.count("disable-stats")) {
-            config.disable_stats = true;
-        }
-        if (vm.count("disable-raw")) {
-            config.disable_raw = true;
+            oscboundary = &geou.prepared;
         }
 
         // Replication
@@ -267,8 +350,19 @@ main(int argc, char *argv[])
         if (vm.count("timestamp")) {
             try {
                 auto timestamps = vm["timestamp"].as<std::vector<std::string>>();
+                long resume = -1;
                 if (timestamps[0] == "now") {
                     config.start_time = boost::posix_time::second_clock::universal_time();
+                } else if (timestamps[0] == "resume") {
+                    // Start after the last file committed to the database
+                    auto last = replicatorthreads::lastCommitted(config, config.frequency);
+                    if (last.sequence < 0 || last.timestamp == not_a_date_time) {
+                        log_error("Nothing to resume from, no %1% file has been committed yet!",
+                                  StateFile::freq_to_string(config.frequency));
+                        exit(-1);
+                    }
+                    config.start_time = last.timestamp;
+                    resume = last.sequence;
                 } else {
                     config.start_time = from_iso_extended_string(timestamps[0]);
                     if (timestamps.size() > 1) {
@@ -276,10 +370,16 @@ main(int argc, char *argv[])
                     }
                 }
                 osmchange = replicator.findRemotePath(config, config.start_time);
+                if (osmchange && resume >= 0) {
+                    osmchange->updatePath(resume / 1000000, (resume / 1000) % 1000, resume % 1000);
+                }
             } catch (const std::exception &ex) {
                 log_error("could not parse timestamps!");
                 exit(-1);
             }
+            if (!osmchange) {
+                exit(-1);
+            }
         } else if (vm.count("url")) {
             replicator.connectServer("https://" + config.planet_server);
             std::string fullurl = "https://" + config.planet_server + "/replication/" + StateFile::freq_to_string(config.frequency);
@@ -298,9 +398,9 @@ main(int argc, char *argv[])
         std::thread osmChangeThread;
         if ((!vm.count("changesets") && !vm.count("changeseturl")) ||
             (vm.count("changeseturl") && (vm.count("timestamp") || vm.count("url")))) {
-            multipolygon_t * osmboundary = &poly;
+            geoutil::PreparedBoundary * osmboundary = &poly;
             if (!vm.count("osmnoboundary")) {
-                osmboundary = &geou.boundary;
+                osmboundary = &geou.prepared;
             }
             osmchange->destdir_base = config.destdir_base;
             if (!config.silent) {
@@ -308,10 +408,10 @@ main(int argc, char *argv[])
             }
 #ifdef SINGLE_THREAD            // debugging hack
             replicatorthreads::startMonitorChanges(std::ref(osmchange),
-                            std::ref(*osmboundary), config);
+                            std::ref(*osmboundary), std::ref(regions), config);
 #else
             osmChangeThread = std::thread(replicatorthreads::startMonitorChanges, std::ref(osmchange),
-                            std::ref(*osmboundary), config);
+                            std::ref(*osmboundary), std::ref(regions), config);
 #endif
         }
 
@@ -332,10 +432,10 @@ main(int argc, char *argv[])
                 changeset->dump();
             }
 #ifdef SINGLE_THREAD            // debugging hack
-            replicatorthreads::startMonitorChangesets(std::ref(changeset), std::ref(*oscboundary), config);
+            replicatorthreads::startMonitorChangesets(std::ref(changeset), std::ref(*oscboundary), std::ref(regions), config);
 #else
             changesetThread = std::thread(replicatorthreads::startMonitorChangesets, 
-                std::ref(changeset), std::ref(*oscboundary), config);
+                std::ref(changeset), std::ref(*oscboundary), std::ref(regions), config);
 #endif
         }
 
@@ -166,12 +166,18 @@ struct UnderpassConfig {
     std::string datadir;
     std::vector<PlanetServer> planet_servers;
     unsigned int concurrency = 1;
+    unsigned int downloads = 16;                     ///< Maximum number of downloads in flight
+    std::string parser = "libxml";                   ///< The osmChange parser, libxml or fast
+    unsigned int coalesce = 1;                       ///< OsmChange files merged into one when catching up
+    std::string node_locations;                      ///< File to keep the node locations in across files
+    bool parsed_cache = false;                       ///< Also keep the parsed osmChange files in the disk cache
     unsigned int bootstrap_page_size = 100;
 
     frequency_t frequency = frequency_t::minutely;
     ptime start_time = not_a_date_time;              ///< Starting time for changesets and OSM changes import
     ptime end_time = not_a_date_time;                ///< Ending time for changesets and OSM changes import
 
+    bool auto_frequency = false;                     ///< Use daily, then hourly files to catch up
     bool disable_validation = false;
     bool disable_stats = false;
     bool disable_raw = false;
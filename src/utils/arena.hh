@@ -0,0 +1,85 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __ARENA_HH__
+#define __ARENA_HH__
+
+/// \file arena.hh
+/// \brief Allocate the objects of a change file in one place
+///
+/// A change file has hundreds of thousands of small objects, which are
+/// all created while parsing and all freed together when the file is
+/// done. They are kept by value in vectors that get their memory from
+/// an arena, and so do their tags, node references and members. The
+/// objects end up next to each other in memory for the loops over them,
+/// there is no reference count to update, and freeing the file only
+/// releases the few big blocks of the arena.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstddef>
+#include <memory_resource>
+
+/// \namespace arena
+namespace arena {
+
+/// The allocator of the containers kept in an arena. Copying one of
+/// them without an allocator makes a copy on the heap, so objects can
+/// still be kept after their file is gone.
+typedef std::pmr::polymorphic_allocator<std::byte> allocator_type;
+
+/// \class Arena
+/// \brief A monotonic buffer, nothing is freed until it is destroyed
+///
+/// This isn't thread safe, a file is only worked on by one thread at
+/// a time. The changes of a file share it, so it stays around as long
+/// as any of them do.
+class Arena : public std::pmr::memory_resource {
+  public:
+    Arena(size_t initial_size = 64 * 1024) : resource(initial_size) {};
+
+    /// The number of bytes handed out
+    size_t size(void) const { return used; };
+
+  private:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        used += bytes;
+        return resource.allocate(bytes, alignment);
+    };
+    /// The memory is only freed with the arena
+    void do_deallocate(void *, size_t, size_t) override {};
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    };
+
+    std::pmr::monotonic_buffer_resource resource;
+    size_t used = 0;
+};
+
+} // namespace arena
+
+#endif // EOF __ARENA_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,742 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <numeric>
+#include <vector>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "utils/boundary.hh"
+
+namespace bg = boost::geometry;
+namespace bgi = boost::geometry::index;
+
+namespace geoutil {
+
+// The kernels testing points a few at a time. The CPU is checked once,
+// and the SIMD versions give the same results as the plain one, as
+// they do the same arithmetic in the same order.
+typedef enum { simd_none, simd_sse41, simd_avx2 } simd_t;
+
+static bool simd_enabled = true;
+
+static simd_t
+simdLevel(void)
+{
+#if defined(__x86_64__)
+    static const simd_t level = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return simd_avx2;
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return simd_sse41;
+        }
+        return simd_none;
+    }();
+    return simd_enabled ? level : simd_none;
+#else
+    return simd_none;
+#endif
+}
+
+void
+PreparedBoundary::useSimd(bool enable)
+{
+    simd_enabled = enable;
+}
+
+// Which of the bins of the given size, starting at origin, v is in.
+// Used for both the bands of a polygon and the cells of the grids.
+static size_t
+bin(double v, double origin, double size, size_t bins)
+{
+    double pos = std::floor((v - origin) / size);
+    if (!(pos > 0)) {
+        return 0;
+    }
+    return std::min(static_cast<size_t>(pos), bins - 1);
+}
+
+// The edges in a band of a polygon
+struct Band {
+    const double *x1;
+    const double *y1;
+    const double *x2;
+    const double *y2;
+    size_t count;
+};
+
+// Count the edges of a band crossing the ray to the right of the point,
+// each vertex only counts for one of its edges. Returns true if that's
+// odd, and sets near if the point is too close to an edge to tell, as
+// boost::geometry rounds differently when deciding which side of an
+// edge a point is on, or if it is on a vertex.
+static bool
+crossBand(const Band &band, double x, double y, double tolerance, bool &near, size_t first = 0)
+{
+    bool in = false;
+    for (size_t i = first; i < band.count; i++) {
+        double x1 = band.x1[i];
+        double y1 = band.y1[i];
+        double x2 = band.x2[i];
+        double y2 = band.y2[i];
+        if (y < std::min(y1, y2) - tolerance || y > std::max(y1, y2) + tolerance) {
+            continue;
+        }
+        double dx = x2 - x1;
+        double dy = y2 - y1;
+        double cross = dx * (y - y1) - dy * (x - x1);
+        if (cross * cross <= tolerance * tolerance * (dx * dx + dy * dy) &&
+            x >= std::min(x1, x2) - tolerance && x <= std::max(x1, x2) + tolerance) {
+            near = true;
+            return false;
+        }
+        if ((y1 > y) != (y2 > y)) {
+            if ((y2 > y1) == (cross > 0)) {
+                in = !in;
+            }
+        }
+    }
+    return in;
+}
+
+// What the kernels need to know about the grid
+struct GridView {
+    double min_x;
+    double min_y;
+    double max_x;
+    double max_y;
+    double cell_width;
+    double cell_height;
+    double fine_width;
+    double fine_height;
+    const uint32_t *cells;
+};
+
+// Find the cell of the top grid each point is in, and the cell of the
+// finer grid in it. The cell is outside for points outside the envelope.
+static void
+binPoints(const GridView &grid, const double *x, const double *y, size_t count, uint32_t *cell, uint32_t *fine)
+{
+    const size_t grid_size = PreparedBoundary::grid_size;
+    const size_t subgrid_size = PreparedBoundary::subgrid_size;
+    for (size_t i = 0; i < count; i++) {
+        if (!(x[i] >= grid.min_x && x[i] <= grid.max_x && y[i] >= grid.min_y && y[i] <= grid.max_y)) {
+            cell[i] = 0;
+            fine[i] = 0;
+            continue;
+        }
+        size_t cx = bin(x[i], grid.min_x, grid.cell_width, grid_size);
+        size_t cy = bin(y[i], grid.min_y, grid.cell_height, grid_size);
+        size_t fx = bin(x[i], grid.min_x + cx * grid.cell_width, grid.fine_width, subgrid_size);
+        size_t fy = bin(y[i], grid.min_y + cy * grid.cell_height, grid.fine_height, subgrid_size);
+        cell[i] = grid.cells[cy * grid_size + cx];
+        fine[i] = fy * subgrid_size + fx;
+    }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) static bool
+crossBandAVX2(const Band &band, double x, double y, double tolerance, bool &near)
+{
+    const __m256d px = _mm256_set1_pd(x);
+    const __m256d py = _mm256_set1_pd(y);
+    const __m256d tol = _mm256_set1_pd(tolerance);
+    const __m256d tol2 = _mm256_set1_pd(tolerance * tolerance);
+    const __m256d zero = _mm256_setzero_pd();
+    int close = 0;
+    int crossings = 0;
+    size_t i = 0;
+    for (; i + 4 <= band.count; i += 4) {
+        __m256d x1 = _mm256_loadu_pd(band.x1 + i);
+        __m256d y1 = _mm256_loadu_pd(band.y1 + i);
+        __m256d x2 = _mm256_loadu_pd(band.x2 + i);
+        __m256d y2 = _mm256_loadu_pd(band.y2 + i);
+        // min(b, a) and max(b, a) pick the same one as std::min(a, b)
+        // and std::max(a, b) when they're equal
+        __m256d in_band = _mm256_and_pd(
+            _mm256_cmp_pd(py, _mm256_sub_pd(_mm256_min_pd(y2, y1), tol), _CMP_NLT_UQ),
+            _mm256_cmp_pd(py, _mm256_add_pd(_mm256_max_pd(y2, y1), tol), _CMP_NGT_UQ));
+        __m256d dx = _mm256_sub_pd(x2, x1);
+        __m256d dy = _mm256_sub_pd(y2, y1);
+        __m256d cross = _mm256_sub_pd(_mm256_mul_pd(dx, _mm256_sub_pd(py, y1)),
+                                      _mm256_mul_pd(dy, _mm256_sub_pd(px, x1)));
+        __m256d on_line = _mm256_cmp_pd(
+            _mm256_mul_pd(cross, cross),
+            _mm256_mul_pd(tol2, _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy))), _CMP_LE_OQ);
+        __m256d beside = _mm256_and_pd(
+            _mm256_cmp_pd(px, _mm256_sub_pd(_mm256_min_pd(x2, x1), tol), _CMP_GE_OQ),
+            _mm256_cmp_pd(px, _mm256_add_pd(_mm256_max_pd(x2, x1), tol), _CMP_LE_OQ));
+        close |= _mm256_movemask_pd(_mm256_and_pd(in_band, _mm256_and_pd(on_line, beside)));
+        __m256d straddles = _mm256_xor_pd(_mm256_cmp_pd(y1, py, _CMP_GT_OQ), _mm256_cmp_pd(y2, py, _CMP_GT_OQ));
+        __m256d other_side = _mm256_xor_pd(_mm256_cmp_pd(y2, y1, _CMP_GT_OQ), _mm256_cmp_pd(cross, zero, _CMP_GT_OQ));
+        crossings += __builtin_popcount(_mm256_movemask_pd(_mm256_andnot_pd(other_side, _mm256_and_pd(in_band, straddles))));
+    }
+    if (close) {
+        near = true;
+        return false;
+    }
+    return crossBand(band, x, y, tolerance, near, i) != (crossings & 1);
+}
+
+__attribute__((target("sse4.1"))) static bool
+crossBandSSE41(const Band &band, double x, double y, double tolerance, bool &near)
+{
+    const __m128d px = _mm_set1_pd(x);
+    const __m128d py = _mm_set1_pd(y);
+    const __m128d tol = _mm_set1_pd(tolerance);
+    const __m128d tol2 = _mm_set1_pd(tolerance * tolerance);
+    const __m128d zero = _mm_setzero_pd();
+    int close = 0;
+    int crossings = 0;
+    size_t i = 0;
+    for (; i + 2 <= band.count; i += 2) {
+        __m128d x1 = _mm_loadu_pd(band.x1 + i);
+        __m128d y1 = _mm_loadu_pd(band.y1 + i);
+        __m128d x2 = _mm_loadu_pd(band.x2 + i);
+        __m128d y2 = _mm_loadu_pd(band.y2 + i);
+        __m128d in_band = _mm_and_pd(_mm_cmpnlt_pd(py, _mm_sub_pd(_mm_min_pd(y2, y1), tol)),
+                                     _mm_cmpngt_pd(py, _mm_add_pd(_mm_max_pd(y2, y1), tol)));
+        __m128d dx = _mm_sub_pd(x2, x1);
+        __m128d dy = _mm_sub_pd(y2, y1);
+        __m128d cross = _mm_sub_pd(_mm_mul_pd(dx, _mm_sub_pd(py, y1)), _mm_mul_pd(dy, _mm_sub_pd(px, x1)));
+        __m128d on_line = _mm_cmple_pd(_mm_mul_pd(cross, cross),
+                                       _mm_mul_pd(tol2, _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy))));
+        __m128d beside = _mm_and_pd(_mm_cmpge_pd(px, _mm_sub_pd(_mm_min_pd(x2, x1), tol)),
+                                    _mm_cmple_pd(px, _mm_add_pd(_mm_max_pd(x2, x1), tol)));
+        close |= _mm_movemask_pd(_mm_and_pd(in_band, _mm_and_pd(on_line, beside)));
+        __m128d straddles = _mm_xor_pd(_mm_cmpgt_pd(y1, py), _mm_cmpgt_pd(y2, py));
+        __m128d other_side = _mm_xor_pd(_mm_cmpgt_pd(y2, y1), _mm_cmpgt_pd(cross, zero));
+        crossings += __builtin_popcount(_mm_movemask_pd(_mm_andnot_pd(other_side, _mm_and_pd(in_band, straddles))));
+    }
+    if (close) {
+        near = true;
+        return false;
+    }
+    return crossBand(band, x, y, tolerance, near, i) != (crossings & 1);
+}
+
+// Like bin(), NaN and negative bins become 0, as max(NaN, 0) is 0
+__attribute__((target("avx2"))) static inline __m256d
+clampAVX2(__m256d pos, __m256d high)
+{
+    return _mm256_min_pd(_mm256_max_pd(pos, _mm256_setzero_pd()), high);
+}
+
+__attribute__((target("sse4.1"))) static inline __m128d
+clampSSE41(__m128d pos, __m128d high)
+{
+    return _mm_min_pd(_mm_max_pd(pos, _mm_setzero_pd()), high);
+}
+
+// The bins are computed like bin() does, and with AVX2 the cells of the
+// top grid are gathered too
+__attribute__((target("avx2"))) static void
+binPointsAVX2(const GridView &grid, const double *x, const double *y, size_t count, uint32_t *cell, uint32_t *fine)
+{
+    const __m256d min_x = _mm256_set1_pd(grid.min_x);
+    const __m256d min_y = _mm256_set1_pd(grid.min_y);
+    const __m256d max_x = _mm256_set1_pd(grid.max_x);
+    const __m256d max_y = _mm256_set1_pd(grid.max_y);
+    const __m256d cell_width = _mm256_set1_pd(grid.cell_width);
+    const __m256d cell_height = _mm256_set1_pd(grid.cell_height);
+    const __m256d fine_width = _mm256_set1_pd(grid.fine_width);
+    const __m256d fine_height = _mm256_set1_pd(grid.fine_height);
+    const __m256d last = _mm256_set1_pd(PreparedBoundary::grid_size - 1);
+    const __m256d last_fine = _mm256_set1_pd(PreparedBoundary::subgrid_size - 1);
+    const __m256d grid_size = _mm256_set1_pd(PreparedBoundary::grid_size);
+    const __m256d subgrid_size = _mm256_set1_pd(PreparedBoundary::subgrid_size);
+    const __m256d none = _mm256_set1_pd(-1);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d px = _mm256_loadu_pd(x + i);
+        __m256d py = _mm256_loadu_pd(y + i);
+        __m256d covered = _mm256_and_pd(
+            _mm256_and_pd(_mm256_cmp_pd(px, min_x, _CMP_GE_OQ), _mm256_cmp_pd(px, max_x, _CMP_LE_OQ)),
+            _mm256_and_pd(_mm256_cmp_pd(py, min_y, _CMP_GE_OQ), _mm256_cmp_pd(py, max_y, _CMP_LE_OQ)));
+        __m256d cx = clampAVX2(_mm256_floor_pd(_mm256_div_pd(_mm256_sub_pd(px, min_x), cell_width)), last);
+        __m256d cy = clampAVX2(_mm256_floor_pd(_mm256_div_pd(_mm256_sub_pd(py, min_y), cell_height)), last);
+        __m256d sub_x = _mm256_add_pd(min_x, _mm256_mul_pd(cx, cell_width));
+        __m256d sub_y = _mm256_add_pd(min_y, _mm256_mul_pd(cy, cell_height));
+        __m256d fx = clampAVX2(_mm256_floor_pd(_mm256_div_pd(_mm256_sub_pd(px, sub_x), fine_width)), last_fine);
+        __m256d fy = clampAVX2(_mm256_floor_pd(_mm256_div_pd(_mm256_sub_pd(py, sub_y), fine_height)), last_fine);
+        __m128i index = _mm256_cvttpd_epi32(
+            _mm256_blendv_pd(none, _mm256_add_pd(_mm256_mul_pd(cy, grid_size), cx), covered));
+        __m128i found = _mm_cmpgt_epi32(index, _mm_set1_epi32(-1));
+        __m128i cells = _mm_mask_i32gather_epi32(_mm_setzero_si128(), reinterpret_cast<const int *>(grid.cells),
+                                                 index, found, 4);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cell + i), cells);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(fine + i),
+                         _mm256_cvttpd_epi32(_mm256_add_pd(_mm256_mul_pd(fy, subgrid_size), fx)));
+    }
+    binPoints(grid, x + i, y + i, count - i, cell + i, fine + i);
+}
+
+__attribute__((target("sse4.1"))) static void
+binPointsSSE41(const GridView &grid, const double *x, const double *y, size_t count, uint32_t *cell, uint32_t *fine)
+{
+    const __m128d min_x = _mm_set1_pd(grid.min_x);
+    const __m128d min_y = _mm_set1_pd(grid.min_y);
+    const __m128d max_x = _mm_set1_pd(grid.max_x);
+    const __m128d max_y = _mm_set1_pd(grid.max_y);
+    const __m128d cell_width = _mm_set1_pd(grid.cell_width);
+    const __m128d cell_height = _mm_set1_pd(grid.cell_height);
+    const __m128d fine_width = _mm_set1_pd(grid.fine_width);
+    const __m128d fine_height = _mm_set1_pd(grid.fine_height);
+    const __m128d last = _mm_set1_pd(PreparedBoundary::grid_size - 1);
+    const __m128d last_fine = _mm_set1_pd(PreparedBoundary::subgrid_size - 1);
+    const __m128d grid_size = _mm_set1_pd(PreparedBoundary::grid_size);
+    const __m128d subgrid_size = _mm_set1_pd(PreparedBoundary::subgrid_size);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128d px = _mm_loadu_pd(x + i);
+        __m128d py = _mm_loadu_pd(y + i);
+        int covered = _mm_movemask_pd(_mm_and_pd(_mm_and_pd(_mm_cmpge_pd(px, min_x), _mm_cmple_pd(px, max_x)),
+                                                 _mm_and_pd(_mm_cmpge_pd(py, min_y), _mm_cmple_pd(py, max_y))));
+        __m128d cx = clampSSE41(_mm_floor_pd(_mm_div_pd(_mm_sub_pd(px, min_x), cell_width)), last);
+        __m128d cy = clampSSE41(_mm_floor_pd(_mm_div_pd(_mm_sub_pd(py, min_y), cell_height)), last);
+        __m128d sub_x = _mm_add_pd(min_x, _mm_mul_pd(cx, cell_width));
+        __m128d sub_y = _mm_add_pd(min_y, _mm_mul_pd(cy, cell_height));
+        __m128d fx = clampSSE41(_mm_floor_pd(_mm_div_pd(_mm_sub_pd(px, sub_x), fine_width)), last_fine);
+        __m128d fy = clampSSE41(_mm_floor_pd(_mm_div_pd(_mm_sub_pd(py, sub_y), fine_height)), last_fine);
+        uint32_t index[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(index),
+                         _mm_cvttpd_epi32(_mm_add_pd(_mm_mul_pd(cy, grid_size), cx)));
+        cell[i] = (covered & 1) ? grid.cells[index[0]] : 0;
+        cell[i + 1] = (covered & 2) ? grid.cells[index[1]] : 0;
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(fine + i),
+                         _mm_cvttpd_epi32(_mm_add_pd(_mm_mul_pd(fy, subgrid_size), fx)));
+    }
+    binPoints(grid, x + i, y + i, count - i, cell + i, fine + i);
+}
+#endif
+
+PreparedBoundary::PreparedBoundary(const multipolygon_t &poly)
+    : boundary(poly)
+{
+    if (boundary.empty()) {
+        return;
+    }
+    envelope = bg::return_envelope<box_t>(boundary);
+    // About a centimeter, for degrees
+    tolerance = 1e-9 * (1 + std::max({std::abs(envelope.min_corner().x()), std::abs(envelope.max_corner().x()),
+                                      std::abs(envelope.min_corner().y()), std::abs(envelope.max_corner().y())}));
+    std::vector<indexed_t> boxes;
+    for (auto pit = boundary.begin(); pit != boundary.end(); ++pit) {
+        Polygon polygon;
+        polygon.envelope = bg::return_envelope<box_t>(*pit);
+        size_t first = edges.size();
+        auto addRing = [this](const polygon_t::ring_type &ring) {
+            for (size_t i = 1; i < ring.size(); i++) {
+                edges.push_back({ring[i - 1].x(), ring[i - 1].y(), ring[i].x(), ring[i].y()});
+            }
+            // The rings may not be closed
+            if (ring.size() > 2 && !bg::equals(ring.front(), ring.back())) {
+                edges.push_back({ring.back().x(), ring.back().y(), ring.front().x(), ring.front().y()});
+            }
+        };
+        addRing(pit->outer());
+        for (auto iit = pit->inners().begin(); iit != pit->inners().end(); ++iit) {
+            addRing(*iit);
+        }
+
+        // About four edges per band, which for a country boundary
+        // is a few thousand bands
+        size_t count = edges.size() - first;
+        size_t bands = std::clamp<size_t>(count / 4, 1, 65536);
+        polygon.min_y = polygon.envelope.min_corner().y();
+        double height = polygon.envelope.max_corner().y() - polygon.min_y;
+        polygon.band_height = height > 0 ? height / bands : 1;
+        std::vector<size_t> sizes(bands + 1);
+        for (size_t i = first; i < edges.size(); i++) {
+            const Edge &edge = edges[i];
+            size_t low = bin(std::min(edge.y1, edge.y2) - tolerance, polygon.min_y, polygon.band_height, bands);
+            size_t high = bin(std::max(edge.y1, edge.y2) + tolerance, polygon.min_y, polygon.band_height, bands);
+            for (size_t b = low; b <= high; b++) {
+                sizes[b + 1]++;
+            }
+        }
+        polygon.band_start.resize(bands + 1);
+        for (size_t b = 0; b < bands; b++) {
+            polygon.band_start[b + 1] = polygon.band_start[b] + sizes[b + 1];
+        }
+        polygon.band_x1.resize(polygon.band_start[bands]);
+        polygon.band_y1.resize(polygon.band_start[bands]);
+        polygon.band_x2.resize(polygon.band_start[bands]);
+        polygon.band_y2.resize(polygon.band_start[bands]);
+        std::vector<uint32_t> fill(polygon.band_start.begin(), polygon.band_start.end() - 1);
+        for (size_t i = first; i < edges.size(); i++) {
+            const Edge &edge = edges[i];
+            size_t low = bin(std::min(edge.y1, edge.y2) - tolerance, polygon.min_y, polygon.band_height, bands);
+            size_t high = bin(std::max(edge.y1, edge.y2) + tolerance, polygon.min_y, polygon.band_height, bands);
+            for (size_t b = low; b <= high; b++) {
+                uint32_t pos = fill[b]++;
+                polygon.band_x1[pos] = edge.x1;
+                polygon.band_y1[pos] = edge.y1;
+                polygon.band_x2[pos] = edge.x2;
+                polygon.band_y2[pos] = edge.y2;
+            }
+            boxes.emplace_back(box_t(point_t(std::min(edge.x1, edge.x2), std::min(edge.y1, edge.y2)),
+                                     point_t(std::max(edge.x1, edge.x2), std::max(edge.y1, edge.y2))),
+                               i);
+        }
+        polygons.push_back(std::move(polygon));
+    }
+    // Packing all the edges at once makes a better tree
+    rtree = decltype(rtree)(boxes.begin(), boxes.end());
+    buildGrid();
+}
+
+void
+PreparedBoundary::buildGrid(void)
+{
+    double width = envelope.max_corner().x() - envelope.min_corner().x();
+    double height = envelope.max_corner().y() - envelope.min_corner().y();
+    if (!(width > 0) || !(height > 0)) {
+        return;
+    }
+    cell_width = width / grid_size;
+    cell_height = height / grid_size;
+    std::vector<uint32_t> all(edges.size());
+    std::iota(all.begin(), all.end(), 0);
+    std::vector<std::vector<uint32_t>> crossing(grid_size * grid_size);
+    std::vector<uint8_t> top = rasterize(envelope.min_corner(), width, height, grid_size, all, &crossing);
+    cells.assign(top.begin(), top.end());
+    for (size_t i = 0; i < top.size(); i++) {
+        if (top[i] != cell_crossed) {
+            continue;
+        }
+        cells[i] = cell_crossed + subcells.size() / (subgrid_size * subgrid_size);
+        point_t origin(envelope.min_corner().x() + (i % grid_size) * cell_width,
+                       envelope.min_corner().y() + (i / grid_size) * cell_height);
+        std::vector<uint8_t> fine = rasterize(origin, cell_width, cell_height, subgrid_size, crossing[i], nullptr);
+        subcells.insert(subcells.end(), fine.begin(), fine.end());
+    }
+}
+
+std::vector<uint8_t>
+PreparedBoundary::rasterize(const point_t &origin, double width, double height, size_t size,
+                            const std::vector<uint32_t> &candidates,
+                            std::vector<std::vector<uint32_t>> *crossing) const
+{
+    double cw = width / size;
+    double ch = height / size;
+    // The cells are widened a little when looking for edges, so a point
+    // rounded into the cell next to it, or close to an edge, is still
+    // tested exactly
+    double mx = std::max(cw * 1e-6, tolerance);
+    double my = std::max(ch * 1e-6, tolerance);
+    std::vector<uint8_t> grid(size * size, cell_outside);
+    std::vector<bool> crossed(size * size);
+    for (auto it = candidates.begin(); it != candidates.end(); ++it) {
+        const Edge &edge = edges[*it];
+        bg::model::segment<point_t> segment(point_t(edge.x1, edge.y1), point_t(edge.x2, edge.y2));
+        size_t low_x = bin(std::min(edge.x1, edge.x2) - mx, origin.x(), cw, size);
+        size_t high_x = bin(std::max(edge.x1, edge.x2) + mx, origin.x(), cw, size);
+        size_t low_y = bin(std::min(edge.y1, edge.y2) - my, origin.y(), ch, size);
+        size_t high_y = bin(std::max(edge.y1, edge.y2) + my, origin.y(), ch, size);
+        for (size_t y = low_y; y <= high_y; y++) {
+            for (size_t x = low_x; x <= high_x; x++) {
+                box_t cell(point_t(origin.x() + x * cw - mx, origin.y() + y * ch - my),
+                           point_t(origin.x() + (x + 1) * cw + mx, origin.y() + (y + 1) * ch + my));
+                if (bg::intersects(segment, cell)) {
+                    crossed[y * size + x] = true;
+                    if (crossing) {
+                        (*crossing)[y * size + x].push_back(*it);
+                    }
+                }
+            }
+        }
+    }
+    // No edge goes between two cells next to each other that aren't
+    // crossed, so they're on the same side, and only the first cell of
+    // each run along a row needs an exact test
+    for (size_t y = 0; y < size; y++) {
+        bool known = false;
+        uint8_t side = cell_outside;
+        for (size_t x = 0; x < size; x++) {
+            if (crossed[y * size + x]) {
+                grid[y * size + x] = cell_crossed;
+                known = false;
+                continue;
+            }
+            if (!known) {
+                point_t center(origin.x() + (x + 0.5) * cw, origin.y() + (y + 0.5) * ch);
+                side = locateExact(center) == inside ? cell_inside : cell_outside;
+                known = true;
+            }
+            grid[y * size + x] = side;
+        }
+    }
+    return grid;
+}
+
+PreparedBoundary::location_t
+PreparedBoundary::locate(const point_t &point) const
+{
+    if (!bg::covered_by(point, envelope)) {
+        return outside;
+    }
+    if (!cells.empty()) {
+        const point_t &origin = envelope.min_corner();
+        size_t x = bin(point.x(), origin.x(), cell_width, grid_size);
+        size_t y = bin(point.y(), origin.y(), cell_height, grid_size);
+        uint32_t cell = cells[y * grid_size + x];
+        if (cell == cell_outside) {
+            return outside;
+        }
+        if (cell == cell_inside) {
+            return inside;
+        }
+        // Only the crossed cells of the finer grid need the exact test
+        double sub_x = origin.x() + x * cell_width;
+        double sub_y = origin.y() + y * cell_height;
+        size_t fine_x = bin(point.x(), sub_x, cell_width / subgrid_size, subgrid_size);
+        size_t fine_y = bin(point.y(), sub_y, cell_height / subgrid_size, subgrid_size);
+        uint8_t subcell = subcells[(cell - cell_crossed) * subgrid_size * subgrid_size +
+                                   fine_y * subgrid_size + fine_x];
+        if (subcell == cell_outside) {
+            return outside;
+        }
+        if (subcell == cell_inside) {
+            return inside;
+        }
+    }
+    return locateExact(point);
+}
+
+PreparedBoundary::location_t
+PreparedBoundary::locateExact(const point_t &point) const
+{
+    double x = point.x();
+    double y = point.y();
+    if (!bg::covered_by(point, envelope)) {
+        return outside;
+    }
+    simd_t level = simdLevel();
+    // Like boost::geometry, the first polygon the point is in, or on
+    // the edge of, decides
+    for (auto it = polygons.begin(); it != polygons.end(); ++it) {
+        const Polygon &polygon = *it;
+        if (!bg::covered_by(point, polygon.envelope)) {
+            continue;
+        }
+        size_t bands = polygon.band_start.size() - 1;
+        size_t b = bin(y, polygon.min_y, polygon.band_height, bands);
+        Band band = {polygon.band_x1.data() + polygon.band_start[b], polygon.band_y1.data() + polygon.band_start[b],
+                     polygon.band_x2.data() + polygon.band_start[b], polygon.band_y2.data() + polygon.band_start[b],
+                     polygon.band_start[b + 1] - polygon.band_start[b]};
+        bool near = false;
+        bool in;
+#if defined(__x86_64__)
+        if (level == simd_avx2) {
+            in = crossBandAVX2(band, x, y, tolerance, near);
+        } else if (level == simd_sse41) {
+            in = crossBandSSE41(band, x, y, tolerance, near);
+        } else {
+            in = crossBand(band, x, y, tolerance, near);
+        }
+#else
+        in = crossBand(band, x, y, tolerance, near);
+#endif
+        if (near) {
+            return on_edge;
+        }
+        if (in) {
+            return inside;
+        }
+    }
+    return outside;
+}
+
+bool
+PreparedBoundary::touchesEdge(const point_t &a, const point_t &b) const
+{
+    bg::model::segment<point_t> segment(a, b);
+    box_t box(point_t(std::min(a.x(), b.x()), std::min(a.y(), b.y())),
+              point_t(std::max(a.x(), b.x()), std::max(a.y(), b.y())));
+    for (auto it = rtree.qbegin(bgi::intersects(box)); it != rtree.qend(); ++it) {
+        const Edge &edge = edges[it->second];
+        bg::model::segment<point_t> other(point_t(edge.x1, edge.y1), point_t(edge.x2, edge.y2));
+        if (bg::intersects(segment, other)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+PreparedBoundary::within(const point_t &point) const
+{
+    if (boundary.empty()) {
+        return false;
+    }
+    location_t location = locate(point);
+    if (location == on_edge) {
+        return bg::within(point, boundary);
+    }
+    return location == inside;
+}
+
+bool
+PreparedBoundary::within(const linestring_t &line) const
+{
+    return withinLine(line);
+}
+
+bool
+PreparedBoundary::within(const pmr_linestring_t &line) const
+{
+    return withinLine(line);
+}
+
+template <typename L>
+bool
+PreparedBoundary::withinLine(const L &line) const
+{
+    if (boundary.empty() || line.size() < 2) {
+        return bg::within(line, boundary);
+    }
+    if (!bg::covered_by(bg::return_envelope<box_t>(line), envelope)) {
+        return false;
+    }
+    // With all the points inside, the line can only leave by crossing
+    // an edge. Lines touching the boundary are left to boost::geometry.
+    for (auto it = line.begin(); it != line.end(); ++it) {
+        location_t location = locate(*it);
+        if (location == outside) {
+            return false;
+        }
+        if (location == on_edge) {
+            return bg::within(line, boundary);
+        }
+    }
+    for (size_t i = 1; i < line.size(); i++) {
+        if (touchesEdge(line[i - 1], line[i])) {
+            return bg::within(line, boundary);
+        }
+    }
+    return true;
+}
+
+void
+PreparedBoundary::within(const double *x, const double *y, size_t count, uint8_t *result) const
+{
+    if (boundary.empty()) {
+        std::fill(result, result + count, 0);
+        return;
+    }
+    if (cells.empty()) {
+        for (size_t i = 0; i < count; i++) {
+            result[i] = within(point_t(x[i], y[i]));
+        }
+        return;
+    }
+    GridView grid = {envelope.min_corner().x(), envelope.min_corner().y(),
+                     envelope.max_corner().x(), envelope.max_corner().y(),
+                     cell_width, cell_height,
+                     cell_width / subgrid_size, cell_height / subgrid_size,
+                     cells.data()};
+    simd_t level = simdLevel();
+    // A block of points at a time, so the cells stay on the stack
+    const size_t block = 256;
+    uint32_t cell[block];
+    uint32_t fine[block];
+    for (size_t start = 0; start < count; start += block) {
+        size_t size = std::min(block, count - start);
+#if defined(__x86_64__)
+        if (level == simd_avx2) {
+            binPointsAVX2(grid, x + start, y + start, size, cell, fine);
+        } else if (level == simd_sse41) {
+            binPointsSSE41(grid, x + start, y + start, size, cell, fine);
+        } else {
+            binPoints(grid, x + start, y + start, size, cell, fine);
+        }
+#else
+        binPoints(grid, x + start, y + start, size, cell, fine);
+#endif
+        for (size_t i = 0; i < size; i++) {
+            uint32_t value = cell[i];
+            if (value >= cell_crossed) {
+                value = subcells[(value - cell_crossed) * subgrid_size * subgrid_size + fine[i]];
+            }
+            if (value != cell_crossed) {
+                result[start + i] = value == cell_inside;
+                continue;
+            }
+            point_t point(x[start + i], y[start + i]);
+            location_t location = locateExact(point);
+            if (location == on_edge) {
+                result[start + i] = bg::within(point, boundary);
+            } else {
+                result[start + i] = location == inside;
+            }
+        }
+    }
+}
+
+bool
+PreparedBoundary::intersects(const polygon_t &poly) const
+{
+    if (boundary.empty() || !poly.inners().empty() || poly.outer().size() < 2) {
+        return bg::intersects(poly, boundary);
+    }
+    if (bg::disjoint(bg::return_envelope<box_t>(poly), envelope)) {
+        return false;
+    }
+    const auto &ring = poly.outer();
+    for (auto it = ring.begin(); it != ring.end(); ++it) {
+        if (locate(*it) != outside) {
+            return true;
+        }
+    }
+    for (size_t i = 1; i < ring.size(); i++) {
+        if (touchesEdge(ring[i - 1], ring[i])) {
+            return true;
+        }
+    }
+    if (!bg::equals(ring.front(), ring.back()) && touchesEdge(ring.back(), ring.front())) {
+        return true;
+    }
+    // Nothing crosses, so each polygon of the boundary is either all
+    // inside poly or all outside it
+    for (auto it = boundary.begin(); it != boundary.end(); ++it) {
+        if (!it->outer().empty() && bg::covered_by(it->outer().front(), poly)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace geoutil
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
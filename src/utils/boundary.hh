@@ -0,0 +1,174 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __BOUNDARY_HH__
+#define __BOUNDARY_HH__
+
+/// \file boundary.hh
+/// \brief Fast tests against the priority boundary
+///
+/// Every node, way and changeset is tested against the priority
+/// boundary, and with a detailed country boundary boost::geometry walks
+/// thousands of edges for each test. The boundary is prepared once
+/// instead, so most tests are a lookup in a grid, and the rest only
+/// look at the few edges near the object.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstdint>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include <boost/geometry.hpp>
+#include <boost/geometry/index/rtree.hpp>
+#include <boost/geometry/geometries/register/linestring.hpp>
+
+typedef boost::geometry::model::d2::point_xy<double> point_t;
+typedef boost::geometry::model::polygon<point_t> polygon_t;
+typedef boost::geometry::model::multi_polygon<polygon_t> multipolygon_t;
+typedef boost::geometry::model::linestring<point_t> linestring_t;
+/// The linestring of a way, allocated with the way. The Boost model
+/// can't be given an allocator, so a vector is registered as one.
+typedef std::pmr::vector<point_t> pmr_linestring_t;
+BOOST_GEOMETRY_REGISTER_LINESTRING(pmr_linestring_t)
+
+/// \namespace geoutil
+namespace geoutil {
+
+/// \class PreparedBoundary
+/// \brief A multipolygon indexed for point, line and box tests
+///
+/// The tests give the same results as the boost::geometry functions on
+/// the multipolygon. A grid over the boundary has each cell marked as
+/// inside, outside, or crossed by an edge, and the crossed cells have a
+/// finer grid of their own. Only the points in a crossed cell of the
+/// finer grid are tested exactly, by counting the edge crossings in
+/// their horizontal band of the polygon, as the edges are binned by
+/// latitude. Lines and boxes use an R-tree of the edges to check they
+/// don't cross the boundary, and fall back to boost::geometry if they
+/// touch it.
+///
+/// Many points can also be tested at once from arrays of coordinates,
+/// which uses SIMD instructions when the CPU has them, for the nodes of
+/// a change file or a page of nodes from the database.
+///
+/// Preparing it takes a while, so it is made once for a boundary and
+/// then shared by all the threads.
+class PreparedBoundary {
+  public:
+    typedef boost::geometry::model::box<point_t> box_t;
+
+    PreparedBoundary(void) {};
+    explicit PreparedBoundary(const multipolygon_t &boundary);
+
+    /// An empty boundary is the whole world for the filters
+    bool empty(void) const { return boundary.empty(); };
+    const multipolygon_t &geometry(void) const { return boundary; };
+
+    /// The same as boost::geometry::within(point, boundary)
+    bool within(const point_t &point) const;
+    /// The same as boost::geometry::within(line, boundary)
+    bool within(const linestring_t &line) const;
+    bool within(const pmr_linestring_t &line) const;
+    /// The same as boost::geometry::intersects(poly, boundary)
+    bool intersects(const polygon_t &poly) const;
+    /// The same as within(point) for \a count points, the longitudes
+    /// are in \a x and the latitudes in \a y. Sets result[i] to 1 if
+    /// the point is inside, else 0.
+    void within(const double *x, const double *y, size_t count, uint8_t *result) const;
+
+    /// Use the SIMD instructions the CPU has, which is the default.
+    /// Turning them off is only for tests and benchmarks.
+    static void useSimd(bool enable);
+
+    /// The number of cells on each side of the grid, and of the finer
+    /// grid in each crossed cell
+    static const size_t grid_size = 256;
+    static const size_t subgrid_size = 16;
+
+  private:
+    template <typename L>
+    bool withinLine(const L &line) const;
+    /// Where a point is, compared to the boundary. A point on an edge,
+    /// or too close to one to tell, is left to boost::geometry.
+    typedef enum { outside, inside, on_edge } location_t;
+    /// Look up the point in the grid first
+    location_t locate(const point_t &point) const;
+    /// Count the edge crossings
+    location_t locateExact(const point_t &point) const;
+
+    /// The cells of the grids. A cell of the top grid above crossed is
+    /// crossed, and its finer grid starts at subcells[(cell - crossed)
+    /// * subgrid_size * subgrid_size].
+    typedef enum { cell_outside, cell_inside, cell_crossed } cell_t;
+    void buildGrid(void);
+    std::vector<uint8_t> rasterize(const point_t &origin, double width, double height, size_t size,
+                                   const std::vector<uint32_t> &candidates,
+                                   std::vector<std::vector<uint32_t>> *crossing) const;
+
+    /// \struct Edge
+    /// \brief A segment of one of the rings
+    struct Edge {
+        double x1, y1, x2, y2;
+    };
+    /// \struct Polygon
+    /// \brief The edges of a polygon, with its holes, in bands
+    struct Polygon {
+        box_t envelope;
+        double min_y = 0;
+        double band_height = 1;
+        /// The edges of band i are from band_start[i] up to
+        /// band_start[i + 1]. Their coordinates are copied in band
+        /// order, so the edges of a band can be loaded a few at a time.
+        std::vector<uint32_t> band_start;
+        std::vector<double> band_x1;
+        std::vector<double> band_y1;
+        std::vector<double> band_x2;
+        std::vector<double> band_y2;
+    };
+    typedef std::pair<box_t, uint32_t> indexed_t;
+
+    /// True if a segment crosses or touches any edge
+    bool touchesEdge(const point_t &a, const point_t &b) const;
+
+    multipolygon_t boundary;
+    box_t envelope;
+    /// How close to an edge a point is left to boost::geometry
+    double tolerance = 0;
+    std::vector<Edge> edges;
+    std::vector<Polygon> polygons;
+    boost::geometry::index::rtree<indexed_t, boost::geometry::index::rstar<16>> rtree;
+    double cell_width = 0;
+    double cell_height = 0;
+    std::vector<uint32_t> cells;
+    std::vector<uint8_t> subcells;
+};
+
+} // namespace geoutil
+
+#endif // EOF __BOUNDARY_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,120 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __BOUNDEDQUEUE_HH__
+#define __BOUNDEDQUEUE_HH__
+
+/// \file boundedqueue.hh
+/// \brief A blocking FIFO queue with a fixed capacity
+///
+/// This is used to connect the stages of the replication pipeline, so
+/// a fast producer blocks instead of piling up data in memory when the
+/// consumer falls behind.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/// \class BoundedQueue
+/// \brief Multi producer, multi consumer queue with a capacity limit
+///
+/// Once closed, push() fails and pop() drains what is left before
+/// returning false, so the consumers can exit cleanly.
+template <typename T>
+class BoundedQueue {
+  public:
+    BoundedQueue(size_t capacity) : capacity(capacity ? capacity : 1) {};
+
+    /// Add an item, blocking while the queue is full. Returns false
+    /// if the queue has been closed.
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    };
+
+    /// Remove the oldest item, blocking while the queue is empty. Returns
+    /// false once the queue is closed and empty.
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    };
+
+    /// Remove the oldest item if there is one, without blocking
+    bool tryPop(T &item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    };
+
+    /// Stop accepting new items and wake up all waiting threads
+    void close(void) {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    };
+
+    bool isClosed(void) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return closed;
+    };
+
+    size_t size(void) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return items.size();
+    };
+
+  private:
+    const size_t capacity;
+    bool closed = false;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+#endif // EOF __BOUNDEDQUEUE_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,252 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <exception>
+
+#include "utils/executor.hh"
+#include "utils/log.hh"
+
+using namespace logger;
+
+namespace executor {
+
+// The executor and queue of the worker running on this thread, if any
+static thread_local Executor *current_executor = nullptr;
+static thread_local size_t current_index = 0;
+
+Executor::Executor(unsigned int count)
+{
+    if (count == 0) {
+        count = std::max(1U, std::thread::hardware_concurrency());
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        threads.push_back(std::thread([this, i] { work(i); }));
+    }
+}
+
+Executor::~Executor(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        stopping = true;
+    }
+    idle_cond.notify_all();
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+    }
+}
+
+Executor &
+Executor::getDefault(void)
+{
+    static Executor instance;
+    return instance;
+}
+
+std::shared_ptr<Metrics>
+Executor::getMetrics(const std::string &subsystem)
+{
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    auto it = metrics.find(subsystem);
+    if (it != metrics.end()) {
+        return it->second;
+    }
+    auto counters = std::make_shared<Metrics>();
+    metrics[subsystem] = counters;
+    return counters;
+}
+
+void
+Executor::post(std::function<void()> fn, const std::string &subsystem, priority_t priority)
+{
+    Task task{std::move(fn), getMetrics(subsystem), std::chrono::steady_clock::now()};
+    task.metrics->queued++;
+
+    // Work posted by a task stays on the same thread, where its data
+    // is likely still in the cache. The rest is spread around.
+    size_t index;
+    if (current_executor == this) {
+        index = current_index;
+    } else {
+        index = next++ % workers.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->queues[priority].push_back(std::move(task));
+    }
+    {
+        // Taking the lock makes sure a thread about to sleep sees it
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        pending++;
+    }
+    idle_cond.notify_one();
+}
+
+bool
+Executor::take(size_t index, Task &task)
+{
+    for (int priority = high; priority <= low; priority++) {
+        // The own queue first, oldest first
+        {
+            auto &worker = *workers[index];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (!worker.queues[priority].empty()) {
+                task = std::move(worker.queues[priority].front());
+                worker.queues[priority].pop_front();
+                pending--;
+                return true;
+            }
+        }
+        // Then steal from the other end of the other queues
+        for (size_t i = 1; i < workers.size(); i++) {
+            auto &worker = *workers[(index + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (!worker.queues[priority].empty()) {
+                task = std::move(worker.queues[priority].back());
+                worker.queues[priority].pop_back();
+                pending--;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void
+Executor::run(Task &task)
+{
+    auto waited = std::chrono::steady_clock::now() - task.queued_at;
+    task.metrics->wait_usec += std::chrono::duration_cast<std::chrono::microseconds>(waited).count();
+    task.metrics->queued--;
+    task.metrics->running++;
+    try {
+        task.fn();
+    } catch (const std::exception &e) {
+        log_error("Uncaught exception in task: %1%", e.what());
+    }
+    task.metrics->running--;
+    task.metrics->completed++;
+}
+
+bool
+Executor::runOne(void)
+{
+    size_t index = current_executor == this ? current_index : 0;
+    Task task;
+    if (!take(index, task)) {
+        return false;
+    }
+    run(task);
+    return true;
+}
+
+void
+Executor::work(size_t index)
+{
+    current_executor = this;
+    current_index = index;
+    while (true) {
+        Task task;
+        if (take(index, task)) {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        // Queued work is finished before exiting
+        if (stopping && pending == 0) {
+            break;
+        }
+        idle_cond.wait(lock, [this] { return pending > 0 || stopping; });
+        if (stopping && pending == 0) {
+            break;
+        }
+    }
+}
+
+void
+Executor::dumpMetrics(void)
+{
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    log_info("Executor: %1% threads, %2% tasks queued", workers.size(), pending.load());
+    for (auto it = metrics.begin(); it != metrics.end(); ++it) {
+        auto &counters = *it->second;
+        long done = counters.completed;
+        log_info("\t%1%: %2% queued, %3% running, %4% completed, %5%ms average wait",
+                 it->first, counters.queued.load(), counters.running.load(), done,
+                 done ? counters.wait_usec / done / 1000 : 0);
+    }
+}
+
+void
+TaskGroup::post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->outstanding++;
+    }
+    auto shared = state;
+    executor.post([shared, task] {
+        try {
+            task();
+        } catch (const std::exception &e) {
+            log_error("Uncaught exception in task: %1%", e.what());
+        }
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        if (--shared->outstanding == 0) {
+            shared->cond.notify_all();
+        }
+    }, subsystem, priority);
+}
+
+void
+TaskGroup::wait(void)
+{
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->outstanding == 0) {
+                return;
+            }
+        }
+        // Help with the queued work rather than just blocking, this
+        // also avoids a deadlock when waiting from inside a task
+        if (executor.runOne()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->cond.wait_for(lock, std::chrono::milliseconds(10),
+                             [this] { return state->outstanding == 0; });
+    }
+}
+
+} // namespace executor
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
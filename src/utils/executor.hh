@@ -0,0 +1,166 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __EXECUTOR_HH__
+#define __EXECUTOR_HH__
+
+/// \file executor.hh
+/// \brief A process wide pool of threads shared by all the work
+///
+/// The monitors and the bootstrap used to create a thread pool for
+/// every batch of files or chunk of the database, and tear it down
+/// again once done. They also each had their own pool, so a busy one
+/// couldn't use the cores left idle by the other. The executor keeps
+/// one set of threads for the whole process instead. Each thread has
+/// its own queues, and an idle thread steals work from the others.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// \namespace executor
+namespace executor {
+
+/// \enum priority_t
+/// Higher priority work is always picked first
+typedef enum { high, normal, low } priority_t;
+
+/// \struct Metrics
+/// \brief Counters for the work of one subsystem
+struct Metrics {
+    std::atomic<long> queued{0};       ///< Tasks waiting for a thread
+    std::atomic<long> running{0};      ///< Tasks being run
+    std::atomic<long> completed{0};    ///< Tasks done
+    std::atomic<long> wait_usec{0};    ///< Total time spent in the queue
+};
+
+/// \class Executor
+/// \brief Work stealing thread pool
+class Executor {
+  public:
+    /// Start \a threads threads, or one per core if 0
+    Executor(unsigned int threads = 0);
+    ~Executor(void);
+
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    /// The executor shared by the whole process
+    static Executor &getDefault(void);
+
+    /// Queue \a task. The \a subsystem is only used for the metrics.
+    void post(std::function<void()> task, const std::string &subsystem = "default",
+              priority_t priority = normal);
+
+    /// Run one queued task on the calling thread, if there is one.
+    /// This lets a thread waiting on other tasks help instead of
+    /// blocking. Returns false if there was nothing to run.
+    bool runOne(void);
+
+    /// The number of tasks waiting for a thread
+    long queueDepth(void) const { return pending; };
+    /// The counters for \a subsystem
+    std::shared_ptr<Metrics> getMetrics(const std::string &subsystem);
+    /// Log the counters of all the subsystems
+    void dumpMetrics(void);
+
+    unsigned int size(void) const { return workers.size(); };
+
+  private:
+    /// \struct Task
+    struct Task {
+        std::function<void()> fn;
+        std::shared_ptr<Metrics> metrics;
+        std::chrono::steady_clock::time_point queued_at;
+    };
+    /// \struct Worker
+    /// \brief The queues of one thread, one per priority
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> queues[3];
+    };
+
+    void work(size_t index);
+    /// Get a task, from the queues of thread \a index first
+    bool take(size_t index, Task &task);
+    void run(Task &task);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next{0};        ///< For spreading external posts
+    std::atomic<long> pending{0};
+    std::atomic<bool> stopping{false};
+    std::mutex idle_mutex;
+    std::condition_variable idle_cond;
+    std::mutex metrics_mutex;
+    std::map<std::string, std::shared_ptr<Metrics>> metrics;
+};
+
+/// \class TaskGroup
+/// \brief A set of tasks that can be waited for
+///
+/// This replaces creating a boost::asio::thread_pool for a batch of
+/// work and joining it.
+class TaskGroup {
+  public:
+    TaskGroup(const std::string &subsystem, priority_t priority = normal,
+              Executor &executor = Executor::getDefault())
+        : executor(executor), subsystem(subsystem), priority(priority) {};
+    /// Waits for the tasks still running, as they may use the caller's data
+    ~TaskGroup(void) { wait(); };
+
+    void post(std::function<void()> task);
+    /// Block until all the tasks posted are done, running queued
+    /// tasks in the meantime
+    void wait(void);
+
+  private:
+    /// The state shared with the tasks, which can outlive the wait
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cond;
+        long outstanding = 0;
+    };
+    Executor &executor;
+    std::string subsystem;
+    priority_t priority;
+    std::shared_ptr<State> state = std::make_shared<State>();
+};
+
+} // namespace executor
+
+#endif // EOF __EXECUTOR_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -79,6 +79,7 @@ GeoUtil::readFile(const std::string &filespec)
             CPLFree(wkt);
         }
     }
+    prepared = PreparedBoundary(boundary);
 
     return true;
 }
@@ -88,6 +89,8 @@ bool
 GeoUtil::readPoly(const std::string &wkt)
 {
     boost::geometry::read_wkt(wkt, boundary);
+    prepared = PreparedBoundary(boundary);
+    return true;
 }
 
 } // namespace geoutil
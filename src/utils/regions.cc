@@ -0,0 +1,170 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <ogr_geometry.h>
+#include <ogrsf_frmts.h>
+
+#include "utils/regions.hh"
+
+#include "utils/log.hh"
+using namespace logger;
+
+namespace bg = boost::geometry;
+namespace bgi = boost::geometry::index;
+
+namespace geoutil {
+
+bool
+RegionSet::readFile(const std::string &filespec, const std::string &field)
+{
+    std::filesystem::path regions_file = filespec;
+    if (!std::filesystem::exists(regions_file)) {
+        log_error("File not found: %1%", regions_file);
+        return false;
+    }
+    GDALAllRegister();
+    GDALDataset *poDS = (GDALDataset *)GDALOpenEx(filespec.c_str(), GDAL_OF_VECTOR, NULL, NULL, NULL);
+    if (poDS == 0) {
+        log_error("couldn't open %1%", regions_file);
+        return false;
+    }
+    OGRLayer *layer = poDS->GetLayer(0);
+    if (layer == 0) {
+        log_error("Couldn't get a layer from %1%", regions_file);
+        GDALClose(poDS);
+        return false;
+    }
+
+    for (auto &feature : layer) {
+        const OGRGeometry *geom = feature->GetGeometryRef();
+        if (geom == 0) {
+            continue;
+        }
+        std::string name;
+        if (feature->GetFieldIndex(field.c_str()) >= 0) {
+            name = feature->GetFieldAsString(field.c_str());
+        }
+        if (name.empty()) {
+            log_error("Region %1% in %2% has no %3%, ignoring it", feature->GetFID(), regions_file, field);
+            continue;
+        }
+        char *wkt = NULL;
+        geom->exportToWkt(&wkt);
+        std::string text = wkt ? wkt : "";
+        CPLFree(wkt);
+        multipolygon_t area;
+        if (text.rfind("MULTIPOLYGON", 0) == 0) {
+            bg::read_wkt(text, area);
+        } else if (text.rfind("POLYGON", 0) == 0) {
+            polygon_t polygon;
+            bg::read_wkt(text, polygon);
+            area.push_back(polygon);
+        } else {
+            log_error("Region %1% in %2% isn't a polygon, ignoring it", name, regions_file);
+            continue;
+        }
+        add(name, area);
+    }
+    GDALClose(poDS);
+
+    log_debug("Read %1% regions from %2%", regions.size(), regions_file);
+    return !regions.empty();
+}
+
+bool
+RegionSet::add(const std::string &name, const multipolygon_t &area)
+{
+    region_t id = stringpool::StringPool::getDefault().intern(name);
+    if (id == stringpool::not_interned) {
+        log_error("Region name \"%1%\" is too long, ignoring it", name);
+        return false;
+    }
+    auto existing = std::find_if(regions.begin(), regions.end(), [id](const Region &region) {
+        return region.id == id;
+    });
+    if (existing == regions.end()) {
+        regions.push_back({id, PreparedBoundary(area)});
+        index.insert(std::make_pair(bg::return_envelope<box_t>(area), regions.size() - 1));
+        return true;
+    }
+    // Countries are often split into a feature per island
+    size_t pos = existing - regions.begin();
+    index.remove(std::make_pair(bg::return_envelope<box_t>(existing->area.geometry()), pos));
+    multipolygon_t merged = existing->area.geometry();
+    merged.insert(merged.end(), area.begin(), area.end());
+    existing->area = PreparedBoundary(merged);
+    index.insert(std::make_pair(bg::return_envelope<box_t>(merged), pos));
+    return true;
+}
+
+std::vector<region_t>
+RegionSet::find(const point_t &point) const
+{
+    std::vector<region_t> found;
+    for (auto it = index.qbegin(bgi::intersects(point)); it != index.qend(); ++it) {
+        const Region &region = regions[it->second];
+        if (region.area.within(point)) {
+            found.push_back(region.id);
+        }
+    }
+    // The same order whatever the R-tree returns
+    std::sort(found.begin(), found.end());
+    return found;
+}
+
+std::vector<region_t>
+RegionSet::find(const polygon_t &bbox) const
+{
+    std::vector<region_t> found;
+    for (auto it = index.qbegin(bgi::intersects(bg::return_envelope<box_t>(bbox))); it != index.qend(); ++it) {
+        const Region &region = regions[it->second];
+        if (region.area.intersects(bbox)) {
+            found.push_back(region.id);
+        }
+    }
+    std::sort(found.begin(), found.end());
+    return found;
+}
+
+void
+RegionSet::dump(void) const
+{
+    std::cerr << "Regions: " << regions.size() << std::endl;
+    for (auto it = regions.begin(); it != regions.end(); ++it) {
+        std::cerr << "\t" << name(it->id) << ": " << bg::num_points(it->area.geometry()) << " points" << std::endl;
+    }
+}
+
+} // namespace geoutil
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
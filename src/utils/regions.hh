@@ -0,0 +1,116 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __REGIONS_HH__
+#define __REGIONS_HH__
+
+/// \file regions.hh
+/// \brief Find which of many named regions the data is in
+///
+/// The priority boundary only says if an object is wanted. To keep
+/// statistics for several countries, every object and changeset also
+/// gets the list of regions it is in, so one process can serve all of
+/// them instead of running one per boundary.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/geometry.hpp>
+#include <boost/geometry/index/rtree.hpp>
+
+#include "utils/boundary.hh"
+#include "utils/stringpool.hh"
+
+/// \namespace geoutil
+namespace geoutil {
+
+/// The ID of a region is its name in the default string pool
+typedef stringpool::string_id_t region_t;
+
+/// \class RegionSet
+/// \brief Named regions, indexed by their bounding boxes
+///
+/// Each region is a PreparedBoundary, and an R-tree of their bounding
+/// boxes picks the few regions worth testing. The regions may overlap,
+/// so a point can be in several of them.
+class RegionSet {
+  public:
+    typedef boost::geometry::model::box<point_t> box_t;
+
+    /// Read the regions from a file in any GDAL supported format. Each
+    /// feature is a region, named by its \a field attribute. Features
+    /// with the same name are one region.
+    bool readFile(const std::string &filespec, const std::string &field = "name");
+    /// Add a region, or more area to an existing one
+    bool add(const std::string &name, const multipolygon_t &area);
+
+    bool empty(void) const { return regions.empty(); };
+    size_t size(void) const { return regions.size(); };
+    /// The name of a region ID
+    static const std::string &name(region_t id) {
+        return stringpool::StringPool::getDefault().get(id);
+    };
+
+    /// The regions a point is in
+    std::vector<region_t> find(const point_t &point) const;
+    /// The regions a bounding box intersects
+    std::vector<region_t> find(const polygon_t &bbox) const;
+
+    /// Dump internal data to the terminal, used only for debugging
+    void dump(void) const;
+
+  private:
+    /// \struct Region
+    /// \brief The area of a named region
+    struct Region {
+        region_t id;
+        PreparedBoundary area;
+    };
+    std::vector<Region> regions;
+    boost::geometry::index::rtree<std::pair<box_t, size_t>, boost::geometry::index::quadratic<16>> index;
+};
+
+/// The names of \a regions as an SQL text array, each escaped by
+/// \a db, a pq::Pq. There has to be at least one region.
+template <typename T, typename DB>
+std::string
+regionArray(const T &regions, DB &db)
+{
+    std::string array = "ARRAY[";
+    for (auto it = regions.begin(); it != regions.end(); ++it) {
+        array += "'" + db.escapedString(RegionSet::name(*it)) + "',";
+    }
+    array.back() = ']';
+    return array + "::text[]";
+}
+
+} // namespace geoutil
+
+#endif // EOF __REGIONS_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
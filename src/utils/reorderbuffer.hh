@@ -0,0 +1,87 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __REORDERBUFFER_HH__
+#define __REORDERBUFFER_HH__
+
+/// \file reorderbuffer.hh
+/// \brief Put items finished out of order back in sequence
+///
+/// The replication files are processed by several threads, so they
+/// finish in any order, but they have to be committed to the database
+/// strictly in sequence, or an older version of an object could
+/// overwrite a newer one.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <map>
+#include <utility>
+
+/// \class ReorderBuffer
+/// \brief Hold items until all the ones before them have been released
+///
+/// This isn't thread safe, it is meant to be used by the single
+/// thread doing the commits.
+template <typename T>
+class ReorderBuffer {
+  public:
+    /// \a next is the first sequence to be released
+    ReorderBuffer(long next = 0) : next(next) {};
+
+    /// Add the item for \a sequence. An item can stand for \a count
+    /// consecutive sequences. Items for a sequence that has already
+    /// been released are ignored.
+    void insert(long sequence, T item, long count = 1) {
+        if (sequence >= next) {
+            pending.emplace(sequence, std::make_pair(std::move(item), count));
+        }
+    };
+
+    /// Get the next item in sequence, if it has arrived
+    bool pop(T &item) {
+        auto it = pending.find(next);
+        if (it == pending.end()) {
+            return false;
+        }
+        item = std::move(it->second.first);
+        next += it->second.second;
+        pending.erase(it);
+        return true;
+    };
+
+    /// The sequence to be released next
+    long getNext(void) const { return next; };
+    /// The number of items waiting for an earlier one
+    size_t size(void) const { return pending.size(); };
+    bool empty(void) const { return pending.empty(); };
+
+  private:
+    long next;
+    std::map<long, std::pair<T, long>> pending;
+};
+
+#endif // EOF __REORDERBUFFER_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
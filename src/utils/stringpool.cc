@@ -0,0 +1,153 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <mutex>
+
+#include "utils/stringpool.hh"
+
+namespace stringpool {
+
+// Most lookups are for the same few hundred keys and values, which are
+// found here without taking the lock
+struct CacheEntry {
+    const StringPool *pool = nullptr;
+    const std::string *str = nullptr;
+    string_id_t id = not_interned;
+};
+static const size_t cache_size = 1024;
+static thread_local CacheEntry cache[cache_size];
+
+StringPool::StringPool(size_t max_strings, size_t max_length)
+    : max_strings(max_strings), max_length(max_length)
+{
+    // Only the table of blocks is allocated up front, so it never has
+    // to grow while other threads read it
+    blocks.reset(new std::unique_ptr<std::string[]>[(max_strings + block_size - 1) / block_size + 1]);
+    blocks[0].reset(new std::string[block_size]);
+    index[blocks[0][0]] = empty_string;
+    count = 1;
+}
+
+StringPool &
+StringPool::getDefault(void)
+{
+    static StringPool instance;
+    return instance;
+}
+
+string_id_t
+StringPool::intern(std::string_view str)
+{
+    if (str.size() > max_length) {
+        return not_interned;
+    }
+    size_t hash = index.hash_function()(str);
+    auto &cached = cache[hash % cache_size];
+    if (cached.pool == this && *cached.str == str) {
+        return cached.id;
+    }
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = index.find(str);
+        if (it != index.end()) {
+            cached = CacheEntry{this, &get(it->second), it->second};
+            return it->second;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    // Another thread may have added it in the meantime
+    auto it = index.find(str);
+    if (it != index.end()) {
+        return it->second;
+    }
+    if (count >= max_strings) {
+        return not_interned;
+    }
+    if (count % block_size == 0) {
+        blocks[count / block_size].reset(new std::string[block_size]);
+    }
+    string_id_t id = count++;
+    auto &stored = blocks[id / block_size][id % block_size];
+    stored = str;
+    bytes += str.size();
+    index[stored] = id;
+    cached = CacheEntry{this, &stored, id};
+    return id;
+}
+
+string_id_t
+StringPool::lookup(std::string_view str) const
+{
+    if (str.size() > max_length) {
+        return not_interned;
+    }
+    size_t hash = index.hash_function()(str);
+    auto &cached = cache[hash % cache_size];
+    if (cached.pool == this && *cached.str == str) {
+        return cached.id;
+    }
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = index.find(str);
+    if (it != index.end()) {
+        cached = CacheEntry{this, &get(it->second), it->second};
+        return it->second;
+    }
+    return not_interned;
+}
+
+size_t
+StringPool::size(void) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return count;
+}
+
+void
+StringPool::dump(void) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    std::cerr << "String pool: " << count << " strings, " << bytes << " bytes";
+    if (count >= max_strings) {
+        std::cerr << ", full";
+    }
+    std::cerr << std::endl;
+}
+
+void
+PooledString::assign(std::string_view str)
+{
+    id = StringPool::getDefault().intern(str);
+    if (id == not_interned) {
+        local = std::make_unique<std::string>(str);
+    } else {
+        local.reset();
+    }
+}
+
+} // namespace stringpool
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,161 @@
+//
+// Copyright (c) 2024 Humanitarian OpenStreetMap Team
+//
+// This file is part of Underpass.
+//
+//     Underpass is free software: you can redistribute it and/or modify
+//     it under the terms of the GNU General Public License as published by
+//     the Free Software Foundation, either version 3 of the License, or
+//     (at your option) any later version.
+//
+//     Underpass is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with Underpass.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifndef __STRINGPOOL_HH__
+#define __STRINGPOOL_HH__
+
+/// \file stringpool.hh
+/// \brief A process wide table of interned strings
+///
+/// The same tag keys, tag values and user names show up in millions of
+/// objects. These get stored once, and the objects only keep a small
+/// integer ID for them, which is also faster to compare than the string.
+///
+/// Underpass runs for months, so the table can't grow forever. Long
+/// strings, which are rarely repeated, don't get interned, and once
+/// the table is full new strings aren't either. Whatever is common is
+/// seen early and often, so this costs little.
+
+// This is generated by autoconf
+#ifdef HAVE_CONFIG_H
+#include "unconfig.h"
+#endif
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/// \namespace stringpool
+namespace stringpool {
+
+typedef uint32_t string_id_t;
+
+/// The ID of the empty string, which is always interned
+const string_id_t empty_string = 0;
+/// Returned for strings that aren't in the table
+const string_id_t not_interned = UINT32_MAX;
+
+/// \class StringPool
+/// \brief Intern strings as 32 bit IDs
+///
+/// Strings are never removed, so the references returned by get() stay
+/// valid. Looking up an ID doesn't lock, the string is stored before
+/// the ID is handed out, under the lock.
+class StringPool {
+  public:
+    /// At most \a max_strings get interned, none longer than \a max_length
+    StringPool(size_t max_strings = 4 * 1024 * 1024, size_t max_length = 64);
+
+    /// The pool used by the OSM objects
+    static StringPool &getDefault(void);
+
+    /// Add \a str if it isn't there yet. Returns not_interned if it is
+    /// too long or the pool is full.
+    string_id_t intern(std::string_view str);
+    /// The ID of \a str, or not_interned if it was never added
+    string_id_t lookup(std::string_view str) const;
+    /// The string for an ID returned by intern()
+    const std::string &get(string_id_t id) const {
+        return blocks[id / block_size][id % block_size];
+    };
+
+    /// The number of interned strings
+    size_t size(void) const;
+    /// Dump internal data to the terminal, used only for debugging
+    void dump(void) const;
+
+  private:
+    static const size_t block_size = 4096;
+    mutable std::shared_mutex mutex;
+    /// The strings are in fixed blocks, so they never move. The SSO
+    /// buffer of short strings is inside the std::string, so this also
+    /// keeps the string_views in the index valid.
+    std::unique_ptr<std::unique_ptr<std::string[]>[]> blocks;
+    size_t count = 0;
+    size_t bytes = 0;
+    size_t max_strings;
+    size_t max_length;
+    std::unordered_map<std::string_view, string_id_t> index;
+};
+
+/// \class PooledString
+/// \brief A string that is interned when possible
+///
+/// This can be used like a const std::string. Strings that didn't get
+/// interned are kept in the object.
+class PooledString {
+  public:
+    PooledString(void) {};
+    explicit PooledString(std::string_view str) { assign(str); };
+    PooledString(const PooledString &other) { *this = other; };
+    PooledString(PooledString &&other) = default;
+
+    PooledString &operator=(const PooledString &other) {
+        id = other.id;
+        local.reset(other.local ? new std::string(*other.local) : nullptr);
+        return *this;
+    };
+    PooledString &operator=(PooledString &&other) = default;
+    PooledString &operator=(std::string_view str) { assign(str); return *this; };
+    PooledString &operator=(const std::string &str) { assign(str); return *this; };
+    PooledString &operator=(const char *str) { assign(str); return *this; };
+
+    const std::string &str(void) const {
+        return local ? *local : StringPool::getDefault().get(id);
+    };
+    operator const std::string &(void) const { return str(); };
+    /// The ID in the default pool, or not_interned
+    string_id_t getId(void) const { return local ? not_interned : id; };
+
+    bool empty(void) const { return !local && id == empty_string; };
+    size_t size(void) const { return str().size(); };
+    bool operator==(const PooledString &other) const {
+        if (!local && !other.local) {
+            return id == other.id;
+        }
+        return str() == other.str();
+    };
+    bool operator!=(const PooledString &other) const { return !(*this == other); };
+    bool operator==(std::string_view other) const { return str() == other; };
+    bool operator!=(std::string_view other) const { return str() != other; };
+
+  private:
+    void assign(std::string_view str);
+    string_id_t id = empty_string;
+    std::unique_ptr<std::string> local;
+};
+
+inline std::ostream &
+operator<<(std::ostream &os, const PooledString &str)
+{
+    return os << str.str();
+}
+
+} // namespace stringpool
+
+#endif // EOF __STRINGPOOL_HH__
+
+// local Variables:
+// mode: C++
+// indent-tabs-mode: nil
+// End:
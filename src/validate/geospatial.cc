@@ -145,7 +145,7 @@ Geospatial::duplicate(const std::list<std::shared_ptr<osmobjects::OsmWay>> &allw
 
 bool
 Geospatial::unsquared(
-    const linestring_t &way,
+    const pmr_linestring_t &way,
     double min_angle,
     double max_angle
 ) {
@@ -45,7 +45,7 @@ public:
     ~Geospatial(void) {  };
     static std::shared_ptr<ValidateStatus> checkWay(const osmobjects::OsmWay &way, const std::string &type, yaml::Yaml &tests, std::shared_ptr<ValidateStatus> &status);
 private:
-    static bool unsquared(const linestring_t &way, double min_angle = 89, double max_angle = 91);
+    static bool unsquared(const pmr_linestring_t &way, double min_angle = 89, double max_angle = 91);
     static bool duplicate(const std::list<std::shared_ptr<osmobjects::OsmWay>> &allways, osmobjects::OsmWay &way);
     static bool overlaps(const std::list<std::shared_ptr<osmobjects::OsmWay>> &allways, osmobjects::OsmWay &way);
 };
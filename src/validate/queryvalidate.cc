@@ -55,6 +55,7 @@ using namespace boost::gregorian;
 #include "validate/queryvalidate.hh"
 #include "validate/validate.hh"
 #include "data/pq.hh"
+#include "utils/regions.hh"
 using namespace pq;
 
 using namespace logger;
@@ -143,14 +144,31 @@ QueryValidate::applyChange(const ValidateStatus &validation, const valerror_t &s
     std::string format;
     auto query = std::make_shared<std::string>();
 
+    // The names of the regions of the feature. Like for the changesets,
+    // the column is only used with --regions, so a database made before
+    // it existed still works.
+    std::string regions;
+    std::string regions_column;
+    if (validation.regions.size() > 0) {
+        regions = geoutil::regionArray(validation.regions, *dbconn);
+        regions_column = ", regions";
+    }
+
     if (validation.values.size() > 0) {
-        *query = "INSERT INTO validation as v (osm_id, changeset, uid, type, status, values, timestamp, location, source, version) VALUES(";
-        format = "%d, %d, %g, \'%s\', \'%s\', ARRAY[%s], \'%s\', ST_GeomFromText(\'%s\', 4326), \'%s\', %s) ";
+        *query = "INSERT INTO validation as v (osm_id, changeset, uid, type, status, values, timestamp, location, source, version" + regions_column + ") VALUES(";
+        format = "%d, %d, %g, \'%s\', \'%s\', ARRAY[%s], \'%s\', ST_GeomFromText(\'%s\', 4326), \'%s\', %s";
     } else {
-        *query = "INSERT INTO validation as v (osm_id, changeset, uid, type, status, timestamp, location, source, version) VALUES(";
-        format = "%d, %d, %g, \'%s\', \'%s\', \'%s\', ST_GeomFromText(\'%s\', 4326), \'%s\', %s) ";
+        *query = "INSERT INTO validation as v (osm_id, changeset, uid, type, status, timestamp, location, source, version" + regions_column + ") VALUES(";
+        format = "%d, %d, %g, \'%s\', \'%s\', \'%s\', ST_GeomFromText(\'%s\', 4326), \'%s\', %s";
+    }
+    if (!regions.empty()) {
+        format += ", %s";
     }
-    format += "ON CONFLICT (osm_id, status, source) DO UPDATE SET version = %d,  timestamp = \'%s\' WHERE v.version < %d;";
+    format += ") ON CONFLICT (osm_id, status, source) DO UPDATE SET version = %d,  timestamp = \'%s\'";
+    if (!regions.empty()) {
+        format += ", regions = EXCLUDED.regions";
+    }
+    format += " WHERE v.version < %d;";
     boost::format fmt(format);
     fmt % validation.osm_id;
     fmt % validation.changeset;
@@ -176,6 +194,9 @@ QueryValidate::applyChange(const ValidateStatus &validation, const valerror_t &s
 
     fmt % validation.source;
     fmt % validation.version;
+    if (!regions.empty()) {
+        fmt % regions;
+    }
 
     // ON CONFLICT
     fmt % validation.version;
@@ -136,24 +136,25 @@ Semantic::checkNode(const osmobjects::OsmNode &node, const std::string &type, ya
     // from being written to the database thus reducing the size of the results.
     auto required_tags = tests.get("required_tags");
 
-    std::string key;
     size_t tagexists = 0;
     status->center = node.point;
 
     if (node.tags.count(type)) {
         for (auto vit = std::begin(node.tags); vit != std::end(node.tags); ++vit) {
+            const std::string key(vit->first);
+            const std::string value(vit->second);
             if (check_badvalue) {
-                if (!isValidTag(vit->first, vit->second, tags)) {
+                if (!isValidTag(key, value, tags)) {
                     status->status.insert(badvalue);
-                    status->values.insert(vit->first + "=" +  vit->second);
+                    status->values.insert(key + "=" + value);
                 }
             }
             if (check_incomplete) {
-                if (isRequiredTag(vit->first, required_tags)) {
+                if (isRequiredTag(key, required_tags)) {
                     tagexists++;
                 }
             }
-            checkTag(vit->first, vit->second, status);
+            checkTag(key, value, status);
         }
 
         if (check_incomplete) {
@@ -199,15 +200,17 @@ Semantic::checkWay(const osmobjects::OsmWay &way, const std::string &type, yaml:
     size_t tagexists = 0;
     if (way.tags.count(type)) {
         for (auto vit = std::begin(way.tags); vit != std::end(way.tags); ++vit) {
+            const std::string key(vit->first);
+            const std::string value(vit->second);
             if (check_badvalue) {
-                if (tags.children.size() > 0 && !isValidTag(vit->first, vit->second, tags)) {
+                if (tags.children.size() > 0 && !isValidTag(key, value, tags)) {
                     status->status.insert(badvalue);
-                    status->values.insert(vit->first + "=" +  vit->second);
+                    status->values.insert(key + "=" + value);
                 }
-                checkTag(vit->first, vit->second, status);
+                checkTag(key, value, status);
             }
             if (check_incomplete) {
-                if (isRequiredTag(vit->first, required_tags)) {
+                if (isRequiredTag(key, required_tags)) {
                     tagexists++;
                 }
             }
@@ -253,15 +256,17 @@ Semantic::checkRelation(const osmobjects::OsmRelation &relation, const std::stri
     size_t tagexists = 0;
     if (relation.tags.count(type)) {
         for (auto vit = std::begin(relation.tags); vit != std::end(relation.tags); ++vit) {
+            const std::string key(vit->first);
+            const std::string value(vit->second);
             if (check_badvalue) {
-                if (tags.children.size() > 0 && !isValidTag(vit->first, vit->second, tags)) {
+                if (tags.children.size() > 0 && !isValidTag(key, value, tags)) {
                     status->status.insert(badvalue);
-                    status->values.insert(vit->first + "=" +  vit->second);
+                    status->values.insert(key + "=" + value);
                 }
-                checkTag(vit->first, vit->second, status);
+                checkTag(key, value, status);
             }
             if (check_incomplete) {
-                if (isRequiredTag(vit->first, required_tags)) {
+                if (isRequiredTag(key, required_tags)) {
                     tagexists++;
                 }
             }
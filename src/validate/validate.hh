@@ -109,6 +109,7 @@ class ValidateStatus {
         version = node.version;
         objtype = osmobjects::node;
         timestamp = node.timestamp;
+        regions.assign(node.regions.begin(), node.regions.end());
     }
     ValidateStatus(const osmobjects::OsmWay &way) {
         osm_id = way.id;
@@ -117,6 +118,7 @@ class ValidateStatus {
         objtype = osmobjects::way;
         version = way.version;
         timestamp = way.timestamp;
+        regions.assign(way.regions.begin(), way.regions.end());
     }
     ValidateStatus(const osmobjects::OsmRelation &relation) {
         osm_id = relation.id;
@@ -125,6 +127,7 @@ class ValidateStatus {
         objtype = osmobjects::relation;
         version = relation.version;
         timestamp = relation.timestamp;
+        regions.assign(relation.regions.begin(), relation.regions.end());
     }
     /// Does this change have a particular status value
     bool hasStatus(const valerror_t &val) const {
@@ -171,6 +174,7 @@ class ValidateStatus {
     point_t center;        ///< The centroid of the building polygon
     std::unordered_set<std::string> values; ///< The found bad tag values
     std::string source; //< The source of the validation status
+    std::vector<stringpool::string_id_t> regions; ///< The regions of the feature
 };
 
 